@@ -0,0 +1,32 @@
+#ifndef __LIBEX_ARENA_H__
+#define __LIBEX_ARENA_H__
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#define ARENA_ALIGN 16
+#define ARENA_DEFAULT_BLOCK 4096
+
+typedef struct arena_block arena_block_t;
+struct arena_block {
+    arena_block_t *next;
+};
+
+// bump allocator, memory is only released all at once by arena_reset or arena_free
+typedef struct {
+    size_t block_size;
+    size_t len;
+    char *cur;
+    char *end;
+    arena_block_t *blocks;
+} arena_t;
+
+arena_t *arena_alloc (size_t block_size);
+void *arena_get (arena_t *arena, size_t size);
+void *arena_calloc (arena_t *arena, size_t size);
+void arena_reset (arena_t *arena);
+void arena_free (arena_t *arena);
+
+#endif // __LIBEX_ARENA_H__
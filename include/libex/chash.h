@@ -0,0 +1,44 @@
+#ifndef __LIBEX_CHASH_H__
+#define __LIBEX_CHASH_H__
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include "hash.h"
+#include "thread.h"
+
+#define CHASH_DEFAULT_SHARDS 64
+#define CHASH_CACHELINE 64
+
+typedef struct {
+    lock_t lock;
+    hash_t *hash;
+} __attribute__((aligned(CHASH_CACHELINE))) chash_shard_t;
+
+typedef struct {
+    hash_key_t nshards;
+    int shift;
+    uint64_t seed;
+    calc_h on_hash;
+    calc_seed_h on_hash_seed;
+    free_h on_free;
+    chash_shard_t *shards;
+} chash_t;
+
+// called under the shard lock with the current value (NULL if the key is absent),
+// returns the new value, NULL removes the key; a new value for an absent key that can not
+// be stored goes to on_free(NULL, value) and chash_compute returns NULL with errno set
+typedef void *(*chash_compute_h) (void *key, void *value, void *userdata);
+
+chash_t *chash_alloc (hash_key_t nshards, hash_key_t hash_buf_size, hash_type_t type, calc_h on_hash, compare_h on_compare, copy_h on_copy, free_h on_free);
+// must be called before the map is shared, -1 and EBUSY once it has items
+int chash_set_seed (chash_t *ch, calc_seed_h on_hash_seed, uint64_t seed);
+int chash_get (chash_t *ch, void *key, size_t key_len, void **value);
+int chash_add (chash_t *ch, void *key, size_t key_len, void *value);
+int chash_del (chash_t *ch, void *key, size_t key_len);
+void *chash_compute (chash_t *ch, void *key, size_t key_len, chash_compute_h on_compute, void *userdata);
+void chash_enum (chash_t *ch, hash_item_h on_item, void *userdata);
+hash_key_t chash_len (chash_t *ch);
+void chash_free (chash_t *ch);
+
+#endif // __LIBEX_CHASH_H__
@@ -0,0 +1,236 @@
+#ifndef __LIBEX_EVLOOP_H__
+#define __LIBEX_EVLOOP_H__
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/tcp.h>
+#include "net.h"
+#include "unet.h"
+#include "uring.h"
+
+#define EV_READ 0x0001
+#define EV_WRITE 0x0002
+// edge triggered, the handler reads and writes until EAGAIN
+#define EV_ET 0x0004
+// reported only, the peer hung up or the socket failed
+#define EV_CLOSE 0x0008
+// a socket the handler reads with ev_recv, under io_uring the loop receives for it
+#define EV_RECV 0x0010
+// a listener several loops wait on, one of them wakes for a connection, it can not be modified
+#define EV_EXCLUSIVE 0x0020
+
+// io_uring if the kernel has multishot recv and buffer rings, epoll otherwise
+#define EVLOOP_URING 0x0001
+// evgroup_t, acceptor i runs on cpu i modulo the cpus online
+#define EVLOOP_PIN_CPU 0x0002
+// evgroup_t, pinned acceptors and their listeners steered with net_steer_cpu
+#define EVLOOP_CPU_STEER 0x0004
+
+#define EV_MAX_EVENTS 256
+#define EV_WHEEL_SIZE 512
+#define EV_TICK_MS 10
+#define EV_URING_ENTRIES 1024
+#define EV_URING_BUFS 1024
+#define EV_URING_BUF_SIZE 4096
+#define EVPOOL_MAX_CONNS 8
+#define EVPOOL_IDLE_MS 60000
+#define EVPOOL_CONNECT_MS 5000
+
+typedef struct evloop evloop_t;
+typedef struct ev ev_t;
+typedef struct evtimer evtimer_t;
+typedef struct evconn evconn_t;
+typedef struct evio evio_t;
+
+typedef void (*ev_h) (evloop_t *loop, ev_t *ev, int events);
+typedef void (*evtimer_h) (evloop_t *loop, evtimer_t *timer);
+// a new connection, -1 closes it before it is watched
+typedef int (*evconn_h) (evloop_t *loop, evconn_t *conn, void *userdata);
+
+struct ev {
+    int fd;
+    int events;
+    ev_h on_event;
+    void *data;
+    evio_t *io;
+};
+
+struct evtimer {
+    evtimer_t *next;
+    evtimer_t *prev;
+    uint64_t expire;
+    uint64_t interval;
+    evtimer_h on_timer;
+    void *data;
+};
+
+// an accepted socket with its buffers, ev goes first so the handler can cast
+struct evconn {
+    ev_t ev;
+    netbuf_t nbuf;
+    evtimer_t timer;
+    void *data;
+};
+
+typedef struct {
+    ev_t ev;
+    int events;
+    size_t buf_len;
+    size_t chunk_size;
+    evconn_h on_accept;
+    ev_h on_event;
+    void *userdata;
+} evlistener_t;
+
+struct evloop {
+    int fd;
+    int is_alive;
+    uring_t *ring;
+    uring_bufs_t *bufs;
+    // a completion being handled, taken by ev_recv or an accept
+    struct {
+        int fd;
+        int res;
+        int is_taken;
+        char *ptr;
+    } rx;
+    evio_t *ios;
+    evio_t *dirty;
+    ev_t wakeup;
+    long tick_ms;
+    uint64_t tick;
+    size_t timers;
+    evtimer_t wheel [EV_WHEEL_SIZE];
+    struct epoll_event *events;
+    int nevents;
+    int cur_event;
+};
+
+// tick_ms is the timer resolution, 0 takes EV_TICK_MS
+evloop_t *evloop_alloc (long tick_ms);
+evloop_t *evloop_alloc_flags (long tick_ms, int flags);
+int evloop_run (evloop_t *loop);
+// one round, timeout_ms as epoll_wait, shorter if timers wait
+int evloop_once (evloop_t *loop, int timeout_ms);
+// safe from other threads and from handlers
+void evloop_stop (evloop_t *loop);
+// under io_uring the sockets with requests are let go at once only in the thread
+// that ran the loop, in another one the kernel closes them a bit later
+void evloop_free (evloop_t *loop);
+
+int ev_add (evloop_t *loop, ev_t *ev, int fd, int events, ev_h on_event, void *data);
+int ev_mod (evloop_t *loop, ev_t *ev, int events);
+// the fd stays open, events of ev not delivered yet are dropped
+int ev_del (evloop_t *loop, ev_t *ev);
+// a net_recv_h for EV_RECV handlers, under io_uring it gives the data of the event
+// once and 0 after, what the handler does not take is dropped
+ssize_t ev_recv (int fd, strbuf_t *buf);
+// queued, all that is queued for ev goes out in one send before the loop waits again
+int ev_send (evloop_t *loop, ev_t *ev, const char *buf, size_t len);
+// the queue of ev_send for its watermarks, drain handler and stat
+netout_t *ev_out (evloop_t *loop, ev_t *ev);
+
+// interval_ms 0 fires once
+void evtimer_start (evloop_t *loop, evtimer_t *timer, long ms, long interval_ms, evtimer_h on_timer, void *data);
+void evtimer_stop (evloop_t *loop, evtimer_t *timer);
+static inline int evtimer_active (evtimer_t *timer) { return NULL != timer->next; };
+
+// accepts on a listening socket of net_bind or unet_bind, every connection
+// gets a netbuf_t of buf_len and is watched for events with on_event,
+// EV_EXCLUSIVE in events goes to the listener
+int evloop_listen (evloop_t *loop, evlistener_t *listener, int fd, int events, evconn_h on_accept, ev_h on_event, void *userdata);
+void evconn_close (evloop_t *loop, evconn_t *conn);
+
+typedef struct {
+    evloop_t *loop;
+    evlistener_t listener;
+    pthread_t th;
+    int cpu;
+    int is_shared;
+    int is_started;
+} evacceptor_t;
+
+// loops in threads of their own, each accepts the connections it serves
+typedef struct {
+    int nacceptors;
+    int flags;
+    // the unix listener they share, -1 if every one has its own
+    int fd;
+    evacceptor_t *acceptors;
+} evgroup_t;
+
+// nacceptors 0 takes one for every cpu online, flags are of evloop_alloc_flags and EVLOOP_PIN_CPU, EVLOOP_CPU_STEER
+evgroup_t *evgroup_alloc (int nacceptors, int flags);
+// a path binds one unix listener for all, anything else a port for a SO_REUSEPORT listener
+// per acceptor, backlog 0 takes SOMAXCONN
+int evgroup_listen (evgroup_t *group, const char *svc, int backlog, int events, evconn_h on_accept, ev_h on_event, void *userdata);
+int evgroup_start (evgroup_t *group);
+// stops and joins the loops, every one is freed in its thread
+void evgroup_free (evgroup_t *group);
+
+typedef struct evpool evpool_t;
+typedef struct evpeer evpeer_t;
+typedef struct evpconn evpconn_t;
+typedef struct evpwait evpwait_t;
+
+// conn is NULL and err an errno if there is no connection
+typedef void (*evpool_h) (evloop_t *loop, evpconn_t *conn, int err, void *userdata);
+
+// a pooled connection, a handler of an evconn_t can take it
+struct evpconn {
+    evconn_t conn;
+    evpeer_t *peer;
+    evpconn_t *next;
+    evpconn_t *prev;
+    int is_idle;
+    struct timespec idle_since;
+    ev_h on_event;
+    evpool_h on_conn;
+    void *userdata;
+};
+
+struct evpwait {
+    evpwait_t *next;
+    ev_h on_event;
+    evpool_h on_conn;
+    void *userdata;
+};
+
+// the connections to one host:service
+struct evpeer {
+    evpool_t *pool;
+    netaddr_t addr;
+    int nconns;
+    evpconn_t *conns;
+    evpwait_t *waiting;
+    evpwait_t *waiting_tail;
+};
+
+struct evpool {
+    evloop_t *loop;
+    int events;
+    int max_conns;
+    long idle_ms;
+    long connect_ms;
+    hash_t *peers;
+    evtimer_t check;
+    size_t connects;
+    size_t reuses;
+};
+
+// connections of the loop keyed by host:service, at most max_conns for one, events are
+// what a connection is watched for while it is out, 0 takes the EVPOOL_ defaults;
+// idle connections have TCP keepalive, are closed when the peer hangs up or sends
+// and after idle_ms
+evpool_t *evpool_alloc (evloop_t *loop, int events, int max_conns, long idle_ms, long connect_ms);
+// on_conn gets an idle connection at once, a new one once it is connected or the first
+// one put back if max_conns are out; on_event handles the events of it until it is put back
+int evpool_get (evpool_t *pool, const char *host, const char *service, ev_h on_event, evpool_h on_conn, void *userdata);
+// the conversation on conn is over, what it received is dropped
+void evpool_put (evpool_t *pool, evpconn_t *conn);
+// conn is broken or in a state of its own
+void evpool_close (evpool_t *pool, evpconn_t *conn);
+// closes the connections those that are out included, on_conn of the waiting ones is not called
+void evpool_free (evpool_t *pool);
+
+#endif // __LIBEX_EVLOOP_H__
@@ -7,6 +7,10 @@
 #include <errno.h>
 #include <limits.h>
 #include <string.h>
+#include <time.h>
+#ifndef __WIN32__
+#include <sys/random.h>
+#endif
 #include "list.h"
 #include "str.h"
 
@@ -17,10 +21,26 @@
 #define MAX_HASH_SIZE INT_MAX
 
 typedef enum {
-    HASH_CONSTSIZE,
-    HASH_VARSIZE
+    HASH_CONSTSIZE = 0x0000,
+    HASH_VARSIZE = 0x0001,
+    HASH_OPEN = 0x0100,
+    HASH_INCREMENTAL = 0x0200
 } hash_type_t;
 
+#define HASH_SIZETYPE(x) ((x) & 0x00ff)
+#define HASH_ISOPEN(h) ((h)->type & HASH_OPEN)
+
+#if __SSE2__
+#define HASH_GROUP 16
+#else
+#define HASH_GROUP 8
+#endif
+// items each call moves while an incremental resize runs, more than an add puts in
+#define HASH_REHASH_STEP 2
+#define HASH_CTRL_EMPTY 0x80
+#define HASH_CTRL_DELETED 0xfe
+#define HASH_CTRL_ISFULL(c) (0 == ((c) & 0x80))
+
 #if __x86_64 || __ppc64__
 #define MAX_HASH_KEY UINT_MAX
 typedef uint64_t hash_key_t;
@@ -29,8 +49,12 @@ typedef uint64_t hash_key_t;
 typedef uint32_t hash_key_t;
 #endif
 
-hash_key_t hash_str (const char *s, size_t dummy);
+// word-at-a-time wyhash, hash_str takes strlen(s) when len is 0
+hash_key_t hash_str (const char *s, size_t len);
 hash_key_t hash_nstr (const char *s, size_t len);
+hash_key_t hash_seed_str (const char *s, size_t len, uint64_t seed);
+hash_key_t hash_seed_nstr (const char *s, size_t len, uint64_t seed);
+uint64_t hash_random_seed ();
 
 typedef struct hash hash_t;
 typedef struct {
@@ -43,6 +67,7 @@ typedef struct {
 } hash_item_t;
 
 typedef hash_key_t (*calc_h) (void*, size_t);
+typedef hash_key_t (*calc_seed_h) (void*, size_t, uint64_t);
 typedef int (*hash_item_h) (hash_item_t*, void*);
 
 struct hash {
@@ -53,9 +78,17 @@ struct hash {
     int32_t dec_size;
     hash_type_t type;
     list_t **ptr;
+    list_t **old_ptr;
+    hash_key_t old_size;
+    hash_key_t rehash_idx;
     list_t *hist;
+    slab_t *slab;
     hash_key_t len;
+    uint8_t *ctrl;
+    hash_item_t *items;
+    uint64_t seed;
     calc_h on_hash;
+    calc_seed_h on_hash_seed;
     compare_h on_compare;
     copy_h on_copy;
     free_h on_free;
@@ -68,6 +101,9 @@ void hash_del (hash_t *hash, void *key, size_t key_len);
 void hash_enum (hash_t *hash, hash_item_h on_item, void *userdata, int flags);
 void hash_resize (hash_t *hash, int32_t grow);
 void hash_free (hash_t *hash);
+// every table gets a random seed, on_hash_seed replaces on_hash and
+// receives it, seed 0 keeps the current one; -1 and EBUSY if the table has items
+int hash_set_seed (hash_t *hash, calc_seed_h on_hash_seed, uint64_t seed);
 void hash_set_max_size (hash_t *hash, hash_key_t max_size);
 double hash_param_filling (hash_t *hash);
 double hash_param_conflict (hash_t *hash);
@@ -83,5 +119,15 @@ double hash_param_conflict (hash_t *hash);
         __x__ = __x__->next; \
     } while (__x__ != hash->hist->head); } }
 
+// HASH_OPEN tables keep items inline in hash->items, a pointer returned by
+// hash_get/hash_add is valid until the next hash_add or hash_resize
+#define HASH_OPEN_FOREACH(key, value, hash) { \
+    for (hash_key_t __i__ = 0; __i__ < hash->size; ++__i__) { \
+        if (!HASH_CTRL_ISFULL(hash->ctrl[__i__])) continue; \
+        hash_item_t *__hash_item__ = &hash->items[__i__]; \
+        void *key = __hash_item__->key, *value = __hash_item__->value;
+
+#define HASH_OPEN_END(hash) } }
+
 
 #endif // __LIBEX_HASH_H__
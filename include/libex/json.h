@@ -8,6 +8,8 @@
 #include "str.h"
 #include "list.h"
 #include "tree.h"
+#include "hash.h"
+#include "task.h"
 
 #define JSON_ANY       -1
 #define JSON_OBJECT     1
@@ -19,9 +21,29 @@
 #define JSON_FALSE      7
 #define JSON_NULL       8
 
-typedef rbtree_t json_object_t;
+// objects up to JSON_OBJECT_FLAT keys are searched linearly by the hash,
+// bigger ones get an open addressing index over the members; keys are hashed
+// with a random seed of the process
+#define JSON_OBJECT_FLAT 16
+
+typedef struct json_item json_item_t;
+
+typedef struct {
+    hash_key_t hash;
+    json_item_t *item;
+} json_member_t;
+
+typedef struct {
+    size_t len;
+    size_t size;
+    json_member_t *members;
+    uint32_t *index;
+    size_t index_mask;
+    arena_t *arena;
+} json_object_t;
+
 typedef list_t json_array_t;
-typedef struct json_item {
+struct json_item {
     strptr_t key;
     int type;
     union {
@@ -31,7 +53,22 @@ typedef struct json_item {
         json_object_t *o;
         json_array_t *a;
     } data;
-} json_item_t;
+};
+
+#define JSON_SCAN_WINDOW 4096
+
+// structural index of the current window, lives on the stack of the parser
+typedef struct json_scan {
+    const char *next;
+    const char *end;
+    const char *base;
+    uint64_t in_string;
+    uint64_t escaped;
+    uint64_t scalar;
+    uint32_t pos;
+    uint32_t len;
+    uint32_t idx [JSON_SCAN_WINDOW];
+} json_scan_t;
 
 typedef struct {
     char *text;
@@ -42,6 +79,9 @@ typedef struct {
         json_object_t *o;
         json_array_t *a;
     } data;
+    arena_t *arena;
+    slab_t *lst_slab;
+    json_scan_t *scan;
 } json_t;
 
 #define JSON_ISNAME(j,S) 0 == cmpstr(j->key.ptr, j->key.len, CONST_STR_LEN(S))
@@ -49,12 +89,71 @@ typedef struct {
 typedef int (*json_item_h) (json_item_t*, void*);
 json_t *json_parse (const char *json_str);
 json_t *json_parse_len (const char *json_str, size_t json_str_len);
+// the whole document lives in one arena, json_free releases it at once
+json_t *json_parse_arena (const char *json_str);
+json_t *json_parse_arena_len (const char *json_str, size_t json_str_len);
 json_item_t *json_find (json_object_t *jo, const char *key, size_t key_len, int type);
 void json_enum_array (json_array_t *lst, json_item_h fn, void *userdata, int flags);
 void json_enum_object (json_object_t *obj, json_item_h fn, void *userdata, int flags);
 static inline char *json_str(json_item_t *j) { return strndup(j->data.s.ptr, j->data.s.len); }
 void json_free (json_t *j);
 
+#define JSON_SAX_START_OBJECT 1
+#define JSON_SAX_END_OBJECT 2
+#define JSON_SAX_START_ARRAY 3
+#define JSON_SAX_END_ARRAY 4
+#define JSON_SAX_KEY 5
+#define JSON_SAX_VALUE 6
+
+#define JSON_SAX_DEPTH 256
+
+// item->key is set for the members of an object, strings are valid only inside the callback,
+// non-zero return aborts the parser
+typedef int (*json_sax_h) (int event, json_item_t *item, void *userdata);
+
+// resumable push parser, the state survives between json_sax_feed calls
+typedef struct {
+    json_sax_h on_event;
+    void *userdata;
+    int state;
+    int lex;
+    int escaped;
+    int error;
+    size_t docs;
+    strbuf_t tok;
+    strbuf_t key;
+    int depth;
+    char stack [JSON_SAX_DEPTH];
+} json_sax_t;
+
+json_sax_t *json_sax_alloc (json_sax_h on_event, void *userdata);
+int json_sax_feed (json_sax_t *sax, const char *buf, size_t buf_len);
+// true if no document is open and no token is pending
+static inline int json_sax_done (json_sax_t *sax) { return !sax->error && 0 == sax->depth && 0 == sax->lex; }
+void json_sax_reset (json_sax_t *sax);
+void json_sax_free (json_sax_t *sax);
+
+// one reference token of a json pointer, index is -1 if the token isn't an array index
+typedef struct {
+    strptr_t key;
+    hash_key_t hash;
+    ssize_t index;
+} json_path_seg_t;
+
+// compiled json pointer (rfc 6901), keys are unescaped and stored after the segments
+typedef struct {
+    size_t len;
+    json_path_seg_t segs [0];
+} json_path_t;
+
+json_path_t *json_path_compile (const char *path, size_t path_len);
+json_item_t *json_path_eval (json_t *j, json_path_t *path);
+// evaluates the path over the raw text without building the document, the text after
+// the found value is not validated,
+// for an object or array item->data.s is the text of the value
+int json_path_scan (const char *json_str, size_t json_str_len, json_path_t *path, json_item_t *item);
+static inline void json_path_free (json_path_t *path) { free(path); }
+
 #define JSON_NOT_INSERTED 0
 #define JSON_INSERTED 1
 
@@ -66,18 +165,22 @@ typedef int (*json_tree_item_h) (tree_item_t*, strbuf_t*, void*);
 #define JSON_ITEM JSON_END
 #define JSON_DOUBLE_PRECISION 6
 
+// strbufreserve the size of a whole object up front and the json_add_* calls never reallocate
 void json_add_key (strbuf_t *buf, const char *key, size_t key_len);
 void json_add_str (strbuf_t *buf, const char *key, size_t key_len, const char *val, size_t val_len, int is_end);
 void json_add_escape_str (strbuf_t *buf, const char *key, size_t key_len, const char *val, size_t val_len, int is_end);
 void json_add_int (strbuf_t *buf, const char *key, size_t key_len, int64_t val, int is_end);
 void json_add_double_p (strbuf_t *buf, const char *key, size_t key_len, long double val, int prec, int is_end);
 static inline void json_add_double (strbuf_t *buf, const char *key, size_t key_len, long double val, int is_end) { json_add_double_p(buf, key, key_len, val, JSON_DOUBLE_PRECISION, is_end); }
+// the shortest text that reads back to the same double
+void json_add_double_s (strbuf_t *buf, const char *key, size_t key_len, double val, int is_end);
 void json_add_null (strbuf_t *buf, const char *key, size_t key_len, int is_end);
 void json_add_bool (strbuf_t *buf, const char *key, size_t key_len, int val, int is_end);
 static inline void json_add_true (strbuf_t *buf, const char *key, size_t key_len, int is_end) { json_add_bool(buf, key, key_len, 1, is_end); }
 static inline void json_add_false (strbuf_t *buf, const char *key, size_t key_len, int is_end) { json_add_bool(buf, key, key_len, 0, is_end); }
 static inline void json_add_item_str (strbuf_t *buf, const char *val, size_t val_len) { json_add_str(buf, CONST_STR_NULL, val, val_len, JSON_ITEM); }
 static inline void json_add_item_int (strbuf_t *buf, int64_t val) { json_add_int(buf, CONST_STR_NULL, val, JSON_ITEM); }
+static inline void json_add_item_double_s (strbuf_t *buf, double val) { json_add_double_s(buf, CONST_STR_NULL, val, JSON_ITEM); }
 static inline void json_add_item_null (strbuf_t *buf) { json_add_null(buf, CONST_STR_NULL, JSON_ITEM); }
 static inline void json_add_item_bool (strbuf_t *buf, int val) { json_add_bool(buf, CONST_STR_NULL, val, JSON_ITEM); }
 static inline void json_add_item_true (strbuf_t *buf) { json_add_bool(buf, CONST_STR_NULL, 1, JSON_ITEM); }
@@ -180,6 +283,23 @@ typedef struct {
     int *param_types;
 } jsonrpc_method_t;
 
+// methods indexed by name, the calls of a batch go to the pool if it is given and the
+// dispatching thread runs those no worker took yet, so it can be a worker of the pool;
+// a POOL_FREEMSG handler of the pool gets NULL for these messages
+typedef struct {
+    jsonrpc_method_t *methods;
+    uint32_t *index;
+    size_t index_mask;
+    pool_t *pool;
+} jsonrpc_dispatch_t;
+
+jsonrpc_dispatch_t *jsonrpc_dispatch_alloc (jsonrpc_method_t *methods, pool_t *pool);
+// a single request or a batch array, the responses replace the request in buf,
+// a batch returns JSONRPC_OK or the error of the whole batch; notifications, 2.0
+// requests without an id, run but are not answered, buf is empty if nothing is
+int jsonrpc_dispatch (jsonrpc_dispatch_t *dispatch, strbuf_t *buf, size_t off, void *userdata);
+void jsonrpc_dispatch_free (jsonrpc_dispatch_t *dispatch);
+// no index, the methods are scanned in order
 int jsonrpc_execute (strbuf_t *buf, size_t off, jsonrpc_method_t *methods, void *userdata);
 
 #endif // __LIBEX_JSON_H__
@@ -3,6 +3,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include "slab.h"
 
 #define LIST_NOT_FOUND 0
 #define LIST_FOUND 1
@@ -29,15 +30,21 @@ struct list {
     size_t len;
     struct list_item *head;
     free_h on_free;
+    slab_t *slab;
 };
 
 list_t *lst_alloc (free_h on_free);
+// nodes come from slab, NULL creates a private one released in bulk by lst_free
+list_t *lst_alloc_slab (free_h on_free, slab_t *slab);
 void lst_clear (list_t *list);
 void lst_free (list_t *list);
 list_item_t *lst_add (list_t *list, void *x);
 list_item_t *lst_adde (list_t *list, void *x);
 list_t *lst_addelst (list_t *dst, list_t *src);
 list_item_t *lst_del (list_item_t *item);
+// relinks item into dst, the node is reallocated if dst uses another slab,
+// NULL and the item still in its list if that fails
+list_item_t *lst_move (list_item_t *item, list_t *dst);
 int lst_enum (list_t *list, list_item_h fn, void *userdata, int flags);
 list_item_t *lst_get (list_t *list, compare_h fn, void *userdata);
 static inline void on_default_free_item (void *x, void *y) {
@@ -0,0 +1,60 @@
+#ifndef __LIBEX_LRU_H__
+#define __LIBEX_LRU_H__
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include "list.h"
+#include "hash.h"
+
+#define LRU_UNLIMITED 0
+
+typedef struct lru_item lru_item_t;
+struct lru_item {
+    void *key;
+    void *value;
+    size_t key_len;
+    size_t size;
+    lru_item_t *prev;
+    lru_item_t *next;
+};
+
+typedef void (*lru_evict_h) (lru_item_t*, void*);
+
+typedef struct {
+    size_t len;
+    size_t bytes;
+    size_t max_len;
+    size_t max_bytes;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    lru_item_t *head;
+    hash_t *index;
+    copy_h on_copy;
+    free_h on_free;
+    lru_evict_h on_evict;
+    void *userdata;
+} lru_t;
+
+lru_t *lru_alloc (size_t max_len, size_t max_bytes, calc_h on_hash, compare_h on_compare, copy_h on_copy, free_h on_free);
+void lru_set_evict (lru_t *lru, lru_evict_h on_evict, void *userdata);
+lru_item_t *lru_get (lru_t *lru, void *key, size_t key_len);
+lru_item_t *lru_peek (lru_t *lru, void *key, size_t key_len);
+// replacing the value of an existing key calls on_free(NULL, old_value) unless it is the same pointer
+lru_item_t *lru_put (lru_t *lru, void *key, size_t key_len, void *value, size_t size);
+void lru_del (lru_t *lru, void *key, size_t key_len);
+int lru_evict (lru_t *lru);
+void lru_clear (lru_t *lru);
+void lru_free (lru_t *lru);
+
+#define LRU_FOREACH(item, lru) { \
+    lru_item_t *item = lru->head; \
+    if (item) { \
+        do {
+
+#define LRU_END(lru) \
+            item = item->next; \
+        } while (item != lru->head); } }
+
+#endif // __LIBEX_LRU_H__
@@ -4,6 +4,7 @@
 #ifdef __GMP__
 #include <gmp.h>
 #endif
+#include <sys/uio.h>
 #include "str.h"
 #include "list.h"
 
@@ -14,17 +15,41 @@
 #define MSG_OK 0
 #define MSG_ERROR -1
 
-#define MSG_INIT { .len = 0, .bufsize = 0, .chunk_size = 0, .ptr = NULL, .pc = NULL, .method = 0, .cookie = { .ptr = NULL, .len = 0 }, .code = 0 }
+// payloads from MSG_REF_MIN bytes are sent from where they are, smaller ones are copied
+#define MSG_REF_MIN 4096
+#define MSG_REF_OWN 0x00000001
+
+// the length word of a message with an id has MSG_ID_FLAG set and the id right behind it,
+// a message without one keeps the layout of the peers that know nothing of ids
+#define MSG_ID_FLAG 0x40000000
+#define MSG_LEN_MASK 0x3fffffff
+
+// external bytes that follow the first off bytes of the inline buffer
+typedef struct {
+    uint32_t off;
+    uint32_t len;
+    const char *ptr;
+    int flags;
+} msg_ref_t;
+
+#define MSG_INIT { .len = 0, .bufsize = 0, .chunk_size = 0, .ptr = NULL, .pc = NULL, .id = 0, .method = 0, .cookie = { .ptr = NULL, .len = 0 }, .code = 0, .refs = NULL, .refs_len = 0, .refs_size = 0, .refs_bytes = 0, .growth = STR_GROW_FIXED }
 typedef struct {
     uint32_t len;
     uint32_t bufsize;
     uint32_t chunk_size;
     char *ptr;
     char *pc;
+    // 0 when the length word has no MSG_ID_FLAG, a response takes the id of its request
+    uint32_t id;
     uint32_t method;
     strptr_t cookie;
     uint32_t code;
     strptr_t errmsg;
+    msg_ref_t *refs;
+    uint32_t refs_len;
+    uint32_t refs_size;
+    uint32_t refs_bytes;
+    int growth;
 } msgbuf_t;
 
 typedef int (*msg_item_h) (msgbuf_t*, void*, void*);
@@ -41,6 +66,11 @@ extern msg_reallocator_h msg_realloc;
 ssize_t msg_buflen (const char *buf, size_t buflen);
 int msg_create_request (msgbuf_t *msg, uint32_t method, const char *cookie, size_t cookie_len, uint32_t len, uint32_t chunk_size);
 int msg_create_response (msgbuf_t *msg, int code, uint32_t len, uint32_t chunk_size);
+// puts the id in after the length and sets MSG_ID_FLAG, id 0 leaves a message without one as it is;
+// an old peer can not read a message with an id
+int msg_set_id (msgbuf_t *msg, uint32_t id);
+// room for add_len more inline bytes in one step
+int msg_reserve (msgbuf_t *msg, uint32_t add_len);
 int msg_setstr (msgbuf_t *msg, const char *src, size_t src_len);
 int msg_setbuf (msgbuf_t *msg, void *src, uint32_t src_len);
 static inline int msg_seti (msgbuf_t *msg, int val) { return msg_setbuf(msg, &val, sizeof(int)); };
@@ -49,6 +79,15 @@ static inline int msg_seti32 (msgbuf_t *msg, int32_t val) { return msg_setbuf(ms
 static inline int msg_setui32 (msgbuf_t *msg, uint32_t val) { return msg_setbuf(msg, &val, sizeof(uint32_t)); };
 static inline int msg_seti64 (msgbuf_t *msg, int64_t val) { return msg_setbuf(msg, &val, sizeof(int64_t)); }
 static inline int msg_setd (msgbuf_t *msg, double val) { return msg_setbuf(msg, &val, sizeof(double)); };
+// the string goes out as a reference, with MSG_REF_OWN it is released by msg_free
+// when the message is cleared; src must live until the message is written
+int msg_setref (msgbuf_t *msg, const char *src, size_t src_len, int flags);
+// wire length, inline bytes plus references
+static inline uint32_t msg_size (msgbuf_t *msg) { return msg->len + msg->refs_bytes; };
+// the message as iovec parts in wire order, iov needs msg_iovcnt entries
+static inline int msg_iovcnt (msgbuf_t *msg) { return msg->refs_len * 2 + 1; };
+int msg_iov (msgbuf_t *msg, struct iovec *iov);
+void msg_clear_refs (msgbuf_t *msg);
 int msg_setlist (msgbuf_t *msg, list_t *lst, msg_item_h fn, void *userdata);
 int msg_load_request (msgbuf_t *msg, char *buf, size_t buflen);
 int msg_load_response (msgbuf_t *msg, char *buf, size_t buflen);
@@ -60,10 +99,10 @@ int msg_geti64 (msgbuf_t *msg, int64_t *val);
 int msg_getd (msgbuf_t *msg, double *val);
 int msg_getstr (msgbuf_t *buf, strptr_t *str);
 int msg_enum (msgbuf_t *msg, msg_item_h fn, void *userdata);
-static inline void msg_clear (msgbuf_t *msg) { if (msg->ptr) msg_free(msg->ptr); msg->ptr = msg->pc = NULL; msg->len = 0; };
+static inline void msg_clear (msgbuf_t *msg) { if (msg->refs) msg_clear_refs(msg); if (msg->ptr) msg_free(msg->ptr); msg->ptr = msg->pc = NULL; msg->len = 0; };
 int msg_error (msgbuf_t *msg, int code, const char *str, size_t len);
 static inline int msg_ok (msgbuf_t *msg) { return msg_create_response(msg, 0, 8, 8); };
-static inline void msg_destroy (msgbuf_t *msg) { if (msg->ptr) { free(msg->ptr); memset(msg, 0, sizeof(msgbuf_t)); } };
+static inline void msg_destroy (msgbuf_t *msg) { if (msg->refs) msg_clear_refs(msg); if (msg->ptr) { free(msg->ptr); memset(msg, 0, sizeof(msgbuf_t)); } };
 
 #define MSG_FOREACH(msg) \
     uint32_t __count__; \
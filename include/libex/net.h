@@ -13,17 +13,27 @@
 #include <sys/epoll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/ioctl.h>
 #include <sys/select.h>
 #include <sys/resource.h>
+#include <linux/filter.h>
 #include "str.h"
 #include "list.h"
 #include "task.h"
+#include "lru.h"
 
 #define NET_OK 1
 #define NET_WAIT 0
 #define NET_ERROR -1
 
+#define NET_BUF_SIZE 512
+
+#define NET_REUSEPORT 0x0001
+#define NET_NONBLOCK 0x0002
+// net_bind_group, the listener a connection goes to is the one of the cpu its packets come on
+#define NET_CPU_STEER 0x0004
+
 typedef int (*mutex_h) (void*);
 extern mutex_h fn_lock;
 extern mutex_h fn_unlock;
@@ -35,15 +45,94 @@ typedef struct {
 int netbuf_alloc (netbuf_t *nbuf, size_t start_len, size_t chunk_size);
 void netbuf_free (netbuf_t *nbuf);
 
+// an output queue, small writes share blocks and go out in one writev
+#define NET_OUT_BLOCK 16384
+#define NET_OUT_IOV 64
+#define NET_OUT_HIGH (1024 * 1024)
+#define NET_OUT_LOW (256 * 1024)
+
+typedef struct netout_block netout_block_t;
+typedef struct netout netout_t;
+// the queue was over the high watermark and went under the low one
+typedef void (*netout_h) (netout_t *out, void *userdata);
+
+struct netout_block {
+    netout_block_t *next;
+    size_t len;
+    size_t size;
+    char data [];
+};
+
+typedef struct {
+    size_t max_queued;
+    size_t writes;
+    size_t bytes;
+    // from the first byte queued to the queue empty, microseconds
+    uint64_t flush_us;
+    uint64_t max_flush_us;
+} netout_stat_t;
+
+struct netout {
+    netout_block_t *head;
+    netout_block_t *tail;
+    size_t off;
+    size_t queued;
+    size_t high;
+    size_t low;
+    int is_full;
+    int is_notsock;
+    netout_h on_drain;
+    void *userdata;
+    struct timespec since;
+    netout_stat_t stat;
+};
+
+// high 0 takes NET_OUT_HIGH and NET_OUT_LOW
+void netout_init (netout_t *out, size_t high, size_t low, netout_h on_drain, void *userdata);
+void netout_free (netout_t *out);
+// copied, it is queued over the high watermark too, the producer looks at netout_is_full
+int netout_add (netout_t *out, const char *buf, size_t len);
+// NET_OK when all went, NET_WAIT when the fd takes no more, NET_ERROR
+int netout_flush (netout_t *out, int fd, void *locker);
+// the unsent part for a writer of its own, consumed after it went out
+int netout_iov (netout_t *out, struct iovec *iov, int max);
+void netout_consume (netout_t *out, size_t nbytes);
+static inline int netout_is_full (netout_t *out) { return out->is_full; }
+
 typedef ssize_t (*fmt_checker_h) (const char*, size_t);
 
 int atoport (const char *service, const char *proto);
 int atoaddr (const char *address, struct in_addr *addr);
 
+#define NET_RESOLVE_CACHE 256
+#define NET_RESOLVE_TTL 60
+
+typedef struct {
+    struct sockaddr_storage addr;
+    socklen_t len;
+} netaddr_t;
+
+// getaddrinfo behind a cache shared by the threads, a numeric address never goes to dns,
+// a name does once in NET_RESOLVE_TTL seconds and blocks then
+int net_resolve (const char *host, const char *service, netaddr_t *addr);
+void net_resolve_clear ();
+
 typedef ssize_t (*net_recv_h) (int, strbuf_t*);
 
 int net_bind (const char *svc);
+int net_bind_flags (const char *svc, int flags);
+// backlog 0 takes SOMAXCONN
+int net_bind_backlog (const char *svc, int flags, int backlog);
+// n listeners of one SO_REUSEPORT group in fds, the kernel spreads the connections over them
+int net_bind_group (const char *svc, int *fds, int n, int flags, int backlog);
+// connections of cpu i go to listener i % n of the group fd is in, in the order they were bound;
+// the acceptor of listener i runs on cpu i to keep a connection on one core
+int net_steer_cpu (int fd, int n);
+// nonblocking, timeout in milliseconds, 0 waits as long as the kernel does
 int net_connect (char *to_addr, char *service, int timeout);
+// a nonblocking socket with the connect in progress, it is done once the socket is
+// writable and SO_ERROR tells how it went
+int net_connect_start (const netaddr_t *addr);
 ssize_t net_recv (int fd, strbuf_t *buf);
 ssize_t net_recvnb (int fd, strbuf_t *buf);
 ssize_t net_write (int fd, char *buf, size_t size, void *locker);
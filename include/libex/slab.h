@@ -0,0 +1,39 @@
+#ifndef __LIBEX_SLAB_H__
+#define __LIBEX_SLAB_H__
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include "arena.h"
+
+#define SLAB_MIN_ITEMS 64
+#define SLAB_MAX_ITEMS 4096
+
+typedef struct slab_chunk slab_chunk_t;
+struct slab_chunk {
+    slab_chunk_t *next;
+};
+
+// fixed-size object cache, not thread safe: share one slab between the
+// containers of a single thread or give each container its own
+typedef struct {
+    size_t item_size;
+    size_t chunk_items;
+    size_t len;
+    size_t refs;
+    void *free_items;
+    char *cur;
+    char *end;
+    slab_chunk_t *chunks;
+    arena_t *arena;
+} slab_t;
+
+slab_t *slab_alloc (size_t item_size);
+// chunks and the slab itself come from arena, slab_free only drops the reference
+slab_t *slab_alloc_arena (size_t item_size, arena_t *arena);
+slab_t *slab_ref (slab_t *slab);
+void *slab_get (slab_t *slab);
+void slab_put (slab_t *slab, void *item);
+void slab_free (slab_t *slab);
+
+#endif // __LIBEX_SLAB_H__
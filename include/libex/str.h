@@ -18,6 +18,9 @@
 #include <locale.h>
 #include <wchar.h>
 #include <wctype.h>
+#include <math.h>
+#include <float.h>
+#include <pthread.h>
 
 #if __x86_64 || __ppc64__
 #define LONG_FMT "%ld"
@@ -40,6 +43,13 @@
 #endif
 #define CONST_STR_NULL NULL,0
 #define STR_REDUCE 0x0001
+
+// how a buffer grows past its size: by chunk_size, twice the size or
+// half the size more, at most STR_GROW_CAP bytes at once
+#define STR_GROW_FIXED 0
+#define STR_GROW_DOUBLE 1
+#define STR_GROW_HALF 2
+#define STR_GROW_CAP (64 * 1024 * 1024)
 #define STR_ADD_NULL(x) (x)->ptr[(x)->len] = '\0'
 #define WSTR_ADD_NULL(x) (x)->ptr[(x)->len] = L'\0'
 #define CONST_STR_INIT(s) { .len = sizeof(s)-1, .ptr = s }
@@ -59,6 +69,7 @@ typedef struct {
     size_t len;
     size_t bufsize;
     size_t chunk_size;
+    int growth;
     char ptr [0];
 } str_t;
 
@@ -66,6 +77,7 @@ typedef struct {
     size_t len;
     size_t bufsize;
     size_t chunk_size;
+    int growth;
     wchar_t ptr [0];
 } wstr_t;
 
@@ -83,11 +95,13 @@ typedef struct {
     size_t len;
     size_t bufsize;
     size_t chunk_size;
+    int growth;
     char *ptr;
 } strbuf_t;
 
 #define isunicode(c) (((c)&0xc0)==0xc0)
 
+size_t strgrowsize (size_t bufsize, size_t nlen, size_t chunk_size, int growth);
 str_t *stralloc (size_t len, size_t chunk_size);
 wstr_t *wstralloc (size_t len, size_t chunk_size);
 wstr_t *str2wstr (const char *str, size_t str_len, size_t chunk_size);
@@ -95,6 +109,8 @@ str_t *wstr2str (const wchar_t *str, size_t str_len, size_t chunk_size);
 str_t *mkstr (const char *str, size_t len, size_t chunk_size);
 wstr_t *wmkstr (const wchar_t *str, size_t len, size_t chunk_size);
 int strsize (str_t **str, size_t nlen, int flags);
+// room for add_len more bytes in one step
+static inline int strreserve (str_t **str, size_t add_len) { return (*str)->len + add_len < (*str)->bufsize ? 0 : strsize(str, (*str)->len + add_len, 0); }
 size_t strwlen (const char *str, size_t str_len);
 void strwupper (char *str, size_t str_len, locale_t locale);
 void strwlower (char *str, size_t str_len, locale_t locale);
@@ -123,11 +139,41 @@ static inline str_t *strclone (str_t *str) { return mkstr(str->ptr, str->len, st
 #define strcopy(x) strclone(x)
 static inline wstr_t *wstrclone (wstr_t *str) { return wmkstr(str->ptr, str->len, str->chunk_size); };
 
+// free lists of buffers by power of two size, one set per thread;
+// strbufalloc takes from them and strbuf_release gives back when
+// strbuf_pool_setmax allows a thread to keep some bytes
+#define STRBUF_POOL_MIN 64
+#define STRBUF_POOL_CLASSES 11
+typedef struct {
+    size_t hits;
+    size_t misses;
+    size_t releases;
+    size_t retained;
+} strbuf_pool_stat_t;
+void strbuf_pool_setmax (size_t max_bytes);
+void strbuf_pool_stat (strbuf_pool_stat_t *stat);
+void strbuf_pool_clear ();
+
+// only the first byte is zero when the buffer comes from the pool,
+// the rest is what the last user left there
 int strbufalloc (strbuf_t *strbuf, size_t len, size_t chunk_size);
+// the buffer goes back to the pool of the thread or is freed
+void strbuf_release (strbuf_t *strbuf);
 int strbufsize (strbuf_t *strbuf, size_t nlen, int flags);
 int strbufput (strbuf_t *strbuf, const char *src, size_t src_len, int flags);
 int strbufadd (strbuf_t *strbuf, const char *src, size_t src_len);
 int strbufset (strbuf_t *buf, const char c, size_t len);
+// room for add_len more bytes, one check before a run of unchecked writes
+static inline int strbufreserve (strbuf_t *strbuf, size_t add_len) { return strbuf->len + add_len < strbuf->bufsize ? 0 : strbufsize(strbuf, strbuf->len + add_len, 0); }
+
+// number to text without the terminating zero, the return is the length
+#define DTOSTR_BUFSIZE 48
+size_t ultostr (uint64_t val, char *buf);
+size_t ltostr (int64_t val, char *buf);
+// fixed precision like "%.*Lf"
+size_t dtostr_p (long double val, int prec, char *buf);
+// shortest text that reads back to the same double
+size_t dtostr (double val, char *buf);
 
 ssize_t base64_encode(const unsigned char *data, size_t input_length, char *encoded_data, size_t output_length);
 str_t *str_base64_encode (const char *buf, size_t bufsize, size_t chunk_size);
@@ -31,9 +31,12 @@ struct rbtree {
     compare_h on_compare;
     copy_h on_copy;
     free_h on_free;
+    slab_t *slab;
 };
 
 rbtree_t *rbtree_alloc (compare_h on_compare, copy_h on_copy, free_h on_free, int unique);
+// nodes come from slab, NULL creates a private one released in bulk by rbtree_free
+rbtree_t *rbtree_alloc_slab (compare_h on_compare, copy_h on_copy, free_h on_free, int unique, slab_t *slab);
 tree_item_t *rbtree_add (rbtree_t *tree, void *key);
 tree_item_t *rbtree_get (rbtree_t *tree, void *key);
 void rbtree_select (rbtree_t *tree, void *key, tree_item_h on_item, void *userdata, int flags);
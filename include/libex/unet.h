@@ -3,8 +3,12 @@
 
 #include <stdint.h>
 #include <unistd.h>
+#include <limits.h>
+#include <fcntl.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "str.h"
 #include "msg.h"
 #include "net.h"
@@ -12,14 +16,105 @@
 typedef int (*on_parse_msg) (msgbuf_t*, char*, size_t);
 
 int unet_bind (const char *sock_file);
+// backlog 0 takes SOMAXCONN
+int unet_bind_backlog (const char *sock_file, int backlog);
 int unet_connect (const char *sock_file);
 int unet_read (int fd, msgbuf_t *msg, on_parse_msg on_msg);
 static inline int unet_read_request (int fd, msgbuf_t *msg) { return unet_read(fd, msg, msg_load_request); }
 static inline int unet_read_response (int fd, msgbuf_t *msg) { return unet_read(fd, msg, msg_load_response); }
 ssize_t unet_write (int fd, char *buf, size_t size);
+// inline parts and references of the message from off bytes on, nothing is copied;
+// a nonblocking fd stops at EAGAIN with the bytes sent by this call, the next one
+// goes on from off plus them
+ssize_t unet_writemsg_off (int fd, msgbuf_t *msg, size_t off);
+static inline ssize_t unet_writemsg (int fd, msgbuf_t *msg) { return unet_writemsg_off(fd, msg, 0); }
 int unet_recv (int fd, netbuf_t *nbuf, msgbuf_t *result, msg_parse_h on_parse);
 static inline int unet_recv_request(int fd, netbuf_t *buf, msgbuf_t *result) { return unet_recv(fd, buf, result, msg_load_request); }
 static inline int unet_recv_response (int fd, netbuf_t *buf, msgbuf_t *result) { return unet_recv(fd, buf, result, msg_load_response); }
 void unet_reset (netbuf_t *nbuf);
 
+// a message parsed in place, it is valid until the handler returns, -1 stops
+typedef int (*unet_msg_h) (msgbuf_t *msg, void *userdata);
+// every complete message in nbuf->buf in the order they came, the part of the next one moves
+// to the start with room for all of it; the number of messages or -1 for a broken stream
+int unet_process (netbuf_t *nbuf, msg_parse_h on_parse, unet_msg_h on_msg, void *userdata);
+
+#define UNET_INFLIGHT 1024
+
+// err is an errno and resp NULL if the connection is gone, resp is valid until it returns
+typedef void (*unet_call_h) (msgbuf_t *resp, int err, void *userdata);
+
+typedef struct {
+    uint32_t id;
+    unet_call_h on_resp;
+    void *userdata;
+} unet_slot_t;
+
+// requests in flight on one connection, responses are matched by id in any order;
+// the server has to know MSG_ID_FLAG and send the id back
+typedef struct {
+    int fd;
+    int is_alive;
+    uint32_t next_id;
+    uint32_t mask;
+    uint32_t inflight;
+    unet_slot_t *slots;
+    pthread_mutex_t lock;
+    pthread_mutex_t send_lock;
+    pthread_cond_t room;
+    pthread_t reader;
+    netbuf_t nbuf;
+} unet_client_t;
+
+// takes fd, max_inflight 0 is UNET_INFLIGHT and goes up to a power of two, a call waits while that many are out;
+// a thread of the client reads the responses and runs the handlers
+unet_client_t *unet_client_alloc (int fd, uint32_t max_inflight);
+// the id of req is set, on_resp must not wait for a response of the same client
+int unet_call_async (unet_client_t *cln, msgbuf_t *req, unet_call_h on_resp, void *userdata);
+// waits for its response, resp gets a buffer of its own
+int unet_call (unet_client_t *cln, msgbuf_t *req, msgbuf_t *resp);
+// the calls still out get ECONNRESET
+void unet_client_free (unet_client_t *cln);
+
+// frames from UNET_SHM_MIN bytes go through a ring in shared memory, the socket takes
+// a unet_shm_frame_t with its place in the ring in the order of the other messages
+#define UNET_SHM_SIZE (64 * 1024 * 1024)
+#define UNET_SHM_MIN (64 * 1024)
+#define UNET_SHM_FRAME 0x80000000
+#define UNET_SHM_HDR 128
+
+typedef struct {
+    uint32_t flags;
+    uint32_t len;
+    uint64_t pos;
+} unet_shm_frame_t;
+
+// every end writes to a memfd ring of its own and reads the one of the peer in place
+typedef struct {
+    int fd;
+    size_t min;
+    char *out;
+    size_t out_size;
+    uint64_t out_head;
+    char *in;
+    size_t in_size;
+    uint64_t in_release;
+    int is_held;
+    size_t consumed;
+    netbuf_t nbuf;
+} unet_shm_t;
+
+// both ends of a connected unix socket call it before any message, size 0 takes UNET_SHM_SIZE;
+// the memfd of each end is sealed against shrinking and growing, an unsealed one fails with EPROTO
+int unet_shm_init (unet_shm_t *shm, int fd, size_t size);
+// the socket stays open
+void unet_shm_free (unet_shm_t *shm);
+// as unet_writemsg, inline when it is smaller than shm->min or the ring has no room for it
+ssize_t unet_shm_writemsg (unet_shm_t *shm, msgbuf_t *msg);
+// the next message parsed where it is, in the ring or in the buffer of shm, it is valid
+// until the next read and must not be cleared
+int unet_shm_read (unet_shm_t *shm, msgbuf_t *msg, msg_parse_h on_parse);
+static inline int unet_shm_read_request (unet_shm_t *shm, msgbuf_t *msg) { return unet_shm_read(shm, msg, msg_load_request); }
+static inline int unet_shm_read_response (unet_shm_t *shm, msgbuf_t *msg) { return unet_shm_read(shm, msg, msg_load_response); }
+
 #endif // __LIBEX_UNET_H__
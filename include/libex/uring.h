@@ -0,0 +1,123 @@
+#ifndef __LIBEX_URING_H__
+#define __LIBEX_URING_H__
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+// io_uring through the raw syscalls, one thread submits and reaps
+typedef struct {
+    int fd;
+    unsigned features;
+    unsigned sq_entries;
+    unsigned sq_queued;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *ring_ptr;
+    size_t ring_size;
+    size_t sqes_size;
+} uring_t;
+
+// buffers the kernel picks for IOSQE_BUFFER_SELECT requests of group bgid
+typedef struct {
+    struct io_uring_buf_ring *br;
+    char *base;
+    unsigned entries;
+    size_t buf_size;
+    size_t map_size;
+    uint16_t bgid;
+    uint16_t tail;
+} uring_bufs_t;
+
+int uring_init (uring_t *ring, unsigned entries);
+void uring_free (uring_t *ring);
+// a zeroed sqe, the queue is submitted first when it is full
+struct io_uring_sqe *uring_get_sqe (uring_t *ring);
+// submits what is queued and waits for wait_nr completions, timeout_ms -1 waits forever
+int uring_submit (uring_t *ring, unsigned wait_nr, int timeout_ms);
+// every request, the files they hold are let go when it returns
+int uring_cancel_all (uring_t *ring);
+
+static inline struct io_uring_cqe *uring_peek (uring_t *ring) {
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &ring->cqes[head & *ring->cq_mask];
+}
+static inline void uring_seen (uring_t *ring) {
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+// entries is a power of 2
+int uring_bufs_alloc (uring_t *ring, uring_bufs_t *bufs, uint16_t bgid, unsigned entries, size_t buf_size);
+void uring_bufs_free (uring_t *ring, uring_bufs_t *bufs);
+static inline char *uring_buf (uring_bufs_t *bufs, uint16_t bid) {
+    return bufs->base + bid * bufs->buf_size;
+}
+// gives the buffer of a completion back to the kernel
+static inline void uring_buf_put (uring_bufs_t *bufs, uint16_t bid) {
+    struct io_uring_buf *buf = &bufs->br->bufs[bufs->tail & (bufs->entries - 1)];
+    buf->addr = (uintptr_t)uring_buf(bufs, bid);
+    buf->len = bufs->buf_size;
+    buf->bid = bid;
+    __atomic_store_n(&bufs->br->tail, ++bufs->tail, __ATOMIC_RELEASE);
+}
+
+static inline void uring_prep_rw (struct io_uring_sqe *sqe, int op, int fd, const void *addr, unsigned len, uint64_t off) {
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)addr;
+    sqe->len = len;
+    sqe->off = off;
+}
+static inline void uring_prep_read (struct io_uring_sqe *sqe, int fd, void *buf, unsigned len, uint64_t off) {
+    uring_prep_rw(sqe, IORING_OP_READ, fd, buf, len, off);
+}
+static inline void uring_prep_write (struct io_uring_sqe *sqe, int fd, const void *buf, unsigned len, uint64_t off) {
+    uring_prep_rw(sqe, IORING_OP_WRITE, fd, buf, len, off);
+}
+static inline void uring_prep_send (struct io_uring_sqe *sqe, int fd, const void *buf, size_t len, int flags) {
+    uring_prep_rw(sqe, IORING_OP_SEND, fd, buf, len, 0);
+    sqe->msg_flags = flags;
+}
+// msg stays until the completion
+static inline void uring_prep_sendmsg (struct io_uring_sqe *sqe, int fd, const struct msghdr *msg, int flags) {
+    uring_prep_rw(sqe, IORING_OP_SENDMSG, fd, msg, 1, 0);
+    sqe->msg_flags = flags;
+}
+// mask as poll(2), a multishot poll reports until it is cancelled
+static inline void uring_prep_poll (struct io_uring_sqe *sqe, int fd, unsigned mask, int multishot) {
+    uring_prep_rw(sqe, IORING_OP_POLL_ADD, fd, NULL, multishot ? IORING_POLL_ADD_MULTI : 0, 0);
+    sqe->poll32_events = mask;
+}
+// receives into the buffers of bgid until the peer closes or the buffers run out
+static inline void uring_prep_recv_multishot (struct io_uring_sqe *sqe, int fd, uint16_t bgid) {
+    uring_prep_rw(sqe, IORING_OP_RECV, fd, NULL, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = bgid;
+    sqe->ioprio |= IORING_RECV_MULTISHOT;
+}
+// flags as accept4, one completion for every new connection
+static inline void uring_prep_accept_multishot (struct io_uring_sqe *sqe, int fd, int flags) {
+    uring_prep_rw(sqe, IORING_OP_ACCEPT, fd, NULL, 0, 0);
+    sqe->accept_flags = flags;
+    sqe->ioprio |= IORING_ACCEPT_MULTISHOT;
+}
+static inline void uring_prep_cancel (struct io_uring_sqe *sqe, uint64_t user_data) {
+    uring_prep_rw(sqe, IORING_OP_ASYNC_CANCEL, -1, NULL, 0, 0);
+    sqe->addr = user_data;
+}
+
+#endif // __LIBEX_URING_H__
@@ -0,0 +1,73 @@
+#include "arena.h"
+
+#define ARENA_ROUND(x) (((x) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+#define ARENA_HDR ARENA_ROUND(sizeof(arena_block_t))
+
+// the arena itself lives at the start of its first block
+arena_t *arena_alloc (size_t block_size) {
+    arena_block_t *block;
+    arena_t *arena;
+    if (block_size < ARENA_HDR + ARENA_ROUND(sizeof(arena_t)) + ARENA_ALIGN)
+        block_size = ARENA_DEFAULT_BLOCK;
+    if (!(block = malloc(block_size)))
+        return NULL;
+    block->next = NULL;
+    arena = (arena_t*)((char*)block + ARENA_HDR);
+    arena->block_size = block_size;
+    arena->len = 0;
+    arena->blocks = block;
+    arena->cur = (char*)arena + ARENA_ROUND(sizeof(arena_t));
+    arena->end = (char*)block + block_size;
+    return arena;
+}
+
+void *arena_get (arena_t *arena, size_t size) {
+    char *p;
+    size = ARENA_ROUND(size);
+    if (size > (size_t)(arena->end - arena->cur)) {
+        size_t n = ARENA_HDR + size > arena->block_size ? ARENA_HDR + size : arena->block_size;
+        arena_block_t *block = malloc(n);
+        if (!block)
+            return NULL;
+        // the first block holds the arena, keep it last
+        block->next = arena->blocks->next;
+        arena->blocks->next = block;
+        arena->cur = (char*)block + ARENA_HDR;
+        arena->end = (char*)block + n;
+    }
+    p = arena->cur;
+    arena->cur += size;
+    arena->len += size;
+    return p;
+}
+
+void *arena_calloc (arena_t *arena, size_t size) {
+    void *p = arena_get(arena, size);
+    if (p)
+        memset(p, 0, size);
+    return p;
+}
+
+static void arena_free_blocks (arena_t *arena) {
+    arena_block_t *block = arena->blocks->next;
+    while (block) {
+        arena_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->blocks->next = NULL;
+}
+
+void arena_reset (arena_t *arena) {
+    arena_free_blocks(arena);
+    arena->len = 0;
+    arena->cur = (char*)arena + ARENA_ROUND(sizeof(arena_t));
+    arena->end = (char*)arena->blocks + arena->block_size;
+}
+
+void arena_free (arena_t *arena) {
+    if (arena) {
+        arena_free_blocks(arena);
+        free(arena->blocks);
+    }
+}
@@ -0,0 +1,172 @@
+#include "chash.h"
+
+static inline chash_shard_t *chash_shard (chash_t *ch, void *key, size_t key_len) {
+    if (1 == ch->nshards)
+        return ch->shards;
+    // top bits of a multiplicative mix, the shard hash keeps the low bits for its buckets
+    uint64_t h = (uint64_t)(ch->on_hash_seed ? ch->on_hash_seed(key, key_len, ch->seed) : ch->on_hash(key, key_len)) * 0x9e3779b97f4a7c15ULL;
+    return &ch->shards[h >> ch->shift];
+}
+
+chash_t *chash_alloc (hash_key_t nshards, hash_key_t hash_buf_size, hash_type_t type, calc_h on_hash, compare_h on_compare, copy_h on_copy, free_h on_free) {
+    chash_t *ch;
+    hash_key_t n = 1;
+    int bits = 0;
+    if (0 == nshards)
+        nshards = CHASH_DEFAULT_SHARDS;
+    while (n < nshards) {
+        n <<= 1;
+        ++bits;
+    }
+    if (!(ch = calloc(1, sizeof(chash_t))))
+        return NULL;
+    if (0 != posix_memalign((void**)&ch->shards, CHASH_CACHELINE, n * sizeof(chash_shard_t))) {
+        free(ch);
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(ch->shards, 0, n * sizeof(chash_shard_t));
+    ch->nshards = n;
+    ch->shift = 64 - bits;
+    ch->on_hash = on_hash;
+    ch->on_free = on_free;
+    hash_buf_size = hash_buf_size / n;
+    for (hash_key_t i = 0; i < n; ++i) {
+        chash_shard_t *shard = &ch->shards[i];
+        if (!(shard->hash = hash_alloc(hash_buf_size, type, on_hash, on_compare, on_copy, on_free))) {
+            ch->nshards = i;
+            chash_free(ch);
+            return NULL;
+        }
+        lock_init(&shard->lock);
+    }
+    return ch;
+}
+
+int chash_set_seed (chash_t *ch, calc_seed_h on_hash_seed, uint64_t seed) {
+    for (hash_key_t i = 0; i < ch->nshards; ++i)
+        if (ch->shards[i].hash->len > 0) {
+            errno = EBUSY;
+            return -1;
+        }
+    if (0 == seed)
+        seed = hash_random_seed();
+    ch->on_hash_seed = on_hash_seed;
+    ch->seed = seed;
+    for (hash_key_t i = 0; i < ch->nshards; ++i)
+        hash_set_seed(ch->shards[i].hash, on_hash_seed, seed);
+    return 0;
+}
+
+int chash_get (chash_t *ch, void *key, size_t key_len, void **value) {
+    chash_shard_t *shard = chash_shard(ch, key, key_len);
+    hash_item_t *hi;
+    int rc = -1;
+    lock(&shard->lock);
+    if ((hi = hash_get(shard->hash, key, key_len))) {
+        if (value)
+            *value = hi->value;
+        rc = 0;
+    }
+    unlock(&shard->lock);
+    if (-1 == rc)
+        errno = ENOENT;
+    return rc;
+}
+
+int chash_add (chash_t *ch, void *key, size_t key_len, void *value) {
+    chash_shard_t *shard = chash_shard(ch, key, key_len);
+    hash_item_t *hi;
+    void *old = NULL;
+    int rc = -1, exists = 0;
+    lock(&shard->lock);
+    if ((hi = hash_add(shard->hash, key, key_len))) {
+        if ((exists = EEXIST == errno))
+            old = hi->value;
+        hi->value = value;
+        rc = 0;
+    }
+    unlock(&shard->lock);
+    if (exists) {
+        if (ch->on_free && old != value)
+            ch->on_free(NULL, old);
+        errno = EEXIST;
+    }
+    return rc;
+}
+
+int chash_del (chash_t *ch, void *key, size_t key_len) {
+    chash_shard_t *shard = chash_shard(ch, key, key_len);
+    hash_key_t len;
+    lock(&shard->lock);
+    len = shard->hash->len;
+    hash_del(shard->hash, key, key_len);
+    len -= shard->hash->len;
+    unlock(&shard->lock);
+    if (0 == len) {
+        errno = ENOENT;
+        return -1;
+    }
+    return 0;
+}
+
+void *chash_compute (chash_t *ch, void *key, size_t key_len, chash_compute_h on_compute, void *userdata) {
+    chash_shard_t *shard = chash_shard(ch, key, key_len);
+    hash_item_t *hi;
+    void *value, *lost = NULL;
+    lock(&shard->lock);
+    if ((hi = hash_get(shard->hash, key, key_len))) {
+        if ((value = on_compute(hi->key, hi->value, userdata)))
+            hi->value = value;
+        else {
+            // the callback owns the old value, keep hash_del from freeing it
+            hi->value = NULL;
+            hash_del(shard->hash, key, key_len);
+        }
+    } else if ((value = on_compute(key, NULL, userdata))) {
+        if ((hi = hash_add(shard->hash, key, key_len)))
+            hi->value = value;
+        else {
+            lost = value;
+            value = NULL;
+        }
+    }
+    unlock(&shard->lock);
+    // the new value has no place, it goes as a replaced one would
+    if (lost) {
+        int err = errno ? errno : ENOMEM;
+        if (ch->on_free)
+            ch->on_free(NULL, lost);
+        errno = err;
+    }
+    return value;
+}
+
+void chash_enum (chash_t *ch, hash_item_h on_item, void *userdata) {
+    for (hash_key_t i = 0; i < ch->nshards; ++i) {
+        chash_shard_t *shard = &ch->shards[i];
+        lock(&shard->lock);
+        hash_enum(shard->hash, on_item, userdata, 0);
+        unlock(&shard->lock);
+    }
+}
+
+hash_key_t chash_len (chash_t *ch) {
+    hash_key_t len = 0;
+    for (hash_key_t i = 0; i < ch->nshards; ++i) {
+        chash_shard_t *shard = &ch->shards[i];
+        lock(&shard->lock);
+        len += shard->hash->len;
+        unlock(&shard->lock);
+    }
+    return len;
+}
+
+void chash_free (chash_t *ch) {
+    for (hash_key_t i = 0; i < ch->nshards; ++i) {
+        hash_free(ch->shards[i].hash);
+        lock_done(&ch->shards[i].lock);
+    }
+    free(ch->shards);
+    free(ch);
+}
@@ -0,0 +1,1047 @@
+#include "evloop.h"
+
+// set by evloop_listen, under io_uring the loop accepts for the listener
+#define EV_ACCEPT 0x0100
+
+// the op of an io_uring request goes in the low bits of its user_data
+#define EVOP_POLL 1
+#define EVOP_RECV 2
+#define EVOP_ACCEPT 3
+#define EVOP_SEND 4
+#define EVOP_MASK 7
+#define EVOP_BIT(op) (1 << (op))
+
+// what the loop keeps for a watcher, it outlives ev until the kernel lets go of it
+struct evio {
+    ev_t *ev;
+    int fd;
+    int inflight;
+    int armed;
+    int is_dirty;
+    int is_eof;
+    uint32_t mask;
+    evio_t *next;
+    evio_t *prev;
+    evio_t *next_dirty;
+    netout_t out;
+    struct msghdr msg;
+    struct iovec *iov;
+};
+
+static __thread evloop_t *cur_loop;
+
+static uint64_t evloop_now (evloop_t *loop) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000) / loop->tick_ms;
+}
+
+static void on_wakeup (evloop_t *loop, ev_t *ev, int events) {
+    uint64_t n;
+    while (read(ev->fd, &n, sizeof n) > 0);
+}
+
+static uint32_t ev_epoll_events (int events) {
+    uint32_t e = EPOLLRDHUP;
+    if ((events & EV_READ)) e |= EPOLLIN;
+    if ((events & EV_WRITE)) e |= EPOLLOUT;
+    if ((events & EV_ET)) e |= EPOLLET;
+    // the only other flags EPOLLEXCLUSIVE goes with are EPOLLIN, EPOLLOUT and EPOLLET
+    if ((events & EV_EXCLUSIVE)) e = (e & ~EPOLLRDHUP) | EPOLLEXCLUSIVE;
+    return e;
+}
+
+static int ev_events (uint32_t e) {
+    int events = 0;
+    if ((e & EPOLLIN)) events |= EV_READ;
+    if ((e & EPOLLOUT)) events |= EV_WRITE;
+    if ((e & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))) events |= EV_CLOSE;
+    return events;
+}
+
+/*****
+  watcher state
+*****/
+static evio_t *evio_alloc (evloop_t *loop, ev_t *ev) {
+    evio_t *io = calloc(1, sizeof(evio_t));
+    if (!io)
+        return NULL;
+    io->ev = ev;
+    io->fd = ev->fd;
+    io->mask = ev_epoll_events(ev->events);
+    netout_init(&io->out, 0, 0, NULL, NULL);
+    if ((io->next = loop->ios))
+        loop->ios->prev = io;
+    loop->ios = io;
+    ev->io = io;
+    return io;
+}
+
+static void evio_free (evloop_t *loop, evio_t *io) {
+    if (io->next)
+        io->next->prev = io->prev;
+    if (io->prev)
+        io->prev->next = io->next;
+    else
+        loop->ios = io->next;
+    netout_free(&io->out);
+    free(io->iov);
+    free(io);
+}
+
+// looked at before the loop waits again
+static void evio_dirty (evloop_t *loop, evio_t *io) {
+    if (!io->is_dirty) {
+        io->is_dirty = 1;
+        io->next_dirty = loop->dirty;
+        loop->dirty = io;
+    }
+}
+
+/*****
+  io_uring
+*****/
+static void evuring_free (evloop_t *loop) {
+    if (loop->bufs) {
+        uring_bufs_free(loop->ring, loop->bufs);
+        free(loop->bufs);
+        loop->bufs = NULL;
+    }
+    if (loop->ring) {
+        // the ring goes away in the background, a listener it accepts on would stay bound
+        if (-1 != loop->ring->fd) {
+            uring_cancel_all(loop->ring);
+            uring_free(loop->ring);
+        }
+        free(loop->ring);
+        loop->ring = NULL;
+    }
+}
+
+static int evuring_alloc (evloop_t *loop) {
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    int fd = -1, rc = -1;
+    if (!(loop->ring = malloc(sizeof(uring_t))))
+        return -1;
+    if (-1 == uring_init(loop->ring, EV_URING_ENTRIES) || !(loop->ring->features & IORING_FEAT_EXT_ARG))
+        goto done;
+    if (!(loop->bufs = malloc(sizeof(uring_bufs_t))) || -1 == uring_bufs_alloc(loop->ring, loop->bufs, 0, EV_URING_BUFS, EV_URING_BUF_SIZE)) {
+        free(loop->bufs);
+        loop->bufs = NULL;
+        goto done;
+    }
+    // multishot recv came a release after the buffer rings, an older kernel
+    // refuses its flag with EINVAL before it looks at the fd
+    if (-1 == (fd = eventfd(0, EFD_CLOEXEC)) || !(sqe = uring_get_sqe(loop->ring)))
+        goto done;
+    uring_prep_recv_multishot(sqe, fd, loop->bufs->bgid);
+    if (-1 == uring_submit(loop->ring, 1, 100) || !(cqe = uring_peek(loop->ring)))
+        goto done;
+    if (-EINVAL != cqe->res)
+        rc = 0;
+    uring_seen(loop->ring);
+done:
+    if (-1 != fd)
+        close(fd);
+    if (-1 == rc)
+        evuring_free(loop);
+    return rc;
+}
+
+static void evuring_submitted (evio_t *io, struct io_uring_sqe *sqe, int op) {
+    sqe->user_data = (uintptr_t)io | op;
+    io->armed |= EVOP_BIT(op);
+    ++io->inflight;
+}
+
+static void evuring_cancel (evloop_t *loop, evio_t *io, int op) {
+    struct io_uring_sqe *sqe;
+    if ((io->armed & EVOP_BIT(op)) && (sqe = uring_get_sqe(loop->ring)))
+        uring_prep_cancel(sqe, (uintptr_t)io | op);
+}
+
+// what is added meanwhile goes behind the iovecs in flight, nothing queued moves
+static void evuring_send (evloop_t *loop, evio_t *io) {
+    struct io_uring_sqe *sqe;
+    if ((!io->iov && !(io->iov = malloc(NET_OUT_IOV * sizeof(struct iovec)))) || !(sqe = uring_get_sqe(loop->ring)))
+        return;
+    memset(&io->msg, 0, sizeof io->msg);
+    io->msg.msg_iov = io->iov;
+    io->msg.msg_iovlen = netout_iov(&io->out, io->iov, NET_OUT_IOV);
+    uring_prep_sendmsg(sqe, io->fd, &io->msg, MSG_NOSIGNAL);
+    evuring_submitted(io, sqe, EVOP_SEND);
+}
+
+// what ev wants and the kernel does not do yet
+static void evuring_arm (evloop_t *loop, evio_t *io) {
+    int events = io->ev->events, recv_op = (events & EV_ACCEPT) ? EVOP_ACCEPT : EVOP_RECV;
+    uint32_t mask = 0;
+    struct io_uring_sqe *sqe;
+    if ((events & (EV_RECV | EV_ACCEPT))) {
+        if (!(events & EV_READ))
+            evuring_cancel(loop, io, recv_op);
+        else
+        if (!(io->armed & EVOP_BIT(recv_op)) && !io->is_eof && (sqe = uring_get_sqe(loop->ring))) {
+            if (EVOP_ACCEPT == recv_op)
+                uring_prep_accept_multishot(sqe, io->fd, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            else
+                uring_prep_recv_multishot(sqe, io->fd, loop->bufs->bgid);
+            evuring_submitted(io, sqe, recv_op);
+        }
+    } else
+    if ((events & EV_READ))
+        mask |= POLLIN;
+    if ((events & EV_WRITE))
+        mask |= POLLOUT;
+    if ((io->armed & EVOP_BIT(EVOP_POLL))) {
+        // the poll is armed again when its cancellation comes
+        if (mask != io->mask)
+            evuring_cancel(loop, io, EVOP_POLL);
+    } else
+    if (mask && (sqe = uring_get_sqe(loop->ring))) {
+        // one shot polls are armed after every event, that makes them level triggered
+        uring_prep_poll(sqe, io->fd, mask | POLLRDHUP, events & EV_ET);
+        evuring_submitted(io, sqe, EVOP_POLL);
+        io->mask = mask;
+    }
+    if (!(io->armed & EVOP_BIT(EVOP_SEND)) && io->out.queued)
+        evuring_send(loop, io);
+}
+
+// a recv or accept completion is there for ev_recv or the listener to take
+static void evuring_handle (evloop_t *loop, evio_t *io, int is_rx, int res, int events) {
+    loop->rx.fd = is_rx ? io->fd : -1;
+    loop->rx.res = res;
+    loop->rx.is_taken = 0;
+    if (io->ev)
+        io->ev->on_event(loop, io->ev, events);
+    loop->rx.fd = -1;
+}
+
+static void evuring_complete (evloop_t *loop, evio_t *io, int op, int res, unsigned flags) {
+    int more = flags & IORING_CQE_F_MORE;
+    if (!more)
+        io->armed &= ~EVOP_BIT(op);
+    switch (op) {
+        case EVOP_POLL:
+            if (res > 0)
+                evuring_handle(loop, io, 0, 0, ev_events(res));
+            break;
+        case EVOP_RECV:
+            loop->rx.ptr = (flags & IORING_CQE_F_BUFFER) ? uring_buf(loop->bufs, flags >> IORING_CQE_BUFFER_SHIFT) : NULL;
+            // out of buffers ends the recv, it is armed again once the handlers gave some back
+            if (-ENOBUFS != res && -ECANCELED != res) {
+                if (res <= 0)
+                    io->is_eof = 1;
+                evuring_handle(loop, io, 1, res, res > 0 ? EV_READ : EV_READ | EV_CLOSE);
+            }
+            if ((flags & IORING_CQE_F_BUFFER))
+                uring_buf_put(loop->bufs, flags >> IORING_CQE_BUFFER_SHIFT);
+            break;
+        case EVOP_ACCEPT:
+            if (res >= 0) {
+                evuring_handle(loop, io, 1, res, EV_READ);
+                // nobody took the connection
+                if (!loop->rx.is_taken)
+                    close(res);
+            }
+            break;
+        case EVOP_SEND:
+            // the rest goes with the next round
+            if (res > 0)
+                netout_consume(&io->out, res);
+            else
+            if (-ECANCELED != res) {
+                netout_free(&io->out);
+                evuring_handle(loop, io, 0, res, EV_CLOSE);
+            }
+            break;
+    }
+    if (!more)
+        --io->inflight;
+    if (!io->ev) {
+        if (!io->inflight && !io->is_dirty)
+            evio_free(loop, io);
+    } else
+    if (!more || io->out.queued)
+        evio_dirty(loop, io);
+}
+
+static int evuring_wait (evloop_t *loop, int timeout_ms) {
+    struct io_uring_cqe *cqe;
+    // an overflown completion queue is drained below
+    if (-1 == uring_submit(loop->ring, 1, timeout_ms) && EBUSY != errno)
+        return -1;
+    while ((cqe = uring_peek(loop->ring))) {
+        uint64_t data = cqe->user_data;
+        int res = cqe->res;
+        unsigned flags = cqe->flags;
+        uring_seen(loop->ring);
+        // cancellations carry no io
+        if (data)
+            evuring_complete(loop, (evio_t*)(uintptr_t)(data & ~(uint64_t)EVOP_MASK), data & EVOP_MASK, res, flags);
+    }
+    return 0;
+}
+
+/*****
+  epoll
+*****/
+static int evepoll_mod (evloop_t *loop, evio_t *io) {
+    uint32_t mask = ev_epoll_events(io->ev->events | (io->out.queued ? EV_WRITE : 0));
+    struct epoll_event e = { .events = mask, .data.ptr = io->ev };
+    if (mask == io->mask)
+        return 0;
+    io->mask = mask;
+    return epoll_ctl(loop->fd, EPOLL_CTL_MOD, io->fd, &e);
+}
+
+// what is left waits for EPOLLOUT
+static void evepoll_send (evloop_t *loop, evio_t *io) {
+    if (NET_ERROR == netout_flush(&io->out, io->fd, NULL))
+        netout_free(&io->out);
+    evepoll_mod(loop, io);
+}
+
+static int evepoll_wait (evloop_t *loop, int timeout_ms) {
+    int rc = epoll_wait(loop->fd, loop->events, EV_MAX_EVENTS, timeout_ms);
+    if (-1 == rc && EINTR != errno)
+        return -1;
+    loop->nevents = rc > 0 ? rc : 0;
+    for (loop->cur_event = 0; loop->cur_event < loop->nevents; ++loop->cur_event) {
+        struct epoll_event *e = &loop->events[loop->cur_event];
+        ev_t *ev = (ev_t*)e->data.ptr;
+        int events;
+        if (!ev)
+            continue;
+        if ((e->events & EPOLLOUT) && ev->io && ev->io->out.queued)
+            evepoll_send(loop, ev->io);
+        // EPOLLOUT may be there for the queue only
+        if ((events = ev_events(e->events) & (ev->events | EV_CLOSE)))
+            ev->on_event(loop, ev, events);
+    }
+    loop->nevents = loop->cur_event = 0;
+    return 0;
+}
+
+/*****
+  loop
+*****/
+evloop_t *evloop_alloc_flags (long tick_ms, int flags) {
+    evloop_t *loop = calloc(1, sizeof(evloop_t));
+    int fd;
+    if (!loop)
+        return NULL;
+    loop->fd = loop->rx.fd = -1;
+    loop->tick_ms = tick_ms > 0 ? tick_ms : EV_TICK_MS;
+    for (int i = 0; i < EV_WHEEL_SIZE; ++i)
+        loop->wheel[i].next = loop->wheel[i].prev = &loop->wheel[i];
+    if (!(flags & EVLOOP_URING) || -1 == evuring_alloc(loop)) {
+        if (!(loop->events = malloc(EV_MAX_EVENTS * sizeof(struct epoll_event))))
+            goto err;
+        if (-1 == (loop->fd = epoll_create1(EPOLL_CLOEXEC)))
+            goto err;
+    }
+    if (-1 == (fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)))
+        goto err;
+    if (-1 == ev_add(loop, &loop->wakeup, fd, EV_READ, on_wakeup, NULL)) {
+        close(fd);
+        goto err;
+    }
+    loop->tick = evloop_now(loop);
+    loop->is_alive = 1;
+    return loop;
+err:
+    evuring_free(loop);
+    if (-1 != loop->fd)
+        close(loop->fd);
+    free(loop->events);
+    free(loop);
+    return NULL;
+}
+
+evloop_t *evloop_alloc (long tick_ms) {
+    return evloop_alloc_flags(tick_ms, 0);
+}
+
+void evloop_free (evloop_t *loop) {
+    if (cur_loop == loop)
+        cur_loop = NULL;
+    close(loop->wakeup.fd);
+    evuring_free(loop);
+    if (-1 != loop->fd)
+        close(loop->fd);
+    while (loop->ios)
+        evio_free(loop, loop->ios);
+    free(loop->events);
+    free(loop);
+}
+
+void evloop_stop (evloop_t *loop) {
+    uint64_t n = 1;
+    loop->is_alive = 0;
+    if (-1 == write(loop->wakeup.fd, &n, sizeof n))
+        errno = 0;
+}
+
+int ev_add (evloop_t *loop, ev_t *ev, int fd, int events, ev_h on_event, void *data) {
+    struct epoll_event e = { .events = ev_epoll_events(events), .data.ptr = ev };
+    ev->fd = fd;
+    ev->events = events;
+    ev->on_event = on_event;
+    ev->data = data;
+    ev->io = NULL;
+    if (loop->ring) {
+        // the kernel is asked at the next round
+        if (!evio_alloc(loop, ev))
+            return -1;
+        evio_dirty(loop, ev->io);
+        return 0;
+    }
+    return epoll_ctl(loop->fd, EPOLL_CTL_ADD, fd, &e);
+}
+
+int ev_mod (evloop_t *loop, ev_t *ev, int events) {
+    struct epoll_event e = { .events = ev_epoll_events(events), .data.ptr = ev };
+    if (events == ev->events)
+        return 0;
+    ev->events = events;
+    if (loop->ring) {
+        evio_dirty(loop, ev->io);
+        return 0;
+    }
+    if (ev->io)
+        return evepoll_mod(loop, ev->io);
+    return epoll_ctl(loop->fd, EPOLL_CTL_MOD, ev->fd, &e);
+}
+
+int ev_del (evloop_t *loop, ev_t *ev) {
+    evio_t *io = ev->io;
+    ev->io = NULL;
+    if (io) {
+        // queued output is dropped, the io goes when the kernel is done with it
+        io->ev = NULL;
+        if (loop->ring) {
+            evuring_cancel(loop, io, EVOP_POLL);
+            evuring_cancel(loop, io, EVOP_RECV);
+            evuring_cancel(loop, io, EVOP_ACCEPT);
+            evuring_cancel(loop, io, EVOP_SEND);
+        }
+        if (!io->inflight && !io->is_dirty)
+            evio_free(loop, io);
+        if (loop->ring)
+            return 0;
+    }
+    // ev may be freed by the caller, its pending events must not be seen
+    for (int i = loop->cur_event + 1; i < loop->nevents; ++i)
+        if (loop->events[i].data.ptr == ev)
+            loop->events[i].data.ptr = NULL;
+    return epoll_ctl(loop->fd, EPOLL_CTL_DEL, ev->fd, NULL);
+}
+
+ssize_t ev_recv (int fd, strbuf_t *buf) {
+    evloop_t *loop = cur_loop;
+    int res;
+    // watchers the loop does not receive for read themselves
+    if (!loop || !loop->ring || fd != loop->rx.fd)
+        return net_recvnb(fd, buf);
+    if (loop->rx.is_taken)
+        return 0;
+    res = loop->rx.res;
+    loop->rx.is_taken = 1;
+    if (res <= 0) {
+        errno = -res;
+        return -1;
+    }
+    if (-1 == strbufadd(buf, loop->rx.ptr, res))
+        return -1;
+    return res;
+}
+
+netout_t *ev_out (evloop_t *loop, ev_t *ev) {
+    if (!ev->io && !evio_alloc(loop, ev))
+        return NULL;
+    return &ev->io->out;
+}
+
+int ev_send (evloop_t *loop, ev_t *ev, const char *buf, size_t len) {
+    netout_t *out = ev_out(loop, ev);
+    if (!out || -1 == netout_add(out, buf, len))
+        return -1;
+    evio_dirty(loop, ev->io);
+    return 0;
+}
+
+// queued sends and watchers go to the kernel before the loop waits
+static void evloop_flush (evloop_t *loop) {
+    while (loop->dirty) {
+        evio_t *io = loop->dirty;
+        loop->dirty = io->next_dirty;
+        io->is_dirty = 0;
+        if (!io->ev) {
+            if (!io->inflight)
+                evio_free(loop, io);
+        } else
+        if (loop->ring)
+            evuring_arm(loop, io);
+        else
+            evepoll_send(loop, io);
+    }
+}
+
+/*****
+  timers
+*****/
+static void evtimer_link (evtimer_t *head, evtimer_t *timer) {
+    timer->next = head;
+    timer->prev = head->prev;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+static void evtimer_unlink (evtimer_t *timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = timer->prev = NULL;
+}
+
+static void evtimer_schedule (evloop_t *loop, evtimer_t *timer, uint64_t expire) {
+    timer->expire = expire;
+    evtimer_link(&loop->wheel[expire % EV_WHEEL_SIZE], timer);
+    ++loop->timers;
+}
+
+void evtimer_start (evloop_t *loop, evtimer_t *timer, long ms, long interval_ms, evtimer_h on_timer, void *data) {
+    if (evtimer_active(timer))
+        evtimer_stop(loop, timer);
+    timer->on_timer = on_timer;
+    timer->data = data;
+    timer->interval = interval_ms > 0 ? (interval_ms + loop->tick_ms - 1) / loop->tick_ms : 0;
+    // the current tick is partly gone, one more keeps the timer from firing early
+    evtimer_schedule(loop, timer, evloop_now(loop) + (ms + loop->tick_ms - 1) / loop->tick_ms + 1);
+}
+
+void evtimer_stop (evloop_t *loop, evtimer_t *timer) {
+    if (evtimer_active(timer)) {
+        evtimer_unlink(timer);
+        --loop->timers;
+    }
+}
+
+// every slot between the last tick and now, a slot holds all the rounds of its timers
+static void evloop_expire (evloop_t *loop) {
+    uint64_t now = evloop_now(loop), tick = loop->tick;
+    evtimer_t expired = { .next = &expired, .prev = &expired };
+    if (now == tick)
+        return;
+    if (now - tick > EV_WHEEL_SIZE)
+        tick = now - EV_WHEEL_SIZE;
+    while (tick < now) {
+        evtimer_t *head = &loop->wheel[++tick % EV_WHEEL_SIZE], *timer = head->next;
+        while (timer != head) {
+            evtimer_t *next = timer->next;
+            if (timer->expire <= now) {
+                evtimer_unlink(timer);
+                evtimer_link(&expired, timer);
+            }
+            timer = next;
+        }
+    }
+    loop->tick = now;
+    // a handler may stop any timer of the list, it is unlinked from there
+    while (expired.next != &expired) {
+        evtimer_t *timer = expired.next;
+        evtimer_unlink(timer);
+        --loop->timers;
+        // counted from the last expiry so an interval does not drift
+        if (timer->interval)
+            evtimer_schedule(loop, timer, timer->expire + timer->interval > now ? timer->expire + timer->interval : now + 1);
+        timer->on_timer(loop, timer);
+    }
+}
+
+/*****
+  rounds
+*****/
+int evloop_once (evloop_t *loop, int timeout_ms) {
+    cur_loop = loop;
+    evloop_flush(loop);
+    if (loop->timers && (timeout_ms < 0 || timeout_ms > loop->tick_ms))
+        timeout_ms = loop->tick_ms;
+    if (-1 == (loop->ring ? evuring_wait(loop, timeout_ms) : evepoll_wait(loop, timeout_ms)))
+        return -1;
+    evloop_expire(loop);
+    return 0;
+}
+
+int evloop_run (evloop_t *loop) {
+    loop->is_alive = 1;
+    while (loop->is_alive)
+        if (-1 == evloop_once(loop, -1))
+            return -1;
+    return 0;
+}
+
+/*****
+  connections
+*****/
+void evconn_close (evloop_t *loop, evconn_t *conn) {
+    evtimer_stop(loop, &conn->timer);
+    ev_del(loop, &conn->ev);
+    close(conn->ev.fd);
+    netbuf_free(&conn->nbuf);
+    free(conn);
+}
+
+// the connection of the accept completion under io_uring
+static int evloop_accept (evloop_t *loop, ev_t *ev) {
+    int fd;
+    if (!loop->ring)
+        return accept4(ev->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (ev->fd != loop->rx.fd || loop->rx.is_taken)
+        return -1;
+    fd = loop->rx.res;
+    loop->rx.is_taken = 1;
+    return fd;
+}
+
+static void on_listener (evloop_t *loop, ev_t *ev, int events) {
+    evlistener_t *listener = (evlistener_t*)ev;
+    int fd;
+    while (-1 != (fd = evloop_accept(loop, ev))) {
+        evconn_t *conn = calloc(1, sizeof(evconn_t));
+        if (!conn || -1 == netbuf_alloc(&conn->nbuf, listener->buf_len, listener->chunk_size)) {
+            if (conn) {
+                netbuf_free(&conn->nbuf);
+                free(conn);
+            }
+            close(fd);
+            continue;
+        }
+        // a connection may take a burst, chunks alone would realloc for every read
+        conn->nbuf.buf.growth = conn->nbuf.tail.growth = STR_GROW_DOUBLE;
+        conn->ev.fd = fd;
+        conn->data = listener->userdata;
+        if ((listener->on_accept && -1 == listener->on_accept(loop, conn, listener->userdata)) ||
+            -1 == ev_add(loop, &conn->ev, fd, listener->events, listener->on_event, listener->userdata)) {
+            close(fd);
+            netbuf_free(&conn->nbuf);
+            free(conn);
+        }
+    }
+}
+
+int evloop_listen (evloop_t *loop, evlistener_t *listener, int fd, int events, evconn_h on_accept, ev_h on_event, void *userdata) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (-1 == flags || -1 == fcntl(fd, F_SETFL, flags | O_NONBLOCK))
+        return -1;
+    listener->events = events & ~EV_EXCLUSIVE;
+    listener->buf_len = listener->chunk_size = NET_BUF_SIZE;
+    listener->on_accept = on_accept;
+    listener->on_event = on_event;
+    listener->userdata = userdata;
+    return ev_add(loop, &listener->ev, fd, EV_READ | EV_ACCEPT | (events & EV_EXCLUSIVE), on_listener, userdata);
+}
+
+/*****
+  acceptor group
+*****/
+evgroup_t *evgroup_alloc (int nacceptors, int flags) {
+    evgroup_t *group = calloc(1, sizeof(evgroup_t));
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (!group)
+        return NULL;
+    if (ncpus < 1)
+        ncpus = 1;
+    if (nacceptors <= 0)
+        nacceptors = ncpus;
+    if ((flags & EVLOOP_CPU_STEER))
+        flags |= EVLOOP_PIN_CPU;
+    group->flags = flags;
+    group->fd = -1;
+    if (!(group->acceptors = calloc(nacceptors, sizeof(evacceptor_t)))) {
+        free(group);
+        return NULL;
+    }
+    for (int i = 0; i < nacceptors; ++i) {
+        evacceptor_t *acc = &group->acceptors[i];
+        acc->listener.ev.fd = -1;
+        acc->cpu = (flags & EVLOOP_PIN_CPU) ? i % ncpus : -1;
+        if (!(acc->loop = evloop_alloc_flags(0, flags & EVLOOP_URING))) {
+            evgroup_free(group);
+            return NULL;
+        }
+        ++group->nacceptors;
+    }
+    return group;
+}
+
+int evgroup_listen (evgroup_t *group, const char *svc, int backlog, int events, evconn_h on_accept, ev_h on_event, void *userdata) {
+    int n = group->nacceptors, *fds = malloc(n * sizeof(int)), rc = 0;
+    if (!fds)
+        return -1;
+    if ('/' == *svc) {
+        // a unix socket has no SO_REUSEPORT group, the loops wait on one listener
+        if (-1 == (group->fd = unet_bind_backlog(svc, backlog))) {
+            free(fds);
+            return -1;
+        }
+        for (int i = 0; i < n; ++i) {
+            fds[i] = group->fd;
+            group->acceptors[i].is_shared = 1;
+        }
+        events |= EV_EXCLUSIVE;
+    } else
+    if (-1 == net_bind_group(svc, fds, n, NET_NONBLOCK | ((group->flags & EVLOOP_CPU_STEER) ? NET_CPU_STEER : 0), backlog)) {
+        free(fds);
+        return -1;
+    }
+    for (int i = 0; i < n && 0 == rc; ++i) {
+        evacceptor_t *acc = &group->acceptors[i];
+        if (-1 == (rc = evloop_listen(acc->loop, &acc->listener, fds[i], events, on_accept, on_event, userdata)))
+            acc->listener.ev.fd = -1;
+    }
+    if (-1 == rc)
+        for (int i = 0; i < n; ++i) {
+            evacceptor_t *acc = &group->acceptors[i];
+            if (-1 != acc->listener.ev.fd)
+                ev_del(acc->loop, &acc->listener.ev);
+            acc->listener.ev.fd = -1;
+            if (fds[i] != group->fd)
+                close(fds[i]);
+        }
+    free(fds);
+    return rc;
+}
+
+// under io_uring the listener is let go at once only in the thread of the loop
+static void evacceptor_free (evacceptor_t *acc) {
+    if (-1 != acc->listener.ev.fd) {
+        ev_del(acc->loop, &acc->listener.ev);
+        if (!acc->is_shared)
+            close(acc->listener.ev.fd);
+    }
+    evloop_free(acc->loop);
+}
+
+static void *evacceptor_run (evacceptor_t *acc) {
+    if (-1 != acc->cpu) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(acc->cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof set, &set);
+    }
+    evloop_run(acc->loop);
+    evacceptor_free(acc);
+    return NULL;
+}
+
+int evgroup_start (evgroup_t *group) {
+    for (int i = 0; i < group->nacceptors; ++i) {
+        evacceptor_t *acc = &group->acceptors[i];
+        if (0 != (errno = pthread_create(&acc->th, NULL, (void*(*)(void*))evacceptor_run, acc)))
+            return -1;
+        acc->is_started = 1;
+    }
+    return 0;
+}
+
+void evgroup_free (evgroup_t *group) {
+    for (int i = 0; i < group->nacceptors; ++i)
+        if (group->acceptors[i].is_started)
+            evloop_stop(group->acceptors[i].loop);
+    for (int i = 0; i < group->nacceptors; ++i) {
+        evacceptor_t *acc = &group->acceptors[i];
+        if (acc->is_started)
+            pthread_join(acc->th, NULL);
+        else
+            evacceptor_free(acc);
+    }
+    if (-1 != group->fd)
+        close(group->fd);
+    free(group->acceptors);
+    free(group);
+}
+
+/*****
+  connect pool
+*****/
+static hash_key_t on_peer_hash (void *key, size_t key_len) {
+    return hash_nstr((const char*)key, key_len);
+}
+
+static int on_peer_compare (void *x, void *y) {
+    return strcmp((const char*)x, (const char*)y);
+}
+
+static void *on_peer_copy (void *key) {
+    return strdup((const char*)key);
+}
+
+static void on_peer_free (void *key, void *value) {
+    free(key);
+    free(value);
+}
+
+// at the head, the idle one used last is taken first
+static void evpool_link (evpconn_t *conn) {
+    evpeer_t *peer = conn->peer;
+    conn->prev = NULL;
+    if ((conn->next = peer->conns))
+        peer->conns->prev = conn;
+    peer->conns = conn;
+}
+
+static void evpool_unlink (evpconn_t *conn) {
+    if (conn->next)
+        conn->next->prev = conn->prev;
+    if (conn->prev)
+        conn->prev->next = conn->next;
+    else
+        conn->peer->conns = conn->next;
+    conn->next = conn->prev = NULL;
+}
+
+static void evpool_release (evpool_t *pool, evpconn_t *conn) {
+    evtimer_stop(pool->loop, &conn->conn.timer);
+    ev_del(pool->loop, &conn->conn.ev);
+    close(conn->conn.ev.fd);
+    netbuf_free(&conn->conn.nbuf);
+    evpool_unlink(conn);
+    --conn->peer->nconns;
+    free(conn);
+}
+
+static void evpool_give (evpool_t *pool, evpconn_t *conn, ev_h on_event, evpool_h on_conn, void *userdata) {
+    conn->is_idle = 0;
+    conn->conn.ev.on_event = on_event;
+    conn->conn.ev.data = conn->conn.data = userdata;
+    on_conn(pool->loop, conn, 0, userdata);
+}
+
+// a hang up or bytes nobody asked for
+static int evpool_is_alive (evpconn_t *conn) {
+    char c;
+    return -1 == recv(conn->conn.ev.fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) && EAGAIN == errno;
+}
+
+// probes start when half of idle_ms went
+static void evpool_keepalive (evpool_t *pool, int fd) {
+    int on = 1, idle = pool->idle_ms > 2000 ? pool->idle_ms / 2000 : 1, cnt = 3;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof on);
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof idle);
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &idle, sizeof idle);
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &cnt, sizeof cnt);
+}
+
+static int evpool_connect (evpool_t *pool, evpeer_t *peer, ev_h on_event, evpool_h on_conn, void *userdata);
+
+// a free place goes to the first one waiting
+static void evpool_serve (evpool_t *pool, evpeer_t *peer) {
+    evpwait_t *w;
+    while ((w = peer->waiting) && peer->nconns < pool->max_conns) {
+        if (!(peer->waiting = w->next))
+            peer->waiting_tail = NULL;
+        if (-1 == evpool_connect(pool, peer, w->on_event, w->on_conn, w->userdata))
+            w->on_conn(pool->loop, NULL, errno, w->userdata);
+        free(w);
+    }
+}
+
+static void evpool_fail (evpool_t *pool, evpconn_t *conn, int err) {
+    evpeer_t *peer = conn->peer;
+    evpool_h on_conn = conn->on_conn;
+    void *userdata = conn->userdata;
+    evpool_release(pool, conn);
+    evpool_serve(pool, peer);
+    on_conn(pool->loop, NULL, err, userdata);
+}
+
+static void on_pconn_connected (evloop_t *loop, ev_t *ev, int events) {
+    evpconn_t *conn = (evpconn_t*)ev;
+    evpool_t *pool = conn->peer->pool;
+    socklen_t len = sizeof(int);
+    int err = 0;
+    if (-1 == getsockopt(ev->fd, SOL_SOCKET, SO_ERROR, &err, &len))
+        err = errno;
+    evtimer_stop(loop, &conn->conn.timer);
+    if (err || -1 == ev_mod(loop, ev, pool->events)) {
+        evpool_fail(pool, conn, err ? err : errno);
+        return;
+    }
+    evpool_keepalive(pool, ev->fd);
+    ++pool->connects;
+    evpool_give(pool, conn, conn->on_event, conn->on_conn, conn->userdata);
+}
+
+static void on_pconn_timeout (evloop_t *loop, evtimer_t *timer) {
+    evpconn_t *conn = (evpconn_t*)timer->data;
+    evpool_fail(conn->peer->pool, conn, ETIMEDOUT);
+}
+
+static void on_pconn_idle (evloop_t *loop, ev_t *ev, int events) {
+    evpconn_t *conn = (evpconn_t*)ev;
+    evpeer_t *peer = conn->peer;
+    evpool_release(peer->pool, conn);
+    evpool_serve(peer->pool, peer);
+}
+
+static int evpool_connect (evpool_t *pool, evpeer_t *peer, ev_h on_event, evpool_h on_conn, void *userdata) {
+    evpconn_t *conn = calloc(1, sizeof(evpconn_t));
+    int fd = -1, err;
+    if (!conn)
+        return -1;
+    if (-1 == (fd = net_connect_start(&peer->addr)) ||
+        -1 == netbuf_alloc(&conn->conn.nbuf, NET_BUF_SIZE, NET_BUF_SIZE) ||
+        -1 == ev_add(pool->loop, &conn->conn.ev, fd, EV_WRITE, on_pconn_connected, pool)) {
+        err = errno;
+        if (-1 != fd)
+            close(fd);
+        netbuf_free(&conn->conn.nbuf);
+        free(conn);
+        errno = err;
+        return -1;
+    }
+    conn->conn.nbuf.buf.growth = conn->conn.nbuf.tail.growth = STR_GROW_DOUBLE;
+    conn->peer = peer;
+    conn->on_event = on_event;
+    conn->on_conn = on_conn;
+    conn->userdata = userdata;
+    evpool_link(conn);
+    ++peer->nconns;
+    evtimer_start(pool->loop, &conn->conn.timer, pool->connect_ms, 0, on_pconn_timeout, conn);
+    return 0;
+}
+
+static int on_peer_check (hash_item_t *item, struct timespec *now) {
+    evpeer_t *peer = (evpeer_t*)item->value;
+    evpool_t *pool = peer->pool;
+    for (evpconn_t *conn = peer->conns, *next; conn; conn = next) {
+        next = conn->next;
+        if (conn->is_idle && (now->tv_sec - conn->idle_since.tv_sec) * 1000 + (now->tv_nsec - conn->idle_since.tv_nsec) / 1000000 >= pool->idle_ms)
+            evpool_release(pool, conn);
+    }
+    return ENUM_CONTINUE;
+}
+
+static void on_pool_check (evloop_t *loop, evtimer_t *timer) {
+    evpool_t *pool = (evpool_t*)timer->data;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    hash_enum(pool->peers, (hash_item_h)on_peer_check, &now, 0);
+}
+
+evpool_t *evpool_alloc (evloop_t *loop, int events, int max_conns, long idle_ms, long connect_ms) {
+    evpool_t *pool = calloc(1, sizeof(evpool_t));
+    if (!pool)
+        return NULL;
+    if (!(pool->peers = hash_alloc(HASH_GROUP, HASH_VARSIZE | HASH_OPEN, on_peer_hash, on_peer_compare, on_peer_copy, on_peer_free))) {
+        free(pool);
+        return NULL;
+    }
+    pool->loop = loop;
+    pool->events = events ? events : EV_READ | EV_RECV;
+    pool->max_conns = max_conns > 0 ? max_conns : EVPOOL_MAX_CONNS;
+    pool->idle_ms = idle_ms > 0 ? idle_ms : EVPOOL_IDLE_MS;
+    pool->connect_ms = connect_ms > 0 ? connect_ms : EVPOOL_CONNECT_MS;
+    evtimer_start(loop, &pool->check, pool->idle_ms / 2 > 0 ? pool->idle_ms / 2 : 1, pool->idle_ms / 2 > 0 ? pool->idle_ms / 2 : 1,
+        on_pool_check, pool);
+    return pool;
+}
+
+int evpool_get (evpool_t *pool, const char *host, const char *service, ev_h on_event, evpool_h on_conn, void *userdata) {
+    size_t host_len = strlen(host), service_len = strlen(service);
+    char key [host_len + service_len + 2];
+    hash_item_t *item;
+    evpeer_t *peer;
+    evpwait_t *w;
+    memcpy(key, host, host_len);
+    key[host_len] = ':';
+    memcpy(key + host_len + 1, service, service_len + 1);
+    if ((item = hash_get(pool->peers, key, sizeof(key) - 1)))
+        peer = (evpeer_t*)item->value;
+    else {
+        if (!(peer = calloc(1, sizeof(evpeer_t))))
+            return -1;
+        if (-1 == net_resolve(host, service, &peer->addr) || !(item = hash_add(pool->peers, key, sizeof(key) - 1))) {
+            free(peer);
+            return -1;
+        }
+        peer->pool = pool;
+        item->value = peer;
+    }
+    for (evpconn_t *conn = peer->conns, *next; conn; conn = next) {
+        next = conn->next;
+        if (!conn->is_idle)
+            continue;
+        if (evpool_is_alive(conn)) {
+            ++pool->reuses;
+            evpool_give(pool, conn, on_event, on_conn, userdata);
+            return 0;
+        }
+        evpool_release(pool, conn);
+    }
+    if (peer->nconns < pool->max_conns)
+        return evpool_connect(pool, peer, on_event, on_conn, userdata);
+    if (!(w = calloc(1, sizeof(evpwait_t))))
+        return -1;
+    w->on_event = on_event;
+    w->on_conn = on_conn;
+    w->userdata = userdata;
+    if (peer->waiting_tail)
+        peer->waiting_tail->next = w;
+    else
+        peer->waiting = w;
+    peer->waiting_tail = w;
+    return 0;
+}
+
+void evpool_put (evpool_t *pool, evpconn_t *conn) {
+    evpeer_t *peer = conn->peer;
+    evpwait_t *w;
+    conn->conn.nbuf.buf.len = conn->conn.nbuf.tail.len = 0;
+    if ((w = peer->waiting)) {
+        ev_h on_event = w->on_event;
+        evpool_h on_conn = w->on_conn;
+        void *userdata = w->userdata;
+        if (!(peer->waiting = w->next))
+            peer->waiting_tail = NULL;
+        free(w);
+        ++pool->reuses;
+        evpool_give(pool, conn, on_event, on_conn, userdata);
+        return;
+    }
+    conn->is_idle = 1;
+    conn->conn.ev.on_event = on_pconn_idle;
+    conn->conn.ev.data = conn->conn.data = pool;
+    clock_gettime(CLOCK_MONOTONIC, &conn->idle_since);
+    evpool_unlink(conn);
+    evpool_link(conn);
+}
+
+void evpool_close (evpool_t *pool, evpconn_t *conn) {
+    evpeer_t *peer = conn->peer;
+    evpool_release(pool, conn);
+    evpool_serve(pool, peer);
+}
+
+static int on_peer_free_conns (hash_item_t *item, evpool_t *pool) {
+    evpeer_t *peer = (evpeer_t*)item->value;
+    while (peer->conns)
+        evpool_release(pool, peer->conns);
+    while (peer->waiting) {
+        evpwait_t *w = peer->waiting;
+        peer->waiting = w->next;
+        free(w);
+    }
+    return ENUM_CONTINUE;
+}
+
+void evpool_free (evpool_t *pool) {
+    evtimer_stop(pool->loop, &pool->check);
+    hash_enum(pool->peers, (hash_item_h)on_peer_free_conns, pool, 0);
+    hash_free(pool->peers);
+    free(pool);
+}
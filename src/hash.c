@@ -1,95 +1,551 @@
 #include "hash.h"
 
-hash_key_t hash_str (const char *s, size_t dummy) {
-    hash_key_t hash = 0;
-    while (*s) {
-        hash += *s;
-        hash += (hash << 10);
-        hash ^= (hash >> 6);
-        ++s;
-    }
-    hash += (hash << 2);
-    hash ^= (hash >> 11);
-    hash += (hash << 15);
-    return hash;
+/*************************************************************************************
+  hash functions
+*************************************************************************************/
+
+#define WY_P0 0xa0761d6478bd642fULL
+#define WY_P1 0xe7037ed1a0b428dbULL
+#define WY_P2 0x8ebc6af09c88c6e3ULL
+#define WY_P3 0x589965cc75374cc3ULL
+
+static inline void wy_mum (uint64_t *a, uint64_t *b) {
+    #ifdef __SIZEOF_INT128__
+    __uint128_t r = *a;
+    r *= *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+    #else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b,
+             rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb, t = rl + (rm0 << 32), c = t < rl, lo, hi;
+    lo = t + (rm1 << 32);
+    c += lo < t;
+    hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    *a = lo;
+    *b = hi;
+    #endif
+}
+
+static inline uint64_t wy_mix (uint64_t a, uint64_t b) {
+    wy_mum(&a, &b);
+    return a ^ b;
+}
+
+static inline uint64_t wy_r8 (const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t wy_r4 (const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t wy_r3 (const uint8_t *p, size_t len) {
+    return ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+}
+
+hash_key_t hash_seed_nstr (const char *s, size_t len, uint64_t seed) {
+    const uint8_t *p = (const uint8_t*)s;
+    uint64_t a, b;
+    seed ^= wy_mix(seed ^ WY_P0, WY_P1);
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (wy_r4(p) << 32) | wy_r4(p + ((len >> 3) << 2));
+            b = (wy_r4(p + len - 4) << 32) | wy_r4(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = wy_r3(p, len);
+            b = 0;
+        } else
+            a = b = 0;
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = wy_mix(wy_r8(p) ^ WY_P1, wy_r8(p + 8) ^ seed);
+                see1 = wy_mix(wy_r8(p + 16) ^ WY_P2, wy_r8(p + 24) ^ see1);
+                see2 = wy_mix(wy_r8(p + 32) ^ WY_P3, wy_r8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = wy_mix(wy_r8(p) ^ WY_P1, wy_r8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        a = wy_r8(p + i - 16);
+        b = wy_r8(p + i - 8);
+    }
+    a ^= WY_P1;
+    b ^= seed;
+    wy_mum(&a, &b);
+    return (hash_key_t)wy_mix(a ^ WY_P0 ^ len, b ^ WY_P1);
+}
+
+hash_key_t hash_seed_str (const char *s, size_t len, uint64_t seed) {
+    return hash_seed_nstr(s, len ? len : strlen(s), seed);
+}
+
+hash_key_t hash_str (const char *s, size_t len) {
+    return hash_seed_nstr(s, len ? len : strlen(s), 0);
 }
 
 hash_key_t hash_nstr (const char *s, size_t len) {
-    hash_key_t hash = 0;
-    for (size_t i = 0; i < len; ++i) {
-        hash += s[i];
-        hash += (hash << 10);
-        hash ^= (hash >> 6);
-    }
-    hash += (hash << 2);
-    hash ^= (hash >> 11);
-    hash += (hash << 15);
-    return hash;
+    return hash_seed_nstr(s, len, 0);
 }
 
+static uint64_t splitmix64 (uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+uint64_t hash_random_seed () {
+    static uint64_t base = 0, counter = 0;
+    uint64_t b = __atomic_load_n(&base, __ATOMIC_RELAXED);
+    if (0 == b) {
+        #ifndef __WIN32__
+        if (sizeof(b) != getrandom(&b, sizeof(b), GRND_NONBLOCK))
+        #endif
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            b = splitmix64((uint64_t)ts.tv_sec ^ ((uint64_t)ts.tv_nsec << 20) ^ (uintptr_t)&b);
+        }
+        b |= 1;
+        __atomic_store_n(&base, b, __ATOMIC_RELAXED);
+    }
+    return splitmix64(b + __atomic_add_fetch(&counter, 0x9e3779b97f4a7c15ULL, __ATOMIC_RELAXED));
+}
+
+static inline hash_key_t hash_calc (hash_t *hash, void *key, size_t key_len) {
+    if (hash->on_hash_seed)
+        return hash->on_hash_seed(key, key_len, hash->seed);
+    return hash->on_hash(key, key_len);
+}
+
+/*************************************************************************************
+  open addressing
+*************************************************************************************/
+
+#define OA_MAX_LOAD(cap) ((cap) - (cap) / 8)
+
+#if __SSE2__
+#include <emmintrin.h>
+#define GROUP_SHIFT 0
+typedef uint32_t group_mask_t;
+
+static inline group_mask_t group_match (const uint8_t *ctrl, uint8_t h2) {
+    __m128i g = _mm_loadu_si128((const __m128i*)ctrl);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(h2)));
+}
+
+static inline group_mask_t group_empty (const uint8_t *ctrl) {
+    __m128i g = _mm_loadu_si128((const __m128i*)ctrl);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)HASH_CTRL_EMPTY)));
+}
+
+static inline group_mask_t group_free (const uint8_t *ctrl) {
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)ctrl));
+}
+#else
+#define GROUP_SHIFT 3
+#define LSB 0x0101010101010101ULL
+#define MSB 0x8080808080808080ULL
+typedef uint64_t group_mask_t;
+
+static inline uint64_t group_load (const uint8_t *ctrl) {
+    uint64_t g;
+    memcpy(&g, ctrl, sizeof(g));
+    #if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    g = __builtin_bswap64(g);
+    #endif
+    return g;
+}
+
+// may report false positives next to a real match, callers compare keys anyway
+static inline group_mask_t group_match (const uint8_t *ctrl, uint8_t h2) {
+    uint64_t x = group_load(ctrl) ^ (LSB * h2);
+    return (x - LSB) & ~x & MSB;
+}
+
+static inline group_mask_t group_empty (const uint8_t *ctrl) {
+    uint64_t g = group_load(ctrl);
+    return g & ~(g << 6) & MSB;
+}
+
+static inline group_mask_t group_free (const uint8_t *ctrl) {
+    return group_load(ctrl) & MSB;
+}
+#endif
+
+#define GROUP_NEXT(m) ((m) &= (m) - 1)
+#define GROUP_FIRST(m) (__builtin_ctzll(m) >> GROUP_SHIFT)
+
+static inline hash_key_t oa_mix (hash_key_t h) {
+    uint64_t x = h;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return (hash_key_t)x;
+}
+
+static inline void oa_set_ctrl (hash_t *hash, hash_key_t i, uint8_t c) {
+    hash->ctrl[i] = c;
+    if (i < HASH_GROUP)
+        hash->ctrl[hash->size + i] = c;
+}
+
+static hash_key_t oa_capacity (hash_key_t n) {
+    hash_key_t cap = HASH_GROUP;
+    while (cap < n && cap < ((hash_key_t)1 << (sizeof(hash_key_t) * 8 - 2)))
+        cap <<= 1;
+    return cap;
+}
+
+static int oa_alloc (hash_t *hash, hash_key_t cap) {
+    uint8_t *ctrl = malloc(cap + HASH_GROUP);
+    hash_item_t *items = malloc(cap * sizeof(hash_item_t));
+    if (!ctrl || !items) {
+        free(ctrl);
+        free(items);
+        return -1;
+    }
+    memset(ctrl, HASH_CTRL_EMPTY, cap + HASH_GROUP);
+    hash->ctrl = ctrl;
+    hash->items = items;
+    hash->size = cap;
+    hash->used_size = 0;
+    return 0;
+}
+
+static hash_key_t oa_find_free (hash_t *hash, hash_key_t h) {
+    hash_key_t mask = hash->size - 1, pos = (h >> 7) & mask, step = 0;
+    while (1) {
+        group_mask_t m = group_free(hash->ctrl + pos);
+        if (m)
+            return (pos + GROUP_FIRST(m)) & mask;
+        step += HASH_GROUP;
+        pos = (pos + step) & mask;
+    }
+}
+
+static int oa_rehash (hash_t *hash, hash_key_t cap) {
+    uint8_t *ctrl = hash->ctrl;
+    hash_item_t *items = hash->items;
+    hash_key_t size = hash->size;
+    if (-1 == oa_alloc(hash, cap)) {
+        hash->ctrl = ctrl;
+        hash->items = items;
+        errno = ENOMEM;
+        return -1;
+    }
+    for (hash_key_t i = 0; i < size; ++i)
+        if (HASH_CTRL_ISFULL(ctrl[i])) {
+            hash_key_t j = oa_find_free(hash, items[i].idx);
+            oa_set_ctrl(hash, j, items[i].idx & 0x7f);
+            hash->items[j] = items[i];
+        }
+    hash->used_size = hash->len;
+    free(ctrl);
+    free(items);
+    return 0;
+}
+
+static hash_item_t *oa_get (hash_t *hash, void *key, size_t key_len) {
+    hash_key_t h = oa_mix(hash_calc(hash, key, key_len)),
+               mask = hash->size - 1, pos = (h >> 7) & mask, step = 0;
+    uint8_t h2 = h & 0x7f;
+    while (1) {
+        const uint8_t *g = hash->ctrl + pos;
+        group_mask_t m = group_match(g, h2);
+        while (m) {
+            hash_item_t *hi = &hash->items[(pos + GROUP_FIRST(m)) & mask];
+            if (hi->idx == h && 0 == hash->on_compare(hi->key, key))
+                return hi;
+            GROUP_NEXT(m);
+        }
+        if (group_empty(g))
+            return NULL;
+        step += HASH_GROUP;
+        if (step > hash->size)
+            return NULL;
+        pos = (pos + step) & mask;
+    }
+}
+
+static hash_item_t *oa_add (hash_t *hash, void *key, size_t key_len) {
+    hash_key_t h = oa_mix(hash_calc(hash, key, key_len)), i;
+    hash_item_t *hi;
+    errno = 0;
+    if ((hi = oa_get(hash, key, key_len))) {
+        errno = EEXIST;
+        return hi;
+    }
+    // a tombstone on the way is taken as it is, only an empty slot adds to the load
+    i = oa_find_free(hash, h);
+    if (HASH_CTRL_EMPTY == hash->ctrl[i] && hash->used_size + 1 > OA_MAX_LOAD(hash->size)) {
+        hash_key_t cap = hash->size;
+        if (HASH_VARSIZE == HASH_SIZETYPE(hash->type) && hash->len + 1 > OA_MAX_LOAD(cap) / 2 && cap < hash->max_size)
+            cap <<= 1;
+        else
+        if (hash->len + 1 > OA_MAX_LOAD(cap)) {
+            errno = ENOSPC;
+            return NULL;
+        }
+        // in place only when tombstones take a sixteenth of the table, a few of them do not pay
+        // for the pass; until then the load goes on over OA_MAX_LOAD, a sixteenth stays empty
+        if (cap != hash->size || hash->used_size - hash->len >= cap / 16) {
+            if (-1 == oa_rehash(hash, cap))
+                return NULL;
+            errno = ERANGE;
+            i = oa_find_free(hash, h);
+        }
+    }
+    if (HASH_CTRL_EMPTY == hash->ctrl[i])
+        ++hash->used_size;
+    oa_set_ctrl(hash, i, h & 0x7f);
+    hi = &hash->items[i];
+    memset(hi, 0, sizeof(hash_item_t));
+    if (hash->on_copy)
+        hi->key = hash->on_copy(key);
+    hi->key_len = key_len;
+    hi->idx = h;
+    hash->len++;
+    return hi;
+}
+
+static void oa_del (hash_t *hash, void *key, size_t key_len) {
+    hash_item_t *hi = oa_get(hash, key, key_len);
+    if (hi) {
+        oa_set_ctrl(hash, hi - hash->items, HASH_CTRL_DELETED);
+        --hash->len;
+        if (hash->on_free)
+            hash->on_free(hi->key, hi->value);
+    }
+}
+
+static void oa_free (hash_t *hash) {
+    if (hash->on_free)
+        for (hash_key_t i = 0; i < hash->size; ++i)
+            if (HASH_CTRL_ISFULL(hash->ctrl[i]))
+                hash->on_free(hash->items[i].key, hash->items[i].value);
+    free(hash->ctrl);
+    free(hash->items);
+    free(hash);
+}
+
+static void oa_enum (hash_t *hash, hash_item_h on_item, void *userdata, int flags) {
+    for (hash_key_t i = 0; i < hash->size; ++i)
+        if (HASH_CTRL_ISFULL(hash->ctrl[i]) && ENUM_BREAK == on_item(&hash->items[i], userdata) && ENUM_STOP_IF_BREAK == flags)
+            return;
+}
+
+/*************************************************************************************
+  hash
+*************************************************************************************/
+
 hash_t *hash_alloc (hash_key_t hash_buf_size, hash_type_t type, calc_h on_hash, compare_h on_compare, copy_h on_copy, free_h on_free) {
-    list_t **ptr = calloc(hash_buf_size, sizeof(list_t*));
-    if (!ptr)
-        return NULL;
     hash_t *hash = calloc(1, sizeof(hash_t));
-    if (hash_buf_size < MIN_HASH_SIZE)
-        hash_buf_size = MIN_HASH_SIZE;
-    hash->size = hash_buf_size;
+    if (!hash)
+        return NULL;
+    if ((type & HASH_OPEN)) {
+        if (-1 == oa_alloc(hash, oa_capacity(hash_buf_size))) {
+            free(hash);
+            return NULL;
+        }
+    } else {
+        if (hash_buf_size < MIN_HASH_SIZE)
+            hash_buf_size = MIN_HASH_SIZE;
+        if (!(hash->ptr = calloc(hash_buf_size, sizeof(list_t*)))) {
+            free(hash);
+            return NULL;
+        }
+        hash->size = hash_buf_size;
+        // bucket and history nodes share one slab
+        if (!(hash->slab = slab_alloc(sizeof(list_item_t))) || !(hash->hist = lst_alloc_slab(NULL, hash->slab))) {
+            slab_free(hash->slab);
+            free(hash->ptr);
+            free(hash);
+            return NULL;
+        }
+    }
     hash->max_size = MAX_HASH_SIZE;
-    hash->used_size = 0;
-    hash->inc_size = 0;
-    hash->dec_size = 0;
-    hash->ptr = ptr;
     hash->on_hash = on_hash;
+    hash->seed = hash_random_seed();
     hash->on_compare = on_compare;
     hash->on_copy = on_copy;
     hash->on_free = on_free;
-    hash->hist = lst_alloc(NULL);
     hash->type = type;
     return hash;
 }
 
+int hash_set_seed (hash_t *hash, calc_seed_h on_hash_seed, uint64_t seed) {
+    // the items are where the old hashes put them
+    if (hash->len > 0) {
+        errno = EBUSY;
+        return -1;
+    }
+    hash->on_hash_seed = on_hash_seed;
+    if (seed)
+        hash->seed = seed;
+    return 0;
+}
+
 void hash_set_max_size (hash_t *hash, hash_key_t max_size) {
     if (max_size > hash->size)
         hash->max_size = max_size;
 }
 
-void hash_free (hash_t *hash) {
-    for (hash_key_t i = 0; i < hash->size; ++i) {
-        list_t *bucket = hash->ptr[i];
+static void free_buckets (hash_t *hash, list_t **ptr, hash_key_t size) {
+    for (hash_key_t i = 0; i < size; ++i) {
+        list_t *bucket = ptr[i];
         if (bucket) {
             list_item_t *li = bucket->head;
-            if (li && hash->on_free)
+            if (li)
                 do {
                     hash_item_t *hi = (hash_item_t*)li->ptr;
-                    hash->on_free(hi->key, hi->value);
+                    if (hash->on_free)
+                        hash->on_free(hi->key, hi->value);
                     free(hi);
                     li = li->next;
                 } while (li != bucket->head);
             lst_free(bucket);
         }
     }
+    free(ptr);
+}
+
+void hash_free (hash_t *hash) {
+    if (HASH_ISOPEN(hash)) {
+        oa_free(hash);
+        return;
+    }
+    free_buckets(hash, hash->ptr, hash->size);
+    if (hash->old_ptr)
+        free_buckets(hash, hash->old_ptr, hash->old_size);
     lst_free(hash->hist);
-    free(hash->ptr);
+    slab_free(hash->slab);
     free(hash);
 }
 
+static list_item_t *bucket_get (hash_t *hash, list_t *bucket, void *key) {
+    list_item_t *li;
+    if (bucket && (li = bucket->head))
+        do {
+            if (0 == hash->on_compare(((hash_item_t*)li->ptr)->key, key))
+                return li;
+            li = li->next;
+        } while (li != bucket->head);
+    return NULL;
+}
+
+static list_item_t *chain_find (hash_t *hash, hash_key_t h, void *key) {
+    list_t **s = &hash->ptr[h % hash->size];
+    list_item_t *li;
+    if (!(li = bucket_get(hash, *s, key)) && hash->old_ptr && h % hash->old_size >= hash->rehash_idx) {
+        s = &hash->old_ptr[h % hash->old_size];
+        li = bucket_get(hash, *s, key);
+    }
+    return li;
+}
+
+static list_t **chain_slot (hash_t *hash, hash_item_t *hi) {
+    list_t **s = &hash->ptr[hi->idx % hash->size];
+    if (*s != hi->b_node->list)
+        s = &hash->old_ptr[hi->idx % hash->old_size];
+    return s;
+}
+
+static void chain_remove (hash_t *hash, hash_item_t *hi) {
+    list_t **slot = chain_slot(hash, hi);
+    lst_del(hi->b_node);
+    lst_del(hi->h_node);
+    if (0 == (*slot)->len) {
+        lst_free(*slot);
+        *slot = NULL;
+        if (slot >= hash->ptr && slot < hash->ptr + hash->size)
+            --hash->used_size;
+    }
+    --hash->len;
+    if (hash->on_free)
+        hash->on_free(hi->key, hi->value);
+    free(hi);
+}
+
+static list_t *chain_bucket (hash_t *hash, hash_key_t h) {
+    list_t **s = &hash->ptr[h % hash->size];
+    if (!*s && (*s = lst_alloc_slab(NULL, hash->slab)))
+        ++hash->used_size;
+    return *s;
+}
+
+// n items at most, -1 if one could not be moved and stays where it is
+static int rehash_step (hash_t *hash, hash_key_t n) {
+    hash_key_t empty_visits = n * 8;
+    while (n > 0 && hash->rehash_idx < hash->old_size) {
+        list_t *bucket = hash->old_ptr[hash->rehash_idx];
+        if (bucket) {
+            while (n > 0 && bucket->head) {
+                list_item_t *li = bucket->head->prev;
+                list_t *dst = chain_bucket(hash, ((hash_item_t*)li->ptr)->idx);
+                if (!dst || !lst_move(li, dst))
+                    return -1;
+                --n;
+            }
+            if (bucket->head)
+                break;
+            lst_free(bucket);
+            hash->old_ptr[hash->rehash_idx] = NULL;
+        } else
+        if (0 == --empty_visits)
+            n = 0;
+        ++hash->rehash_idx;
+    }
+    if (hash->rehash_idx >= hash->old_size) {
+        free(hash->old_ptr);
+        hash->old_ptr = NULL;
+        hash->old_size = hash->rehash_idx = 0;
+    } else {
+        // the next step starts with what it moves in the cache
+        list_t *bucket = hash->old_ptr[hash->rehash_idx];
+        if (bucket && bucket->head) {
+            list_item_t *li = bucket->head->prev;
+            __builtin_prefetch(li->ptr);
+        } else
+        if (hash->rehash_idx + 1 < hash->old_size && (bucket = hash->old_ptr[hash->rehash_idx + 1]))
+            __builtin_prefetch(bucket);
+    }
+    return 0;
+}
+
+// the old table is gone when it returns 0
+static int rehash_all (hash_t *hash) {
+    while (hash->old_ptr)
+        if (-1 == rehash_step(hash, hash->old_size + hash->len))
+            return -1;
+    return 0;
+}
+
 hash_item_t *hash_get (hash_t *hash, void *key, size_t key_len) {
-    hash_key_t idx = hash->on_hash(key, key_len) % hash->size;
-    list_t *bucket = hash->ptr[idx];
-    if (bucket) {
-        list_item_t *li = bucket->head;
-        if (li) {
-            do {
-                hash_item_t *hi = (hash_item_t*)li->ptr;
-                if (0 == hash->on_compare(hi->key, key)) {
-                    lst_del(hi->h_node);
-                    hi->h_node = lst_add(hash->hist, hi);
-                    return hi;
-                }
-                li = li->next;
-            } while (li != bucket->head);
-        }
+    if (HASH_ISOPEN(hash))
+        return oa_get(hash, key, key_len);
+    if (hash->old_ptr)
+        rehash_step(hash, HASH_REHASH_STEP);
+    list_item_t *li = chain_find(hash, hash_calc(hash, key, key_len), key);
+    if (li) {
+        hash_item_t *hi = (hash_item_t*)li->ptr;
+        lst_del(hi->h_node);
+        hi->h_node = lst_add(hash->hist, hi);
+        return hi;
     }
     return NULL;
 }
@@ -104,85 +560,73 @@ double hash_param_conflict (hash_t *hash) {
     return used_size / len;
 }
 
-static int on_reuse_item (list_item_t *li, hash_t *hash) {
-    hash_item_t *hi = (hash_item_t*)li->ptr;
-    list_t *bucket;
-    hi->idx = hash->on_hash(hi->key, hi->key_len);
-    if (!(bucket = hash->ptr[hi->idx]))
-        bucket = hash->ptr[hi->idx] = lst_alloc(NULL);
-    hi->b_node = lst_add(bucket, hi);
-    return ENUM_CONTINUE;
-}
-
 void hash_resize (hash_t *hash, int32_t grow) {
-    errno = ERANGE;
-    for (hash_key_t i = 0; i < hash->size; ++i) {
-        list_t *bucket = hash->ptr[i];
-        if (bucket)
-            lst_free(bucket);
+    if (HASH_ISOPEN(hash)) {
+        hash_key_t cap = oa_capacity(hash->size + grow);
+        while (OA_MAX_LOAD(cap) < hash->len)
+            cap <<= 1;
+        if (0 == oa_rehash(hash, cap))
+            errno = ERANGE;
+        return;
     }
-    hash_key_t newsize = hash->size + grow,
-               newbufsize = newsize * sizeof(list_t*);
-    list_t **ptr = realloc(hash->ptr, newbufsize);
-    if (ptr) {
-        hash->ptr = ptr;
-        hash->size = newsize;
-    } else
+    if (-1 == rehash_all(hash)) {
+        errno = ENOMEM;
+        return;
+    }
+    hash_key_t newsize = hash->size + grow;
+    list_t **ptr = calloc(newsize, sizeof(list_t*));
+    if (!ptr) {
+        errno = ENOMEM;
+        return;
+    }
+    hash->old_ptr = hash->ptr;
+    hash->old_size = hash->size;
+    hash->rehash_idx = 0;
+    hash->ptr = ptr;
+    hash->size = newsize;
+    hash->used_size = 0;
+    if (!(hash->type & HASH_INCREMENTAL) && -1 == rehash_all(hash)) {
         errno = ENOMEM;
-    memset(hash->ptr, 0, newbufsize);
-    lst_enum(hash->hist, (list_item_h)on_reuse_item, hash, 0);
+        return;
+    }
+    errno = ERANGE;
 }
 
 hash_item_t *hash_add (hash_t *hash, void *key, size_t key_len) {
+    if (HASH_ISOPEN(hash))
+        return oa_add(hash, key, key_len);
     hash_item_t *hi = NULL;
-    hash_key_t idx = hash->on_hash(key, key_len) % hash->size;
-    errno = 0;
+    hash_key_t h = hash_calc(hash, key, key_len);
     list_item_t *li;
-    list_t *bucket = hash->ptr[idx];
-    if (bucket) {
-        li = bucket->head;
-        if (li) {
-            do {
-                hash_item_t *hi = (hash_item_t*)li->ptr;
-                if (0 == hash->on_compare(hi->key, key)) {
-                    errno = EEXIST;
-                    return hi;
-                }
-                li = li->next;
-            } while (li != bucket->head);
-        }
-    } else {
-        hash->ptr[idx] = bucket = lst_alloc(NULL);
-        ++hash->used_size;
+    list_t *bucket;
+    if (hash->old_ptr)
+        rehash_step(hash, HASH_REHASH_STEP);
+    errno = 0;
+    if ((li = chain_find(hash, h, key))) {
+        errno = EEXIST;
+        return (hash_item_t*)li->ptr;
     }
     if (!(hi = calloc(1, sizeof(hash_item_t))))
         return NULL;
     if (hash->on_copy)
         hi->key = hash->on_copy(key);
     hi->key_len = key_len;
-    hi->idx = idx;
+    hi->idx = h;
+    if (!(bucket = chain_bucket(hash, h))) {
+        free(hi);
+        return NULL;
+    }
     hi->b_node = lst_add(bucket, hi);
     hi->h_node = lst_add(hash->hist, hi);
     hash->len++;
-    switch (hash->type) {
+    switch (HASH_SIZETYPE(hash->type)) {
         case HASH_VARSIZE:
-            if (hash->inc_size && hash->used_size / hash->size > INC_THRESHOLD && hash->max_size > 0 && hash->max_size - hash->inc_size > hash->size)
+            if (hash->inc_size && !hash->old_ptr && (double)hash->used_size / hash->size > INC_THRESHOLD && hash->max_size > 0 && hash->max_size - hash->inc_size > hash->size)
                 hash_resize(hash, hash->inc_size);
             break;
         case HASH_CONSTSIZE:
-            if (hash->used_size / hash->size > INC_THRESHOLD && hash->max_size > 0 && hash->max_size - hash->inc_size > hash->size && hash->hist->head && (li = hash->hist->head->prev)) {
-                hash_item_t *dhi = (hash_item_t*)li->ptr;
-                lst_del(dhi->b_node);
-                lst_del(dhi->h_node);
-                bucket = hash->ptr[idx];
-                if (0 == bucket->len) {
-                    lst_free(bucket);
-                    hash->ptr[idx] = NULL;
-                    --hash->used_size;
-                }
-                if (hash->on_free)
-                    hash->on_free(dhi->key, dhi->value);
-                free(dhi);
+            if ((double)hash->used_size / hash->size > INC_THRESHOLD && hash->len > 1) {
+                chain_remove(hash, (hash_item_t*)hash->hist->head->prev->ptr);
                 errno = ERANGE;
             }
     }
@@ -190,33 +634,18 @@ hash_item_t *hash_add (hash_t *hash, void *key, size_t key_len) {
 }
 
 void hash_del (hash_t *hash, void *key, size_t key_len) {
-    hash_key_t idx = hash->on_hash(key, key_len) % hash->size;
-    list_t *bucket = hash->ptr[idx];
-    if (bucket) {
-        list_item_t *li = bucket->head;
-        if (li) {
-            do {
-                hash_item_t *hi = (hash_item_t*)li->ptr;
-                if (0 == hash->on_compare(hi->key, key)) {
-                    lst_del(hi->h_node);
-                    lst_del(li);
-                    --hash->len;
-                    if (hash->on_free)
-                        hash->on_free(hi->key, hi->value);
-                    free(hi);
-                    break;
-                }
-                li = li->next;
-            } while (li != bucket->head);
-        }
-        if (0 == bucket->len) {
-            lst_free(bucket);
-            hash->ptr[idx] = NULL;
-            --hash->used_size;
-        }
-        switch (hash->type) {
+    if (HASH_ISOPEN(hash)) {
+        oa_del(hash, key, key_len);
+        return;
+    }
+    list_item_t *li;
+    if (hash->old_ptr)
+        rehash_step(hash, HASH_REHASH_STEP);
+    if ((li = chain_find(hash, hash_calc(hash, key, key_len), key))) {
+        chain_remove(hash, (hash_item_t*)li->ptr);
+        switch (HASH_SIZETYPE(hash->type)) {
             case HASH_VARSIZE:
-                if (hash->dec_size && hash->used_size / hash->size < DEC_THRESHOLD && hash->size - hash->dec_size > MIN_HASH_SIZE)
+                if (hash->dec_size && !hash->old_ptr && (double)hash->used_size / hash->size < DEC_THRESHOLD && hash->size - hash->dec_size > MIN_HASH_SIZE)
                     hash_resize(hash, -hash->dec_size);
                 break;
             default:
@@ -240,6 +669,10 @@ static int on_hash_enum (list_item_t *li, hash_enum_t *he) {
 }
 
 void hash_enum (hash_t *hash, hash_item_h on_item, void *userdata, int flags) {
+    if (HASH_ISOPEN(hash)) {
+        oa_enum(hash, on_item, userdata, flags);
+        return;
+    }
     hash_enum_t he = { .on_item = on_item, .userdata = userdata, .flags = flags };
     lst_enum(hash->hist, (list_item_h)on_hash_enum, (void*)&he, flags);
 }
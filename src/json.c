@@ -1,63 +1,242 @@
+#include <float.h>
+#include <math.h>
 #include "json.h"
 
 enum { JSON_OK, JSON_FIN, JSON_ERROR };
 __thread char *json_error_msg = NULL;
-const char *delims = "{}[],:";
 
 size_t json_prefix_len = 0;
 char json_prefix = ' ';
 
+/*************************************************************************************
+  structural index
+*************************************************************************************/
+
+#define JSON_CQUOTE 0x01
+#define JSON_CESCAPE 0x02
+#define JSON_COP 0x04
+#define JSON_CSPACE 0x08
+
+static const uint8_t json_class [256] = {
+    ['"'] = JSON_CQUOTE, ['\\'] = JSON_CESCAPE,
+    ['{'] = JSON_COP, ['}'] = JSON_COP, ['['] = JSON_COP, [']'] = JSON_COP, [','] = JSON_COP, [':'] = JSON_COP,
+    [' '] = JSON_CSPACE, ['\t'] = JSON_CSPACE, ['\n'] = JSON_CSPACE, ['\r'] = JSON_CSPACE
+};
+
+typedef struct {
+    uint64_t quote;
+    uint64_t escape;
+    uint64_t op;
+    uint64_t space;
+} json_masks_t;
+
+#if !__SSE2__
+static inline __attribute__((always_inline)) void classify_scalar (const uint8_t *p, json_masks_t *m) {
+    uint64_t quote = 0, escape = 0, op = 0, space = 0;
+    for (int i = 0; i < 64; ++i) {
+        uint64_t c = json_class[p[i]], bit = 1ULL << i;
+        if (c & JSON_CQUOTE) quote |= bit;
+        if (c & JSON_CESCAPE) escape |= bit;
+        if (c & JSON_COP) op |= bit;
+        if (c & JSON_CSPACE) space |= bit;
+    }
+    m->quote = quote;
+    m->escape = escape;
+    m->op = op;
+    m->space = space;
+}
+#else
+#include <emmintrin.h>
+
+static inline __attribute__((always_inline)) void classify_sse2 (const uint8_t *p, json_masks_t *m) {
+    uint64_t quote = 0, escape = 0, op = 0, space = 0;
+    for (int i = 0; i < 4; ++i) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i * 16)),
+                // '[' and ']' differ from '{' and '}' only in bit 0x20
+                b = _mm_or_si128(v, _mm_set1_epi8(0x20)),
+                o = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(b, _mm_set1_epi8('{')), _mm_cmpeq_epi8(b, _mm_set1_epi8('}'))),
+                    _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(',')), _mm_cmpeq_epi8(v, _mm_set1_epi8(':')))),
+                s = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+                    _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+        quote |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('"'))) << (i * 16);
+        escape |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))) << (i * 16);
+        op |= (uint64_t)(uint16_t)_mm_movemask_epi8(o) << (i * 16);
+        space |= (uint64_t)(uint16_t)_mm_movemask_epi8(s) << (i * 16);
+    }
+    m->quote = quote;
+    m->escape = escape;
+    m->op = op;
+    m->space = space;
+}
+#endif
+
+#if __x86_64__ || __i386__
+#include <immintrin.h>
+#define JSON_HAVE_AVX2 1
+
+static inline __attribute__((always_inline, target("avx2"))) void classify_avx2 (const uint8_t *p, json_masks_t *m) {
+    uint64_t quote = 0, escape = 0, op = 0, space = 0;
+    for (int i = 0; i < 2; ++i) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + i * 32)),
+                b = _mm256_or_si256(v, _mm256_set1_epi8(0x20)),
+                o = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(b, _mm256_set1_epi8('{')), _mm256_cmpeq_epi8(b, _mm256_set1_epi8('}'))),
+                    _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(',')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(':')))),
+                s = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+                    _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))));
+        quote |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'))) << (i * 32);
+        escape |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))) << (i * 32);
+        op |= (uint64_t)(uint32_t)_mm256_movemask_epi8(o) << (i * 32);
+        space |= (uint64_t)(uint32_t)_mm256_movemask_epi8(s) << (i * 32);
+    }
+    m->quote = quote;
+    m->escape = escape;
+    m->op = op;
+    m->space = space;
+}
+#endif
+
+static inline __attribute__((always_inline)) uint64_t prefix_xor (uint64_t x) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+// turns one 64 byte block into a mask of structural positions: unescaped quotes,
+// operators outside of strings and the first byte of every other scalar
+static inline __attribute__((always_inline)) uint64_t scan_block (json_scan_t *js, json_masks_t *m) {
+    const uint64_t even = 0x5555555555555555ULL;
+    uint64_t escape = m->escape & ~js->escaped, follows, odd_starts, seq, escaped, quote, in_string, scalar, starts;
+    follows = (escape << 1) | js->escaped;
+    odd_starts = escape & ~even & ~follows;
+    js->escaped = __builtin_add_overflow(odd_starts, escape, &seq);
+    escaped = (even ^ (seq << 1)) & follows;
+    quote = m->quote & ~escaped;
+    in_string = prefix_xor(quote) ^ js->in_string;
+    js->in_string = (uint64_t)((int64_t)in_string >> 63);
+    scalar = ~(m->op | m->space | quote);
+    starts = scalar & ~((scalar << 1) | js->scalar);
+    js->scalar = scalar >> 63;
+    return ((m->op | starts) & ~in_string) | quote;
+}
+
+static inline __attribute__((always_inline)) void flatten (json_scan_t *js, uint64_t s, uint32_t off) {
+    uint32_t *idx = js->idx + js->len;
+    while (s) {
+        *idx++ = off + __builtin_ctzll(s);
+        s &= s - 1;
+    }
+    js->len = idx - js->idx;
+}
+
+#define SCAN_WINDOW(classify) \
+    const uint8_t *p = (const uint8_t*)js->next; \
+    size_t i = 0; \
+    json_masks_t m; \
+    for (; i + 64 <= len; i += 64) { \
+        classify(p + i, &m); \
+        flatten(js, scan_block(js, &m), i); \
+    } \
+    if (i < len) { \
+        uint8_t tail [64]; \
+        memset(tail, ' ', sizeof(tail)); \
+        memcpy(tail, p + i, len - i); \
+        classify(tail, &m); \
+        flatten(js, scan_block(js, &m), i); \
+    }
+
+#if !__SSE2__
+static void scan_window_scalar (json_scan_t *js, size_t len) {
+    SCAN_WINDOW(classify_scalar)
+}
+#else
+static void scan_window_sse2 (json_scan_t *js, size_t len) {
+    SCAN_WINDOW(classify_sse2)
+}
+#endif
+
+#if JSON_HAVE_AVX2
+static __attribute__((target("avx2"))) void scan_window_avx2 (json_scan_t *js, size_t len) {
+    SCAN_WINDOW(classify_avx2)
+}
+#endif
+
+typedef void (*scan_window_h) (json_scan_t*, size_t);
+
+static scan_window_h scan_window_select () {
+    #if JSON_HAVE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return scan_window_avx2;
+    #endif
+    #if __SSE2__
+    return scan_window_sse2;
+    #else
+    return scan_window_scalar;
+    #endif
+}
+
+static scan_window_h scan_window = NULL;
+
+static int scan_fill (json_scan_t *js) {
+    size_t len;
+    if (!scan_window)
+        scan_window = scan_window_select();
+    js->pos = js->len = 0;
+    while (0 == js->len && js->next < js->end) {
+        len = js->end - js->next;
+        if (len > JSON_SCAN_WINDOW)
+            len = JSON_SCAN_WINDOW;
+        js->base = js->next;
+        scan_window(js, len);
+        js->next += len;
+    }
+    return js->len > 0;
+}
+
+static inline const char *scan_next (json_scan_t *js) {
+    if (js->pos == js->len && !scan_fill(js))
+        return NULL;
+    return js->base + js->idx[js->pos++];
+}
+
 /*************************************************************************************
   json parser
 *************************************************************************************/
 
 static int get_token (json_t *j, strptr_t *token) {
-    char *p = j->text_ptr, *q, *e = j->text + j->text_len;
+    json_scan_t *js = j->scan;
+    const char *p, *q, *e = j->text + j->text_len;
     token->ptr = NULL;
     token->len = 0;
-    while (p < e && isspace(*p)) ++p;
-    if (p >= e) {
+    if (!(p = scan_next(js))) {
         errno = EAGAIN;
         return JSON_FIN;
     }
-    q = p;
     if ('"' == *p) {
-        token->ptr = p++;
-        while (p < e) {
-            if (*p == '"')
-                break;
-            if (*p == '\\')
-                ++p;
-            ++p;
-        }
-        if (p >= e) {
+        if (!(q = scan_next(js))) {
             errno = EAGAIN;
             return JSON_ERROR;
         }
-        j->text_ptr = ++p;
-        token->ptr = q;
-        token->len = (uintptr_t)p - (uintptr_t)q;
+        token->ptr = (char*)p;
+        token->len = (uintptr_t)++q - (uintptr_t)p;
+        j->text_ptr = (char*)q;
         return JSON_OK;
     }
-    switch (*p++) {
-        case '{':
-        case '}':
-        case ',':
-        case ':':
-        case '[':
-        case ']':
-            token->ptr = q;
-            token->len = 1;
-            j->text_ptr = p;
-            return JSON_OK;
-    }
-    while (p < e && ! isspace(*p) && !strchr(delims, *p)) ++p;
-    e = p;
-    if (e > q) {
-        token->ptr = q;
-        token->len = (uintptr_t)p - (uintptr_t)q;
-        j->text_ptr = p;
+    if (json_class[(uint8_t)*p] & JSON_COP) {
+        token->ptr = (char*)p;
+        token->len = 1;
+        j->text_ptr = (char*)p + 1;
+        return JSON_OK;
     }
+    q = p;
+    while (q < e && !json_class[(uint8_t)*q]) ++q;
+    token->ptr = (char*)p;
+    token->len = (uintptr_t)q - (uintptr_t)p;
+    j->text_ptr = (char*)q;
     return JSON_OK;
 }
 
@@ -67,7 +246,13 @@ static void json_free_array (json_array_t *ja);
 static void json_free_item (json_item_t *ji);
 
 static void json_free_object (json_object_t *jo) {
-    rbtree_free(jo);
+    if (jo->arena)
+        return;
+    for (size_t i = 0; i < jo->len; ++i)
+        json_free_item(jo->members[i].item);
+    if (jo->members) free(jo->members);
+    if (jo->index) free(jo->index);
+    free(jo);
 }
 
 static void json_free_array (json_array_t *ja) {
@@ -94,6 +279,10 @@ static void json_free_item (json_item_t *ji) {
 }
 
 void json_free (json_t *j) {
+    if (j->arena) {
+        arena_free(j->arena);
+        return;
+    }
     switch (j->type) {
         case JSON_OBJECT:
             json_free_object(j->data.o);
@@ -106,24 +295,185 @@ void json_free (json_t *j) {
     free(j);
 }
 
-int json_str2long (strptr_t *str, int64_t *l) {
-    char *s = strndup(str->ptr, str->len), *tail = NULL;
-    if (!isdigit(*s) && '-' != *s && '+' != *s)
+/*************************************************************************************
+  numbers
+*************************************************************************************/
+
+#define JSON_NUM_BUF 64
+#define JSON_MAX_DIGITS 19
+#define JSON_POW5_MIN -342
+#define JSON_POW5_MAX 308
+
+extern const uint64_t json_pow5 [][2];
+
+static const double json_pow10 [] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// w * 10^q correctly rounded, -1 if the caller has to fall back to strtod
+static int json_eisel_lemire (uint64_t w, int64_t q, int neg, double *d) {
+    #if defined(__SIZEOF_INT128__) && FLT_EVAL_METHOD == 0
+    uint64_t lower, upper, upperbit, mantissa;
+    unsigned __int128 r;
+    int64_t real_exponent;
+    int lz;
+    if (q >= -22 && q <= 22 && w <= (1ULL << 53)) {
+        // both operands are exact, one rounding
+        *d = q < 0 ? (double)w / json_pow10[-q] : (double)w * json_pow10[q];
+        if (neg)
+            *d = -*d;
+        return 0;
+    }
+    if (q < JSON_POW5_MIN || q > JSON_POW5_MAX)
         return -1;
-    *l = strtoll(s, &tail, 0);
-    int ret = *tail != '\0' || errno == ERANGE ? -1 : 0;
-    free(s);
+    lz = __builtin_clzll(w);
+    w <<= lz;
+    r = (unsigned __int128)w * json_pow5[q - JSON_POW5_MIN][0];
+    lower = (uint64_t)r;
+    upper = (uint64_t)(r >> 64);
+    if (0x1ff == (upper & 0x1ff) && lower + w < lower) {
+        uint64_t low, middle, high = upper;
+        r = (unsigned __int128)w * json_pow5[q - JSON_POW5_MIN][1];
+        low = (uint64_t)r;
+        middle = lower + (uint64_t)(r >> 64);
+        if (middle < lower)
+            ++high;
+        if (middle + 1 == 0 && 0x1ff == (high & 0x1ff) && low + w < low)
+            return -1;
+        upper = high;
+        lower = middle;
+    }
+    upperbit = upper >> 63;
+    mantissa = upper >> (upperbit + 9);
+    lz += (int)(1 ^ upperbit);
+    // exactly halfway between two doubles
+    if (0 == lower && 0 == (upper & 0x1ff) && 1 == (mantissa & 3))
+        return -1;
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    if (mantissa >= (1ULL << 53)) {
+        mantissa = 1ULL << 52;
+        --lz;
+    }
+    mantissa &= ~(1ULL << 52);
+    // 217706 / 2^16 ~ log2(10)
+    real_exponent = (((152170 + 65536) * q) >> 16) + 1024 + 63 - lz;
+    if (real_exponent < 1 || real_exponent > 2046)
+        return -1;
+    mantissa |= (uint64_t)real_exponent << 52;
+    mantissa |= (uint64_t)neg << 63;
+    memcpy(d, &mantissa, sizeof(*d));
+    return 0;
+    #else
+    return -1;
+    #endif
+}
+
+static int json_strtod (const char *p, size_t len, double *d) {
+    char buf [JSON_NUM_BUF], *s = buf, *tail;
+    int ret;
+    if (len >= JSON_NUM_BUF) {
+        if (!(s = strndup(p, len)))
+            return -1;
+    } else {
+        memcpy(buf, p, len);
+        buf[len] = '\0';
+    }
+    errno = 0;
+    *d = strtod(s, &tail);
+    // subnormals and underflows to zero are ERANGE too, only an overflow fails
+    ret = *tail != '\0' || (ERANGE == errno && (HUGE_VAL == *d || -HUGE_VAL == *d)) ? -1 : 0;
+    if (s != buf)
+        free(s);
     return ret;
 }
 
+// one pass over the token: integers that fit int64_t become JSON_INTEGER,
+// anything else that looks like a number becomes JSON_DOUBLE
+static int json_parse_number (const char *p, size_t len, json_item_t *ji) {
+    const char *s = p, *e = p + len;
+    uint64_t w = 0;
+    int64_t q = 0, exp = 0;
+    int neg = 0, digits = 0, is_int = 1;
+    double d;
+    if (s < e && ('-' == *s || '+' == *s))
+        neg = '-' == *s++;
+    if (s == e || !isdigit(*s))
+        return -1;
+    for (; s < e && isdigit(*s); ++s) {
+        int c = *s - '0';
+        if (0 == w && 0 == c)
+            continue;
+        if (++digits <= JSON_MAX_DIGITS)
+            w = w * 10 + c;
+        else
+            ++q;
+    }
+    if (s < e && '.' == *s) {
+        is_int = 0;
+        for (++s; s < e && isdigit(*s); ++s) {
+            int c = *s - '0';
+            if (0 == w && 0 == c)
+                --q;
+            else
+            if (++digits <= JSON_MAX_DIGITS) {
+                w = w * 10 + c;
+                --q;
+            }
+        }
+    }
+    if (s < e && ('e' == *s || 'E' == *s)) {
+        int exp_neg = 0;
+        is_int = 0;
+        if (++s < e && ('-' == *s || '+' == *s))
+            exp_neg = '-' == *s++;
+        if (s == e || !isdigit(*s))
+            return -1;
+        for (; s < e && isdigit(*s); ++s)
+            if (exp < 100000)
+                exp = exp * 10 + *s - '0';
+        q += exp_neg ? -exp : exp;
+    }
+    if (s != e)
+        return -1;
+    if (is_int && 0 == q) {
+        if (!neg && w <= INT64_MAX) {
+            ji->type = JSON_INTEGER;
+            ji->data.i = (int64_t)w;
+            return 0;
+        }
+        if (neg && w <= (uint64_t)INT64_MAX + 1) {
+            ji->type = JSON_INTEGER;
+            ji->data.i = -(int64_t)(w - 1) - 1;
+            return 0;
+        }
+    }
+    if (0 == w)
+        d = neg ? -0.0 : 0.0;
+    else
+    if (digits > JSON_MAX_DIGITS || -1 == json_eisel_lemire(w, q, neg, &d))
+        if (-1 == json_strtod(p, len, &d))
+            return -1;
+    ji->type = JSON_DOUBLE;
+    ji->data.d = d;
+    return 0;
+}
+
+int json_str2long (strptr_t *str, int64_t *l) {
+    json_item_t ji;
+    if (-1 == json_parse_number(str->ptr, str->len, &ji) || JSON_INTEGER != ji.type)
+        return -1;
+    *l = ji.data.i;
+    return 0;
+}
+
 int json_str2double (strptr_t *str, long double *d) {
-    char *s = strndup(str->ptr, str->len), *tail = NULL;
-    if (!isdigit(*s) && '-' != *s && '+' != *s)
+    json_item_t ji;
+    if (-1 == json_parse_number(str->ptr, str->len, &ji))
         return -1;
-    *d = strtold(s, &tail);
-    int ret = *tail != '\0' || errno == ERANGE ? -1 : 0;
-    free(s);
-    return ret;
+    *d = JSON_INTEGER == ji.type ? (long double)ji.data.i : ji.data.d;
+    return 0;
 }
 
 static void json_set_item_value (json_t *j, json_item_t *ji, strptr_t *token) {
@@ -133,23 +483,19 @@ static void json_set_item_value (json_t *j, json_item_t *ji, strptr_t *token) {
         ji->type = JSON_STRING;
         ji->data.s = *token;
     } else
-    if (0 == json_str2long(token, &ji->data.i))
-        ji->type = JSON_INTEGER;
-    else
-    if (0 == json_str2double(token, &ji->data.d))
-        ji->type = JSON_DOUBLE;
-    else
-    if (0 == cmpcasestr(token->ptr, token->len, CONST_STR_LEN("TRUE")))
-        ji->type = JSON_TRUE;
-    else
-    if (0 == cmpcasestr(token->ptr, token->len, CONST_STR_LEN("FALSE")))
-        ji->type = JSON_FALSE;
-    else
-    if (0 == cmpcasestr(token->ptr, token->len, CONST_STR_LEN("NULL")))
-        ji->type = JSON_NULL;
-    else {
-        ji->type = JSON_STRING;
-        ji->data.s = *token;
+    if (-1 == json_parse_number(token->ptr, token->len, ji)) {
+        if (0 == cmpcasestr(token->ptr, token->len, CONST_STR_LEN("TRUE")))
+            ji->type = JSON_TRUE;
+        else
+        if (0 == cmpcasestr(token->ptr, token->len, CONST_STR_LEN("FALSE")))
+            ji->type = JSON_FALSE;
+        else
+        if (0 == cmpcasestr(token->ptr, token->len, CONST_STR_LEN("NULL")))
+            ji->type = JSON_NULL;
+        else {
+            ji->type = JSON_STRING;
+            ji->data.s = *token;
+        }
     }
 }
 
@@ -157,24 +503,36 @@ static json_array_t *json_parse_array (json_t *j, strptr_t *token);
 static json_item_t *json_parse_item (json_t *j, strptr_t *token);
 static json_object_t *json_parse_object(json_t *j, strptr_t *token);
 
+static inline json_item_t *json_alloc_item (json_t *j) {
+    return j->arena ? arena_calloc(j->arena, sizeof(json_item_t)) : calloc(1, sizeof(json_item_t));
+}
+
+static inline void json_drop_item (json_t *j, json_item_t *ji) {
+    if (!j->arena)
+        json_free_item(ji);
+}
+
 static json_array_t *json_parse_array (json_t *j, strptr_t *token) {
-    json_array_t *a = lst_alloc((free_h)json_free_item);
+    json_array_t *a = j->arena ? lst_alloc_slab(NULL, j->lst_slab) : lst_alloc((free_h)json_free_item);
+    if (!a)
+        return NULL;
     while (JSON_OK == get_token(j, token)) {
         json_item_t *ji;
         if (0 == cmpstr(token->ptr, token->len, CONST_STR_LEN("]")))
             break;
-        ji = calloc(1, sizeof(json_item_t));
+        if (!(ji = json_alloc_item(j)))
+            goto err;
         if (0 == cmpstr(token->ptr, token->len, CONST_STR_LEN("{"))) {
             ji->type = JSON_OBJECT;
             if (!(ji->data.o = json_parse_object(j, token))) {
-                json_free_item(ji);
+                json_drop_item(j, ji);
                 goto err;
             }
         } else
         if (0 == cmpstr(token->ptr, token->len, CONST_STR_LEN("["))) {
             ji->type = JSON_ARRAY;
             if (!(ji->data.a = json_parse_array(j, token))) {
-                json_free_item(ji);
+                json_drop_item(j, ji);
                 goto err;
             }
         } else
@@ -198,23 +556,25 @@ static json_item_t *json_parse_item (json_t *j, strptr_t *token) {
         return NULL;
     token->ptr++;
     token->len -= 2;
-    json_item_t *ji = calloc(1, sizeof(json_item_t));
+    json_item_t *ji = json_alloc_item(j);
+    if (!ji)
+        return NULL;
     ji->key = *token;
     if (JSON_OK != get_token(j, token) || 0 != cmpstr(token->ptr, token->len, CONST_STR_LEN(":")) || JSON_OK != get_token(j, token)) {
-        json_free_item(ji);
+        json_drop_item(j, ji);
         return NULL;
     }
     if (0 == cmpstr(token->ptr, token->len, CONST_STR_LEN("{"))) {
         ji->type = JSON_OBJECT;
         if (!(ji->data.o = json_parse_object(j, token))) {
-            json_free_item(ji);
+            json_drop_item(j, ji);
             return NULL;
         }
     } else
     if (0 == cmpstr(token->ptr, token->len, CONST_STR_LEN("["))) {
         ji->type = JSON_ARRAY;
         if (!(ji->data.a = json_parse_array(j, token))) {
-            json_free_item(ji);
+            json_drop_item(j, ji);
             return NULL;
         }
     } else
@@ -222,33 +582,116 @@ static json_item_t *json_parse_item (json_t *j, strptr_t *token) {
     return ji;
 }
 
-static int on_json_item_compare (void *x, void *y) {
-    strptr_t *s1 = (strptr_t*)x, *s2 = (strptr_t*)y;
-    return cmpstr(s1->ptr, s1->len, s2->ptr, s2->len);
+#define JSON_MIN_INDEX 64
+
+// keys come from the peer, one random seed for the process keeps them from being
+// chosen to collide; the first one stored wins so every thread hashes alike
+static uint64_t json_seed;
+
+static hash_key_t json_key_hash (const char *key, size_t key_len) {
+    uint64_t seed = __atomic_load_n(&json_seed, __ATOMIC_RELAXED);
+    if (0 == seed) {
+        uint64_t expected = 0;
+        seed = hash_random_seed() | 1;
+        if (!__atomic_compare_exchange_n(&json_seed, &expected, seed, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            seed = expected;
+    }
+    return hash_seed_nstr(key, key_len, seed);
+}
+
+static json_object_t *json_object_alloc (json_t *j) {
+    json_object_t *o = j->arena ? arena_calloc(j->arena, sizeof(json_object_t)) : calloc(1, sizeof(json_object_t));
+    if (o)
+        o->arena = j->arena;
+    return o;
 }
 
-static void *on_json_copy_key (void *key) {
-    return key;
+static json_member_t *json_object_lookup (json_object_t *o, const char *key, size_t key_len, hash_key_t h) {
+    json_member_t *m;
+    if (!o->index) {
+        for (size_t i = 0; i < o->len; ++i) {
+            m = &o->members[i];
+            if (h == m->hash && 0 == cmpstr(m->item->key.ptr, m->item->key.len, key, key_len))
+                return m;
+        }
+        return NULL;
+    }
+    for (size_t i = h & o->index_mask; o->index[i]; i = (i + 1) & o->index_mask) {
+        m = &o->members[o->index[i] - 1];
+        if (h == m->hash && 0 == cmpstr(m->item->key.ptr, m->item->key.len, key, key_len))
+            return m;
+    }
+    return NULL;
 }
 
-static void on_json_item_free (void *key, void *value) {
-    json_free_item((json_item_t*)value);
+// the index holds the member number + 1, zero is an empty slot
+static int json_object_reindex (json_object_t *o) {
+    size_t size = JSON_MIN_INDEX;
+    uint32_t *index;
+    while (size < o->len * 4) size <<= 1;
+    if (!(index = o->arena ? arena_calloc(o->arena, size * sizeof(uint32_t)) : calloc(size, sizeof(uint32_t))))
+        return -1;
+    for (size_t i = 0; i < o->len; ++i) {
+        size_t n = o->members[i].hash & (size - 1);
+        while (index[n]) n = (n + 1) & (size - 1);
+        index[n] = i + 1;
+    }
+    if (o->index && !o->arena)
+        free(o->index);
+    o->index = index;
+    o->index_mask = size - 1;
+    return 0;
+}
+
+static int json_object_add (json_object_t *o, json_item_t *ji) {
+    hash_key_t h = json_key_hash(ji->key.ptr, ji->key.len);
+    if (json_object_lookup(o, ji->key.ptr, ji->key.len, h)) {
+        errno = EEXIST;
+        return -1;
+    }
+    if (o->len == o->size) {
+        size_t size = o->size ? o->size * 2 : 4;
+        json_member_t *members;
+        if (o->arena) {
+            if (!(members = arena_get(o->arena, size * sizeof(json_member_t))))
+                return -1;
+            if (o->len)
+                memcpy(members, o->members, o->len * sizeof(json_member_t));
+        } else
+        if (!(members = realloc(o->members, size * sizeof(json_member_t))))
+            return -1;
+        o->members = members;
+        o->size = size;
+    }
+    o->members[o->len].hash = h;
+    o->members[o->len++].item = ji;
+    if (o->index && o->len * 2 <= o->index_mask + 1) {
+        size_t n = h & o->index_mask;
+        while (o->index[n]) n = (n + 1) & o->index_mask;
+        o->index[n] = o->len;
+        return 0;
+    }
+    if (o->len > JSON_OBJECT_FLAT && -1 == json_object_reindex(o)) {
+        --o->len;
+        return -1;
+    }
+    return 0;
 }
 
 static json_object_t *json_parse_object(json_t *j, strptr_t *token) {
-    json_object_t *o = rbtree_alloc(on_json_item_compare, on_json_copy_key, on_json_item_free, RBT_UNIQUE);
+    json_object_t *o = json_object_alloc(j);
+    if (!o)
+        return NULL;
     while (JSON_OK == get_token(j, token)) {
         json_item_t *ji;
         if (0 == cmpstr(token->ptr, token->len, CONST_STR_LEN("}")))
             break;
         if (!(ji = json_parse_item(j, token)))
             goto err;
-        tree_item_t *n = rbtree_add(o, &ji->key);
-        if (EEXIST == errno) {
-            json_free_item(ji);
+        if (-1 == json_object_add(o, ji)) {
+            json_drop_item(j, ji);
             goto err;
         }
-        n->value = ji;
         if (JSON_OK != get_token(j, token))
             goto err;
         if (0 == cmpstr(token->ptr, token->len, CONST_STR_LEN(",")))
@@ -263,41 +706,509 @@ err:
     return NULL;
 }
 
-json_t *json_parse_len (const char *json_str, size_t json_str_len) {
-    json_t *j = calloc(1, sizeof(json_t));
-    strptr_t token;
+static void json_scan_start (json_t *j, json_scan_t *js, const char *json_str, size_t json_str_len) {
+    // not an initializer, the index itself doesn't need zeroing
+    js->next = json_str;
+    js->end = json_str + json_str_len;
+    js->in_string = js->escaped = js->scalar = 0;
+    js->pos = js->len = 0;
     errno = 0;
     j->text = j->text_ptr = (char*)json_str;
     j->text_len = json_str_len;
-    if (JSON_ERROR == get_token(j, &token)) goto err;
-    if (0 == cmpstr(token.ptr, token.len, CONST_STR_LEN("{"))) {
-        j->type = JSON_OBJECT;
-        if (!(j->data.o = json_parse_object(j, &token))) goto err;
-    } else
-    if (0 == cmpstr(token.ptr, token.len, CONST_STR_LEN("["))) {
-        j->type = JSON_ARRAY;
-        if (!(j->data.a = json_parse_array(j, &token))) goto err;
-    } else
-        goto err;
+    j->scan = js;
+}
+
+static int json_parse_intr (json_t *j, const char *json_str, size_t json_str_len) {
+    strptr_t token;
+    json_scan_t js;
+    int rc = -1;
+    json_scan_start(j, &js, json_str, json_str_len);
+    if (JSON_ERROR != get_token(j, &token)) {
+        if (0 == cmpstr(token.ptr, token.len, CONST_STR_LEN("{"))) {
+            j->type = JSON_OBJECT;
+            if ((j->data.o = json_parse_object(j, &token)))
+                rc = 0;
+        } else
+        if (0 == cmpstr(token.ptr, token.len, CONST_STR_LEN("["))) {
+            j->type = JSON_ARRAY;
+            if ((j->data.a = json_parse_array(j, &token)))
+                rc = 0;
+        }
+    }
+    j->scan = NULL;
+    return rc;
+}
+
+json_t *json_parse_len (const char *json_str, size_t json_str_len) {
+    json_t *j = calloc(1, sizeof(json_t));
+    if (!j)
+        return NULL;
+    if (-1 == json_parse_intr(j, json_str, json_str_len)) {
+        free(j);
+        return NULL;
+    }
     return j;
-err:
-    free(j);
-    return NULL;
 }
 
 json_t *json_parse (const char *json_str) {
     return json_parse_len(json_str, strlen(json_str));
 }
 
+// the first block, the rest of a big document comes in more blocks of that size
+#define JSON_ARENA_MAX_BLOCK (4 * 1024 * 1024)
+
+json_t *json_parse_arena_len (const char *json_str, size_t json_str_len) {
+    // the DOM is usually a few times larger than the text
+    size_t block_size = json_str_len < (JSON_ARENA_MAX_BLOCK - ARENA_DEFAULT_BLOCK) / 4 ? json_str_len * 4 + ARENA_DEFAULT_BLOCK : JSON_ARENA_MAX_BLOCK;
+    arena_t *arena = arena_alloc(block_size);
+    json_t *j;
+    if (!arena)
+        return NULL;
+    if (!(j = arena_calloc(arena, sizeof(json_t))) ||
+        !(j->lst_slab = slab_alloc_arena(sizeof(list_item_t), arena))) {
+        arena_free(arena);
+        return NULL;
+    }
+    j->arena = arena;
+    if (-1 == json_parse_intr(j, json_str, json_str_len)) {
+        arena_free(arena);
+        return NULL;
+    }
+    return j;
+}
+
+json_t *json_parse_arena (const char *json_str) {
+    return json_parse_arena_len(json_str, strlen(json_str));
+}
+
 json_item_t *json_find (json_object_t *jo, const char *key, size_t key_len, int type) {
-    strptr_t k = { .ptr = (char*)key, .len = key_len };
-    tree_item_t *n = rbtree_get(jo, &k);
-    if (!n)
+    json_member_t *m = json_object_lookup(jo, key, key_len, json_key_hash(key, key_len));
+    if (!m)
+        return NULL;
+    if (JSON_ANY == type)
+        return m->item;
+    return type == m->item->type ? m->item : NULL;
+}
+
+/*************************************************************************************
+  streaming parser
+*************************************************************************************/
+
+#define SAX_ROOT 0
+#define SAX_VALUE 1
+#define SAX_ARRAY_FIRST 2
+#define SAX_OBJECT_FIRST 3
+#define SAX_KEY 4
+#define SAX_COLON 5
+#define SAX_NEXT 6
+
+#define SAX_LEX_NONE 0
+#define SAX_LEX_STRING 1
+#define SAX_LEX_SCALAR 2
+
+#define SAX_CHUNK_SIZE 64
+
+json_sax_t *json_sax_alloc (json_sax_h on_event, void *userdata) {
+    json_sax_t *sax = calloc(1, sizeof(json_sax_t));
+    if (!sax)
+        return NULL;
+    if (-1 == strbufalloc(&sax->tok, SAX_CHUNK_SIZE, SAX_CHUNK_SIZE) ||
+        -1 == strbufalloc(&sax->key, SAX_CHUNK_SIZE, SAX_CHUNK_SIZE)) {
+        json_sax_free(sax);
+        return NULL;
+    }
+    sax->on_event = on_event;
+    sax->userdata = userdata;
+    return sax;
+}
+
+void json_sax_reset (json_sax_t *sax) {
+    sax->state = SAX_ROOT;
+    sax->lex = SAX_LEX_NONE;
+    sax->escaped = sax->error = sax->depth = 0;
+    sax->docs = 0;
+    sax->tok.len = sax->key.len = 0;
+}
+
+void json_sax_free (json_sax_t *sax) {
+    if (sax->tok.ptr) free(sax->tok.ptr);
+    if (sax->key.ptr) free(sax->key.ptr);
+    free(sax);
+}
+
+static inline int sax_in_object (json_sax_t *sax) {
+    return sax->depth > 0 && '{' == sax->stack[sax->depth-1];
+}
+
+static int sax_emit (json_sax_t *sax, int event, json_item_t *ji) {
+    if (0 == sax->on_event(event, ji, sax->userdata))
+        return 0;
+    errno = ECANCELED;
+    return -1;
+}
+
+static int sax_open (json_sax_t *sax, char c) {
+    json_item_t ji = { .key = { .ptr = NULL, .len = 0 } };
+    if (JSON_SAX_DEPTH == sax->depth) {
+        errno = E2BIG;
+        return -1;
+    }
+    if (sax_in_object(sax))
+        ji.key = (strptr_t){ .ptr = sax->key.ptr, .len = sax->key.len };
+    ji.type = '{' == c ? JSON_OBJECT : JSON_ARRAY;
+    sax->stack[sax->depth++] = c;
+    sax->state = '{' == c ? SAX_OBJECT_FIRST : SAX_ARRAY_FIRST;
+    return sax_emit(sax, '{' == c ? JSON_SAX_START_OBJECT : JSON_SAX_START_ARRAY, &ji);
+}
+
+static int sax_close (json_sax_t *sax, char c) {
+    json_item_t ji = { .key = { .ptr = NULL, .len = 0 } };
+    if (0 == sax->depth || sax->stack[sax->depth-1] != ('}' == c ? '{' : '[')) {
+        errno = EINVAL;
+        return -1;
+    }
+    ji.type = '}' == c ? JSON_OBJECT : JSON_ARRAY;
+    if (0 == --sax->depth) {
+        sax->state = SAX_ROOT;
+        ++sax->docs;
+    } else
+        sax->state = SAX_NEXT;
+    return sax_emit(sax, '}' == c ? JSON_SAX_END_OBJECT : JSON_SAX_END_ARRAY, &ji);
+}
+
+static int sax_value (json_sax_t *sax, const char *ptr, size_t len) {
+    json_item_t ji = { .key = { .ptr = NULL, .len = 0 } };
+    strptr_t token = { .ptr = (char*)ptr, .len = len };
+    if (sax_in_object(sax))
+        ji.key = (strptr_t){ .ptr = sax->key.ptr, .len = sax->key.len };
+    json_set_item_value(NULL, &ji, &token);
+    sax->state = SAX_NEXT;
+    return sax_emit(sax, JSON_SAX_VALUE, &ji);
+}
+
+static int sax_key (json_sax_t *sax, const char *ptr, size_t len) {
+    json_item_t ji = { .type = 0 };
+    // the value may come with the next chunk
+    sax->key.len = 0;
+    if (-1 == strbufadd(&sax->key, ptr + 1, len - 2))
+        return -1;
+    ji.key = (strptr_t){ .ptr = sax->key.ptr, .len = sax->key.len };
+    sax->state = SAX_COLON;
+    return sax_emit(sax, JSON_SAX_KEY, &ji);
+}
+
+// the grammar, a token is recognized by its first character
+static int sax_token (json_sax_t *sax, const char *ptr, size_t len) {
+    char c = *ptr;
+    switch (sax->state) {
+        case SAX_ROOT:
+            if ('{' == c || '[' == c)
+                return sax_open(sax, c);
+            break;
+        case SAX_ARRAY_FIRST:
+            if (']' == c)
+                return sax_close(sax, c);
+            // fall through
+        case SAX_VALUE:
+            if ('{' == c || '[' == c)
+                return sax_open(sax, c);
+            if (!(json_class[(uint8_t)c] & JSON_COP))
+                return sax_value(sax, ptr, len);
+            break;
+        case SAX_OBJECT_FIRST:
+            if ('}' == c)
+                return sax_close(sax, c);
+            // fall through
+        case SAX_KEY:
+            if ('"' == c)
+                return sax_key(sax, ptr, len);
+            break;
+        case SAX_COLON:
+            if (':' == c) {
+                sax->state = SAX_VALUE;
+                return 0;
+            }
+            break;
+        case SAX_NEXT:
+            if (',' == c) {
+                sax->state = sax_in_object(sax) ? SAX_KEY : SAX_VALUE;
+                return 0;
+            }
+            if ('}' == c || ']' == c)
+                return sax_close(sax, c);
+            break;
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+// a token split between chunks is collected in sax->tok, anything else is passed in place
+static int sax_pending (json_sax_t *sax, const char *start, const char *p) {
+    if (0 == sax->tok.len)
+        return sax_token(sax, start, (uintptr_t)p - (uintptr_t)start);
+    if (-1 == strbufadd(&sax->tok, start, (uintptr_t)p - (uintptr_t)start))
+        return -1;
+    size_t len = sax->tok.len;
+    sax->tok.len = 0;
+    return sax_token(sax, sax->tok.ptr, len);
+}
+
+int json_sax_feed (json_sax_t *sax, const char *buf, size_t buf_len) {
+    const char *p = buf, *e = buf + buf_len, *start = buf;
+    if (sax->error) {
+        errno = EINVAL;
+        return -1;
+    }
+    while (p < e) {
+        if (SAX_LEX_STRING == sax->lex) {
+            while (p < e) {
+                if (sax->escaped)
+                    sax->escaped = 0;
+                else
+                if ('\\' == *p)
+                    sax->escaped = 1;
+                else
+                if ('"' == *p)
+                    break;
+                ++p;
+            }
+            if (p == e)
+                break;
+            sax->lex = SAX_LEX_NONE;
+            if (-1 == sax_pending(sax, start, ++p))
+                goto err;
+            continue;
+        }
+        if (SAX_LEX_SCALAR == sax->lex) {
+            while (p < e && !json_class[(uint8_t)*p]) ++p;
+            if (p == e)
+                break;
+            sax->lex = SAX_LEX_NONE;
+            if (-1 == sax_pending(sax, start, p))
+                goto err;
+            continue;
+        }
+        uint8_t c = json_class[(uint8_t)*p];
+        if (c & JSON_CSPACE) {
+            ++p;
+            continue;
+        }
+        start = p;
+        if (c & JSON_COP) {
+            if (-1 == sax_token(sax, p++, 1))
+                goto err;
+        } else
+        if (c & JSON_CQUOTE) {
+            sax->lex = SAX_LEX_STRING;
+            ++p;
+        } else
+        if (c & JSON_CESCAPE) {
+            errno = EINVAL;
+            goto err;
+        } else
+            sax->lex = SAX_LEX_SCALAR;
+    }
+    if (sax->lex && -1 == strbufadd(&sax->tok, start, (uintptr_t)e - (uintptr_t)start))
+        goto err;
+    return 0;
+err:
+    sax->error = 1;
+    return -1;
+}
+
+/*************************************************************************************
+  json path
+*************************************************************************************/
+
+static ssize_t json_path_index (const char *s, size_t len) {
+    ssize_t n = 0;
+    if (0 == len || len > 18 || ('0' == *s && len > 1))
+        return -1;
+    for (size_t i = 0; i < len; ++i) {
+        if (s[i] < '0' || s[i] > '9')
+            return -1;
+        n = n * 10 + s[i] - '0';
+    }
+    return n;
+}
+
+json_path_t *json_path_compile (const char *path, size_t path_len) {
+    const char *p = path, *e = path + path_len;
+    size_t nsegs = 0;
+    json_path_t *jp;
+    char *keys;
+    if (path_len > 0 && '/' != *path) {
+        errno = EINVAL;
+        return NULL;
+    }
+    for (size_t i = 0; i < path_len; ++i)
+        if ('/' == path[i])
+            ++nsegs;
+    if (!(jp = malloc(sizeof(json_path_t) + nsegs * sizeof(json_path_seg_t) + path_len)))
         return NULL;
-    json_item_t *j = (json_item_t*)n->value;
-    if (-1 == type)
-        return j;
-    return j && type == j->type ? j : NULL;
+    jp->len = nsegs;
+    keys = (char*)&jp->segs[nsegs];
+    for (size_t i = 0; i < nsegs; ++i) {
+        json_path_seg_t *seg = &jp->segs[i];
+        seg->key.ptr = keys;
+        for (++p; p < e && '/' != *p; ++p) {
+            if ('~' == *p) {
+                if (p + 1 == e || ('0' != p[1] && '1' != p[1])) {
+                    free(jp);
+                    errno = EINVAL;
+                    return NULL;
+                }
+                *keys++ = '0' == *++p ? '~' : '/';
+            } else
+                *keys++ = *p;
+        }
+        seg->key.len = (uintptr_t)keys - (uintptr_t)seg->key.ptr;
+        seg->hash = json_key_hash(seg->key.ptr, seg->key.len);
+        seg->index = json_path_index(seg->key.ptr, seg->key.len);
+    }
+    return jp;
+}
+
+json_item_t *json_path_eval (json_t *j, json_path_t *path) {
+    int type = j->type;
+    json_object_t *o = j->data.o;
+    json_array_t *a = j->data.a;
+    json_item_t *ji = NULL;
+    errno = ENOENT;
+    for (size_t i = 0; i < path->len; ++i) {
+        json_path_seg_t *seg = &path->segs[i];
+        if (JSON_OBJECT == type) {
+            json_member_t *m = json_object_lookup(o, seg->key.ptr, seg->key.len, seg->hash);
+            if (!m)
+                return NULL;
+            ji = m->item;
+        } else
+        if (JSON_ARRAY == type) {
+            list_item_t *li = a->head;
+            if (seg->index < 0 || seg->index >= a->len)
+                return NULL;
+            for (ssize_t n = 0; n < seg->index; ++n)
+                li = li->next;
+            ji = (json_item_t*)li->ptr;
+        } else
+            return NULL;
+        type = ji->type;
+        o = ji->data.o;
+        a = ji->data.a;
+    }
+    if (!ji)
+        errno = EINVAL;
+    return ji;
+}
+
+// skips the value started by the token, nested values are walked on the structural index only
+static int json_path_skip (json_t *j, strptr_t *token) {
+    int depth = 0;
+    do {
+        if (1 == token->len && ('{' == *token->ptr || '[' == *token->ptr))
+            ++depth;
+        else
+        if (1 == token->len && ('}' == *token->ptr || ']' == *token->ptr))
+            --depth;
+        if (0 == depth)
+            return 0;
+    } while (JSON_OK == get_token(j, token));
+    return -1;
+}
+
+static int json_path_next (json_t *j, strptr_t *token, char close) {
+    if (JSON_OK != get_token(j, token))
+        return -1;
+    if (1 == token->len && ',' == *token->ptr)
+        return 0;
+    if (1 == token->len && close == *token->ptr)
+        errno = ENOENT;
+    return -1;
+}
+
+static int json_path_member (json_t *j, strptr_t *token, json_path_seg_t *seg, json_item_t *item) {
+    if (JSON_OK != get_token(j, token))
+        return -1;
+    if (1 == token->len && '}' == *token->ptr) {
+        errno = ENOENT;
+        return -1;
+    }
+    while (1) {
+        strptr_t key = { .ptr = token->ptr + 1, .len = token->len - 2 };
+        if ('"' != *token->ptr || token->len < 2 ||
+            JSON_OK != get_token(j, token) || 1 != token->len || ':' != *token->ptr ||
+            JSON_OK != get_token(j, token))
+            return -1;
+        if (0 == cmpstr(key.ptr, key.len, seg->key.ptr, seg->key.len)) {
+            item->key = key;
+            return 0;
+        }
+        if (-1 == json_path_skip(j, token) || -1 == json_path_next(j, token, '}') || JSON_OK != get_token(j, token))
+            return -1;
+    }
+}
+
+static int json_path_element (json_t *j, strptr_t *token, json_path_seg_t *seg, json_item_t *item) {
+    if (seg->index < 0) {
+        errno = ENOENT;
+        return -1;
+    }
+    if (JSON_OK != get_token(j, token))
+        return -1;
+    if (1 == token->len && ']' == *token->ptr) {
+        errno = ENOENT;
+        return -1;
+    }
+    for (ssize_t n = 0; n < seg->index; ++n)
+        if (-1 == json_path_skip(j, token) || -1 == json_path_next(j, token, ']') || JSON_OK != get_token(j, token))
+            return -1;
+    item->key.ptr = NULL;
+    item->key.len = 0;
+    return 0;
+}
+
+int json_path_scan (const char *json_str, size_t json_str_len, json_path_t *path, json_item_t *item) {
+    json_t j = { .type = 0 };
+    json_scan_t js;
+    strptr_t token;
+    int rc = -1;
+    json_scan_start(&j, &js, json_str, json_str_len);
+    if (JSON_OK != get_token(&j, &token) || 1 != token.len || ('{' != *token.ptr && '[' != *token.ptr))
+        goto done;
+    if (0 == path->len) {
+        errno = EINVAL;
+        goto done;
+    }
+    for (size_t i = 0; i < path->len; ++i) {
+        if (1 == token.len && '{' == *token.ptr) {
+            if (-1 == json_path_member(&j, &token, &path->segs[i], item))
+                goto done;
+        } else
+        if (1 == token.len && '[' == *token.ptr) {
+            if (-1 == json_path_element(&j, &token, &path->segs[i], item))
+                goto done;
+        } else {
+            errno = ENOENT;
+            goto done;
+        }
+    }
+    if (1 == token.len && ('{' == *token.ptr || '[' == *token.ptr)) {
+        const char *start = token.ptr;
+        item->type = '{' == *token.ptr ? JSON_OBJECT : JSON_ARRAY;
+        if (-1 == json_path_skip(&j, &token))
+            goto done;
+        item->data.s.ptr = (char*)start;
+        item->data.s.len = (uintptr_t)token.ptr + 1 - (uintptr_t)start;
+    } else
+    if (1 == token.len && (json_class[(uint8_t)*token.ptr] & JSON_COP))
+        goto done;
+    else
+        json_set_item_value(&j, item, &token);
+    rc = 0;
+done:
+    if (-1 == rc && ENOENT != errno)
+        errno = EINVAL;
+    return rc;
 }
 
 /*************************************************************************************
@@ -317,97 +1228,117 @@ void json_enum_array (json_array_t *lst, json_item_h fn, void *userdata, int fla
     }
 }
 
-typedef struct {
-    json_item_h fn;
-    void *userdata;
-} json_enum_object_t;
+// members come in the document order
+void json_enum_object (json_object_t *obj, json_item_h fn, void *userdata, int flags) {
+    for (size_t i = 0; i < obj->len; ++i) {
+        int n = fn(obj->members[i].item, userdata);
+        if (ENUM_STOP_IF_BREAK == flags && ENUM_BREAK == n)
+            return;
+    }
+}
 
-static int on_object (tree_item_t *item, void *userdata) {
-    json_enum_object_t *je = (json_enum_object_t*)userdata;
-    return je->fn((json_item_t*)item->value, je->userdata);
+// the key, the value of at most val_len and the comma get one capacity check,
+// then they are written in place
+static inline char *json_put_key (strbuf_t *buf, const char *key, size_t key_len, size_t val_len) {
+    char *p;
+    if (-1 == strbufreserve(buf, key_len + val_len + 4))
+        return NULL;
+    p = buf->ptr + buf->len;
+    if (key && key_len) {
+        *p++ = '"';
+        memcpy(p, key, key_len);
+        p += key_len;
+        *p++ = '"';
+        *p++ = ':';
+    }
+    return p;
 }
 
-void json_enum_object (json_object_t *obj, json_item_h fn, void *userdata, int flags) {
-    json_enum_object_t je = { .fn = fn, .userdata = userdata };
-    rbtree_enum(obj, NULL, on_object, &je, flags);
+static inline void json_put_end (strbuf_t *buf, char *p, int is_end) {
+    if (!is_end)
+        *p++ = ',';
+    buf->len = (uintptr_t)p - (uintptr_t)buf->ptr;
+}
+
+static inline void json_put_str (strbuf_t *buf, const char *key, size_t key_len, const char *val, size_t val_len, int is_end) {
+    char *p = json_put_key(buf, key, key_len, val_len);
+    if (p) {
+        memcpy(p, val, val_len);
+        json_put_end(buf, p + val_len, is_end);
+    }
 }
 
 void json_add_key (strbuf_t *buf, const char *key, size_t key_len) {
-    strbufadd(buf, CONST_STR_LEN("\""));
-    strbufadd(buf, key, key_len);
-    strbufadd(buf, CONST_STR_LEN("\":"));
+    char *p;
+    if (-1 == strbufreserve(buf, key_len + 3))
+        return;
+    p = buf->ptr + buf->len;
+    *p++ = '"';
+    memcpy(p, key, key_len);
+    p += key_len;
+    *p++ = '"';
+    *p++ = ':';
+    buf->len = (uintptr_t)p - (uintptr_t)buf->ptr;
 }
 
 void json_add_str (strbuf_t *buf, const char *key, size_t key_len, const char *val, size_t val_len, int is_end) {
-    if (key && key_len)
-        json_add_key(buf, key, key_len);
-    strbufadd(buf, CONST_STR_LEN("\""));
-    strbufadd(buf, val, val_len);
-    strbufadd(buf, CONST_STR_LEN("\""));
-    if (!is_end)
-        strbufadd(buf, CONST_STR_LEN(","));
+    char *p = json_put_key(buf, key, key_len, val_len + 2);
+    if (p) {
+        *p++ = '"';
+        memcpy(p, val, val_len);
+        p += val_len;
+        *p++ = '"';
+        json_put_end(buf, p, is_end);
+    }
 }
 
 void json_add_escape_str (strbuf_t *buf, const char *key, size_t key_len, const char *val, size_t val_len, int is_end) {
-    if (key && key_len)
-        json_add_key(buf, key, key_len);
-    strbufadd(buf, CONST_STR_LEN("\""));
+    char *p = json_put_key(buf, key, key_len, 1);
+    if (!p)
+        return;
+    *p++ = '"';
+    buf->len = (uintptr_t)p - (uintptr_t)buf->ptr;
     strbuf_escape(buf, val, val_len);
-    strbufadd(buf, CONST_STR_LEN("\""));
-    if (!is_end)
-        strbufadd(buf, CONST_STR_LEN(","));
+    json_put_str(buf, CONST_STR_NULL, CONST_STR_LEN("\""), is_end);
 }
 
 void json_add_int (strbuf_t *buf, const char *key, size_t key_len, int64_t val, int is_end) {
-    char str [48];
-    snprintf(str, sizeof(str), LONG_FMT, val);
-    if (key && key_len)
-        json_add_key(buf, key, key_len);
-    strbufadd(buf, str, strlen(str));
-    if (!is_end)
-        strbufadd(buf, CONST_STR_LEN(","));
+    char *p = json_put_key(buf, key, key_len, 20);
+    if (p)
+        json_put_end(buf, p + ltostr(val, p), is_end);
 }
 
 void json_add_double_p (strbuf_t *buf, const char *key, size_t key_len, long double val, int prec, int is_end) {
-    char str [48];
+    char *p = json_put_key(buf, key, key_len, DTOSTR_BUFSIZE);
     if (prec <= 0)
         prec = JSON_DOUBLE_PRECISION;
-    snprintf(str, sizeof(str), "%.*Lf", prec, val);
-    if (key && key_len)
-        json_add_key(buf, key, key_len);
-    strbufadd(buf, str, strlen(str));
-    if (!is_end)
-        strbufadd(buf, CONST_STR_LEN(","));
+    if (p)
+        json_put_end(buf, p + dtostr_p(val, prec, p), is_end);
+}
+
+void json_add_double_s (strbuf_t *buf, const char *key, size_t key_len, double val, int is_end) {
+    char *p = json_put_key(buf, key, key_len, DTOSTR_BUFSIZE);
+    if (p)
+        json_put_end(buf, p + dtostr(val, p), is_end);
 }
 
 void json_add_null (strbuf_t *buf, const char *key, size_t key_len, int is_end) {
-    if (key && key_len)
-        json_add_key(buf, key, key_len);
-    strbufadd(buf, CONST_STR_LEN("null"));
-    if (!is_end)
-        strbufadd(buf, CONST_STR_LEN(","));
+    json_put_str(buf, key, key_len, CONST_STR_LEN("null"), is_end);
 }
 
 void json_add_bool (strbuf_t *buf, const char *key, size_t key_len, int val, int is_end) {
-    char *str = 0 == val ? "false" : "true";
-    if (key && key_len)
-        json_add_key(buf, key, key_len);
-    strbufadd(buf, str, strlen(str));
-    if (!is_end)
-        strbufadd(buf, CONST_STR_LEN(","));
+    if (val)
+        json_put_str(buf, key, key_len, CONST_STR_LEN("true"), is_end);
+    else
+        json_put_str(buf, key, key_len, CONST_STR_LEN("false"), is_end);
 }
 
 void json_open_array (strbuf_t *buf, const char *key, size_t key_len) {
-    if (key && key_len)
-        json_add_key(buf, key, key_len);
-    strbufadd(buf, CONST_STR_LEN("["));
+    json_put_str(buf, key, key_len, CONST_STR_LEN("["), JSON_END);
 }
 
 void json_close_array (strbuf_t *buf, int is_end) {
-    if (is_end)
-        strbufadd(buf, CONST_STR_LEN("]"));
-    else
-        strbufadd(buf, CONST_STR_LEN("],"));
+    json_put_str(buf, CONST_STR_NULL, CONST_STR_LEN("]"), is_end);
 }
 
 void json_add_list (strbuf_t *buf, const char *key, size_t key_len, list_t *list, json_list_item_h on_item, void *userdata, int is_end) {
@@ -469,16 +1400,11 @@ void json_add_tree (strbuf_t *buf, const char *key, size_t key_len, rbtree_t *tr
 }
 
 void json_open_object (strbuf_t *buf, const char *key, size_t key_len) {
-    if (key && key_len)
-        json_add_key(buf, key, key_len);
-    strbufadd(buf, CONST_STR_LEN("{"));
+    json_put_str(buf, key, key_len, CONST_STR_LEN("{"), JSON_END);
 }
 
 void json_close_object (strbuf_t *buf, int is_end) {
-    if (is_end)
-        strbufadd(buf, CONST_STR_LEN("}"));
-    else
-        strbufadd(buf, CONST_STR_LEN("},"));
+    json_put_str(buf, CONST_STR_NULL, CONST_STR_LEN("}"), is_end);
 }
 
 /*************************************************************************************
@@ -554,8 +1480,7 @@ static int jsonrpc_parse_error_message (json_item_t *ji, jsonrpc_enum_t *data) {
     return 0;
 }
 
-static int on_parse_error (tree_item_t *item, jsonrpc_enum_t *data) {
-    json_item_t *ji = (json_item_t*)item->value;
+static int on_parse_error (json_item_t *ji, jsonrpc_enum_t *data) {
     if (-1 == jsonrpc_parse_error_code(ji, data))
         return -1;
     if (-1 == jsonrpc_parse_error_message(ji, data))
@@ -571,7 +1496,7 @@ static int jsonrpc_parse_error (json_item_t *ji, jsonrpc_enum_t *data) {
             data->errcode = JSONRPC_INVALID_REQUEST;
             return -1;
         }
-        rbtree_enum(ji->data.o, NULL, (tree_item_h)on_parse_error, (void*)data, ENUM_STOP_IF_BREAK);
+        json_enum_object(ji->data.o, (json_item_h)on_parse_error, (void*)data, ENUM_STOP_IF_BREAK);
         if (JSONRPC_OK != data->errcode)
             return data->errcode;
         if (!data->jsonrpc->error_code || !data->jsonrpc->error_message.ptr) {
@@ -582,8 +1507,7 @@ static int jsonrpc_parse_error (json_item_t *ji, jsonrpc_enum_t *data) {
     return 0;
 }
 
-static int on_jsonrpc_parse_request (tree_item_t *item, jsonrpc_enum_t *data) {
-    json_item_t *ji = (json_item_t*)item->value;
+static int on_jsonrpc_parse_request (json_item_t *ji, jsonrpc_enum_t *data) {
     if (-1 == jsonrpc_parse_id(ji, data)) {
         data->errcode = JSONRPC_INVALID_REQUEST;
         return ENUM_BREAK;
@@ -601,8 +1525,7 @@ static int on_jsonrpc_parse_request (tree_item_t *item, jsonrpc_enum_t *data) {
     return ENUM_CONTINUE;
 }
 
-static int on_jsonrpc_parse_response (tree_item_t *item, jsonrpc_enum_t *data) {
-    json_item_t *ji = (json_item_t*)item->value;
+static int on_jsonrpc_parse_response (json_item_t *ji, jsonrpc_enum_t *data) {
     if (-1 == jsonrpc_parse_id(ji, data))
         return ENUM_BREAK;
     if (-1 == jsonrpc_parse_ver(ji, data))
@@ -614,23 +1537,39 @@ static int on_jsonrpc_parse_response (tree_item_t *item, jsonrpc_enum_t *data) {
     return ENUM_CONTINUE;
 }
 
+// all but the id, a request without one is a notification
+static int jsonrpc_check_call (json_object_t *o, jsonrpc_t *jsonrpc) {
+    jsonrpc_enum_t data = { .jsonrpc = jsonrpc, .errcode = JSONRPC_OK };
+    json_enum_object(o, (json_item_h)on_jsonrpc_parse_request, (void*)&data, ENUM_STOP_IF_BREAK);
+    if (data.errcode != JSONRPC_OK)
+        return data.errcode;
+    if (jsonrpc->ver == JSONRPC_VNONE || !jsonrpc->method.len)
+        return JSONRPC_INVALID_REQUEST;
+    if (!jsonrpc->params || jsonrpc->params->type != JSON_ARRAY)
+        return JSONRPC_INVALID_PARAMS;
+    return JSONRPC_OK;
+}
+
+static inline int jsonrpc_is_notify (jsonrpc_t *jsonrpc, int rc) {
+    return (JSONRPC_OK == rc || JSONRPC_INVALID_PARAMS == rc) && !jsonrpc->id && JSONRPC_V20 == jsonrpc->ver;
+}
+
+static int jsonrpc_check_request (json_object_t *o, jsonrpc_t *jsonrpc) {
+    int rc = jsonrpc_check_call(o, jsonrpc);
+    if ((JSONRPC_OK == rc || JSONRPC_INVALID_PARAMS == rc) && !jsonrpc->id)
+        return JSONRPC_INVALID_REQUEST;
+    return rc;
+}
+
 int jsonrpc_parse_request_intr (const char *json_str, size_t json_str_len, json_parse_h on_parse, jsonrpc_t *jsonrpc) {
     int rc = JSONRPC_OK;
-    jsonrpc_enum_t data = { .jsonrpc = jsonrpc, .errcode = JSONRPC_OK };
     if (!(jsonrpc->json = on_parse(json_str, json_str_len)))
         return JSONRPC_PARSE_ERROR;
     if (JSON_OBJECT != jsonrpc->json->type) {
         rc = JSONRPC_INVALID_REQUEST;
         goto err;
     }
-    rbtree_enum(jsonrpc->json->data.o, NULL, (tree_item_h)on_jsonrpc_parse_request, (void*)&data, ENUM_STOP_IF_BREAK);
-    if (data.errcode != JSONRPC_OK)
-        return data.errcode;
-    if (!jsonrpc->id || (jsonrpc->id->type != JSON_INTEGER && jsonrpc->id->type != JSON_STRING) || jsonrpc->ver == JSONRPC_VNONE || !jsonrpc->method.len)
-        return JSONRPC_INVALID_REQUEST;
-    if (!jsonrpc->params || jsonrpc->params->type != JSON_ARRAY)
-        return JSONRPC_INVALID_PARAMS;
-    return JSONRPC_OK;
+    return jsonrpc_check_request(jsonrpc->json->data.o, jsonrpc);
 err:
     if (jsonrpc->json) {
         json_free(jsonrpc->json);
@@ -648,7 +1587,7 @@ int jsonrpc_parse_response_intr (const char *json_str, size_t json_str_len, json
         rc = JSONRPC_INVALID_REQUEST;
         goto err;
     }
-    rbtree_enum(jsonrpc->json->data.o, NULL, (tree_item_h)on_jsonrpc_parse_response, (void*)&data, ENUM_STOP_IF_BREAK);
+    json_enum_object(jsonrpc->json->data.o, (json_item_h)on_jsonrpc_parse_response, (void*)&data, ENUM_STOP_IF_BREAK);
     if (data.errcode != JSONRPC_OK)
         return data.errcode;
     if (!jsonrpc->id || jsonrpc->ver == JSONRPC_VNONE || (jsonrpc->result && jsonrpc->error_message.ptr) || (!jsonrpc->result && !jsonrpc->error_message.ptr))
@@ -799,57 +1738,302 @@ static int get_id (json_item_t *item, intptr_t *id, int *id_len) {
 }
 
 typedef struct {
+    jsonrpc_dispatch_t *dispatch;
+    strbuf_t *out;
+    strbuf_t buf;
+    jsonrpc_method_t *method;
     json_item_t **params;
     size_t params_len;
-} list_to_array_t;
+    intptr_t id;
+    int id_len;
+    int is_notify;
+    int rc;
+    void *userdata;
+} jsonrpc_call_t;
 
-static int on_list_to_array (json_item_t *li, list_to_array_t *la) {
-    la->params[la->params_len++] = li;
-    return ENUM_CONTINUE;
+// the calls are taken by index, by the workers and by the thread that waits for them;
+// a worker whose message comes late finds nothing to take, the last one out frees it
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    jsonrpc_call_t *calls;
+    size_t len;
+    size_t next;
+    size_t done;
+    int refs;
+} jsonrpc_batch_t;
+
+jsonrpc_dispatch_t *jsonrpc_dispatch_alloc (jsonrpc_method_t *methods, pool_t *pool) {
+    jsonrpc_dispatch_t *dispatch = calloc(1, sizeof(jsonrpc_dispatch_t));
+    size_t len = 0, size = 16;
+    if (!dispatch)
+        return NULL;
+    while (methods[len].method.ptr && methods[len].method.len) ++len;
+    while (size < len * 2) size <<= 1;
+    if (!(dispatch->index = calloc(size, sizeof(uint32_t)))) {
+        free(dispatch);
+        return NULL;
+    }
+    dispatch->methods = methods;
+    dispatch->index_mask = size - 1;
+    dispatch->pool = pool;
+    for (size_t i = 0; i < len; ++i) {
+        size_t n = hash_nstr(methods[i].method.ptr, methods[i].method.len) & dispatch->index_mask;
+        while (dispatch->index[n]) n = (n + 1) & dispatch->index_mask;
+        dispatch->index[n] = i + 1;
+    }
+    return dispatch;
 }
 
-int jsonrpc_execute (strbuf_t *buf, size_t off, jsonrpc_method_t *methods, void *userdata) {
-    int rc;
+void jsonrpc_dispatch_free (jsonrpc_dispatch_t *dispatch) {
+    free(dispatch->index);
+    free(dispatch);
+}
+
+static jsonrpc_method_t *jsonrpc_find_method (jsonrpc_dispatch_t *dispatch, strptr_t *name) {
+    jsonrpc_method_t *m;
+    if (!dispatch->index) {
+        for (m = dispatch->methods; m->method.ptr && m->method.len; ++m)
+            if (0 == cmpstr(m->method.ptr, m->method.len, name->ptr, name->len))
+                return m;
+        return NULL;
+    }
+    for (size_t n = hash_nstr(name->ptr, name->len) & dispatch->index_mask; dispatch->index[n]; n = (n + 1) & dispatch->index_mask) {
+        m = &dispatch->methods[dispatch->index[n] - 1];
+        if (0 == cmpstr(m->method.ptr, m->method.len, name->ptr, name->len))
+            return m;
+    }
+    return NULL;
+}
+
+// everything but the handler itself, the params come from the arena of the document
+static void jsonrpc_prepare_call (jsonrpc_call_t *call, json_t *json, json_object_t *req) {
     jsonrpc_t jsonrpc;
+    jsonrpc_method_t *m;
     memset(&jsonrpc, 0, sizeof(jsonrpc_t));
-    if (JSONRPC_OK == (rc = jsonrpc_parse_request_len(buf->ptr + off, buf->len - off, &jsonrpc))) {
-        intptr_t id = 0;
-        int id_len = 0;
-        jsonrpc_method_t *m = methods;
-        if (0 == get_id(jsonrpc.id, &id, &id_len)) {
-            while (m->method.ptr && m->method.len && 0 != cmpstr(m->method.ptr, m->method.len, jsonrpc.method.ptr, jsonrpc.method.len))
-                m++;
-            if (m->method.ptr && m->method.len) {
-                int is_params_correct = 1;
-                list_to_array_t la = { .params = calloc(jsonrpc.params->data.a->len, sizeof(json_item_t*)), .params_len = 0 };
-                json_enum_array(jsonrpc.params->data.a, (json_item_h)on_list_to_array, &la, 0);
-                if (m->param_lens > 0 && la.params_len != m->param_lens)
-                    is_params_correct = 0;
-                if (is_params_correct && m->param_types) {
-                    for (size_t i = 0; i < la.params_len; ++i) {
-                        if (-1 == m->param_types[i])
-                            break;
-                        if (la.params[i]->type != m->param_types[i]) {
-                            is_params_correct = 0;
-                            break;
-                        }
-                    }
-                }
-                if (is_params_correct) {
-                    m->handle(buf, la.params, la.params_len, id, id_len, userdata);
-                    rc = m->id;
-                } else
-                    rc = jsonrpc_stderror(buf, JSONRPC_INVALID_PARAMS, id, id_len);
-                free(la.params);
-            } else
-                rc = jsonrpc_stderror(buf, JSONRPC_METHOD_NOT_FOUND, id, id_len);
-            if (id_len > 0)
-                free((void*)id);
-        } else
-            rc = jsonrpc_stderror(buf, JSONRPC_PARSE_ERROR, 0, 0);
+    if (!req)
+        call->rc = JSONRPC_INVALID_REQUEST;
+    else {
+        call->rc = jsonrpc_check_call(req, &jsonrpc);
+        // runs if it can, gets no response either way
+        call->is_notify = jsonrpc_is_notify(&jsonrpc, call->rc);
+        if (!jsonrpc.id && !call->is_notify && (JSONRPC_OK == call->rc || JSONRPC_INVALID_PARAMS == call->rc))
+            call->rc = JSONRPC_INVALID_REQUEST;
+    }
+    // the request is not valid enough to answer with its id
+    if (JSONRPC_OK != call->rc)
+        return;
+    if (jsonrpc.id && -1 == get_id(jsonrpc.id, &call->id, &call->id_len)) {
+        call->rc = JSONRPC_PARSE_ERROR;
+        return;
+    }
+    if (!(m = jsonrpc_find_method(call->dispatch, &jsonrpc.method))) {
+        call->rc = JSONRPC_METHOD_NOT_FOUND;
+        return;
+    }
+    json_array_t *a = jsonrpc.params->data.a;
+    if (a->len && !(call->params = arena_get(json->arena, a->len * sizeof(json_item_t*)))) {
+        call->rc = JSONRPC_INTERNAL_ERROR;
+        return;
+    }
+    if (a->head) {
+        list_item_t *li = a->head;
+        do {
+            call->params[call->params_len++] = (json_item_t*)li->ptr;
+            li = li->next;
+        } while (li != a->head);
+    }
+    if (m->param_lens > 0 && call->params_len != m->param_lens) {
+        call->rc = JSONRPC_INVALID_PARAMS;
+        return;
+    }
+    if (m->param_types) {
+        for (size_t i = 0; i < call->params_len; ++i) {
+            if (-1 == m->param_types[i])
+                break;
+            if (call->params[i]->type != m->param_types[i]) {
+                call->rc = JSONRPC_INVALID_PARAMS;
+                return;
+            }
+        }
+    }
+    call->method = m;
+}
+
+// what a notification writes to out is dropped by the caller
+static void jsonrpc_run_call (jsonrpc_call_t *call) {
+    if (call->method) {
+        call->method->handle(call->out, call->params, call->params_len, call->id, call->id_len, call->userdata);
+        call->rc = call->method->id;
     } else
-        rc = jsonrpc_stderror(buf, rc, 0, 0);
-    if (jsonrpc.json)
-        json_free(jsonrpc.json);
-    return rc;
+    if (!call->is_notify)
+        call->rc = jsonrpc_stderror(call->out, call->rc, call->id, call->id_len);
+    if (call->id_len > 0)
+        free((void*)call->id);
+}
+
+static void jsonrpc_batch_unref (jsonrpc_batch_t *batch) {
+    int refs;
+    pthread_mutex_lock(&batch->mutex);
+    refs = --batch->refs;
+    pthread_mutex_unlock(&batch->mutex);
+    if (0 == refs) {
+        pthread_cond_destroy(&batch->cond);
+        pthread_mutex_destroy(&batch->mutex);
+        free(batch);
+    }
+}
+
+// 0 once every call is taken, the calls are not touched after that
+static int jsonrpc_batch_step (jsonrpc_batch_t *batch) {
+    size_t i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_ACQ_REL);
+    if (i >= batch->len)
+        return 0;
+    jsonrpc_run_call(&batch->calls[i]);
+    pthread_mutex_lock(&batch->mutex);
+    if (++batch->done == batch->len)
+        pthread_cond_signal(&batch->cond);
+    pthread_mutex_unlock(&batch->mutex);
+    return 1;
+}
+
+// the batch comes as out_data, a POOL_FREEMSG handler gets the in_data of a message
+static int on_batch_call (void *slot_data, void *dummy, jsonrpc_batch_t *batch) {
+    while (jsonrpc_batch_step(batch));
+    jsonrpc_batch_unref(batch);
+    return MSG_DONE;
+}
+
+// the caller runs what no worker took yet and waits only for the calls in progress,
+// so a dispatch from a worker of the same pool does not wait for a free slot
+static void jsonrpc_run_batch (jsonrpc_dispatch_t *dispatch, jsonrpc_call_t *calls, size_t len) {
+    jsonrpc_batch_t *batch = calloc(1, sizeof(jsonrpc_batch_t));
+    if (!batch) {
+        for (size_t i = 0; i < len; ++i)
+            jsonrpc_run_call(&calls[i]);
+        return;
+    }
+    pthread_mutex_init(&batch->mutex, NULL);
+    pthread_cond_init(&batch->cond, NULL);
+    batch->calls = calls;
+    batch->len = len;
+    batch->refs = 1;
+    for (size_t i = 1; i < len; ++i) {
+        msg_t *msg = pool_createmsg((pool_msg_h)on_batch_call, NULL, batch, NULL, NULL, 0);
+        if (!msg)
+            break;
+        pthread_mutex_lock(&batch->mutex);
+        ++batch->refs;
+        pthread_mutex_unlock(&batch->mutex);
+        if (0 != pool_call(dispatch->pool, msg, NULL)) {
+            free(msg);
+            jsonrpc_batch_unref(batch);
+            break;
+        }
+    }
+    while (jsonrpc_batch_step(batch));
+    pthread_mutex_lock(&batch->mutex);
+    while (batch->done < batch->len)
+        pthread_cond_wait(&batch->cond, &batch->mutex);
+    pthread_mutex_unlock(&batch->mutex);
+    jsonrpc_batch_unref(batch);
+}
+
+static void jsonrpc_batch_add (strbuf_t *res, jsonrpc_call_t *call, strbuf_t *out) {
+    if (!call->is_notify && out->len > json_prefix_len) {
+        strbufadd(res, out->ptr + json_prefix_len, out->len - json_prefix_len);
+        strbufadd(res, CONST_STR_LEN(","));
+    }
+}
+
+// responses are joined in the order of the requests, the calls on the pool
+// write to their own buffers, inline calls share one
+static int jsonrpc_dispatch_batch (jsonrpc_dispatch_t *dispatch, strbuf_t *buf, json_t *json, void *userdata) {
+    json_array_t *a = json->data.a;
+    jsonrpc_call_t *calls;
+    list_item_t *li = a->head;
+    int is_pooled = dispatch->pool && a->len > 1;
+    strbuf_t res, out;
+    size_t i = 0;
+    if (0 == a->len)
+        return jsonrpc_stderror(buf, JSONRPC_INVALID_REQUEST, 0, 0);
+    if (!(calls = calloc(a->len, sizeof(jsonrpc_call_t))))
+        return jsonrpc_stderror(buf, JSONRPC_INTERNAL_ERROR, 0, 0);
+    memset(&out, 0, sizeof out);
+    memset(&res, 0, sizeof res);
+    if (-1 == strbufalloc(&res, buf->len, 1024))
+        goto nomem;
+    if (is_pooled) {
+        for (i = 0; i < a->len; ++i)
+            if (-1 == strbufalloc(&calls[i].buf, 256, 256))
+                goto nomem;
+    } else
+    if (-1 == strbufalloc(&out, 256, 256))
+        goto nomem;
+    i = 0;
+    do {
+        jsonrpc_call_t *call = &calls[i++];
+        json_item_t *req = (json_item_t*)li->ptr;
+        call->dispatch = dispatch;
+        call->userdata = userdata;
+        call->out = is_pooled ? &call->buf : &out;
+        jsonrpc_prepare_call(call, json, JSON_OBJECT == req->type ? req->data.o : NULL);
+        li = li->next;
+    } while (li != a->head);
+    if (is_pooled) {
+        jsonrpc_run_batch(dispatch, calls, a->len);
+        for (i = 0; i < a->len; ++i) {
+            jsonrpc_batch_add(&res, &calls[i], &calls[i].buf);
+            strbuf_release(&calls[i].buf);
+        }
+    } else
+        for (i = 0; i < a->len; ++i) {
+            out.len = 0;
+            jsonrpc_run_call(&calls[i]);
+            jsonrpc_batch_add(&res, &calls[i], &out);
+        }
+    // notifications only, nothing to answer
+    if (0 == res.len)
+        buf->len = 0;
+    else {
+        jsonrpc_prepare(buf);
+        json_begin_array(buf);
+        strbufadd(buf, res.ptr, res.len - 1);
+        json_end_array(buf);
+    }
+    strbuf_release(&out);
+    strbuf_release(&res);
+    free(calls);
+    return JSONRPC_OK;
+nomem:
+    for (i = 0; i < a->len; ++i)
+        strbuf_release(&calls[i].buf);
+    strbuf_release(&out);
+    strbuf_release(&res);
+    free(calls);
+    return jsonrpc_stderror(buf, JSONRPC_INTERNAL_ERROR, 0, 0);
+}
+
+int jsonrpc_dispatch (jsonrpc_dispatch_t *dispatch, strbuf_t *buf, size_t off, void *userdata) {
+    jsonrpc_call_t call = { .dispatch = dispatch, .out = buf, .userdata = userdata };
+    json_t *json = json_parse_arena_len(buf->ptr + off, buf->len - off);
+    int rc;
+    if (!json)
+        return jsonrpc_stderror(buf, JSONRPC_PARSE_ERROR, 0, 0);
+    if (JSON_ARRAY == json->type) {
+        rc = jsonrpc_dispatch_batch(dispatch, buf, json, userdata);
+        json_free(json);
+        return rc;
+    }
+    jsonrpc_prepare_call(&call, json, JSON_OBJECT == json->type ? json->data.o : NULL);
+    jsonrpc_run_call(&call);
+    json_free(json);
+    if (call.is_notify)
+        buf->len = 0;
+    return call.rc;
+}
+
+int jsonrpc_execute (strbuf_t *buf, size_t off, jsonrpc_method_t *methods, void *userdata) {
+    jsonrpc_dispatch_t dispatch = { .methods = methods, .index = NULL, .pool = NULL };
+    return jsonrpc_dispatch(&dispatch, buf, off, userdata);
 }
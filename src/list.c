@@ -6,6 +6,31 @@ list_t *lst_alloc (free_h on_free) {
     return list;
 }
 
+list_t *lst_alloc_slab (free_h on_free, slab_t *slab) {
+    list_t *list = slab && slab->arena ? arena_calloc(slab->arena, sizeof(list_t)) : calloc(1, sizeof(list_t));
+    if (!list)
+        return NULL;
+    if (slab)
+        list->slab = slab_ref(slab);
+    else if (!(list->slab = slab_alloc(sizeof(list_item_t)))) {
+        free(list);
+        return NULL;
+    }
+    list->on_free = on_free;
+    return list;
+}
+
+static inline list_item_t *lst_node_alloc (list_t *list) {
+    return list->slab ? slab_get(list->slab) : malloc(sizeof(list_item_t));
+}
+
+static inline void lst_node_free (list_t *list, list_item_t *item) {
+    if (list->slab)
+        slab_put(list->slab, item);
+    else
+        free(item);
+}
+
 void lst_clear (list_t *list) {
     while (list->head)
         lst_del(list->head);
@@ -13,13 +38,26 @@ void lst_clear (list_t *list) {
 
 void lst_free (list_t *list) {
     if (list) {
-        lst_clear(list);
-        free(list);
+        int in_arena = list->slab && list->slab->arena;
+        if (list->slab && (1 == list->slab->refs || in_arena)) {
+            // private or arena slab, release all nodes at once
+            if (list->on_free && list->head) {
+                list_item_t *li = list->head;
+                do {
+                    list->on_free(li->ptr, NULL);
+                    li = li->next;
+                } while (li != list->head);
+            }
+        } else
+            lst_clear(list);
+        slab_free(list->slab);
+        if (!in_arena)
+            free(list);
     }
 }
 
 list_item_t *lst_add (list_t *list, void *x) {
-    list_item_t *item = malloc(sizeof(list_item_t));
+    list_item_t *item = lst_node_alloc(list);
     if (!item) return NULL;
     item->ptr = x;
     if (!list->head)
@@ -37,7 +75,7 @@ list_item_t *lst_add (list_t *list, void *x) {
 }
 
 list_item_t *lst_adde (list_t *list, void *x) {
-    list_item_t *item = malloc(sizeof(list_item_t));
+    list_item_t *item = lst_node_alloc(list);
     if (!item) return NULL;
     item->ptr = x;
     if (!list->head) {
@@ -72,12 +110,48 @@ list_item_t *lst_del (list_item_t *item) {
     if (x == list->head) list->head = next;
     if (list->on_free)
         list->on_free(item->ptr, NULL);
-    free(item);
+    lst_node_free(list, item);
     --list->len;
     if (0 == list->len) next = list->head = NULL;
     return next;
 }
 
+list_item_t *lst_move (list_item_t *item, list_t *dst) {
+    list_t *src = item->list;
+    list_item_t *node = item;
+    // the new node first, the item stays in src if there is none
+    if (src->slab != dst->slab) {
+        if (!(node = lst_node_alloc(dst)))
+            return NULL;
+        node->ptr = item->ptr;
+    }
+    if (item->next == item)
+        src->head = NULL;
+    else {
+        item->prev->next = item->next;
+        item->next->prev = item->prev;
+        if (item == src->head)
+            src->head = item->next;
+    }
+    --src->len;
+    if (node != item) {
+        lst_node_free(src, item);
+        item = node;
+    }
+    if (!dst->head)
+        item->next = item->prev = item;
+    else {
+        item->next = dst->head;
+        item->prev = dst->head->prev;
+        dst->head->prev = item;
+        item->prev->next = item;
+    }
+    dst->head = item;
+    item->list = dst;
+    ++dst->len;
+    return item;
+}
+
 int lst_enum (list_t *list, list_item_h fn, void *userdata, int flags) {
     list_item_t *x = list->head;
     if (x) {
@@ -0,0 +1,149 @@
+#include "lru.h"
+
+static void *on_lru_key (void *key) {
+    return key;
+}
+
+lru_t *lru_alloc (size_t max_len, size_t max_bytes, calc_h on_hash, compare_h on_compare, copy_h on_copy, free_h on_free) {
+    lru_t *lru = calloc(1, sizeof(lru_t));
+    if (!lru)
+        return NULL;
+    if (!(lru->index = hash_alloc(max_len ? max_len + max_len / 4 : HASH_GROUP, HASH_VARSIZE | HASH_OPEN, on_hash, on_compare, on_lru_key, NULL))) {
+        free(lru);
+        return NULL;
+    }
+    lru->max_len = max_len;
+    lru->max_bytes = max_bytes;
+    lru->on_copy = on_copy;
+    lru->on_free = on_free;
+    return lru;
+}
+
+void lru_set_evict (lru_t *lru, lru_evict_h on_evict, void *userdata) {
+    lru->on_evict = on_evict;
+    lru->userdata = userdata;
+}
+
+static void lru_unlink (lru_t *lru, lru_item_t *item) {
+    if (item->next == item)
+        lru->head = NULL;
+    else {
+        item->prev->next = item->next;
+        item->next->prev = item->prev;
+        if (item == lru->head)
+            lru->head = item->next;
+    }
+}
+
+static void lru_link (lru_t *lru, lru_item_t *item) {
+    if (!lru->head)
+        item->next = item->prev = item;
+    else {
+        item->next = lru->head;
+        item->prev = lru->head->prev;
+        lru->head->prev = item;
+        item->prev->next = item;
+    }
+    lru->head = item;
+}
+
+static void lru_remove (lru_t *lru, lru_item_t *item) {
+    lru_unlink(lru, item);
+    hash_del(lru->index, item->key, item->key_len);
+    --lru->len;
+    lru->bytes -= item->size;
+    if (lru->on_free)
+        lru->on_free(item->key, item->value);
+    free(item);
+}
+
+int lru_evict (lru_t *lru) {
+    lru_item_t *item;
+    if (!lru->head)
+        return -1;
+    item = lru->head->prev;
+    ++lru->evictions;
+    if (lru->on_evict)
+        lru->on_evict(item, lru->userdata);
+    lru_remove(lru, item);
+    return 0;
+}
+
+static void lru_shrink (lru_t *lru, lru_item_t *keep) {
+    while (lru->head && lru->head->prev != keep &&
+           ((lru->max_len && lru->len > lru->max_len) || (lru->max_bytes && lru->bytes > lru->max_bytes)))
+        lru_evict(lru);
+}
+
+lru_item_t *lru_peek (lru_t *lru, void *key, size_t key_len) {
+    hash_item_t *hi = hash_get(lru->index, key, key_len);
+    return hi ? (lru_item_t*)hi->value : NULL;
+}
+
+lru_item_t *lru_get (lru_t *lru, void *key, size_t key_len) {
+    lru_item_t *item = lru_peek(lru, key, key_len);
+    if (!item) {
+        ++lru->misses;
+        return NULL;
+    }
+    ++lru->hits;
+    if (item != lru->head) {
+        lru_unlink(lru, item);
+        lru_link(lru, item);
+    }
+    return item;
+}
+
+lru_item_t *lru_put (lru_t *lru, void *key, size_t key_len, void *value, size_t size) {
+    lru_item_t *item = lru_peek(lru, key, key_len);
+    errno = 0;
+    if (item) {
+        if (lru->on_free && item->value != value)
+            lru->on_free(NULL, item->value);
+        item->value = value;
+        lru->bytes += size - item->size;
+        item->size = size;
+        if (item != lru->head) {
+            lru_unlink(lru, item);
+            lru_link(lru, item);
+        }
+        errno = EEXIST;
+    } else {
+        hash_item_t *hi;
+        if (!(item = calloc(1, sizeof(lru_item_t))))
+            return NULL;
+        item->key = lru->on_copy ? lru->on_copy(key) : key;
+        item->key_len = key_len;
+        item->value = value;
+        item->size = size;
+        if (!(hi = hash_add(lru->index, item->key, key_len))) {
+            if (lru->on_free)
+                lru->on_free(item->key, NULL);
+            free(item);
+            return NULL;
+        }
+        hi->value = item;
+        lru_link(lru, item);
+        ++lru->len;
+        lru->bytes += size;
+    }
+    lru_shrink(lru, item);
+    return item;
+}
+
+void lru_del (lru_t *lru, void *key, size_t key_len) {
+    lru_item_t *item = lru_peek(lru, key, key_len);
+    if (item)
+        lru_remove(lru, item);
+}
+
+void lru_clear (lru_t *lru) {
+    while (lru->head)
+        lru_remove(lru, lru->head);
+}
+
+void lru_free (lru_t *lru) {
+    lru_clear(lru);
+    hash_free(lru->index);
+    free(lru);
+}
@@ -13,16 +13,25 @@ static int allocate (msgbuf_t *msg, uint32_t len, uint32_t chunk_size) {
     msg->len = sizeof(uint32_t);
     msg->bufsize = bufsize;
     msg->chunk_size = chunk_size;
+    msg->id = 0;
+    if (msg->refs)
+        msg_clear_refs(msg);
     *(uint32_t*)msg->ptr = sizeof(uint32_t);
     msg->pc = msg->ptr + sizeof(uint32_t);
     return MSG_OK;
 }
 
+// the id flag stays where it is
+static inline void msg_putlen (msgbuf_t *msg) {
+    uint32_t *hdr = (uint32_t*)msg->ptr;
+    *hdr = (*hdr & MSG_ID_FLAG) | (msg->len + msg->refs_bytes);
+}
+
 ssize_t msg_buflen (const char *buf, size_t buflen) {
     ssize_t len;
     if (buflen < sizeof(uint32_t))
         return MSG_ERROR;
-    len = *(uint32_t*)buf;
+    len = *(uint32_t*)buf & MSG_LEN_MASK;
     if (len <= buflen)
         return len;
     return MSG_ERROR;
@@ -47,7 +56,9 @@ static int msg_prealloc (msgbuf_t *msg, uint32_t nstr_len) {
 //    uint32_t nstr_len = *new_len = msg->len + src_len;
     errno = 0;
     if (nstr_len >= msg->bufsize) {
-        uint32_t nbufsize = (nstr_len / msg->chunk_size) * msg->chunk_size + msg->chunk_size;
+        size_t nbufsize = strgrowsize(msg->bufsize, nstr_len, msg->chunk_size, msg->growth);
+        if (nbufsize > UINT32_MAX)
+            nbufsize = (nstr_len / msg->chunk_size) * msg->chunk_size + msg->chunk_size;
         uintptr_t pc_len = (uintptr_t)msg->pc - (uintptr_t)msg->ptr;
         buf = msg_realloc(buf, nbufsize);
         if (!buf) return MSG_ERROR;
@@ -58,6 +69,36 @@ static int msg_prealloc (msgbuf_t *msg, uint32_t nstr_len) {
     return MSG_OK;
 }
 
+int msg_reserve (msgbuf_t *msg, uint32_t add_len) {
+    return msg_prealloc(msg, msg->len + add_len);
+}
+
+// the id goes in after the length, everything behind it moves on by four bytes
+int msg_set_id (msgbuf_t *msg, uint32_t id) {
+    uint32_t *hdr;
+    int rc;
+    if (!(*(uint32_t*)msg->ptr & MSG_ID_FLAG)) {
+        if (0 == id)
+            return MSG_OK;
+        if (msg->len + msg->refs_bytes > MSG_LEN_MASK - sizeof(uint32_t)) {
+            errno = EFBIG;
+            return MSG_ERROR;
+        }
+        if (MSG_OK != (rc = msg_prealloc(msg, msg->len + sizeof(uint32_t))))
+            return rc;
+        memmove(msg->ptr + sizeof(uint32_t) * 2, msg->ptr + sizeof(uint32_t), msg->len - sizeof(uint32_t));
+        for (uint32_t i = 0; i < msg->refs_len; ++i)
+            msg->refs[i].off += sizeof(uint32_t);
+        msg->pc += sizeof(uint32_t);
+        msg->len += sizeof(uint32_t);
+        *(uint32_t*)msg->ptr |= MSG_ID_FLAG;
+        msg_putlen(msg);
+    }
+    hdr = (uint32_t*)msg->ptr;
+    hdr[1] = msg->id = id;
+    return MSG_OK;
+}
+
 int msg_setbuf (msgbuf_t *msg, void *src, uint32_t src_len) {
     uint32_t nstr_len = msg->len + src_len;
     int rc = msg_prealloc(msg, nstr_len);
@@ -65,7 +106,7 @@ int msg_setbuf (msgbuf_t *msg, void *src, uint32_t src_len) {
     memcpy(msg->pc, src, src_len);
     msg->pc += src_len;
     msg->len = nstr_len;
-    *(uint32_t*)msg->ptr = msg->len;
+    msg_putlen(msg);
     return MSG_OK;
 }
 
@@ -79,10 +120,67 @@ int msg_setstr (msgbuf_t *msg, const char *src, size_t src_len) {
     *(uint32_t*)msg->pc = 0;
     msg->pc += sizeof(uint32_t);
     msg->len = nstr_len;
-    *(uint32_t*)msg->ptr = msg->len;
+    msg_putlen(msg);
+    return MSG_OK;
+}
+
+static int msg_addref (msgbuf_t *msg, const char *src, uint32_t src_len, int flags) {
+    if (msg->refs_len == msg->refs_size) {
+        uint32_t refs_size = msg->refs_size ? msg->refs_size * 2 : 4;
+        msg_ref_t *refs = msg_realloc(msg->refs, refs_size * sizeof(msg_ref_t));
+        if (!refs) return MSG_ERROR;
+        msg->refs = refs;
+        msg->refs_size = refs_size;
+    }
+    msg->refs[msg->refs_len++] = (msg_ref_t){ .off = msg->len, .len = src_len, .ptr = src, .flags = flags };
+    msg->refs_bytes += src_len;
     return MSG_OK;
 }
 
+// same layout as msg_setstr, the length and the trailing zero stay inline
+int msg_setref (msgbuf_t *msg, const char *src, size_t src_len, int flags) {
+    int rc;
+    if (src_len < MSG_REF_MIN) {
+        rc = msg_setstr(msg, src, src_len);
+        if ((flags & MSG_REF_OWN))
+            msg_free((void*)src);
+        return rc;
+    }
+    if (src_len > MSG_LEN_MASK - msg_size(msg) - sizeof(uint32_t) * 2) {
+        errno = EFBIG;
+        rc = MSG_ERROR;
+    } else
+    if (MSG_OK == (rc = msg_setui32(msg, src_len)) && MSG_OK == (rc = msg_addref(msg, src, src_len, flags)))
+        return msg_setui32(msg, 0);
+    if ((flags & MSG_REF_OWN))
+        msg_free((void*)src);
+    return rc;
+}
+
+int msg_iov (msgbuf_t *msg, struct iovec *iov) {
+    uint32_t off = 0;
+    int cnt = 0;
+    for (uint32_t i = 0; i < msg->refs_len; ++i) {
+        msg_ref_t *ref = &msg->refs[i];
+        if (ref->off > off)
+            iov[cnt++] = (struct iovec){ .iov_base = msg->ptr + off, .iov_len = ref->off - off };
+        iov[cnt++] = (struct iovec){ .iov_base = (void*)ref->ptr, .iov_len = ref->len };
+        off = ref->off;
+    }
+    if (msg->len > off)
+        iov[cnt++] = (struct iovec){ .iov_base = msg->ptr + off, .iov_len = msg->len - off };
+    return cnt;
+}
+
+void msg_clear_refs (msgbuf_t *msg) {
+    for (uint32_t i = 0; i < msg->refs_len; ++i)
+        if ((msg->refs[i].flags & MSG_REF_OWN))
+            msg_free((void*)msg->refs[i].ptr);
+    msg_free(msg->refs);
+    msg->refs = NULL;
+    msg->refs_len = msg->refs_size = msg->refs_bytes = 0;
+}
+
 typedef struct {
     uintptr_t pc;
     msgbuf_t *msg;
@@ -120,10 +218,13 @@ int msg_load_request (msgbuf_t *msg, char *buf, size_t buflen) {
     msg->chunk_size = 0;
     if (MSG_ERROR == msg_getui32(msg, &len))
         return MSG_PARTIAL;
-    if (len > buflen)
+    if ((len & MSG_LEN_MASK) > buflen)
         return MSG_PARTIAL;
-    if (len < buflen)
+    if ((len & MSG_LEN_MASK) < buflen)
         return MSG_TOOBIG;
+    msg->id = 0;
+    if ((len & MSG_ID_FLAG) && MSG_ERROR == msg_getui32(msg, &msg->id))
+        return MSG_PARTIAL;
     if (MSG_ERROR == msg_getui32(msg, &msg->method))
         return MSG_PARTIAL;
     if (MSG_ERROR == msg_getstr(msg, &msg->cookie))
@@ -139,10 +240,13 @@ int msg_load_response (msgbuf_t *msg, char *buf, size_t buflen) {
     msg->chunk_size = 0;
     if (MSG_ERROR == msg_getui32(msg, &len))
         return MSG_PARTIAL;
-    if (len > buflen)
+    if ((len & MSG_LEN_MASK) > buflen)
         return MSG_PARTIAL;
-    if (len < buflen)
+    if ((len & MSG_LEN_MASK) < buflen)
         return MSG_TOOBIG;
+    msg->id = 0;
+    if ((len & MSG_ID_FLAG) && MSG_ERROR == msg_getui32(msg, &msg->id))
+        return MSG_PARTIAL;
     if (MSG_ERROR == msg_getui32(msg, &msg->code))
         return MSG_PARTIAL;
     if (MSG_OK == msg->code)
@@ -286,7 +390,7 @@ int msg_setmpz (msgbuf_t *msg, const mpz_t u) {
     mpz_export(msg->pc, NULL, 1, sizeof(char), 0, 0, u);
     msg->pc += src_len;
     msg->len += src_len;
-    *(uint32_t*)msg->ptr = msg->len;
+    msg_putlen(msg);
     return MSG_OK;
 }
 
@@ -1,7 +1,5 @@
 #include "net.h"
 
-#define CONN_BUF_SIZE 512
-
 mutex_h fn_lock = NULL;
 mutex_h fn_unlock = NULL;
 
@@ -12,10 +10,8 @@ int netbuf_alloc (netbuf_t *nbuf, size_t start_len, size_t chunk_size) {
 }
 
 void netbuf_free (netbuf_t *nbuf) {
-    if (nbuf->buf.ptr)
-        free(nbuf->buf.ptr);
-    if (nbuf->tail.ptr)
-        free(nbuf->tail.ptr);
+    strbuf_release(&nbuf->buf);
+    strbuf_release(&nbuf->tail);
     memset(nbuf, 0, sizeof(netbuf_t));
 }
 
@@ -32,20 +28,116 @@ int atoport (const char *service, const char *proto) {
 }
 
 int atoaddr (const char *address, struct in_addr *addr) {
-    struct hostent *host;
-    addr->s_addr = inet_addr(address);
-    if (-1 == addr->s_addr)
+    struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM }, *res;
+    if (1 == inet_pton(AF_INET, address, addr))
+        return 0;
+    if (0 != getaddrinfo(address, NULL, &hints, &res))
         return -1;
-    if (!(host = gethostbyname(address)))
+    *addr = ((struct sockaddr_in*)res->ai_addr)->sin_addr;
+    freeaddrinfo(res);
+    return 0;
+}
+
+/*****
+  resolver
+*****/
+typedef struct {
+    netaddr_t addr;
+    time_t expire;
+} netaddr_cached_t;
+
+static lru_t *resolved;
+static pthread_mutex_t resolved_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static hash_key_t on_resolved_hash (void *key, size_t key_len) {
+    return hash_nstr((const char*)key, key_len);
+}
+
+static int on_resolved_compare (void *x, void *y) {
+    return strcmp((const char*)x, (const char*)y);
+}
+
+static void *on_resolved_copy (void *key) {
+    return strdup((const char*)key);
+}
+
+static void on_resolved_free (void *key, void *value) {
+    free(key);
+    free(value);
+}
+
+static int net_getaddrinfo (const char *host, const char *service, netaddr_t *addr, int *is_numeric) {
+    struct addrinfo hints = { .ai_socktype = SOCK_STREAM, .ai_flags = AI_NUMERICHOST }, *res;
+    int rc;
+    *is_numeric = 1;
+    if (EAI_NONAME == (rc = getaddrinfo(host, service, &hints, &res))) {
+        *is_numeric = 0;
+        hints.ai_flags = AI_ADDRCONFIG;
+        rc = getaddrinfo(host, service, &hints, &res);
+    }
+    if (0 != rc) {
+        errno = EAI_SYSTEM == rc ? errno : EHOSTUNREACH;
         return -1;
-    *addr = *(struct in_addr*)*host->h_addr_list;
+    }
+    memcpy(&addr->addr, res->ai_addr, res->ai_addrlen);
+    addr->len = res->ai_addrlen;
+    freeaddrinfo(res);
     return 0;
 }
 
-int net_bind (const char *svc) {
+int net_resolve (const char *host, const char *service, netaddr_t *addr) {
+    size_t host_len = strlen(host), service_len = strlen(service);
+    char key [host_len + service_len + 2];
+    netaddr_cached_t *cached;
+    lru_item_t *item;
+    time_t now = time(0);
+    int is_numeric;
+    memcpy(key, host, host_len);
+    key[host_len] = ':';
+    memcpy(key + host_len + 1, service, service_len + 1);
+    pthread_mutex_lock(&resolved_lock);
+    if (!resolved)
+        resolved = lru_alloc(NET_RESOLVE_CACHE, LRU_UNLIMITED, on_resolved_hash, on_resolved_compare, on_resolved_copy, on_resolved_free);
+    if (resolved && (item = lru_get(resolved, key, sizeof(key) - 1)) && ((netaddr_cached_t*)item->value)->expire > now) {
+        *addr = ((netaddr_cached_t*)item->value)->addr;
+        pthread_mutex_unlock(&resolved_lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&resolved_lock);
+    // other threads do not wait for dns
+    if (-1 == net_getaddrinfo(host, service, addr, &is_numeric))
+        return -1;
+    if (!(cached = malloc(sizeof(netaddr_cached_t))))
+        return 0;
+    cached->addr = *addr;
+    cached->expire = is_numeric ? (time_t)INT64_MAX : now + NET_RESOLVE_TTL;
+    pthread_mutex_lock(&resolved_lock);
+    if (!resolved || !lru_put(resolved, key, sizeof(key) - 1, cached, sizeof(netaddr_cached_t)))
+        free(cached);
+    pthread_mutex_unlock(&resolved_lock);
+    return 0;
+}
+
+void net_resolve_clear () {
+    pthread_mutex_lock(&resolved_lock);
+    if (resolved) {
+        lru_free(resolved);
+        resolved = NULL;
+    }
+    pthread_mutex_unlock(&resolved_lock);
+}
+
+int net_bind_backlog (const char *svc, int flags, int backlog) {
     struct sockaddr_in6 inaddr;
-    int fd = socket(AF_INET6, SOCK_STREAM, 0), on = 1;
+    int fd = socket(AF_INET6, SOCK_STREAM | ((flags & NET_NONBLOCK) ? SOCK_NONBLOCK : 0), 0), on = 1;
+    if (-1 == fd)
+        return -1;
     setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    // every loop binds its own socket, the kernel spreads the connections
+    if ((flags & NET_REUSEPORT) && -1 == setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on))) {
+        close(fd);
+        return -1;
+    }
     memset(&inaddr, 0, sizeof(inaddr));
     inaddr.sin6_family = AF_INET6;
     inaddr.sin6_port = atoport(svc, "tcp");
@@ -54,13 +146,47 @@ int net_bind (const char *svc) {
         close(fd);
         return -1;
     }
-    if(listen(fd, SOMAXCONN) < 0) {
+    if(listen(fd, backlog > 0 ? backlog : SOMAXCONN) < 0) {
         close(fd);
         return -1;
     }
     return fd;
 }
 
+int net_bind_flags (const char *svc, int flags) {
+    return net_bind_backlog(svc, flags, 0);
+}
+
+int net_bind_group (const char *svc, int *fds, int n, int flags, int backlog) {
+    for (int i = 0; i < n; ++i)
+        if (-1 == (fds[i] = net_bind_backlog(svc, flags | NET_REUSEPORT, backlog))) {
+            while (i-- > 0)
+                close(fds[i]);
+            return -1;
+        }
+    if ((flags & NET_CPU_STEER) && -1 == net_steer_cpu(fds[0], n)) {
+        for (int i = 0; i < n; ++i)
+            close(fds[i]);
+        return -1;
+    }
+    return 0;
+}
+
+// the program returns the index of the socket in the group, the cpu modulo n
+int net_steer_cpu (int fd, int n) {
+    struct sock_filter code [] = {
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, n },
+        { BPF_RET | BPF_A, 0, 0, 0 }
+    };
+    struct sock_fprog prog = { .len = sizeof code / sizeof code[0], .filter = code };
+    return setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof prog);
+}
+
+int net_bind (const char *svc) {
+    return net_bind_flags(svc, 0);
+}
+
 ssize_t net_recvnb (int fd, strbuf_t *buf) {
     int done = 0, rc = -1;
     ssize_t total = 0;
@@ -72,7 +198,7 @@ ssize_t net_recvnb (int fd, strbuf_t *buf) {
                 done = 1;
                 break;
             }
-            readed = recv(fd, buf->ptr + buf->len, buf->chunk_size, 0);
+            readed = recv(fd, buf->ptr + buf->len, buf->bufsize - buf->len - 1, 0);
             if (-1 == readed) {
                 if (EAGAIN == errno)
                     errno = 0;
@@ -99,7 +225,8 @@ ssize_t net_recv (int fd, strbuf_t *buf) {
     ssize_t readed;
     if (-1 == strbufsize(buf, buf->len + buf->chunk_size, 0))
         return -1;
-    if ((readed = recv(fd, buf->ptr + buf->len, buf->chunk_size, 0)) > 0)
+    // all the free room, it is more than chunk_size once the buffer grows geometrically
+    if ((readed = recv(fd, buf->ptr + buf->len, buf->bufsize - buf->len - 1, 0)) > 0)
         buf->len += readed;
     return readed;
 }
@@ -125,48 +252,186 @@ ssize_t net_write (int fd, char *buf, size_t size, void *locker) {
     return sent;
 }
 
+/*****
+  output queue
+*****/
+void netout_init (netout_t *out, size_t high, size_t low, netout_h on_drain, void *userdata) {
+    memset(out, 0, sizeof(netout_t));
+    out->high = high ? high : NET_OUT_HIGH;
+    out->low = high ? low : NET_OUT_LOW;
+    out->on_drain = on_drain;
+    out->userdata = userdata;
+}
+
+void netout_free (netout_t *out) {
+    while (out->head) {
+        netout_block_t *block = out->head;
+        out->head = block->next;
+        free(block);
+    }
+    out->tail = NULL;
+    out->off = out->queued = 0;
+    out->is_full = 0;
+}
+
+static netout_block_t *netout_block (netout_t *out, size_t len) {
+    size_t size = len > NET_OUT_BLOCK ? len : NET_OUT_BLOCK;
+    netout_block_t *block = malloc(sizeof(netout_block_t) + size);
+    if (!block)
+        return NULL;
+    block->next = NULL;
+    block->len = 0;
+    block->size = size;
+    if (out->tail)
+        out->tail->next = block;
+    else
+        out->head = block;
+    out->tail = block;
+    return block;
+}
+
+// bytes already queued are never moved, a writer may have them in flight
+int netout_add (netout_t *out, const char *buf, size_t len) {
+    netout_block_t *block = out->tail;
+    size_t n;
+    if (!len)
+        return 0;
+    if (!out->queued)
+        clock_gettime(CLOCK_MONOTONIC, &out->since);
+    if (block && (n = block->size - block->len) > 0) {
+        if (n > len)
+            n = len;
+        memcpy(block->data + block->len, buf, n);
+        block->len += n;
+        buf += n;
+        len -= n;
+        out->queued += n;
+    }
+    if (len) {
+        if (!(block = netout_block(out, len)))
+            return -1;
+        memcpy(block->data, buf, len);
+        block->len = len;
+        out->queued += len;
+    }
+    if (out->queued > out->stat.max_queued)
+        out->stat.max_queued = out->queued;
+    if (out->queued >= out->high)
+        out->is_full = 1;
+    return 0;
+}
+
+int netout_iov (netout_t *out, struct iovec *iov, int max) {
+    netout_block_t *block = out->head;
+    int n = 0;
+    if (block && max > 0) {
+        iov[n].iov_base = block->data + out->off;
+        iov[n++].iov_len = block->len - out->off;
+        block = block->next;
+    }
+    for (; block && n < max; block = block->next, ++n) {
+        iov[n].iov_base = block->data;
+        iov[n].iov_len = block->len;
+    }
+    return n;
+}
+
+void netout_consume (netout_t *out, size_t nbytes) {
+    out->stat.bytes += nbytes;
+    out->queued -= nbytes;
+    while (nbytes) {
+        netout_block_t *block = out->head;
+        size_t n = block->len - out->off;
+        if (nbytes < n) {
+            out->off += nbytes;
+            break;
+        }
+        nbytes -= n;
+        out->off = 0;
+        // the tail keeps taking small writes
+        if (block == out->tail) {
+            block->len = 0;
+            break;
+        }
+        out->head = block->next;
+        free(block);
+    }
+    if (!out->queued) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        out->stat.flush_us = (ts.tv_sec - out->since.tv_sec) * 1000000 + (ts.tv_nsec - out->since.tv_nsec) / 1000;
+        if (out->stat.flush_us > out->stat.max_flush_us)
+            out->stat.max_flush_us = out->stat.flush_us;
+    }
+    if (out->is_full && out->queued <= out->low) {
+        out->is_full = 0;
+        if (out->on_drain)
+            out->on_drain(out, out->userdata);
+    }
+}
+
+// sockets take a sendmsg without SIGPIPE, pipes and files a writev
+static ssize_t netout_writev (netout_t *out, int fd, struct iovec *iov, int n) {
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = n };
+    ssize_t wrote;
+    if (!out->is_notsock) {
+        if (-1 != (wrote = sendmsg(fd, &msg, MSG_NOSIGNAL)) || ENOTSOCK != errno)
+            return wrote;
+        out->is_notsock = 1;
+    }
+    return writev(fd, iov, n);
+}
+
+// one lock and one write for up to NET_OUT_IOV blocks
+int netout_flush (netout_t *out, int fd, void *locker) {
+    struct iovec iov [NET_OUT_IOV];
+    while (out->queued) {
+        int n = netout_iov(out, iov, NET_OUT_IOV);
+        ssize_t wrote;
+        if (locker && fn_lock && fn_unlock) {
+            fn_lock(locker);
+            wrote = netout_writev(out, fd, iov, n);
+            fn_unlock(locker);
+        } else
+            wrote = netout_writev(out, fd, iov, n);
+        ++out->stat.writes;
+        if (wrote > 0)
+            netout_consume(out, wrote);
+        else
+        if (-1 == wrote && EINTR != errno)
+            return EAGAIN == errno ? NET_WAIT : NET_ERROR;
+    }
+    return NET_OK;
+}
+
+int net_connect_start (const netaddr_t *addr) {
+    int fd = socket(addr->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (-1 == fd)
+        return -1;
+    if (-1 == connect(fd, (const struct sockaddr*)&addr->addr, addr->len) && EINPROGRESS != errno) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
 int net_connect (char *to_addr, char *service, int timeout) {
-    int port, sock, rc = -1, flags, err;
-    socklen_t len = sizeof(err);
-    struct in_addr addr;
-    struct sockaddr_in in_addr;
-    fd_set rd, wr, ex;
-    memset(&addr, 0, sizeof(struct in_addr));
-    if (-1 == (port = atoport(service, "tcp")) || (-1 == atoaddr(to_addr, &addr)))
+    struct pollfd pfd = { .events = POLLOUT };
+    socklen_t len = sizeof(int);
+    netaddr_t addr;
+    int rc, err = 0;
+    if (-1 == net_resolve(to_addr, service, &addr) || -1 == (pfd.fd = net_connect_start(&addr)))
         return -1;
-    memset(&in_addr, 0, sizeof in_addr);
-    in_addr.sin_family = AF_INET;
-    in_addr.sin_port = port;
-    in_addr.sin_addr.s_addr = addr.s_addr;
-    sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (timeout > 0) {
-        if (0 > (flags = fcntl(sock, F_GETFL, 0)) ||
-            0 > fcntl(sock, F_SETFL, flags | O_NONBLOCK) ||
-            ((rc = connect(sock, (struct sockaddr*)&in_addr, sizeof in_addr)) && EINPROGRESS != errno))
-            goto err;
-    } else
-    if (0 == (rc = connect(sock, (struct sockaddr*)&in_addr, sizeof in_addr))) {
-        if (0 > (flags = fcntl(sock, F_GETFL, 0)) || 0 > fcntl(sock, F_SETFL, O_NONBLOCK | flags))
-            goto err;
-        return sock;
-    } else
-        goto err;
-    FD_ZERO(&rd);
-    FD_SET(sock, &rd);
-    wr = rd = ex;
-    long ns = (timeout % 1000) * 1000000;
-    struct timeval tv = { .tv_sec = timeout / 1000 + (ns / 1000000000), .tv_usec = ns % 1000000000 };
-    if (0 > (rc = select(sock+1, &rd, &wr, &ex, &tv)))
-        goto err;
+    while (-1 == (rc = poll(&pfd, 1, timeout > 0 ? timeout : -1)) && EINTR == errno);
     if (0 == rc)
-        goto err;
-    errno = 0;
-    if (!FD_ISSET(sock, &rd) && !FD_ISSET(sock, &wr))  return 0;
-    if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len) < 0) return 0;
-    errno = err;
-    if (0 == err) return sock;
-    return sock;
-err:
-    close(sock);
-    return -1;
+        err = ETIMEDOUT;
+    else
+    if (-1 == rc || -1 == getsockopt(pfd.fd, SOL_SOCKET, SO_ERROR, &err, &len))
+        err = errno;
+    if (err) {
+        close(pfd.fd);
+        errno = err;
+        return -1;
+    }
+    return pfd.fd;
 }
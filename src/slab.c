@@ -0,0 +1,86 @@
+#include "slab.h"
+
+#define SLAB_ALIGN sizeof(void*)
+
+static void slab_init (slab_t *slab, size_t item_size) {
+    if (item_size < sizeof(void*))
+        item_size = sizeof(void*);
+    slab->item_size = (item_size + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1);
+    slab->chunk_items = SLAB_MIN_ITEMS;
+    slab->refs = 1;
+}
+
+slab_t *slab_alloc (size_t item_size) {
+    slab_t *slab = calloc(1, sizeof(slab_t));
+    if (!slab)
+        return NULL;
+    slab_init(slab, item_size);
+    return slab;
+}
+
+slab_t *slab_alloc_arena (size_t item_size, arena_t *arena) {
+    slab_t *slab = arena_calloc(arena, sizeof(slab_t));
+    if (!slab)
+        return NULL;
+    slab_init(slab, item_size);
+    // small documents shouldn't pull a fresh arena block for the first chunk
+    slab->chunk_items = SLAB_MIN_ITEMS / 8;
+    slab->arena = arena;
+    return slab;
+}
+
+slab_t *slab_ref (slab_t *slab) {
+    ++slab->refs;
+    return slab;
+}
+
+static int slab_grow (slab_t *slab) {
+    size_t hdr = (sizeof(slab_chunk_t) + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1);
+    slab_chunk_t *chunk;
+    if (slab->arena) {
+        if (!(slab->cur = arena_get(slab->arena, slab->chunk_items * slab->item_size)))
+            return -1;
+    } else {
+        if (!(chunk = malloc(hdr + slab->chunk_items * slab->item_size)))
+            return -1;
+        chunk->next = slab->chunks;
+        slab->chunks = chunk;
+        slab->cur = (char*)chunk + hdr;
+    }
+    slab->end = slab->cur + slab->chunk_items * slab->item_size;
+    if (slab->chunk_items < SLAB_MAX_ITEMS)
+        slab->chunk_items *= 2;
+    return 0;
+}
+
+void *slab_get (slab_t *slab) {
+    void *item;
+    if ((item = slab->free_items))
+        slab->free_items = *(void**)item;
+    else {
+        if (slab->cur == slab->end && -1 == slab_grow(slab))
+            return NULL;
+        item = slab->cur;
+        slab->cur += slab->item_size;
+    }
+    ++slab->len;
+    return item;
+}
+
+void slab_put (slab_t *slab, void *item) {
+    *(void**)item = slab->free_items;
+    slab->free_items = item;
+    --slab->len;
+}
+
+void slab_free (slab_t *slab) {
+    if (slab && 0 == --slab->refs && !slab->arena) {
+        slab_chunk_t *chunk = slab->chunks;
+        while (chunk) {
+            slab_chunk_t *next = chunk->next;
+            free(chunk);
+            chunk = next;
+        }
+        free(slab);
+    }
+}
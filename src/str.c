@@ -1,26 +1,40 @@
 #include "str.h"
 
+size_t strgrowsize (size_t bufsize, size_t nlen, size_t chunk_size, int growth) {
+    size_t nbufsize = (nlen / chunk_size) * chunk_size + chunk_size, step;
+    switch (growth) {
+        case STR_GROW_DOUBLE: step = bufsize; break;
+        case STR_GROW_HALF: step = bufsize / 2 < STR_GROW_CAP ? bufsize / 2 : STR_GROW_CAP; break;
+        default: return nbufsize;
+    }
+    if (nbufsize < bufsize + step)
+        nbufsize = ((bufsize + step + chunk_size - 1) / chunk_size) * chunk_size;
+    return nbufsize;
+}
+
 str_t *stralloc (size_t len, size_t chunk_size) {
     size_t bufsize = (len / chunk_size) * chunk_size + chunk_size;
     if (len == bufsize) bufsize += chunk_size;
-    str_t *ret = malloc(sizeof(size_t)*3 + bufsize);
+    str_t *ret = malloc(sizeof(str_t) + bufsize);
     if (!ret) return NULL;
     ret->ptr[0] = '\0';
     ret->len = 0;
     ret->bufsize = bufsize;
     ret->chunk_size = chunk_size;
+    ret->growth = STR_GROW_FIXED;
     return ret;
 }
 
 wstr_t *wstralloc (size_t len, size_t chunk_size) {
     size_t bufsize = (len / chunk_size) * chunk_size + chunk_size;
     if (len == bufsize) bufsize += chunk_size;
-    wstr_t *ret = malloc(sizeof(size_t)*3 + bufsize * sizeof(wchar_t));
+    wstr_t *ret = malloc(sizeof(wstr_t) + bufsize * sizeof(wchar_t));
     if (!ret) return NULL;
     ret->ptr[0] = '\0';
     ret->len = 0;
     ret->bufsize = bufsize;
     ret->chunk_size = chunk_size;
+    ret->growth = STR_GROW_FIXED;
     return ret;
 }
 
@@ -50,7 +64,9 @@ int strsize (str_t **str, size_t nlen, int flags) {
     errno = 0;
     if (bufsize == s->bufsize) return 0;
     if (!(flags & STR_REDUCE) && bufsize < s->bufsize) return 0;
-    s = realloc(s, sizeof(size_t)*3 + bufsize);
+    if (bufsize > s->bufsize)
+        bufsize = strgrowsize(s->bufsize, nlen, s->chunk_size, s->growth);
+    s = realloc(s, sizeof(str_t) + bufsize);
     if (!s) return -1;
     errno = ERANGE;
     s->bufsize = bufsize;
@@ -209,8 +225,8 @@ int strepl (str_t **str, char *dst_pos, size_t dst_len, const char *src_pos, siz
     if (dst_len < src_len) {
         size_t dv = src_len - dst_len;
         if (s->bufsize <= s->len + dv) {
-            size_t nbufsize = ((1 + s->len + dv) / s->chunk_size) * s->chunk_size + s->chunk_size, dst = (uintptr_t)dst_pos - (uintptr_t)s->ptr;
-            str_t *nstr = realloc(s, nbufsize + sizeof(size_t) * 3);
+            size_t nbufsize = strgrowsize(s->bufsize, 1 + s->len + dv, s->chunk_size, s->growth), dst = (uintptr_t)dst_pos - (uintptr_t)s->ptr;
+            str_t *nstr = realloc(s, nbufsize + sizeof(str_t));
             errno = ERANGE;
             if (!nstr) return -1;
             s = *str = nstr;
@@ -265,8 +281,8 @@ int strnadd (str_t **str, const char *src, size_t src_len) {
     str_t *s = *str;
     size_t nstr_len = s->len + src_len;
     if (nstr_len >= s->bufsize) {
-        size_t nbufsize = (nstr_len / s->chunk_size) * s->chunk_size + s->chunk_size;
-        str_t *nstr = realloc(s, sizeof(size_t)*3 + nbufsize);
+        size_t nbufsize = strgrowsize(s->bufsize, nstr_len, s->chunk_size, s->growth);
+        str_t *nstr = realloc(s, sizeof(str_t) + nbufsize);
         if (!nstr) return -1;
         s = *str = nstr;
         s->bufsize = nbufsize;
@@ -281,8 +297,8 @@ int wstrnadd (wstr_t **str, const wchar_t *src, size_t src_len) {
     wstr_t *s = *str;
     size_t nstr_len = s->len + src_len;
     if (nstr_len >= s->bufsize) {
-        size_t nbufsize = (nstr_len / s->chunk_size) * s->chunk_size + s->chunk_size;
-        wstr_t *nstr = realloc(s, sizeof(size_t)*3 + nbufsize * sizeof(wchar_t));
+        size_t nbufsize = strgrowsize(s->bufsize, nstr_len, s->chunk_size, s->growth);
+        wstr_t *nstr = realloc(s, sizeof(wstr_t) + nbufsize * sizeof(wchar_t));
         if (!nstr) return -1;
         s = *str = nstr;
         s->bufsize = nbufsize;
@@ -403,17 +419,125 @@ int wcmpcasestr (const wchar_t *x, size_t x_len, const wchar_t *y, size_t y_len)
     return wcsncasecmp(x, y, x_len);
 }
 
+typedef struct {
+    void *heads [STRBUF_POOL_CLASSES];
+    strbuf_pool_stat_t stat;
+} strbuf_pool_t;
+
+static size_t strbuf_pool_max = 0;
+static __thread strbuf_pool_t *strbuf_pool = NULL;
+static pthread_key_t strbuf_pool_key;
+static pthread_once_t strbuf_pool_once = PTHREAD_ONCE_INIT;
+
+static void strbuf_pool_free (strbuf_pool_t *pool) {
+    for (int i = 0; i < STRBUF_POOL_CLASSES; ++i)
+        while (pool->heads[i]) {
+            void *next = *(void**)pool->heads[i];
+            free(pool->heads[i]);
+            pool->heads[i] = next;
+        }
+    pool->stat.retained = 0;
+}
+
+// the buffers of a thread are freed when it exits, a later destructor
+// that uses a strbuf_t gets a new pool
+static void on_strbuf_pool_exit (void *pool) {
+    strbuf_pool_free(pool);
+    free(pool);
+    strbuf_pool = NULL;
+}
+
+static void strbuf_pool_init () {
+    pthread_key_create(&strbuf_pool_key, on_strbuf_pool_exit);
+}
+
+static strbuf_pool_t *strbuf_pool_get () {
+    if (!strbuf_pool) {
+        pthread_once(&strbuf_pool_once, strbuf_pool_init);
+        if (!(strbuf_pool = calloc(1, sizeof(strbuf_pool_t))))
+            return NULL;
+        pthread_setspecific(strbuf_pool_key, strbuf_pool);
+    }
+    return strbuf_pool;
+}
+
+void strbuf_pool_setmax (size_t max_bytes) {
+    strbuf_pool_max = max_bytes;
+}
+
+void strbuf_pool_stat (strbuf_pool_stat_t *stat) {
+    if (strbuf_pool)
+        *stat = strbuf_pool->stat;
+    else
+        memset(stat, 0, sizeof(strbuf_pool_stat_t));
+}
+
+void strbuf_pool_clear () {
+    if (strbuf_pool)
+        strbuf_pool_free(strbuf_pool);
+}
+
+// a buffer of the smallest class that holds bufsize, the class size is the new bufsize
+static char *strbuf_pool_take (size_t *bufsize) {
+    strbuf_pool_t *pool;
+    int n = *bufsize <= STRBUF_POOL_MIN ? 0 : 64 - __builtin_clzl(*bufsize - 1) - __builtin_ctzl(STRBUF_POOL_MIN);
+    char *buf;
+    if (n >= STRBUF_POOL_CLASSES || !(pool = strbuf_pool_get()))
+        return NULL;
+    *bufsize = (size_t)STRBUF_POOL_MIN << n;
+    if ((buf = pool->heads[n])) {
+        pool->heads[n] = *(void**)buf;
+        pool->stat.retained -= *bufsize;
+        ++pool->stat.hits;
+        return buf;
+    }
+    ++pool->stat.misses;
+    return malloc(*bufsize);
+}
+
+static int strbuf_pool_put (strbuf_pool_t *pool, char *buf, int n) {
+    size_t size = (size_t)STRBUF_POOL_MIN << n;
+    // the other classes give way, largest first, so the sizes in use stay
+    for (int i = STRBUF_POOL_CLASSES - 1; i >= 0 && pool->stat.retained + size > strbuf_pool_max; --i)
+        while (i != n && pool->heads[i] && pool->stat.retained + size > strbuf_pool_max) {
+            void *next = *(void**)pool->heads[i];
+            free(pool->heads[i]);
+            pool->heads[i] = next;
+            pool->stat.retained -= (size_t)STRBUF_POOL_MIN << i;
+        }
+    if (pool->stat.retained + size > strbuf_pool_max)
+        return -1;
+    *(void**)buf = pool->heads[n];
+    pool->heads[n] = buf;
+    pool->stat.retained += size;
+    ++pool->stat.releases;
+    return 0;
+}
+
+void strbuf_release (strbuf_t *strbuf) {
+    strbuf_pool_t *pool;
+    int n;
+    if (!strbuf->ptr)
+        return;
+    // the largest class that fits in the buffer
+    n = strbuf->bufsize < STRBUF_POOL_MIN ? -1 : 63 - __builtin_clzl(strbuf->bufsize) - __builtin_ctzl(STRBUF_POOL_MIN);
+    if (n < 0 || n >= STRBUF_POOL_CLASSES || !strbuf_pool_max || !(pool = strbuf_pool_get()) || -1 == strbuf_pool_put(pool, strbuf->ptr, n))
+        free(strbuf->ptr);
+    strbuf->ptr = NULL;
+    strbuf->len = strbuf->bufsize = 0;
+}
+
 int strbufalloc (strbuf_t *strbuf, size_t len, size_t chunk_size) {
     size_t bufsize = (len / chunk_size) * chunk_size + chunk_size;
     if (len == bufsize) bufsize += chunk_size;
-    char *buf = calloc(1, bufsize);
-    if (!buf) return -1;
-    buf[0] = '\0';
+    char *buf = strbuf_pool_max ? strbuf_pool_take(&bufsize) : NULL;
+    if (!buf && !(buf = calloc(1, bufsize))) return -1;
     strbuf->ptr = buf;
     strbuf->ptr[0] = '\0';
     strbuf->len = 0;
     strbuf->bufsize = bufsize;
     strbuf->chunk_size = chunk_size;
+    strbuf->growth = STR_GROW_FIXED;
     return 0;
 }
 
@@ -423,6 +547,8 @@ int strbufsize (strbuf_t *strbuf, size_t nlen, int flags) {
     errno = 0;
     if (bufsize == strbuf->bufsize) return 0;
     if (!(flags & STR_REDUCE) && bufsize < strbuf->bufsize) return 0;
+    if (bufsize > strbuf->bufsize)
+        bufsize = strgrowsize(strbuf->bufsize, nlen, strbuf->chunk_size, strbuf->growth);
     buf = realloc(buf, bufsize);
     if (!buf) return -1;
     errno = ERANGE;
@@ -443,7 +569,7 @@ int strbufadd (strbuf_t *strbuf, const char *src, size_t src_len) {
     char *buf = strbuf->ptr;
     size_t nstr_len = strbuf->len + src_len;
     if (nstr_len >= strbuf->bufsize) {
-        size_t nbufsize = (nstr_len / strbuf->chunk_size) * strbuf->chunk_size + strbuf->chunk_size;
+        size_t nbufsize = strgrowsize(strbuf->bufsize, nstr_len, strbuf->chunk_size, strbuf->growth);
         buf = realloc(buf, nbufsize);
         if (!buf) return -1;
         strbuf->ptr = buf;
@@ -462,6 +588,293 @@ int strbufset (strbuf_t *buf, const char c, size_t len) {
     return 0;
 }
 
+static const char digits2 [] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static const uint64_t pow10_u64 [] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL,
+    10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL, 100000000000000ULL,
+    1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL, 1000000000000000000ULL,
+    10000000000000000000ULL
+};
+
+static inline int count_digits (uint64_t val) {
+    int n = 1;
+    while (n < 20 && val >= pow10_u64[n]) ++n;
+    return n;
+}
+
+// writes from the end, two digits per step
+static inline void put_digits (uint64_t val, char *end) {
+    while (val >= 100) {
+        const char *d = &digits2[(val % 100) * 2];
+        val /= 100;
+        *--end = d[1];
+        *--end = d[0];
+    }
+    if (val >= 10) {
+        *--end = digits2[val * 2 + 1];
+        *--end = digits2[val * 2];
+    } else
+        *--end = '0' + val;
+}
+
+size_t ultostr (uint64_t val, char *buf) {
+    int n = count_digits(val);
+    put_digits(val, buf + n);
+    return n;
+}
+
+size_t ltostr (int64_t val, char *buf) {
+    if (val < 0) {
+        *buf = '-';
+        return ultostr(-(uint64_t)val, buf + 1) + 1;
+    }
+    return ultostr(val, buf);
+}
+
+#if __SIZEOF_INT128__ && LDBL_MANT_DIG <= 64
+// exact, rounds a tie to even like printf
+static size_t fixed_dtostr (long double val, int prec, char *buf) {
+    int ex, neg = signbit(val);
+    long double fr = frexpl(fabsl(val), &ex);
+    uint64_t m = (uint64_t)ldexpl(fr, 64), q, ip, fp;
+    unsigned __int128 n = (unsigned __int128)m * pow10_u64[prec];
+    int e = ex - 64;
+    char *p = buf;
+    if (e >= 0) {
+        if (e >= 63 || (n >> (63 - e)))
+            return 0;
+        q = (uint64_t)n << e;
+    } else
+    if (-e >= 128)
+        q = 0;
+    else {
+        unsigned __int128 r, half;
+        if ((n >> -e) >> 63)
+            return 0;
+        q = (uint64_t)(n >> -e);
+        r = n & (((unsigned __int128)1 << -e) - 1);
+        half = (unsigned __int128)1 << (-e - 1);
+        if (r > half || (r == half && (q & 1)))
+            ++q;
+    }
+    ip = q / pow10_u64[prec];
+    fp = q % pow10_u64[prec];
+    if (neg)
+        *p++ = '-';
+    p += ultostr(ip, p);
+    if (prec > 0) {
+        *p++ = '.';
+        put_digits(fp, p + prec);
+        memset(p, '0', prec - count_digits(fp));
+        p += prec;
+    }
+    return (uintptr_t)p - (uintptr_t)buf;
+}
+#endif
+
+size_t dtostr_p (long double val, int prec, char *buf) {
+    #if __SIZEOF_INT128__ && LDBL_MANT_DIG <= 64
+    size_t len;
+    if (prec >= 0 && prec <= 18 && isfinite(val) && (len = fixed_dtostr(val, prec, buf)))
+        return len;
+    #endif
+    int n = snprintf(buf, DTOSTR_BUFSIZE, "%.*Lf", prec, val);
+    return n < DTOSTR_BUFSIZE ? n : DTOSTR_BUFSIZE - 1;
+}
+
+#if __SIZEOF_INT128__
+/* shortest representation that reads back to the same double, grisu2 by Florian Loitsch */
+
+typedef struct {
+    uint64_t f;
+    int e;
+} diyfp_t;
+
+static const struct {
+    uint64_t f;
+    int16_t e;
+} cached_powers [] = {
+    { 0xfa8fd5a0081c0288ULL, -1220 }, { 0xbaaee17fa23ebf76ULL, -1193 }, { 0x8b16fb203055ac76ULL, -1166 },
+    { 0xcf42894a5dce35eaULL, -1140 }, { 0x9a6bb0aa55653b2dULL, -1113 }, { 0xe61acf033d1a45dfULL, -1087 },
+    { 0xab70fe17c79ac6caULL, -1060 }, { 0xff77b1fcbebcdc4fULL, -1034 }, { 0xbe5691ef416bd60cULL, -1007 },
+    { 0x8dd01fad907ffc3cULL, -980 }, { 0xd3515c2831559a83ULL, -954 }, { 0x9d71ac8fada6c9b5ULL, -927 },
+    { 0xea9c227723ee8bcbULL, -901 }, { 0xaecc49914078536dULL, -874 }, { 0x823c12795db6ce57ULL, -847 },
+    { 0xc21094364dfb5637ULL, -821 }, { 0x9096ea6f3848984fULL, -794 }, { 0xd77485cb25823ac7ULL, -768 },
+    { 0xa086cfcd97bf97f4ULL, -741 }, { 0xef340a98172aace5ULL, -715 }, { 0xb23867fb2a35b28eULL, -688 },
+    { 0x84c8d4dfd2c63f3bULL, -661 }, { 0xc5dd44271ad3cdbaULL, -635 }, { 0x936b9fcebb25c996ULL, -608 },
+    { 0xdbac6c247d62a584ULL, -582 }, { 0xa3ab66580d5fdaf6ULL, -555 }, { 0xf3e2f893dec3f126ULL, -529 },
+    { 0xb5b5ada8aaff80b8ULL, -502 }, { 0x87625f056c7c4a8bULL, -475 }, { 0xc9bcff6034c13053ULL, -449 },
+    { 0x964e858c91ba2655ULL, -422 }, { 0xdff9772470297ebdULL, -396 }, { 0xa6dfbd9fb8e5b88fULL, -369 },
+    { 0xf8a95fcf88747d94ULL, -343 }, { 0xb94470938fa89bcfULL, -316 }, { 0x8a08f0f8bf0f156bULL, -289 },
+    { 0xcdb02555653131b6ULL, -263 }, { 0x993fe2c6d07b7facULL, -236 }, { 0xe45c10c42a2b3b06ULL, -210 },
+    { 0xaa242499697392d3ULL, -183 }, { 0xfd87b5f28300ca0eULL, -157 }, { 0xbce5086492111aebULL, -130 },
+    { 0x8cbccc096f5088ccULL, -103 }, { 0xd1b71758e219652cULL, -77 }, { 0x9c40000000000000ULL, -50 },
+    { 0xe8d4a51000000000ULL, -24 }, { 0xad78ebc5ac620000ULL, 3 }, { 0x813f3978f8940984ULL, 30 },
+    { 0xc097ce7bc90715b3ULL, 56 }, { 0x8f7e32ce7bea5c70ULL, 83 }, { 0xd5d238a4abe98068ULL, 109 },
+    { 0x9f4f2726179a2245ULL, 136 }, { 0xed63a231d4c4fb27ULL, 162 }, { 0xb0de65388cc8ada8ULL, 189 },
+    { 0x83c7088e1aab65dbULL, 216 }, { 0xc45d1df942711d9aULL, 242 }, { 0x924d692ca61be758ULL, 269 },
+    { 0xda01ee641a708deaULL, 295 }, { 0xa26da3999aef774aULL, 322 }, { 0xf209787bb47d6b85ULL, 348 },
+    { 0xb454e4a179dd1877ULL, 375 }, { 0x865b86925b9bc5c2ULL, 402 }, { 0xc83553c5c8965d3dULL, 428 },
+    { 0x952ab45cfa97a0b3ULL, 455 }, { 0xde469fbd99a05fe3ULL, 481 }, { 0xa59bc234db398c25ULL, 508 },
+    { 0xf6c69a72a3989f5cULL, 534 }, { 0xb7dcbf5354e9beceULL, 561 }, { 0x88fcf317f22241e2ULL, 588 },
+    { 0xcc20ce9bd35c78a5ULL, 614 }, { 0x98165af37b2153dfULL, 641 }, { 0xe2a0b5dc971f303aULL, 667 },
+    { 0xa8d9d1535ce3b396ULL, 694 }, { 0xfb9b7cd9a4a7443cULL, 720 }, { 0xbb764c4ca7a44410ULL, 747 },
+    { 0x8bab8eefb6409c1aULL, 774 }, { 0xd01fef10a657842cULL, 800 }, { 0x9b10a4e5e9913129ULL, 827 },
+    { 0xe7109bfba19c0c9dULL, 853 }, { 0xac2820d9623bf429ULL, 880 }, { 0x80444b5e7aa7cf85ULL, 907 },
+    { 0xbf21e44003acdd2dULL, 933 }, { 0x8e679c2f5e44ff8fULL, 960 }, { 0xd433179d9c8cb841ULL, 986 },
+    { 0x9e19db92b4e31ba9ULL, 1013 }, { 0xeb96bf6ebadf77d9ULL, 1039 }, { 0xaf87023b9bf0ee6bULL, 1066 },
+};
+
+static inline diyfp_t diyfp_mul (diyfp_t x, diyfp_t y) {
+    unsigned __int128 p = (unsigned __int128)x.f * y.f;
+    uint64_t h = p >> 64, l = (uint64_t)p;
+    return (diyfp_t){ .f = h + (l >> 63), .e = x.e + y.e + 64 };
+}
+
+static inline diyfp_t diyfp_normalize (diyfp_t x) {
+    int s = __builtin_clzll(x.f);
+    return (diyfp_t){ .f = x.f << s, .e = x.e - s };
+}
+
+static void grisu_round (char *buf, int len, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w) {
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+           (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+        buf[len - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+static int grisu_digits (diyfp_t w, diyfp_t mp, uint64_t delta, char *buf, int *k) {
+    diyfp_t one = { .f = 1ULL << -mp.e, .e = mp.e };
+    uint64_t wp_w = mp.f - w.f, p2 = mp.f & (one.f - 1);
+    uint32_t p1 = mp.f >> -one.e;
+    int kappa = count_digits(p1), len = 0;
+    while (kappa > 0) {
+        uint32_t d = p1 / pow10_u64[kappa - 1];
+        p1 %= pow10_u64[kappa - 1];
+        if (d || len)
+            buf[len++] = '0' + d;
+        --kappa;
+        uint64_t tmp = ((uint64_t)p1 << -one.e) + p2;
+        if (tmp <= delta) {
+            *k += kappa;
+            grisu_round(buf, len, delta, tmp, pow10_u64[kappa] << -one.e, wp_w);
+            return len;
+        }
+    }
+    while (1) {
+        p2 *= 10;
+        delta *= 10;
+        char d = p2 >> -one.e;
+        if (d || len)
+            buf[len++] = '0' + d;
+        p2 &= one.f - 1;
+        --kappa;
+        if (p2 < delta) {
+            *k += kappa;
+            grisu_round(buf, len, delta, p2, one.f, -kappa < 20 ? wp_w * pow10_u64[-kappa] : 0);
+            return len;
+        }
+    }
+}
+
+static int grisu2 (double val, char *buf, int *k) {
+    union { double d; uint64_t u; } u = { .d = val };
+    int be = (u.u >> 52) & 0x7ff;
+    uint64_t sig = u.u & ((1ULL << 52) - 1);
+    diyfp_t v = be ? (diyfp_t){ .f = sig | (1ULL << 52), .e = be - 1075 } : (diyfp_t){ .f = sig, .e = -1074 },
+            pl = { .f = (v.f << 1) + 1, .e = v.e - 1 }, mi, c;
+    while (!(pl.f & (1ULL << 53))) {
+        pl.f <<= 1;
+        pl.e--;
+    }
+    pl.f <<= 10;
+    pl.e -= 10;
+    mi = (1ULL << 52) == v.f ? (diyfp_t){ .f = (v.f << 2) - 1, .e = v.e - 2 } : (diyfp_t){ .f = (v.f << 1) - 1, .e = v.e - 1 };
+    mi.f <<= mi.e - pl.e;
+    mi.e = pl.e;
+    // the cached power brings the exponent of the upper boundary into [-60, -32]
+    double dk = (-61 - pl.e) * 0.30102999566398114 + 347;
+    int ck = (int)dk;
+    if (dk - ck > 0)
+        ++ck;
+    int idx = (ck >> 3) + 1;
+    *k = -(-348 + idx * 8);
+    c = (diyfp_t){ .f = cached_powers[idx].f, .e = cached_powers[idx].e };
+    diyfp_t w = diyfp_mul(diyfp_normalize(v), c), wp = diyfp_mul(pl, c), wm = diyfp_mul(mi, c);
+    wm.f++;
+    wp.f--;
+    return grisu_digits(w, wp, wp.f - wm.f, buf, k);
+}
+
+static int put_exponent (int k, char *buf) {
+    char *p = buf;
+    if (k < 0) {
+        *p++ = '-';
+        k = -k;
+    }
+    p += ultostr(k, p);
+    return p - buf;
+}
+
+// json-friendly layout of the digits: always a fraction or an exponent, so it reads back as a double
+static int grisu_format (char *buf, int len, int k) {
+    int kk = len + k;
+    if (0 <= k && kk <= 21) {
+        memset(buf + len, '0', k);
+        buf[kk] = '.';
+        buf[kk + 1] = '0';
+        return kk + 2;
+    }
+    if (0 < kk && kk <= 21) {
+        memmove(buf + kk + 1, buf + kk, len - kk);
+        buf[kk] = '.';
+        return len + 1;
+    }
+    if (-6 < kk && kk <= 0) {
+        int off = 2 - kk;
+        memmove(buf + off, buf, len);
+        buf[0] = '0';
+        buf[1] = '.';
+        memset(buf + 2, '0', off - 2);
+        return len + off;
+    }
+    if (1 == len) {
+        buf[1] = 'e';
+        return 2 + put_exponent(kk - 1, buf + 2);
+    }
+    memmove(buf + 2, buf + 1, len - 1);
+    buf[1] = '.';
+    buf[len + 1] = 'e';
+    return len + 2 + put_exponent(kk - 1, buf + len + 2);
+}
+
+size_t dtostr (double val, char *buf) {
+    char *p = buf;
+    int len, k;
+    if (!isfinite(val))
+        return snprintf(buf, DTOSTR_BUFSIZE, "%f", val);
+    if (signbit(val)) {
+        *p++ = '-';
+        val = -val;
+    }
+    if (0 == val) {
+        memcpy(p, "0.0", 3);
+        return p + 3 - buf;
+    }
+    len = grisu2(val, p, &k);
+    return p + grisu_format(p, len, k) - buf;
+}
+#else
+size_t dtostr (double val, char *buf) {
+    return snprintf(buf, DTOSTR_BUFSIZE, "%.17g", val);
+}
+#endif
+
 static char encoding_table [] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 static char decoding_table [] = {
     0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
@@ -793,34 +1206,147 @@ static int utf8_decode (const char *str, size_t *i) {
     return u;
 }
 
+#define ESCAPE_BLOCK 4096
+// the worst case is \u00XX for a byte, plus a surrogate pair started at the end of a block
+#define ESCAPE_BOUND(len) ((len) * 6 + 12)
+#define ESCAPE_END 1
+#define ESCAPE_HEX 'u'
+#define ESCAPE_UTF 'U'
+
+static const char hex_digits [] = "0123456789abcdef";
+
+#if __SSE2__
+#include <emmintrin.h>
+#endif
+
+// 0 copies the byte, else the letter after the backslash or how to encode
+static const uint8_t escape_table [256] = {
+    [0x00] = ESCAPE_END, [0x01 ... 0x1f] = ESCAPE_HEX,
+    ['\b'] = 'b', ['\f'] = 'f', ['\n'] = 'n', ['\r'] = 'r', ['\t'] = 't',
+    ['"'] = '"', ['\\'] = '\\',
+    [0xc2 ... 0xf4] = ESCAPE_UTF
+};
+
+// bytes that need no escaping, the vector part stops at anything below 0x20 or above 0x7f
+// and leaves stray utf-8 continuation bytes to the table
+static inline size_t escape_span (const uint8_t *s, size_t len) {
+    size_t i = 0;
+    #if __SSE2__
+    const __m128i quote = _mm_set1_epi8('"'), bslash = _mm_set1_epi8('\\'), space = _mm_set1_epi8(0x20);
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+        int m = _mm_movemask_epi8(_mm_or_si128(_mm_cmplt_epi8(v, space),
+                                  _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash))));
+        if (m) {
+            i += __builtin_ctz(m);
+            break;
+        }
+    }
+    #endif
+    while (i < len && !escape_table[s[i]]) ++i;
+    return i;
+}
+
+static inline char *escape_u16 (char *p, uint32_t c) {
+    p[0] = '\\';
+    p[1] = 'u';
+    p[2] = hex_digits[(c >> 12) & 0xf];
+    p[3] = hex_digits[(c >> 8) & 0xf];
+    p[4] = hex_digits[(c >> 4) & 0xf];
+    p[5] = hex_digits[c & 0xf];
+    return p + 6;
+}
+
+static const uint32_t utf_min [] = { [2] = 0x80, [3] = 0x800, [4] = 0x10000 };
+
+// a utf-8 sequence as \uXXXX or a surrogate pair, a broken one is copied as is,
+// so are overlong forms, encoded surrogates and anything above U+10FFFF
+static inline char *escape_utf (const uint8_t **sp, const uint8_t *e, char *p) {
+    const uint8_t *s = *sp;
+    int n = *s >= 0xf0 ? 4 : *s >= 0xe0 ? 3 : 2;
+    uint32_t c = *s & (0x7f >> n);
+    if (e - s < n) {
+        *p++ = *s;
+        *sp = s + 1;
+        return p;
+    }
+    for (int i = 1; i < n; ++i) {
+        if (0x80 != (s[i] & 0xc0)) {
+            *p++ = *s;
+            *sp = s + 1;
+            return p;
+        }
+        c = (c << 6) | (s[i] & 0x3f);
+    }
+    if (c < utf_min[n] || c > 0x10ffff || (c >= 0xd800 && c <= 0xdfff)) {
+        *p++ = *s;
+        *sp = s + 1;
+        return p;
+    }
+    *sp = s + n;
+    if (c < 0x10000)
+        return escape_u16(p, c);
+    c -= 0x10000;
+    p = escape_u16(p, 0xd800 | (c >> 10));
+    return escape_u16(p, 0xdc00 | (c & 0x3ff));
+}
+
+// escapes the bytes started before be, the output has room for ESCAPE_BOUND(be - s),
+// stops at zero byte like the string functions do
+static char *escape_block (const uint8_t **sp, const uint8_t *be, const uint8_t *e, char *p, int *is_end) {
+    const uint8_t *s = *sp;
+    while (s < be) {
+        size_t n = escape_span(s, be - s);
+        memcpy(p, s, n);
+        p += n;
+        s += n;
+        if (s >= be)
+            break;
+        switch (escape_table[*s]) {
+            case 0:
+                *p++ = *s++;
+                break;
+            case ESCAPE_END:
+                *is_end = 1;
+                *sp = s;
+                return p;
+            case ESCAPE_HEX:
+                p[0] = '\\';
+                p[1] = 'u';
+                p[2] = p[3] = '0';
+                p[4] = hex_digits[*s >> 4];
+                p[5] = hex_digits[*s++ & 0xf];
+                p += 6;
+                break;
+            case ESCAPE_UTF:
+                p = escape_utf(&s, e, p);
+                break;
+            default:
+                p[0] = '\\';
+                p[1] = escape_table[*s++];
+                p += 2;
+                break;
+        }
+    }
+    *sp = s;
+    return p;
+}
+
 str_t *str_escape (const char *src, size_t src_len, size_t chunk_size) {
+    const uint8_t *s = (const uint8_t*)src, *e = s + src_len;
     str_t *ret = stralloc(src_len, chunk_size);
-    int i;
-    for (i = 0; i < src_len && src[i] != '\0'; ) {
-        char c = src[i];
-        if (!isunicode(c)) {
-            switch (c) {
-                case '\"': strnadd(&ret, CONST_STR_LEN("\\\"")); break;
-                case '\\': strnadd(&ret, CONST_STR_LEN("\\")); break;
-                case '\b': strnadd(&ret, CONST_STR_LEN("\\b")); break;
-                case '\f': strnadd(&ret, CONST_STR_LEN("\\f")); break;
-                case '\n': strnadd(&ret, CONST_STR_LEN("\\n")); break;
-                case '\r': strnadd(&ret, CONST_STR_LEN("\\r")); break;
-                case '\t': strnadd(&ret, CONST_STR_LEN("\\t")); break;
-                default: strnadd(&ret, &c, sizeof(char)); break;
-            }
-            i++;
-        } else {
-            char buf [8];
-            size_t l = 0;
-            int z = utf8_decode(&src[i], &l);
-            snprintf(buf, sizeof buf, "\\u%04x", z);
-            if (-1 == strnadd(&ret, buf, strlen(buf))) {
-                free(ret);
-                return NULL;
-            } i += l;
+    int is_end = 0;
+    if (!ret)
+        return NULL;
+    while (s < e && !is_end) {
+        size_t len = e - s < ESCAPE_BLOCK ? e - s : ESCAPE_BLOCK;
+        if (-1 == strsize(&ret, ret->len + ESCAPE_BOUND(len), 0)) {
+            free(ret);
+            return NULL;
         }
+        ret->len = escape_block(&s, s + len, e, ret->ptr + ret->len, &is_end) - ret->ptr;
     }
+    STR_ADD_NULL(ret);
     return ret;
 }
 
@@ -871,30 +1397,13 @@ str_t *wstr2str (const wchar_t *str, size_t str_len, size_t chunk_size) {
 }
 
 int strbuf_escape (strbuf_t *dst, const char *src, size_t src_len) {
-    int i;
-    for (i = 0; i < src_len && src[i] != '\0'; ) {
-        char c = src[i];
-        if (!isunicode(c)) {
-            switch (c) {
-                case '\"': strbufadd(dst, CONST_STR_LEN("\\\"")); break;
-                case '\\': strbufadd(dst, CONST_STR_LEN("\\")); break;
-                case '\b': strbufadd(dst, CONST_STR_LEN("\\b")); break;
-                case '\f': strbufadd(dst, CONST_STR_LEN("\\f")); break;
-                case '\n': strbufadd(dst, CONST_STR_LEN("\\n")); break;
-                case '\r': strbufadd(dst, CONST_STR_LEN("\\r")); break;
-                case '\t': strbufadd(dst, CONST_STR_LEN("\\t")); break;
-                default: strbufadd(dst, &c, sizeof(char)); break;
-            }
-            i++;
-        } else {
-            char buf [8];
-            size_t l = 0;
-            int z = utf8_decode(&src[i], &l);
-            snprintf(buf, sizeof buf, "\\u%04x", z);
-            if (-1 == strbufadd(dst, buf, strlen(buf)))
-                return -1;
-            i += l;
-        }
+    const uint8_t *s = (const uint8_t*)src, *e = s + src_len;
+    int is_end = 0;
+    while (s < e && !is_end) {
+        size_t len = e - s < ESCAPE_BLOCK ? e - s : ESCAPE_BLOCK;
+        if (-1 == strbufreserve(dst, ESCAPE_BOUND(len)))
+            return -1;
+        dst->len = escape_block(&s, s + len, e, dst->ptr + dst->len, &is_end) - dst->ptr;
     }
     return 0;
 }
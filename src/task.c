@@ -146,13 +146,20 @@ static msg_t *get_next_msg (slot_t *slot, pool_t *pool) {
     msg_t *msg = NULL;
     pthread_mutex_lock(&pool->locker);
     while (slot->is_alive && !msg) {
+        // a pinned message goes back to the thread that took it first
         if ((li = pool->queue->head)) {
-            msg = (msg_t*)li->ptr;
-            if ((msg->flags & TASK_PIN) && msg->tid == pthread_self())
-                lst_del(li);
-            else
-                continue;
-        } else
+            do {
+                msg_t *m = (msg_t*)li->ptr;
+                if (!(m->flags & TASK_PIN) || !m->tid || pthread_equal(m->tid, pthread_self())) {
+                    msg = m;
+                    lst_del(li);
+                    break;
+                }
+                li = li->next;
+            } while (li != pool->queue->head);
+            if (msg)
+                break;
+        }
         if (0 == pool->livingtime)
             pthread_cond_wait(&pool->cond, &pool->locker);
         else {
@@ -178,9 +185,6 @@ static void *slot_process (void *arg) {
     //slot_t *slot = sd->slot;
     slot_t *slot = (slot_t*)arg;
     pool_t *pool = slot->pool;
-    pthread_mutex_lock(&pool->locker);
-    slot->node =lst_adde(pool->slots, slot);
-    pthread_mutex_unlock(&pool->locker);
     if (pool->on_create_slot) {
         //if (-1 == pool->on_create_slot(slot, sd->init_data)) {
         if (-1 == pool->on_create_slot(slot, slot->init_data)) {
@@ -249,9 +253,12 @@ static int add_slot (pool_t *pool, void *init_data) {
     slot->is_alive = 1;
     slot->pool = pool;
     slot->init_data = init_data;
+    // counted at once, so the calls before it runs do not start more of them
+    slot->node = lst_adde(pool->slots, slot);
 //    sd->init_data = init_data;
 //    if (0 != pthread_create(&slot->th, NULL, slot_process, sd)) {
     if (0 != pthread_create(&slot->th, NULL, slot_process, slot)) {
+        lst_del(slot->node);
         free(slot);
 //        free(sd);
         return -1;
@@ -277,9 +284,12 @@ void pool_start (pool_t *pool) {
     if (pool->max_slots <= 0)
         pool->max_slots = 0;
     pool->slots = lst_alloc(NULL);
-    if (0 == pool->livingtime)
+    if (0 == pool->livingtime) {
+        pthread_mutex_lock(&pool->locker);
         for (long i = 0; i < pool->max_slots; ++i)
             add_slot(pool, NULL);
+        pthread_mutex_unlock(&pool->locker);
+    }
 }
 
 msg_t *pool_createmsg (pool_msg_h on_msg,
@@ -303,8 +313,10 @@ int pool_call (pool_t *pool, msg_t *msg, void *init_data) {
     pthread_mutex_lock(&pool->locker);
     if (pool->livingtime > 0 && (0 == pool->slots->len || (pool->queue->len > 0 && pool->slots->len < pool->max_slots)))
         ret = add_slot(pool, init_data);
-    if (0 != ret)
+    if (0 != ret) {
+        pthread_mutex_unlock(&pool->locker);
         return ret;
+    }
     lst_adde(pool->queue, msg);
     pthread_cond_broadcast(&pool->cond);
     pthread_mutex_unlock(&pool->locker);
@@ -6,6 +6,7 @@ rbtree_t *rbtree_alloc (compare_h on_compare, copy_h on_copy, free_h on_free, in
 
     new_tree = (rbtree_t*)malloc(sizeof(rbtree_t));
     new_tree->len = 0;
+    new_tree->slab = NULL;
     new_tree->unique = unique;
 
     temp = new_tree->nil = (tree_item_t*)malloc(sizeof(tree_item_t));
@@ -23,6 +24,42 @@ rbtree_t *rbtree_alloc (compare_h on_compare, copy_h on_copy, free_h on_free, in
     return new_tree;
 }
 
+rbtree_t *rbtree_alloc_slab (compare_h on_compare, copy_h on_copy, free_h on_free, int unique, slab_t *slab) {
+    rbtree_t *tree;
+    tree_item_t *nil, *root;
+    if (!slab || !slab->arena) {
+        if (slab)
+            slab_ref(slab);
+        else if (!(slab = slab_alloc(sizeof(tree_item_t))))
+            return NULL;
+        tree = rbtree_alloc(on_compare, on_copy, on_free, unique);
+        tree->slab = slab;
+        return tree;
+    }
+    // everything comes from the arena, rbtree_free releases nothing
+    if (!(tree = arena_calloc(slab->arena, sizeof(rbtree_t))) ||
+        !(nil = arena_calloc(slab->arena, sizeof(tree_item_t))) ||
+        !(root = arena_calloc(slab->arena, sizeof(tree_item_t))))
+        return NULL;
+    nil->parent = nil->left = nil->right = nil;
+    root->parent = root->left = root->right = nil;
+    tree->nil = nil;
+    tree->root = root;
+    tree->unique = unique;
+    tree->on_compare = on_compare;
+    tree->on_copy = on_copy;
+    tree->on_free = on_free;
+    tree->slab = slab;
+    return tree;
+}
+
+static inline void tree_node_free (rbtree_t *tree, tree_item_t *x) {
+    if (tree->slab)
+        slab_put(tree->slab, x);
+    else
+        free(x);
+}
+
 static void left_rotate (rbtree_t *tree, tree_item_t *x) {
     tree_item_t *y, *nil = tree->nil;
 
@@ -73,7 +110,13 @@ static tree_item_t *tree_insert_help (rbtree_t *tree, void *key) {
             x = x->right;
         }
     }
-    z = calloc(1, sizeof(tree_item_t));
+    if (tree->slab) {
+        if ((z = slab_get(tree->slab)))
+            memset(z, 0, sizeof(tree_item_t));
+    } else
+        z = calloc(1, sizeof(tree_item_t));
+    if (!z)
+        return NULL;
     z->left = z->right=nil;
     z->parent = y;
     z->red = 1;
@@ -139,11 +182,14 @@ tree_item_t *rbtree_add (rbtree_t *tree, void *key) {
 
 void rbtree_free (rbtree_t *tree) {
     tree_item_t *nil;
+    // a private slab is released in bulk, nodes aren't freed one by one
+    int in_arena = tree->slab && tree->slab->arena,
+        bulk = tree->slab && (1 == tree->slab->refs || in_arena);
     void fh (tree_item_t *x) {
         if (x != nil) {
             fh(x->left);
             fh(x->right);
-            free(x);
+            tree_node_free(tree, x);
         }
     }
     void fhf (tree_item_t *x) {
@@ -151,14 +197,18 @@ void rbtree_free (rbtree_t *tree) {
             fhf(x->left);
             fhf(x->right);
             tree->on_free(x->key, x->value);
-            free(x);
+            if (!bulk)
+                tree_node_free(tree, x);
         }
     }
     nil = tree->nil;
     if (tree->on_free)
         fhf(tree->root->left);
-    else
+    else if (!bulk)
         fh(tree->root->left);
+    slab_free(tree->slab);
+    if (in_arena)
+        return;
     free(tree->root);
     free(tree->nil);
     free(tree);
@@ -300,13 +350,15 @@ void rbtree_del_node (tree_item_t *z) {
             z->parent->left=y; 
         else
             z->parent->right=y;
-        errno = EEXIST;
+        if (tree->on_free)
+            tree->on_free(z->key, z->value);
+        tree_node_free(tree, z);
         --tree->len;
     } else {
         if (!(y->red)) rb_delete_fixup(tree, x);
         if (tree->on_free)
             tree->on_free(y->key, y->value);
-        free(y);
+        tree_node_free(tree, y);
         --tree->len;
     }
 }
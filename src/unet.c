@@ -1,6 +1,6 @@
 #include "unet.h"
 
-int unet_bind (const char *sock_file) {
+int unet_bind_backlog (const char *sock_file, int backlog) {
     struct sockaddr_un addr;
     int fd_listener;
     if ((fd_listener = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
@@ -13,13 +13,17 @@ int unet_bind (const char *sock_file) {
         close(fd_listener);
         return -1;
     }
-    if (listen(fd_listener, 64) < 0) {
+    if (listen(fd_listener, backlog > 0 ? backlog : SOMAXCONN) < 0) {
         close(fd_listener);
         return -1;
     }
     return fd_listener;
 }
 
+int unet_bind (const char *sock_file) {
+    return unet_bind_backlog(sock_file, 0);
+}
+
 int unet_connect (const char *sock_file) {
     int fd;
     struct sockaddr_un addr;
@@ -35,38 +39,42 @@ int unet_connect (const char *sock_file) {
     return fd;
 }
 
+// the first read takes what is there, the rest of the message is read in one piece
+// once the header tells its size
 int unet_read (int fd, msgbuf_t *msg, on_parse_msg on_msg) {
     ssize_t bytes;
+    size_t msg_len = 0;
     strbuf_t buf;
     msg_clear(msg);
-    strbufalloc(&buf, 256, 256);
-    while ((bytes = read(fd, buf.ptr + buf.len, buf.chunk_size)) > 0) {
+    if (-1 == strbufalloc(&buf, 256, 256))
+        return -1;
+    while (0 == msg_len || buf.len < msg_len) {
+        do
+            bytes = read(fd, buf.ptr + buf.len, (msg_len ? msg_len : buf.bufsize) - buf.len);
+        while (bytes < 0 && errno == EINTR);
+        if (bytes < 0)
+            goto err;
+        if (0 == bytes)
+            break;
         buf.len += bytes;
-        if (-1 == strbufsize(&buf, buf.len + buf.chunk_size, 0)) {
-            msg_clear(msg);
-            return -1;
+        if (0 == msg_len && buf.len >= sizeof(uint32_t)) {
+            msg_len = *(uint32_t*)buf.ptr & MSG_LEN_MASK;
+            if (msg_len < sizeof(uint32_t) || buf.len > msg_len || -1 == strbufsize(&buf, msg_len, 0))
+                goto err;
         }
-        if (buf.len < *(uint32_t*)buf.ptr)
-            continue;
-        if (buf.len > *(uint32_t*)buf.ptr) {
-            msg_clear(msg);
-            return -1;
-        } else
-            break;
     }
-    if (bytes < 0)
-        return -1;
     return on_msg(msg, buf.ptr, buf.len);
+err:
+    strbuf_release(&buf);
+    return -1;
 }
 
+// the tail is copied, it used to point into buf over the buffer of its own
 static void unet_save_tail (netbuf_t *nbuf, ssize_t nbytes) {
-    if (nbytes < nbuf->buf.len) {
-        nbuf->tail.ptr = nbuf->buf.ptr + nbytes;
-        nbuf->tail.len = nbuf->buf.len - nbytes;
-    } else {
-        nbuf->tail.ptr = NULL;
+    if (nbytes < nbuf->buf.len)
+        strbufput(&nbuf->tail, nbuf->buf.ptr + nbytes, nbuf->buf.len - nbytes, 0);
+    else
         nbuf->tail.len = 0;
-    }
 }
 
 int unet_recv (int fd, netbuf_t *nbuf, msgbuf_t *result, msg_parse_h fn_parse) {
@@ -109,10 +117,465 @@ ssize_t unet_write (int fd, char *buf, size_t size) {
     return sent;
 }
 
+ssize_t unet_writemsg_off (int fd, msgbuf_t *msg, size_t off) {
+    int cnt = msg_iovcnt(msg);
+    struct iovec iovs [cnt], *iov = iovs;
+    struct msghdr mh = { .msg_name = NULL, .msg_namelen = 0, .msg_control = NULL, .msg_controllen = 0, .msg_flags = 0 };
+    ssize_t sent = 0, wrote;
+    cnt = msg_iov(msg, iov);
+    // what went out before
+    while (cnt > 0 && off >= iov->iov_len) {
+        off -= iov->iov_len;
+        ++iov;
+        --cnt;
+    }
+    if (cnt > 0) {
+        iov->iov_base += off;
+        iov->iov_len -= off;
+    }
+    while (cnt > 0) {
+        mh.msg_iov = iov;
+        mh.msg_iovlen = cnt < IOV_MAX ? cnt : IOV_MAX;
+        do
+            wrote = sendmsg(fd, &mh, MSG_NOSIGNAL);
+        while (wrote < 0 && errno == EINTR);
+        if (0 == wrote) {
+            errno = EIO;
+            return -1;
+        }
+        if (wrote < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) sent = -1;
+            break;
+        }
+        sent += wrote;
+        while (cnt > 0 && (size_t)wrote >= iov->iov_len) {
+            wrote -= iov->iov_len;
+            ++iov;
+            --cnt;
+        }
+        if (cnt > 0) {
+            iov->iov_base += wrote;
+            iov->iov_len -= wrote;
+        }
+    }
+    return sent;
+}
+
 void unet_reset (netbuf_t *nbuf) {
-    if (nbuf->tail.ptr && nbuf->tail.len) {
-        memmove(nbuf->buf.ptr, nbuf->tail.ptr, nbuf->tail.len);
-        nbuf->buf.len = nbuf->tail.len;
-    } else
-        nbuf->buf.len = 0;
+    strbuf_t s = nbuf->buf;
+    nbuf->buf = nbuf->tail;
+    nbuf->tail = s;
+    nbuf->tail.len = 0;
+}
+
+int unet_process (netbuf_t *nbuf, msg_parse_h on_parse, unet_msg_h on_msg, void *userdata) {
+    strbuf_t *buf = &nbuf->buf;
+    size_t off = 0;
+    uint32_t len = 0;
+    int n = 0, rc = 0;
+    while (buf->len - off >= sizeof(uint32_t)) {
+        msgbuf_t msg;
+        if ((len = *(uint32_t*)(buf->ptr + off) & MSG_LEN_MASK) < sizeof(uint32_t) * 2) {
+            errno = EBADMSG;
+            return -1;
+        }
+        if (len > buf->len - off)
+            break;
+        memset(&msg, 0, sizeof msg);
+        if (MSG_OK != on_parse(&msg, buf->ptr + off, len)) {
+            errno = EBADMSG;
+            return -1;
+        }
+        off += len;
+        ++n;
+        if (-1 == (rc = on_msg(&msg, userdata)))
+            break;
+    }
+    if (off) {
+        memmove(buf->ptr, buf->ptr + off, buf->len - off);
+        buf->len -= off;
+    }
+    if (-1 == rc)
+        return -1;
+    // the rest of a big one comes in one read
+    if (buf->len >= sizeof(uint32_t) && (len = *(uint32_t*)buf->ptr & MSG_LEN_MASK) >= buf->bufsize && -1 == strbufsize(buf, len + 1, 0))
+        return -1;
+    return n;
+}
+
+/*****
+  pipelined client
+*****/
+typedef struct {
+    unet_client_t *cln;
+    pthread_cond_t cond;
+    msgbuf_t *resp;
+    int err;
+    int is_done;
+} unet_wait_t;
+
+static int unet_client_dispatch (msgbuf_t *resp, unet_client_t *cln) {
+    unet_slot_t *slot;
+    unet_call_h on_resp = NULL;
+    void *userdata = NULL;
+    pthread_mutex_lock(&cln->lock);
+    slot = &cln->slots[resp->id & cln->mask];
+    if (slot->on_resp && slot->id == resp->id) {
+        on_resp = slot->on_resp;
+        userdata = slot->userdata;
+        slot->on_resp = NULL;
+        --cln->inflight;
+        pthread_cond_broadcast(&cln->room);
+    }
+    pthread_mutex_unlock(&cln->lock);
+    if (on_resp)
+        on_resp(resp, 0, userdata);
+    return 0;
+}
+
+// the calls still out get err, nothing is sent after
+static void unet_client_fail (unet_client_t *cln, int err) {
+    pthread_mutex_lock(&cln->lock);
+    cln->is_alive = 0;
+    pthread_cond_broadcast(&cln->room);
+    for (uint32_t i = 0; i <= cln->mask; ++i) {
+        unet_slot_t *slot = &cln->slots[i];
+        unet_call_h on_resp = slot->on_resp;
+        void *userdata = slot->userdata;
+        if (on_resp) {
+            slot->on_resp = NULL;
+            --cln->inflight;
+            pthread_mutex_unlock(&cln->lock);
+            on_resp(NULL, err, userdata);
+            pthread_mutex_lock(&cln->lock);
+        }
+    }
+    pthread_mutex_unlock(&cln->lock);
+}
+
+// one read takes as many responses as there are
+static void *unet_client_run (unet_client_t *cln) {
+    ssize_t nbytes;
+    while ((nbytes = net_recv(cln->fd, &cln->nbuf.buf)) > 0 || (-1 == nbytes && EINTR == errno))
+        if (nbytes > 0 && -1 == unet_process(&cln->nbuf, msg_load_response, (unet_msg_h)unet_client_dispatch, cln))
+            break;
+    unet_client_fail(cln, nbytes < 0 ? errno : ECONNRESET);
+    return NULL;
+}
+
+unet_client_t *unet_client_alloc (int fd, uint32_t max_inflight) {
+    unet_client_t *cln = calloc(1, sizeof(unet_client_t));
+    uint32_t size = 1;
+    if (!cln)
+        return NULL;
+    while (size < (max_inflight ? max_inflight : UNET_INFLIGHT))
+        size <<= 1;
+    cln->fd = fd;
+    cln->mask = size - 1;
+    cln->next_id = 1;
+    cln->is_alive = 1;
+    if (!(cln->slots = calloc(size, sizeof(unet_slot_t))) || -1 == netbuf_alloc(&cln->nbuf, NET_BUF_SIZE * 8, NET_BUF_SIZE)) {
+        netbuf_free(&cln->nbuf);
+        free(cln->slots);
+        free(cln);
+        return NULL;
+    }
+    cln->nbuf.buf.growth = STR_GROW_DOUBLE;
+    pthread_mutex_init(&cln->lock, NULL);
+    pthread_mutex_init(&cln->send_lock, NULL);
+    pthread_cond_init(&cln->room, NULL);
+    if (0 != (errno = pthread_create(&cln->reader, NULL, (void*(*)(void*))unet_client_run, cln))) {
+        pthread_mutex_destroy(&cln->lock);
+        pthread_mutex_destroy(&cln->send_lock);
+        pthread_cond_destroy(&cln->room);
+        netbuf_free(&cln->nbuf);
+        free(cln->slots);
+        free(cln);
+        return NULL;
+    }
+    return cln;
+}
+
+// the slot is taken before the request goes, its response can come at once;
+// the reader does not wait for a sender, a full socket can not lock them up
+int unet_call_async (unet_client_t *cln, msgbuf_t *req, unet_call_h on_resp, void *userdata) {
+    unet_slot_t *slot;
+    uint32_t id;
+    ssize_t sent;
+    pthread_mutex_lock(&cln->lock);
+    while (cln->is_alive && cln->inflight > cln->mask)
+        pthread_cond_wait(&cln->room, &cln->lock);
+    if (!cln->is_alive) {
+        pthread_mutex_unlock(&cln->lock);
+        errno = EPIPE;
+        return -1;
+    }
+    // a slot is free, the ids of the busy ones and 0, the id of a response to no one, are passed over
+    do {
+        id = cln->next_id++;
+        slot = &cln->slots[id & cln->mask];
+    } while (0 == id || slot->on_resp);
+    slot->id = id;
+    slot->on_resp = on_resp;
+    slot->userdata = userdata;
+    ++cln->inflight;
+    pthread_mutex_unlock(&cln->lock);
+    if (MSG_OK != msg_set_id(req, id)) {
+        pthread_mutex_lock(&cln->lock);
+        slot->on_resp = NULL;
+        --cln->inflight;
+        pthread_cond_broadcast(&cln->room);
+        pthread_mutex_unlock(&cln->lock);
+        return -1;
+    }
+    pthread_mutex_lock(&cln->send_lock);
+    sent = unet_writemsg(cln->fd, req);
+    pthread_mutex_unlock(&cln->send_lock);
+    if (sent == msg_size(req))
+        return 0;
+    // a part of it may be out, the stream can not go on
+    shutdown(cln->fd, SHUT_RDWR);
+    pthread_mutex_lock(&cln->lock);
+    if (slot->on_resp && slot->id == id) {
+        slot->on_resp = NULL;
+        --cln->inflight;
+        pthread_cond_broadcast(&cln->room);
+        pthread_mutex_unlock(&cln->lock);
+        errno = EPIPE;
+        return -1;
+    }
+    // the reader was first and on_resp has the error
+    pthread_mutex_unlock(&cln->lock);
+    return 0;
+}
+
+static void on_wait_resp (msgbuf_t *resp, int err, unet_wait_t *w) {
+    char *buf;
+    if (!err) {
+        if ((buf = msg_alloc(resp->len))) {
+            memcpy(buf, resp->ptr, resp->len);
+            msg_load_response(w->resp, buf, resp->len);
+        } else
+            err = ENOMEM;
+    }
+    pthread_mutex_lock(&w->cln->lock);
+    w->err = err;
+    w->is_done = 1;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->cln->lock);
+}
+
+int unet_call (unet_client_t *cln, msgbuf_t *req, msgbuf_t *resp) {
+    unet_wait_t w = { .cln = cln, .resp = resp };
+    msg_clear(resp);
+    pthread_cond_init(&w.cond, NULL);
+    if (-1 == unet_call_async(cln, req, (unet_call_h)on_wait_resp, &w)) {
+        pthread_cond_destroy(&w.cond);
+        return -1;
+    }
+    pthread_mutex_lock(&cln->lock);
+    while (!w.is_done)
+        pthread_cond_wait(&w.cond, &cln->lock);
+    pthread_mutex_unlock(&cln->lock);
+    pthread_cond_destroy(&w.cond);
+    if (w.err) {
+        errno = w.err;
+        return -1;
+    }
+    return 0;
+}
+
+void unet_client_free (unet_client_t *cln) {
+    shutdown(cln->fd, SHUT_RDWR);
+    pthread_join(cln->reader, NULL);
+    close(cln->fd);
+    pthread_mutex_destroy(&cln->lock);
+    pthread_mutex_destroy(&cln->send_lock);
+    pthread_cond_destroy(&cln->room);
+    netbuf_free(&cln->nbuf);
+    free(cln->slots);
+    free(cln);
+}
+
+/*****
+  shared memory
+*****/
+// the ring starts with the position the reader let go of, the writer keeps its head
+#define UNET_SHM_TAIL(ptr) ((uint64_t*)(ptr))
+#define UNET_SHM_DATA(ptr) ((ptr) + UNET_SHM_HDR)
+
+static int unet_shm_send_fd (int fd, int memfd, uint64_t size) {
+    char ctl [CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { .iov_base = &size, .iov_len = sizeof size };
+    struct msghdr mh = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = ctl, .msg_controllen = sizeof ctl };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+    ssize_t rc;
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+    while (-1 == (rc = sendmsg(fd, &mh, MSG_NOSIGNAL)) && EINTR == errno);
+    return sizeof size == rc ? 0 : -1;
+}
+
+// the fd comes with the first byte of the size
+static int unet_shm_recv_fd (int fd, uint64_t *size) {
+    char ctl [CMSG_SPACE(sizeof(int))];
+    size_t got = 0;
+    int memfd = -1;
+    while (got < sizeof *size) {
+        struct iovec iov = { .iov_base = (char*)size + got, .iov_len = sizeof *size - got };
+        struct msghdr mh = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = ctl, .msg_controllen = sizeof ctl };
+        struct cmsghdr *cmsg;
+        ssize_t rc = recvmsg(fd, &mh, MSG_CMSG_CLOEXEC);
+        if (-1 == rc && EINTR == errno)
+            continue;
+        if (rc <= 0)
+            break;
+        for (cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg))
+            if (SOL_SOCKET == cmsg->cmsg_level && SCM_RIGHTS == cmsg->cmsg_type && -1 == memfd)
+                memcpy(&memfd, CMSG_DATA(cmsg), sizeof(int));
+        got += rc;
+    }
+    if (got < sizeof *size) {
+        if (-1 != memfd)
+            close(memfd);
+        errno = EPROTO;
+        return -1;
+    }
+    return memfd;
+}
+
+int unet_shm_init (unet_shm_t *shm, int fd, size_t size) {
+    int memfd = -1, peer_fd = -1, seals;
+    uint64_t peer_size;
+    struct stat st;
+    memset(shm, 0, sizeof(unet_shm_t));
+    shm->fd = fd;
+    shm->min = UNET_SHM_MIN;
+    shm->out = shm->in = MAP_FAILED;
+    shm->out_size = (size ? size : UNET_SHM_SIZE) - UNET_SHM_HDR;
+    // pages come when they are written to
+    // the size is sealed, the peer can not shrink it under our mapping and we can not under its
+    if (-1 == (memfd = memfd_create("unet_shm", MFD_CLOEXEC | MFD_ALLOW_SEALING)) ||
+        -1 == ftruncate(memfd, shm->out_size + UNET_SHM_HDR) ||
+        -1 == fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) ||
+        MAP_FAILED == (shm->out = mmap(NULL, shm->out_size + UNET_SHM_HDR, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0)) ||
+        -1 == unet_shm_send_fd(fd, memfd, shm->out_size + UNET_SHM_HDR) ||
+        -1 == (peer_fd = unet_shm_recv_fd(fd, &peer_size)))
+        goto err;
+    if (-1 == (seals = fcntl(peer_fd, F_GET_SEALS)) || (F_SEAL_SHRINK | F_SEAL_GROW) != (seals & (F_SEAL_SHRINK | F_SEAL_GROW)) ||
+        -1 == fstat(peer_fd, &st) || st.st_size != peer_size || peer_size <= UNET_SHM_HDR) {
+        errno = EPROTO;
+        goto err;
+    }
+    // the peer writes the data, the tail is ours
+    if (MAP_FAILED == (shm->in = mmap(NULL, peer_size, PROT_READ | PROT_WRITE, MAP_SHARED, peer_fd, 0)))
+        goto err;
+    shm->in_size = peer_size - UNET_SHM_HDR;
+    close(memfd);
+    close(peer_fd);
+    if (-1 == netbuf_alloc(&shm->nbuf, NET_BUF_SIZE * 8, NET_BUF_SIZE)) {
+        unet_shm_free(shm);
+        return -1;
+    }
+    shm->nbuf.buf.growth = STR_GROW_DOUBLE;
+    return 0;
+err:
+    if (-1 != memfd)
+        close(memfd);
+    if (-1 != peer_fd)
+        close(peer_fd);
+    unet_shm_free(shm);
+    return -1;
+}
+
+void unet_shm_free (unet_shm_t *shm) {
+    if (MAP_FAILED != shm->out && shm->out)
+        munmap(shm->out, shm->out_size + UNET_SHM_HDR);
+    if (MAP_FAILED != shm->in && shm->in)
+        munmap(shm->in, shm->in_size + UNET_SHM_HDR);
+    shm->out = shm->in = NULL;
+    netbuf_free(&shm->nbuf);
+}
+
+// a frame never wraps, the end of the ring is skipped when it does not fit there
+ssize_t unet_shm_writemsg (unet_shm_t *shm, msgbuf_t *msg) {
+    uint32_t len = msg_size(msg);
+    uint64_t pos = shm->out_head;
+    if (len >= shm->min && len <= shm->out_size) {
+        if (pos % shm->out_size + len > shm->out_size)
+            pos += shm->out_size - pos % shm->out_size;
+        if (pos + len - __atomic_load_n(UNET_SHM_TAIL(shm->out), __ATOMIC_ACQUIRE) <= shm->out_size) {
+            int cnt = msg_iovcnt(msg);
+            struct iovec iov [cnt];
+            unet_shm_frame_t frame = { .flags = sizeof(unet_shm_frame_t) | UNET_SHM_FRAME, .len = len, .pos = pos };
+            char *ptr = UNET_SHM_DATA(shm->out) + pos % shm->out_size;
+            cnt = msg_iov(msg, iov);
+            for (int i = 0; i < cnt; ++i) {
+                memcpy(ptr, iov[i].iov_base, iov[i].iov_len);
+                ptr += iov[i].iov_len;
+            }
+            // the bytes are there before the peer can read the frame
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+            if (sizeof frame != unet_write(shm->fd, (char*)&frame, sizeof frame))
+                return -1;
+            shm->out_head = pos + len;
+            return len;
+        }
+    }
+    return unet_writemsg(shm->fd, msg);
+}
+
+int unet_shm_read (unet_shm_t *shm, msgbuf_t *msg, msg_parse_h on_parse) {
+    strbuf_t *buf = &shm->nbuf.buf;
+    ssize_t nbytes;
+    // the message read last goes
+    if (shm->is_held) {
+        __atomic_store_n(UNET_SHM_TAIL(shm->in), shm->in_release, __ATOMIC_RELEASE);
+        shm->is_held = 0;
+    }
+    if (shm->consumed) {
+        memmove(buf->ptr, buf->ptr + shm->consumed, buf->len - shm->consumed);
+        buf->len -= shm->consumed;
+        shm->consumed = 0;
+    }
+    memset(msg, 0, sizeof(msgbuf_t));
+    while (1) {
+        if (buf->len >= sizeof(uint32_t)) {
+            uint32_t len = *(uint32_t*)buf->ptr;
+            if ((len & UNET_SHM_FRAME)) {
+                unet_shm_frame_t frame;
+                if (buf->len >= sizeof frame) {
+                    memcpy(&frame, buf->ptr, sizeof frame);
+                    if (frame.len < sizeof(uint32_t) * 2 || frame.pos % shm->in_size + frame.len > shm->in_size) {
+                        errno = EBADMSG;
+                        return MSG_ERROR;
+                    }
+                    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                    shm->consumed = sizeof frame;
+                    shm->in_release = frame.pos + frame.len;
+                    shm->is_held = 1;
+                    return on_parse(msg, UNET_SHM_DATA(shm->in) + frame.pos % shm->in_size, frame.len);
+                }
+            } else
+            if ((len &= MSG_LEN_MASK) < sizeof(uint32_t) * 2) {
+                errno = EBADMSG;
+                return MSG_ERROR;
+            } else
+            if (buf->len >= len) {
+                shm->consumed = len;
+                return on_parse(msg, buf->ptr, len);
+            } else
+            if (len >= buf->bufsize && -1 == strbufsize(buf, len + 1, 0))
+                return MSG_ERROR;
+        }
+        if ((nbytes = net_recv(shm->fd, buf)) <= 0) {
+            if (-1 == nbytes && EINTR == errno)
+                continue;
+            if (0 == nbytes)
+                errno = ECONNRESET;
+            return MSG_ERROR;
+        }
+    }
 }
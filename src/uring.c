@@ -0,0 +1,141 @@
+#include "uring.h"
+
+int uring_init (uring_t *ring, unsigned entries) {
+    struct io_uring_params p;
+    char *ptr;
+    memset(ring, 0, sizeof(uring_t));
+    memset(&p, 0, sizeof p);
+    // multishot requests complete more often than they are submitted
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+    p.cq_entries = entries * 4;
+    if (-1 == (ring->fd = syscall(__NR_io_uring_setup, entries, &p)) && EINVAL == errno) {
+        p.flags &= ~IORING_SETUP_COOP_TASKRUN;
+        ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+    }
+    if (-1 == ring->fd)
+        return -1;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        close(ring->fd);
+        ring->fd = -1;
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+    ring->features = p.features;
+    ring->sq_entries = p.sq_entries;
+    ring->ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    if (ring->ring_size < p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe))
+        ring->ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    if (MAP_FAILED == (ring->ring_ptr = mmap(NULL, ring->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING)))
+        goto err;
+    if (MAP_FAILED == (ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES))) {
+        munmap(ring->ring_ptr, ring->ring_size);
+        goto err;
+    }
+    ptr = ring->ring_ptr;
+    ring->sq_head = (unsigned*)(ptr + p.sq_off.head);
+    ring->sq_tail = (unsigned*)(ptr + p.sq_off.tail);
+    ring->sq_mask = (unsigned*)(ptr + p.sq_off.ring_mask);
+    ring->cq_head = (unsigned*)(ptr + p.cq_off.head);
+    ring->cq_tail = (unsigned*)(ptr + p.cq_off.tail);
+    ring->cq_mask = (unsigned*)(ptr + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(ptr + p.cq_off.cqes);
+    // sqes are taken in order, the index array never changes
+    for (unsigned i = 0; i < p.sq_entries; ++i)
+        ((unsigned*)(ptr + p.sq_off.array))[i] = i;
+    ring->sq_queued = *ring->sq_tail;
+    return 0;
+err:
+    close(ring->fd);
+    ring->fd = -1;
+    return -1;
+}
+
+void uring_free (uring_t *ring) {
+    munmap(ring->sqes, ring->sqes_size);
+    munmap(ring->ring_ptr, ring->ring_size);
+    close(ring->fd);
+    ring->fd = -1;
+}
+
+struct io_uring_sqe *uring_get_sqe (uring_t *ring) {
+    struct io_uring_sqe *sqe;
+    if (ring->sq_queued - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+        uring_submit(ring, 0, -1);
+        if (ring->sq_queued - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+            errno = EBUSY;
+            return NULL;
+        }
+    }
+    sqe = &ring->sqes[ring->sq_queued++ & *ring->sq_mask];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    return sqe;
+}
+
+int uring_submit (uring_t *ring, unsigned wait_nr, int timeout_ms) {
+    unsigned submit = ring->sq_queued - *ring->sq_tail, flags = 0;
+    struct __kernel_timespec ts = { .tv_sec = timeout_ms / 1000, .tv_nsec = (timeout_ms % 1000) * 1000000L };
+    struct io_uring_getevents_arg arg = { .ts = timeout_ms >= 0 ? (uintptr_t)&ts : 0 };
+    int rc;
+    __atomic_store_n(ring->sq_tail, ring->sq_queued, __ATOMIC_RELEASE);
+    // completions already there are not waited for
+    if (wait_nr && uring_peek(ring))
+        wait_nr = 0;
+    if (wait_nr)
+        flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+    else
+    if (!submit)
+        return 0;
+    rc = syscall(__NR_io_uring_enter, ring->fd, submit, wait_nr, flags, wait_nr ? &arg : NULL, wait_nr ? sizeof arg : 0);
+    if (-1 == rc && (ETIME == errno || EINTR == errno))
+        return 0;
+    return rc;
+}
+
+int uring_cancel_all (uring_t *ring) {
+    struct io_uring_sync_cancel_reg reg;
+    memset(&reg, 0, sizeof reg);
+    reg.fd = -1;
+    reg.flags = IORING_ASYNC_CANCEL_ANY;
+    reg.timeout.tv_sec = reg.timeout.tv_nsec = -1;
+    return syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_SYNC_CANCEL, &reg, 1);
+}
+
+int uring_bufs_alloc (uring_t *ring, uring_bufs_t *bufs, uint16_t bgid, unsigned entries, size_t buf_size) {
+    struct io_uring_buf_reg reg;
+    size_t ring_size = entries * sizeof(struct io_uring_buf);
+    memset(bufs, 0, sizeof(uring_bufs_t));
+    // the ring is page aligned, the buffers follow it
+    bufs->map_size = ring_size + entries * buf_size;
+    if (MAP_FAILED == (bufs->br = mmap(NULL, bufs->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0))) {
+        bufs->br = NULL;
+        return -1;
+    }
+    bufs->base = (char*)bufs->br + ring_size;
+    bufs->entries = entries;
+    bufs->buf_size = buf_size;
+    bufs->bgid = bgid;
+    memset(&reg, 0, sizeof reg);
+    reg.ring_addr = (uintptr_t)bufs->br;
+    reg.ring_entries = entries;
+    reg.bgid = bgid;
+    if (-1 == syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1)) {
+        munmap(bufs->br, bufs->map_size);
+        bufs->br = NULL;
+        return -1;
+    }
+    for (unsigned i = 0; i < entries; ++i)
+        uring_buf_put(bufs, i);
+    return 0;
+}
+
+void uring_bufs_free (uring_t *ring, uring_bufs_t *bufs) {
+    struct io_uring_buf_reg reg;
+    if (!bufs->br)
+        return;
+    memset(&reg, 0, sizeof reg);
+    reg.bgid = bufs->bgid;
+    syscall(__NR_io_uring_register, ring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    munmap(bufs->br, bufs->map_size);
+    bufs->br = NULL;
+}
@@ -9,6 +9,7 @@ int wsnet_handshake (int fd) {
     http_request_t req;
     ws_handshake_t wsh;
     strbufalloc(&buf, 128, 128);
+    buf.growth = STR_GROW_DOUBLE;
     memset(&wsh, 0, sizeof(wsh));
     memset(&req, 0, sizeof(req));
     while (net_recv(fd, &buf) > 0) {
@@ -19,7 +20,7 @@ int wsnet_handshake (int fd) {
             break;
         }
     }
-    free(buf.ptr);
+    strbuf_release(&buf);
     return rc;
 }
 
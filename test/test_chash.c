@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <time.h>
+#include <stdint.h>
+#include "../include/libex/chash.h"
+
+#define KEYS 65536
+#define OPS 4000000
+
+static hash_key_t int_calc (void *key, size_t key_len) {
+    return (intptr_t)key;
+}
+
+static int int_compare (void *x, void *y) {
+    if ((intptr_t)x > (intptr_t)y) return 1;
+    if ((intptr_t)x < (intptr_t)y) return -1;
+    return 0;
+}
+
+static void *int_copy (void *key) {
+    return key;
+}
+
+static void *on_incr (void *key, void *value, void *userdata) {
+    return (void*)((intptr_t)value + 1);
+}
+
+static void *on_drop (void *key, void *value, void *userdata) {
+    return NULL;
+}
+
+static void test_chash_1 () {
+    chash_t *ch = chash_alloc(8, 1024, HASH_VARSIZE, int_calc, int_compare, int_copy, NULL);
+    void *value;
+    for (intptr_t i = 1; i <= 100; ++i)
+        chash_add(ch, (void*)i, sizeof(intptr_t), (void*)(i * 10));
+    printf("len: %lu\n", (unsigned long)chash_len(ch));
+    if (0 == chash_get(ch, (void*)42, sizeof(intptr_t), &value))
+        printf("42: %ld\n", (intptr_t)value);
+    chash_add(ch, (void*)42, sizeof(intptr_t), (void*)4200);
+    printf("replace 42: %s\n", EEXIST == errno ? "EEXIST" : "?");
+    chash_get(ch, (void*)42, sizeof(intptr_t), &value);
+    printf("42: %ld\n", (intptr_t)value);
+    chash_del(ch, (void*)42, sizeof(intptr_t));
+    printf("42 after del: %s\n", -1 == chash_get(ch, (void*)42, sizeof(intptr_t), &value) ? "not found" : "found");
+    for (int i = 0; i < 5; ++i)
+        chash_compute(ch, (void*)1000, sizeof(intptr_t), on_incr, NULL);
+    chash_get(ch, (void*)1000, sizeof(intptr_t), &value);
+    printf("counter: %ld\n", (intptr_t)value);
+    chash_compute(ch, (void*)1000, sizeof(intptr_t), on_drop, NULL);
+    printf("len: %lu\n", (unsigned long)chash_len(ch));
+    chash_free(ch);
+}
+
+static int freed;
+
+static void on_free_value (void *key, void *value) {
+    if (!key && value) {
+        ++freed;
+        free(value);
+    }
+}
+
+static void *on_new (void *key, void *value, void *userdata) {
+    return value ? value : malloc(16);
+}
+
+// a full constant size table can not take the new value, it must not leak
+static void test_chash_3 () {
+    chash_t *ch = chash_alloc(1, 16, HASH_CONSTSIZE | HASH_OPEN, int_calc, int_compare, int_copy, on_free_value);
+    intptr_t i = 1;
+    void *value;
+    while (0 == chash_add(ch, (void*)i, sizeof(intptr_t), NULL))
+        ++i;
+    value = chash_compute(ch, (void*)i, sizeof(intptr_t), on_new, NULL);
+    printf("compute on a full table: %s\n", !value && ENOSPC == errno && 1 == freed ? "ok" : "FAIL");
+    chash_free(ch);
+}
+
+static double elapsed (struct timespec *start) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec - start->tv_sec) + (ts.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+typedef struct {
+    chash_t *ch;
+    hash_t *hash;
+    lock_t *lock;
+    long ops;
+    uint64_t seed;
+} bench_arg_t;
+
+// 90% get, 10% add over a preloaded key set
+static void *bench_chash_proc (void *arg) {
+    bench_arg_t *ba = (bench_arg_t*)arg;
+    uint64_t x = ba->seed;
+    void *value;
+    for (long i = 0; i < ba->ops; ++i) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        intptr_t key = (intptr_t)((x % KEYS) * 0x9e3779b97f4a7c15ULL >> 1);
+        if (x % 10 == 0)
+            chash_add(ba->ch, (void*)key, sizeof(intptr_t), (void*)key);
+        else
+            chash_get(ba->ch, (void*)key, sizeof(intptr_t), &value);
+    }
+    return NULL;
+}
+
+static void *bench_lock_proc (void *arg) {
+    bench_arg_t *ba = (bench_arg_t*)arg;
+    uint64_t x = ba->seed;
+    for (long i = 0; i < ba->ops; ++i) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        intptr_t key = (intptr_t)((x % KEYS) * 0x9e3779b97f4a7c15ULL >> 1);
+        lock(ba->lock);
+        if (x % 10 == 0)
+            hash_add(ba->hash, (void*)key, sizeof(intptr_t))->value = (void*)key;
+        else
+            hash_get(ba->hash, (void*)key, sizeof(intptr_t));
+        unlock(ba->lock);
+    }
+    return NULL;
+}
+
+static double bench_run (thread_h proc, chash_t *ch, hash_t *hash, lock_t *lck, int nthreads) {
+    thread_t th [nthreads];
+    bench_arg_t args [nthreads];
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (int i = 0; i < nthreads; ++i) {
+        args[i] = (bench_arg_t){ .ch = ch, .hash = hash, .lock = lck, .ops = OPS / nthreads, .seed = 0x2545f4914f6cdd1dULL + i };
+        mkthread(&th[i], proc, &args[i]);
+    }
+    for (int i = 0; i < nthreads; ++i)
+        pthread_join(th[i].h, NULL);
+    return OPS / elapsed(&ts) / 1e6;
+}
+
+static void test_chash_2 () {
+    chash_t *ch = chash_alloc(CHASH_DEFAULT_SHARDS, KEYS * 2, HASH_VARSIZE | HASH_OPEN, int_calc, int_compare, int_copy, NULL);
+    hash_t *hash = hash_alloc(KEYS * 2, HASH_VARSIZE | HASH_OPEN, int_calc, int_compare, int_copy, NULL);
+    lock_t lck;
+    lock_init(&lck);
+    for (intptr_t i = 0; i < KEYS; i += 2) {
+        intptr_t key = (intptr_t)(i * 0x9e3779b97f4a7c15ULL >> 1);
+        chash_add(ch, (void*)key, sizeof(intptr_t), (void*)key);
+        hash_add(hash, (void*)key, sizeof(intptr_t))->value = (void*)key;
+    }
+    printf("threads  global lock Mops/s  chash Mops/s\n");
+    for (int n = 1; n <= 64; n *= 2)
+        printf("%7d  %18.2f  %12.2f\n", n, bench_run(bench_lock_proc, NULL, hash, &lck, n), bench_run(bench_chash_proc, ch, NULL, NULL, n));
+    lock_done(&lck);
+    hash_free(hash);
+    chash_free(ch);
+}
+
+int main () {
+    test_chash_1();
+    test_chash_3();
+    test_chash_2();
+    return 0;
+}
@@ -0,0 +1,584 @@
+#include <time.h>
+#include <poll.h>
+#include <netinet/tcp.h>
+#include "../include/libex/evloop.h"
+#include "../include/libex/wsnet.h"
+
+#define PORT "17017"
+#define NLOOPS 2
+#define NCONNS 2000
+#define NREQS 10
+
+static double elapsed (struct timespec *start) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec - start->tv_sec) + (ts.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int connect_local (int port) {
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    int fd = socket(AF_INET, SOCK_STREAM, 0), on = 1;
+    if (-1 == fd)
+        return -1;
+    if (-1 == connect(fd, (struct sockaddr*)&addr, sizeof addr)) {
+        close(fd);
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+    return fd;
+}
+
+typedef struct {
+    evloop_t *loop;
+    evlistener_t listener;
+    pthread_t th;
+    size_t accepted;
+    size_t echoed;
+    evconn_t *conns [16];
+    int nconns;
+} server_t;
+
+static int on_accept (evloop_t *loop, evconn_t *conn, server_t *srv) {
+    ++srv->accepted;
+    return 0;
+}
+
+static void on_echo (evloop_t *loop, ev_t *ev, int events) {
+    evconn_t *conn = (evconn_t*)ev;
+    server_t *srv = (server_t*)conn->data;
+    ssize_t nbytes = 0;
+    if ((events & EV_READ))
+        nbytes = ev_recv(ev->fd, &conn->nbuf.buf);
+    if (nbytes > 0) {
+        ev_send(loop, ev, conn->nbuf.buf.ptr, conn->nbuf.buf.len);
+        conn->nbuf.buf.len = 0;
+        ++srv->echoed;
+    }
+    if (nbytes < 0 || (0 == nbytes && (events & EV_CLOSE)))
+        evconn_close(loop, conn);
+}
+
+// frames split over the reads, wsnet_recvfn takes them through ev_recv
+static void on_ws (evloop_t *loop, ev_t *ev, int events) {
+    evconn_t *conn = (evconn_t*)ev;
+    server_t *srv = (server_t*)conn->data;
+    ws_t *ws = NULL;
+    int rc;
+    while (WS_OK == (rc = wsnet_recvfn(ev->fd, &conn->nbuf, ev_recv, &ws))) {
+        ++srv->echoed;
+        ev_send(loop, ev, ".", 1);
+        free(ws);
+        ws = NULL;
+        wsnet_reset(&conn->nbuf);
+    }
+    if (WS_ERROR == rc)
+        evconn_close(loop, conn);
+}
+
+static void *server (server_t *srv) {
+    evloop_run(srv->loop);
+    close(srv->listener.ev.fd);
+    evloop_free(srv->loop);
+    return NULL;
+}
+
+static const char *backend (evloop_t *loop) {
+    return loop->ring ? "io_uring" : "epoll";
+}
+
+static void test_echo (int flags) {
+    server_t srvs [NLOOPS];
+    struct timespec ts;
+    const char *name;
+    int fds [NCONNS], ok = 1;
+    memset(srvs, 0, sizeof srvs);
+    for (int i = 0; i < NLOOPS; ++i) {
+        srvs[i].loop = evloop_alloc_flags(0, flags);
+        evloop_listen(srvs[i].loop, &srvs[i].listener, net_bind_flags(PORT, NET_REUSEPORT), EV_READ | EV_RECV | EV_ET,
+            (evconn_h)on_accept, on_echo, &srvs[i]);
+        pthread_create(&srvs[i].th, NULL, (void*(*)(void*))server, &srvs[i]);
+    }
+    name = backend(srvs[0].loop);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (int i = 0; i < NCONNS; ++i)
+        if (-1 == (fds[i] = connect_local(atoi(PORT))))
+            ok = 0;
+    for (int r = 0; r < NREQS && ok; ++r)
+        for (int i = 0; i < NCONNS && ok; ++i) {
+            char buf [16];
+            if (4 != write(fds[i], "ping", 4) || 4 != read(fds[i], buf, sizeof buf) || memcmp(buf, "ping", 4))
+                ok = 0;
+        }
+    for (int i = 0; i < NCONNS; ++i)
+        if (-1 != fds[i])
+            close(fds[i]);
+    double t = elapsed(&ts);
+    usleep(100000);
+    for (int i = 0; i < NLOOPS; ++i) {
+        evloop_stop(srvs[i].loop);
+        pthread_join(srvs[i].th, NULL);
+        printf("  loop %d: %zu connections, %zu echoes\n", i, srvs[i].accepted, srvs[i].echoed);
+    }
+    printf("echo %s: %s, %d connections x %d requests in %.0f ms, %.0f requests/s\n", name, ok ? "ok" : "FAIL",
+        NCONNS, NREQS, t * 1e3, NCONNS * NREQS / t);
+}
+
+// connections of the acceptor that took them
+static int on_group_accept (evloop_t *loop, evconn_t *conn, server_t *srvs) {
+    for (int i = 0; i < NLOOPS; ++i)
+        if (srvs[i].loop == loop) {
+            conn->data = &srvs[i];
+            ++srvs[i].accepted;
+        }
+    return 0;
+}
+
+// all connect before the first request, the backlog takes the storm
+static void test_group (const char *svc, int flags) {
+    evgroup_t *group = evgroup_alloc(NLOOPS, flags);
+    server_t srvs [NLOOPS];
+    struct timespec ts;
+    const char *name;
+    int fds [NCONNS], ok = 1;
+    memset(srvs, 0, sizeof srvs);
+    for (int i = 0; i < NLOOPS; ++i)
+        srvs[i].loop = group->acceptors[i].loop;
+    name = backend(srvs[0].loop);
+    if (-1 == evgroup_listen(group, svc, 0, EV_READ | EV_RECV | EV_ET, (evconn_h)on_group_accept, on_echo, srvs) ||
+        -1 == evgroup_start(group)) {
+        printf("group %s %s: FAIL, %s\n", name, svc, strerror(errno));
+        evgroup_free(group);
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (int i = 0; i < NCONNS; ++i)
+        if (-1 == (fds[i] = '/' == *svc ? unet_connect(svc) : connect_local(atoi(svc))))
+            ok = 0;
+    for (int i = 0; i < NCONNS && ok; ++i) {
+        char buf [16];
+        if (4 != write(fds[i], "ping", 4) || 4 != read(fds[i], buf, sizeof buf) || memcmp(buf, "ping", 4))
+            ok = 0;
+    }
+    double t = elapsed(&ts);
+    for (int i = 0; i < NCONNS; ++i)
+        if (-1 != fds[i])
+            close(fds[i]);
+    usleep(100000);
+    evgroup_free(group);
+    if ('/' == *svc)
+        unlink(svc);
+    printf("group %s %s%s: %s, %d connections in %.0f ms, accepted", name, svc, (flags & EVLOOP_CPU_STEER) ? " steered" : "",
+        ok ? "ok" : "FAIL", NCONNS, t * 1e3);
+    for (int i = 0; i < NLOOPS; ++i)
+        printf(" %zu", srvs[i].accepted);
+    printf("\n");
+}
+
+#define NCALLS 10000
+#define NPARALLEL 16
+
+static const char rpc_req [] = "{\"jsonrpc\":\"2.0\",\"method\":\"ping\",\"params\":[],\"id\":1}";
+
+static struct {
+    evpool_t *pool;
+    int ncalls;
+    int calls;
+    int done;
+    int failed;
+    int inflight;
+    int err;
+} rpc;
+
+static int on_pool_accept (evloop_t *loop, evconn_t *conn, server_t *srv) {
+    ++srv->accepted;
+    if (srv->nconns < sizeof srv->conns / sizeof srv->conns[0])
+        srv->conns[srv->nconns++] = conn;
+    return 0;
+}
+
+// the connections of the pool are closed by the server
+static void *pool_server (server_t *srv) {
+    evloop_run(srv->loop);
+    for (int i = 0; i < srv->nconns; ++i)
+        evconn_close(srv->loop, srv->conns[i]);
+    close(srv->listener.ev.fd);
+    evloop_free(srv->loop);
+    return NULL;
+}
+
+static void rpc_on_reply (evloop_t *loop, ev_t *ev, int events);
+static void rpc_on_conn (evloop_t *loop, evpconn_t *conn, int err, void *userdata);
+
+static void rpc_next (evloop_t *loop) {
+    if (rpc.calls < rpc.ncalls) {
+        ++rpc.calls;
+        ++rpc.inflight;
+        if (-1 == evpool_get(rpc.pool, "127.0.0.1", PORT, rpc_on_reply, rpc_on_conn, NULL)) {
+            ++rpc.failed;
+            --rpc.inflight;
+        }
+    } else
+    if (!rpc.inflight)
+        evloop_stop(loop);
+}
+
+static void rpc_on_reply (evloop_t *loop, ev_t *ev, int events) {
+    evpconn_t *conn = (evpconn_t*)ev;
+    ssize_t nbytes = 0;
+    if ((events & EV_READ))
+        nbytes = ev_recv(ev->fd, &conn->conn.nbuf.buf);
+    if (nbytes < 0 || (0 == nbytes && (events & EV_CLOSE))) {
+        ++rpc.failed;
+        --rpc.inflight;
+        evpool_close(rpc.pool, conn);
+        rpc_next(loop);
+    } else
+    if (conn->conn.nbuf.buf.len >= sizeof rpc_req - 1) {
+        ++rpc.done;
+        --rpc.inflight;
+        evpool_put(rpc.pool, conn);
+        rpc_next(loop);
+    }
+}
+
+static void rpc_on_conn (evloop_t *loop, evpconn_t *conn, int err, void *userdata) {
+    if (!conn) {
+        ++rpc.failed;
+        --rpc.inflight;
+        rpc.err = err;
+        rpc_next(loop);
+        return;
+    }
+    ev_send(loop, &conn->conn.ev, rpc_req, sizeof rpc_req - 1);
+}
+
+static double rpc_run (evloop_t *loop, int ncalls, int nparallel) {
+    struct timespec ts;
+    rpc.ncalls = ncalls;
+    rpc.calls = rpc.done = rpc.failed = rpc.inflight = rpc.err = 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (int i = 0; i < nparallel; ++i)
+        rpc_next(loop);
+    evloop_run(loop);
+    return elapsed(&ts);
+}
+
+static int pool_nconns () {
+    hash_item_t *item = hash_get(rpc.pool->peers, "127.0.0.1:" PORT, sizeof("127.0.0.1:" PORT) - 1);
+    return item ? ((evpeer_t*)item->value)->nconns : 0;
+}
+
+// a connection for every call against the pool
+static void test_pool (int flags) {
+    server_t srv;
+    evloop_t *loop = evloop_alloc_flags(0, flags);
+    struct timespec ts;
+    int ok = 1, nconns;
+    double t;
+
+    memset(&srv, 0, sizeof srv);
+    srv.loop = evloop_alloc_flags(0, flags);
+    evloop_listen(srv.loop, &srv.listener, net_bind(PORT), EV_READ | EV_RECV | EV_ET, (evconn_h)on_accept, on_echo, &srv);
+    pthread_create(&srv.th, NULL, (void*(*)(void*))server, &srv);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (int i = 0; i < NCALLS / 10 && ok; ++i) {
+        char buf [256];
+        int fd = net_connect("127.0.0.1", PORT, 1000);
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        if (-1 == fd || sizeof rpc_req - 1 != write(fd, rpc_req, sizeof rpc_req - 1) || 1 != poll(&pfd, 1, 1000) ||
+            sizeof rpc_req - 1 != read(fd, buf, sizeof buf))
+            ok = 0;
+        if (-1 != fd)
+            close(fd);
+    }
+    t = elapsed(&ts);
+    evloop_stop(srv.loop);
+    pthread_join(srv.th, NULL);
+    printf("pool %s: net_connect %s, %d calls in %.0f ms, %.1f us a call\n", backend(loop), ok ? "ok" : "FAIL",
+        NCALLS / 10, t * 1e3, t * 1e7 / NCALLS);
+
+    memset(&srv, 0, sizeof srv);
+    srv.loop = evloop_alloc_flags(0, flags);
+    evloop_listen(srv.loop, &srv.listener, net_bind(PORT), EV_READ | EV_RECV | EV_ET, (evconn_h)on_pool_accept, on_echo, &srv);
+    pthread_create(&srv.th, NULL, (void*(*)(void*))pool_server, &srv);
+    rpc.pool = evpool_alloc(loop, 0, 2, 0, 1000);
+    t = rpc_run(loop, NCALLS, 1);
+    printf("pool %s: one by one %s, %d calls in %.0f ms, %.1f us a call, %zu connects\n", backend(loop),
+        NCALLS == rpc.done ? "ok" : "FAIL", rpc.done, t * 1e3, t * 1e6 / NCALLS, rpc.pool->connects);
+    t = rpc_run(loop, NCALLS, NPARALLEL);
+    printf("pool %s: %d at once %s, %d calls in %.0f ms, %zu connects for at most 2\n", backend(loop), NPARALLEL,
+        NCALLS == rpc.done && 2 == rpc.pool->connects ? "ok" : "FAIL", rpc.done, t * 1e3, rpc.pool->connects);
+
+    // the server goes, the idle connections see it hang up
+    evloop_stop(srv.loop);
+    pthread_join(srv.th, NULL);
+    nconns = pool_nconns();
+    for (int i = 0; i < 10 && pool_nconns(); ++i)
+        evloop_once(loop, 10);
+    printf("pool %s: idle %s, %d connections, %d after the server closed them\n", backend(loop),
+        2 == nconns && 0 == pool_nconns() ? "ok" : "FAIL", nconns, pool_nconns());
+    rpc_run(loop, 1, 1);
+    printf("pool %s: no server %s, %s\n", backend(loop), 1 == rpc.failed && ECONNREFUSED == rpc.err ? "ok" : "FAIL", strerror(rpc.err));
+    evpool_free(rpc.pool);
+    evloop_free(loop);
+}
+
+#define NFRAMES 20000
+
+static void test_ws (int flags) {
+    server_t srv;
+    struct timespec ts;
+    char *frames = malloc(NFRAMES * WST_PING_LEN), acks [4096];
+    size_t len = NFRAMES * WST_PING_LEN, off = 0, nacks = 0;
+    int fd;
+    memset(&srv, 0, sizeof srv);
+    srv.loop = evloop_alloc_flags(0, flags);
+    evloop_listen(srv.loop, &srv.listener, net_bind(PORT), EV_READ | EV_RECV, (evconn_h)on_accept, on_ws, &srv);
+    pthread_create(&srv.th, NULL, (void*(*)(void*))server, &srv);
+    for (int i = 0; i < NFRAMES; ++i)
+        memcpy(frames + i * WST_PING_LEN, wst_ping, WST_PING_LEN);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    fd = connect_local(atoi(PORT));
+    // pieces that cut the frames anywhere
+    while (off < len) {
+        ssize_t n = write(fd, frames + off, off + 1000 < len ? 1000 : len - off);
+        if (n <= 0)
+            break;
+        off += n;
+    }
+    while (nacks < NFRAMES) {
+        ssize_t n = read(fd, acks, sizeof acks);
+        if (n <= 0)
+            break;
+        nacks += n;
+    }
+    double t = elapsed(&ts);
+    close(fd);
+    usleep(100000);
+    printf("ws %s: ", backend(srv.loop));
+    evloop_stop(srv.loop);
+    pthread_join(srv.th, NULL);
+    printf("%s, %zu of %d frames in %.0f ms\n", NFRAMES == nacks && NFRAMES == srv.echoed ? "ok" : "FAIL",
+        srv.echoed, NFRAMES, t * 1e3);
+    free(frames);
+}
+
+static void test_file () {
+    uring_t ring;
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    char path [] = "/tmp/test_evloopXXXXXX", data [8192], back [8192];
+    int fd = mkstemp(path), ok = 0;
+    if (-1 == fd || -1 == uring_init(&ring, 8)) {
+        printf("file: io_uring not available\n");
+        if (-1 != fd) {
+            close(fd);
+            unlink(path);
+        }
+        return;
+    }
+    for (int i = 0; i < sizeof data; ++i)
+        data[i] = 'a' + i % 26;
+    // the write and the read go in one submission, the link keeps them in order
+    sqe = uring_get_sqe(&ring);
+    uring_prep_write(sqe, fd, data, sizeof data, 0);
+    sqe->flags |= IOSQE_IO_LINK;
+    sqe->user_data = 1;
+    sqe = uring_get_sqe(&ring);
+    uring_prep_read(sqe, fd, back, sizeof back, 0);
+    sqe->user_data = 2;
+    uring_submit(&ring, 2, 1000);
+    while ((cqe = uring_peek(&ring)) || (uring_submit(&ring, 1, 1000) >= 0 && (cqe = uring_peek(&ring)))) {
+        if (sizeof data == cqe->res)
+            ++ok;
+        uring_seen(&ring);
+        if (2 == ok)
+            break;
+    }
+    printf("file: %s\n", 2 == ok && !memcmp(data, back, sizeof data) ? "ok" : "FAIL");
+    uring_free(&ring);
+    close(fd);
+    unlink(path);
+}
+
+#define NMSGS 200000
+#define NBATCH 100
+
+typedef struct {
+    int fd;
+    int delay_us;
+    size_t nbytes;
+} reader_t;
+
+static void *reader (reader_t *r) {
+    char buf [65536];
+    ssize_t n;
+    while ((n = read(r->fd, buf, sizeof buf)) > 0) {
+        r->nbytes += n;
+        if (r->delay_us)
+            usleep(r->delay_us);
+    }
+    return NULL;
+}
+
+static int msg (char *buf, int i) {
+    return snprintf(buf, 128, "{\"id\":%d,\"method\":\"tick\",\"params\":[%d,%d]}\n", i, i * 7, i % 13);
+}
+
+static void on_drain (netout_t *out, int *drains) {
+    ++*drains;
+}
+
+// small messages one write each against the queue flushed once per batch
+static void test_netout () {
+    int fds [2], drains = 0;
+    reader_t r;
+    pthread_t th;
+    struct timespec ts;
+    netout_t out;
+    size_t total = 0, max_queued = 0;
+    char buf [128];
+    double t;
+
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    memset(&r, 0, sizeof r);
+    r.fd = fds[1];
+    pthread_create(&th, NULL, (void*(*)(void*))reader, &r);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (int i = 0; i < NMSGS; ++i) {
+        int len = msg(buf, i);
+        net_write(fds[0], buf, len, NULL);
+        total += len;
+    }
+    t = elapsed(&ts);
+    shutdown(fds[0], SHUT_WR);
+    pthread_join(th, NULL);
+    printf("net_write: %s, %d writes in %.0f ms\n", total == r.nbytes ? "ok" : "FAIL", NMSGS, t * 1e3);
+    close(fds[0]);
+    close(fds[1]);
+
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    memset(&r, 0, sizeof r);
+    r.fd = fds[1];
+    netout_init(&out, 0, 0, NULL, NULL);
+    pthread_create(&th, NULL, (void*(*)(void*))reader, &r);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (int i = 0; i < NMSGS; ++i) {
+        netout_add(&out, buf, msg(buf, i));
+        if (0 == (i + 1) % NBATCH)
+            netout_flush(&out, fds[0], NULL);
+    }
+    netout_flush(&out, fds[0], NULL);
+    t = elapsed(&ts);
+    shutdown(fds[0], SHUT_WR);
+    pthread_join(th, NULL);
+    printf("netout: %s, %d messages in %zu writes in %.0f ms, flush %lu us, max %lu us\n", total == r.nbytes ? "ok" : "FAIL",
+        NMSGS, out.stat.writes, t * 1e3, out.stat.flush_us, out.stat.max_flush_us);
+    netout_free(&out);
+    close(fds[0]);
+    close(fds[1]);
+
+    // a slow reader, the producer stops at the high watermark and goes on when it drained
+    socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds);
+    fcntl(fds[1], F_SETFL, 0);
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &(int){ 4096 }, sizeof(int));
+    memset(&r, 0, sizeof r);
+    r.fd = fds[1];
+    r.delay_us = 100;
+    netout_init(&out, 64 * 1024, 16 * 1024, (netout_h)on_drain, &drains);
+    pthread_create(&th, NULL, (void*(*)(void*))reader, &r);
+    for (int i = 0; i < NMSGS; ) {
+        if (netout_is_full(&out)) {
+            struct pollfd pfd = { .fd = fds[0], .events = POLLOUT };
+            poll(&pfd, 1, 1000);
+            if (NET_ERROR == netout_flush(&out, fds[0], NULL))
+                break;
+            continue;
+        }
+        netout_add(&out, buf, msg(buf, i++));
+        if (out.queued > max_queued)
+            max_queued = out.queued;
+        if (0 == i % NBATCH && NET_ERROR == netout_flush(&out, fds[0], NULL))
+            break;
+    }
+    while (out.queued && NET_ERROR != netout_flush(&out, fds[0], NULL)) {
+        struct pollfd pfd = { .fd = fds[0], .events = POLLOUT };
+        poll(&pfd, 1, 1000);
+    }
+    shutdown(fds[0], SHUT_WR);
+    pthread_join(th, NULL);
+    printf("backpressure: %s, %zu bytes, %d drains, max queued %zu of %zu, max flush %lu us\n",
+        total == r.nbytes && drains && max_queued < out.high + sizeof buf ? "ok" : "FAIL",
+        r.nbytes, drains, max_queued, out.high, out.stat.max_flush_us);
+    netout_free(&out);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+#define NTIMERS 1000
+
+typedef struct {
+    evtimer_t timer;
+    struct timespec start;
+    long ms;
+    double late;
+    int fired;
+} ttimer_t;
+
+static double max_late;
+static int fired, ticks;
+
+static void on_timer (evloop_t *loop, ttimer_t *t) {
+    double late = elapsed(&t->start) * 1e3 - t->ms;
+    if (late > max_late)
+        max_late = late;
+    if (late < -1)
+        printf("timer %ld ms fired %.1f ms early\n", t->ms, -late);
+    ++t->fired;
+    ++fired;
+    if (fired == NTIMERS - 1)
+        evloop_stop(loop);
+}
+
+static void on_tick (evloop_t *loop, evtimer_t *timer) {
+    ++ticks;
+}
+
+static void test_timers () {
+    evloop_t *loop = evloop_alloc(0);
+    ttimer_t *ts = calloc(NTIMERS, sizeof(ttimer_t));
+    evtimer_t tick;
+    struct timespec start;
+    memset(&tick, 0, sizeof tick);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    evtimer_start(loop, &tick, 50, 50, on_tick, NULL);
+    for (int i = 0; i < NTIMERS; ++i) {
+        // some go round the wheel more than once
+        ts[i].ms = (i * 7919) % 8000;
+        clock_gettime(CLOCK_MONOTONIC, &ts[i].start);
+        evtimer_start(loop, &ts[i].timer, ts[i].ms, 0, (evtimer_h)on_timer, &ts[i]);
+    }
+    evtimer_stop(loop, &ts[NTIMERS / 2].timer);
+    evloop_run(loop);
+    evtimer_stop(loop, &tick);
+    printf("timers: %d of %d fired, stopped one %s, max late %.1f ms, %d ticks of 50 ms in %.0f ms, %zu left\n",
+        fired, NTIMERS, ts[NTIMERS / 2].fired ? "FIRED" : "silent", max_late, ticks, elapsed(&start) * 1e3, loop->timers);
+    free(ts);
+    evloop_free(loop);
+}
+
+int main () {
+    test_timers();
+    test_echo(0);
+    test_echo(EVLOOP_URING);
+    test_group(PORT, EVLOOP_CPU_STEER);
+    test_group("/tmp/test_evloop.sock", 0);
+    test_group("/tmp/test_evloop.sock", EVLOOP_URING);
+    test_pool(0);
+    test_pool(EVLOOP_URING);
+    test_ws(0);
+    test_ws(EVLOOP_URING);
+    test_file();
+    test_netout();
+    return 0;
+}
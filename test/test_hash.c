@@ -129,7 +129,7 @@ void test_hash_3 () {
 }
 
 void test_hash_4 () {
-    hash_t *h = hash_alloc(2000, HASH_CONSTSIZE, int_calc, int_compare, int_copy, int_free);
+    hash_t *h = hash_alloc(2000, HASH_CONSTSIZE, int_calc, int_compare, int_copy, NULL);
     for (intptr_t i = 0; i < 3000; ++i) {
         hash_item_t *hi = hash_add(h, (void*)i, sizeof(intptr_t));
         hi->value = (void*)i;
@@ -143,10 +143,221 @@ void test_hash_4 () {
     hash_free(h);
 }
 
+static double elapsed (struct timespec *start) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec - start->tv_sec) + (ts.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void bench_hash (hash_type_t type, const char *name, intptr_t count) {
+    struct timespec ts;
+    hash_t *h = hash_alloc(count, type, int_calc, int_compare, int_copy, NULL);
+    intptr_t found = 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (intptr_t i = 1; i <= count; ++i)
+        hash_add(h, (void*)((i * 0x9e3779b97f4a7c15ULL) >> 1), sizeof(intptr_t))->value = (void*)i;
+    printf("%s: add %ld: %f sec\n", name, count, elapsed(&ts));
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (intptr_t i = 1; i <= count; ++i)
+        if (hash_get(h, (void*)((i * 0x9e3779b97f4a7c15ULL) >> 1), sizeof(intptr_t)))
+            ++found;
+    printf("%s: get %ld: %f sec, found %ld\n", name, count, elapsed(&ts), found);
+    hash_free(h);
+}
+
+void test_hash_5 () {
+    hash_t *h = hash_alloc(16, HASH_VARSIZE | HASH_OPEN, char_calc, char_compare, char_copy, char_free);
+    char key [16];
+    for (int i = 0; i < 1000; ++i) {
+        snprintf(key, sizeof key, "key%d", i);
+        hash_add(h, key, 0)->value = (void*)(intptr_t)i;
+    }
+    printf("open hash: size " ULONG_FMT ", items " ULONG_FMT "\n", h->size, h->len);
+    for (int i = 0; i < 1000; i += 2) {
+        snprintf(key, sizeof key, "key%d", i);
+        hash_del(h, key, 0);
+    }
+    for (int i = 0; i < 1000; ++i) {
+        hash_item_t *hi;
+        snprintf(key, sizeof key, "key%d", i);
+        hi = hash_get(h, key, 0);
+        if ((i % 2 == 0 && hi) || (i % 2 == 1 && (!hi || (intptr_t)hi->value != i)))
+            printf("error: %s\n", key);
+    }
+    hash_add(h, "key1", 0);
+    if (EEXIST != errno)
+        printf("error: key1 must exist\n");
+    int n = 0;
+    HASH_OPEN_FOREACH(key, value, h)
+        if (key && value)
+            ++n;
+    HASH_OPEN_END(h)
+    printf("open hash: items " ULONG_FMT ", foreach %d\n", h->len, n);
+    hash_free(h);
+    bench_hash(HASH_VARSIZE, "list", 1000000);
+    bench_hash(HASH_VARSIZE | HASH_OPEN, "open", 1000000);
+}
+
+static int cmp_double (const void *x, const void *y) {
+    double a = *(const double*)x, b = *(const double*)y;
+    return a > b ? 1 : a < b ? -1 : 0;
+}
+
+static void print_latency (const char *name, double *lat, intptr_t count) {
+    qsort(lat, count, sizeof(double), cmp_double);
+    printf("%s p50 %.3f us, p99 %.3f us, p99.9 %.3f us, max %.3f us\n", name,
+           lat[count / 2], lat[count * 99 / 100], lat[count * 999 / 1000], lat[count - 1]);
+}
+
+// a growth window runs from one resize to the next, p99 should not change from one to the other
+static void bench_latency (hash_type_t type, const char *name, intptr_t count) {
+    double *lat = malloc(count * sizeof(double));
+    hash_t *h = hash_alloc(1024, type, int_calc, int_compare, int_copy, NULL);
+    intptr_t start = 0;
+    hash_key_t size = h->size;
+    h->inc_size = 1 << 17;
+    printf("%s:\n", name);
+    for (intptr_t i = 0; i < count; ++i) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        hash_add(h, (void*)((i * 0x9e3779b97f4a7c15ULL) >> 1), sizeof(intptr_t));
+        lat[i] = elapsed(&ts) * 1e6;
+        if (h->size != size || i == count - 1) {
+            char s [64];
+            // the add that resized ends its window
+            snprintf(s, sizeof s, "  size %7lu, %7ld adds:", (unsigned long)size, (long)(i + 1 - start));
+            print_latency(s, lat + start, i + 1 - start);
+            start = i + 1;
+            size = h->size;
+        }
+    }
+    print_latency("  all:", lat, count);
+    hash_free(h);
+    free(lat);
+}
+
+void test_hash_6 () {
+    bench_latency(HASH_VARSIZE, "stop-the-world", 2000000);
+    bench_latency(HASH_VARSIZE | HASH_INCREMENTAL, "incremental", 2000000);
+}
+
+static hash_key_t oaat_nstr (const char *s, size_t len) {
+    hash_key_t hash = 0;
+    for (size_t i = 0; i < len; ++i) {
+        hash += s[i];
+        hash += (hash << 10);
+        hash ^= (hash >> 6);
+    }
+    hash += (hash << 2);
+    hash ^= (hash >> 11);
+    hash += (hash << 15);
+    return hash;
+}
+
+static hash_key_t char_seed_calc (void *key, size_t key_len, uint64_t seed) {
+    return hash_seed_str((const char*)key, key_len, seed);
+}
+
+static void bench_hashfn (size_t len) {
+    size_t total = 256 * 1024 * 1024, n = total / len;
+    char *buf = malloc(len + 64);
+    hash_key_t x = 0;
+    struct timespec ts;
+    double t1, t2;
+    for (size_t i = 0; i < len + 64; ++i)
+        buf[i] = 'a' + i % 26;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (size_t i = 0; i < n; ++i)
+        x += oaat_nstr(buf + (i & 63), len);
+    t1 = elapsed(&ts);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (size_t i = 0; i < n; ++i)
+        x += hash_nstr(buf + (i & 63), len);
+    t2 = elapsed(&ts);
+    printf("%5lu bytes: one-at-a-time %7.2f MB/s, hash_nstr %8.2f MB/s (%lx)\n", len, total / t1 / 1e6, total / t2 / 1e6, (unsigned long)(x & 0xf));
+    free(buf);
+}
+
+void test_hash_7 () {
+    hash_t *h1 = hash_alloc(1024, HASH_VARSIZE | HASH_OPEN, NULL, char_compare, char_copy, char_free),
+           *h2 = hash_alloc(1024, HASH_VARSIZE | HASH_OPEN, NULL, char_compare, char_copy, char_free);
+    hash_set_seed(h1, char_seed_calc, 0);
+    hash_set_seed(h2, char_seed_calc, 0);
+    hash_add(h1, "Content-Type", 0)->value = "h1";
+    hash_add(h2, "Content-Type", 0)->value = "h2";
+    printf("seeds differ: %s\n", h1->seed != h2->seed ? "yes" : "no");
+    printf("Content-Type: %s %s\n", (char*)hash_get(h1, "Content-Type", 0)->value, (char*)hash_get(h2, "Content-Type", 0)->value);
+    printf("seed of a filled table kept: %s\n", -1 == hash_set_seed(h1, char_seed_calc, 1) && EBUSY == errno && hash_get(h1, "Content-Type", 0) ? "yes" : "no");
+    printf("hash_str honours length: %s\n", hash_str("abcdef", 3) == hash_str("abc", 0) ? "yes" : "no");
+    hash_free(h1);
+    hash_free(h2);
+    bench_hashfn(8);
+    bench_hashfn(32);
+    bench_hashfn(256);
+    bench_hashfn(4096);
+}
+
+// more items than buckets, every resize has to move all of the old table
+static void test_resize_twice (hash_type_t type, const char *name) {
+    hash_t *h = hash_alloc(1000, type, int_calc, int_compare, int_copy, NULL);
+    intptr_t missing = 0;
+    for (intptr_t i = 0; i < 8000; ++i)
+        hash_add(h, (void*)i, sizeof(intptr_t))->value = (void*)i;
+    hash_resize(h, 1000);
+    hash_resize(h, 2000);
+    for (intptr_t i = 0; i < 8000; ++i) {
+        hash_item_t *hi = hash_get(h, (void*)i, sizeof(intptr_t));
+        if (!hi || (intptr_t)hi->value != i)
+            ++missing;
+    }
+    printf("%s resize twice: %s, %ld missing of " SIZE_FMT "\n", name, missing ? "FAIL" : "ok", missing, h->len);
+    hash_free(h);
+}
+
+void test_hash_8 () {
+    test_resize_twice(HASH_VARSIZE, "stop-the-world");
+    test_resize_twice(HASH_VARSIZE | HASH_INCREMENTAL, "incremental");
+}
+
+// a constant size open table next to full with deletes and adds going on, a tombstone
+// must not make every add rebuild the table
+static void test_open_churn (hash_key_t cap, intptr_t ops) {
+    hash_t *h = hash_alloc(cap, HASH_CONSTSIZE | HASH_OPEN, int_calc, int_compare, int_copy, NULL);
+    intptr_t n = 0, missing = 0, failed = 0;
+    struct timespec ts;
+    double t;
+    while (hash_add(h, (void*)n, sizeof(intptr_t)))
+        ++n;
+    hash_del(h, (void*)0, sizeof(intptr_t));
+    --n;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (intptr_t i = 0; i < ops; ++i) {
+        hash_del(h, (void*)(i + 1), sizeof(intptr_t));
+        if (!hash_add(h, (void*)(i + 1 + n), sizeof(intptr_t)))
+            ++failed;
+    }
+    t = elapsed(&ts);
+    for (intptr_t i = ops + 1; i <= ops + n; ++i)
+        if (!hash_get(h, (void*)i, sizeof(intptr_t)))
+            ++missing;
+    printf("open churn at %lu of " ULONG_FMT ": %s, %.0f ns a del and add\n", (unsigned long)h->len, h->size,
+           missing || failed ? "FAIL" : "ok", t * 1e9 / ops);
+    hash_free(h);
+}
+
+void test_hash_9 () {
+    test_open_churn(16384, 200000);
+}
+
 int main () {
     srand(time(0));
 //    test_hash_1();
 //    test_hash_2();
 //    test_hash_3();
+    test_hash_5();
+    test_hash_6();
     test_hash_4();
+    test_hash_7();
+    test_hash_8();
+    test_hash_9();
 }
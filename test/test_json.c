@@ -3,6 +3,8 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <time.h>
+#include <ctype.h>
 #include "../include/libex/file.h"
 #include "../include/libex/json.h"
 #if 0
@@ -154,6 +156,8 @@ void test_json4 () {
 
 void test_json5 () {
     str_t *str = load_all_file("./json_4.txt", 2048, 8192);
+    if (!str)
+        return;
     json_t *json = json_parse_len(str->ptr, str->len);
     if (json) {
         printf("Ok\n");
@@ -163,11 +167,852 @@ void test_json5 () {
     free(str);
 }
 
+static const char *rpc_req = "{\"jsonrpc\":\"2.0\",\"method\":\"update\",\"params\":[{\"id\":17,\"name\":\"Rio de Janeiro\","
+                             "\"tags\":[\"a\",\"b\",\"c\"],\"price\":2.65,\"active\":true,\"parent\":null},42,\"text\"],\"id\":1}";
+
+static double elapsed (struct timespec *start) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec - start->tv_sec) + (ts.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void bench_parse (json_parse_h on_parse, const char *name, int count) {
+    size_t len = strlen(rpc_req);
+    struct timespec ts;
+    double t;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (int i = 0; i < count; ++i) {
+        json_t *json = on_parse(rpc_req, len);
+        json_free(json);
+    }
+    t = elapsed(&ts);
+    printf("%s: %d parses, %f sec, %.0f req/s\n", name, count, t, count / t);
+}
+
+void test_json6 () {
+    json_t *json = json_parse_arena(rpc_req);
+    json_item_t *ji;
+    if (json && (ji = json_find(json->data.o, CONST_STR_LEN("params"), JSON_ARRAY))) {
+        json_item_t *jo = (json_item_t*)ji->data.a->head->ptr, *jn;
+        if ((jn = json_find(jo->data.o, CONST_STR_LEN("name"), JSON_STRING)))
+            printf("arena: params " SIZE_FMT ", name %.*s, %lu bytes\n", ji->data.a->len, (int)jn->data.s.len, jn->data.s.ptr, (unsigned long)json->arena->len);
+    }
+    json_free(json);
+    printf("broken: %s\n", json_parse_arena("{\"a\":[1,2,{\"b\":}]}") ? "parsed" : "rejected");
+    bench_parse(json_parse_len, "malloc", 200000);
+    bench_parse(json_parse_arena_len, "arena", 200000);
+}
+
+static void bench_large (const char *name, const char *item, int count) {
+    strbuf_t buf;
+    struct timespec ts;
+    json_t *json;
+    double t;
+    strbufalloc(&buf, 1024 * 1024, 1024 * 1024);
+    strbufadd(&buf, CONST_STR_LEN("["));
+    for (int i = 0; i < count; ++i) {
+        if (i > 0)
+            strbufadd(&buf, CONST_STR_LEN(",\n  "));
+        strbufadd(&buf, item, strlen(item));
+    }
+    strbufadd(&buf, CONST_STR_LEN("]"));
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    json = json_parse_arena_len(buf.ptr, buf.len);
+    t = elapsed(&ts);
+    printf("%s: %.1f MB, " SIZE_FMT " items, %.0f MB/s, arena blocks of %.1f MB\n", name, buf.len / 1e6, json ? json->data.a->len : 0,
+           buf.len / t / 1e6, json ? json->arena->block_size / 1e6 : 0);
+    if (json)
+        json_free(json);
+    free(buf.ptr);
+}
+
+void test_json7 () {
+    bench_large("records", "{\"id\": 123456, \"name\": \"Rio de Janeiro\", \"tags\": [\"a\", \"b\"], \"price\": 2.65, \"ok\": true}", 300000);
+    bench_large("numbers", "[123456, -7.25e-3, 3.141592653589793, 42, 1e10, -0.5, 17.0, 9007199254740993]", 300000);
+    bench_large("text", "{\"body\": \"Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor incididunt ut labore et "
+                        "dolore magna aliqua. Ut enim ad minim veniam, quis nostrud exercitation ullamco laboris nisi ut aliquip ex ea commodo "
+                        "consequat. Duis aute irure dolor in reprehenderit in voluptate velit esse cillum dolore eu fugiat nulla \\\"pariatur\\\". "
+                        "Excepteur sint occaecat cupidatat non proident, sunt in culpa qui officia deserunt mollit anim id est laborum.\"}", 100000);
+}
+
+static int on_sax_trace (int event, json_item_t *ji, strbuf_t *trace) {
+    static const char *events [] = { "", "{", "}", "[", "]", "k", "v" };
+    strbufadd(trace, events[event], 1);
+    if (ji->key.len)
+        strbufadd(trace, ji->key.ptr, ji->key.len);
+    if (JSON_SAX_VALUE == event) {
+        char num [64];
+        switch (ji->type) {
+            case JSON_STRING:
+                strbufadd(trace, CONST_STR_LEN("="));
+                strbufadd(trace, ji->data.s.ptr, ji->data.s.len);
+                break;
+            case JSON_INTEGER:
+                strbufadd(trace, num, snprintf(num, sizeof num, "=%ld", ji->data.i));
+                break;
+            case JSON_DOUBLE:
+                strbufadd(trace, num, snprintf(num, sizeof num, "=%.17Lg", ji->data.d));
+                break;
+            default:
+                strbufadd(trace, num, snprintf(num, sizeof num, "=#%d", ji->type));
+                break;
+        }
+    }
+    strbufadd(trace, CONST_STR_LEN(";"));
+    return 0;
+}
+
+static int on_sax_count (int event, json_item_t *ji, size_t *count) {
+    ++*count;
+    return 0;
+}
+
+void test_json8 () {
+    const char *doc = "{\"jsonrpc\": \"2.0\", \"method\": \"where\", \"params\": [\"Rio \\\"de\\\" Janeiro\", 1234567, -2.5e-3, true, null, [], {}],"
+                      " \"nested\": {\"a\": [1, [2, [3]]], \"b\": {\"c\": false}}, \"id\": 1} [1,2] ";
+    size_t doc_len = strlen(doc);
+    strbuf_t whole, trace;
+    json_sax_t *sax;
+    int fails = 0;
+    strbufalloc(&whole, 256, 256);
+    strbufalloc(&trace, 256, 256);
+    sax = json_sax_alloc((json_sax_h)on_sax_trace, &whole);
+    json_sax_feed(sax, doc, doc_len);
+    printf("%s\ndocs: " SIZE_FMT ", done: %d\n", whole.ptr, sax->docs, json_sax_done(sax));
+    json_sax_free(sax);
+    // every split of the document must give the same events
+    for (size_t chunk = 1; chunk < doc_len; ++chunk) {
+        trace.len = 0;
+        sax = json_sax_alloc((json_sax_h)on_sax_trace, &trace);
+        for (size_t off = 0; off < doc_len; off += chunk)
+            json_sax_feed(sax, doc + off, off + chunk < doc_len ? chunk : doc_len - off);
+        if (0 != cmpstr(whole.ptr, whole.len, trace.ptr, trace.len) || !json_sax_done(sax))
+            ++fails;
+        json_sax_free(sax);
+    }
+    printf("splits: " SIZE_FMT ", failed: %d\n", doc_len - 1, fails);
+    sax = json_sax_alloc((json_sax_h)on_sax_trace, &trace);
+    printf("bad: %d", json_sax_feed(sax, CONST_STR_LEN("{\"a\": 1 \"b\"")));
+    printf(" %d\n", json_sax_feed(sax, CONST_STR_LEN("}")));
+    json_sax_free(sax);
+    free(whole.ptr);
+    free(trace.ptr);
+}
+
+// a large message arrives in 4k fragments: push parser vs buffer and reparse on every fragment
+void test_json9 () {
+    const char *item = "{\"id\": 123456, \"name\": \"Rio de Janeiro\", \"tags\": [\"a\", \"b\"], \"price\": 2.65, \"ok\": true}";
+    strbuf_t buf, acc;
+    struct timespec ts;
+    size_t count = 0, parses = 0;
+    double t;
+    json_sax_t *sax;
+    strbufalloc(&buf, 1024 * 1024, 1024 * 1024);
+    strbufadd(&buf, CONST_STR_LEN("["));
+    for (int i = 0; i < 300000; ++i) {
+        if (i > 0)
+            strbufadd(&buf, CONST_STR_LEN(",\n  "));
+        strbufadd(&buf, item, strlen(item));
+    }
+    strbufadd(&buf, CONST_STR_LEN("]"));
+    sax = json_sax_alloc((json_sax_h)on_sax_count, &count);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (size_t off = 0; off < buf.len; off += 4096)
+        json_sax_feed(sax, buf.ptr + off, off + 4096 < buf.len ? 4096 : buf.len - off);
+    t = elapsed(&ts);
+    printf("sax: %.1f MB, " SIZE_FMT " events, %.0f MB/s, done: %d\n", buf.len / 1e6, count, buf.len / t / 1e6, json_sax_done(sax));
+    json_sax_free(sax);
+    // the reparse is quadratic, so only the first 256k of the same stream
+    buf.len = 256 * 1024;
+    strbufalloc(&acc, 4096, 4096);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (size_t off = 0; off < buf.len; off += 4096) {
+        json_t *json;
+        strbufadd(&acc, buf.ptr + off, 4096);
+        if ((json = json_parse_arena_len(acc.ptr, acc.len)))
+            json_free(json);
+        ++parses;
+    }
+    t = elapsed(&ts);
+    printf("reparse: %.2f MB, " SIZE_FMT " parses, %.0f MB/s\n", buf.len / 1e6, parses, buf.len / t / 1e6);
+    free(acc.ptr);
+    free(buf.ptr);
+}
+
+static int on_key_compare (void *x, void *y) {
+    strptr_t *s1 = (strptr_t*)x, *s2 = (strptr_t*)y;
+    return cmpstr(s1->ptr, s1->len, s2->ptr, s2->len);
+}
+
+static void *on_key_copy (void *key) {
+    return key;
+}
+
+// parse and lookup of objects by size, the lookup is compared with an rbtree over the same keys
+static void bench_object (int nkeys, int count) {
+    strbuf_t buf;
+    strptr_t *keys = malloc(nkeys * sizeof(strptr_t));
+    struct timespec ts;
+    json_t *json;
+    rbtree_t *tree = rbtree_alloc(on_key_compare, on_key_copy, NULL, RBT_UNIQUE);
+    size_t found = 0, lookups = (size_t)count * nkeys;
+    double tp, tf, tt;
+    strbufalloc(&buf, 64 * nkeys, 4096);
+    strbufadd(&buf, CONST_STR_LEN("{"));
+    for (int i = 0; i < nkeys; ++i) {
+        char item [64];
+        strbufadd(&buf, item, snprintf(item, sizeof item, "%s\"field_%d\": %d", i ? ", " : "", i * 7919, i));
+    }
+    strbufadd(&buf, CONST_STR_LEN("}"));
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (int i = 0; i < count; ++i)
+        if ((json = json_parse_arena_len(buf.ptr, buf.len)))
+            json_free(json);
+    tp = elapsed(&ts);
+    json = json_parse_len(buf.ptr, buf.len);
+    for (int i = 0; i < nkeys; ++i) {
+        json_item_t *ji = json->data.o->members[i].item;
+        keys[i] = ji->key;
+        rbtree_add(tree, &keys[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (int n = 0; n < count; ++n)
+        for (int i = 0; i < nkeys; ++i)
+            if (json_find(json->data.o, keys[i].ptr, keys[i].len, JSON_INTEGER))
+                ++found;
+    tf = elapsed(&ts);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (int n = 0; n < count; ++n)
+        for (int i = 0; i < nkeys; ++i)
+            if (rbtree_get(tree, &keys[i]))
+                ++found;
+    tt = elapsed(&ts);
+    printf("%5d keys: %.0f parses/s, find %.1f ns, rbtree %.1f ns, found " SIZE_FMT "/" SIZE_FMT "\n",
+        nkeys, count / tp, tf * 1e9 / lookups, tt * 1e9 / lookups, found, lookups * 2);
+    json_free(json);
+    rbtree_free(tree);
+    free(keys);
+    free(buf.ptr);
+}
+
+void test_json10 () {
+    bench_object(4, 500000);
+    bench_object(32, 100000);
+    bench_object(10000, 200);
+}
+
+static json_item_t *find_user_id (json_t *json) {
+    json_item_t *ji;
+    if (!(ji = json_find(json->data.o, CONST_STR_LEN("params"), JSON_ARRAY)) || !ji->data.a->len)
+        return NULL;
+    ji = (json_item_t*)ji->data.a->head->ptr;
+    if (JSON_OBJECT != ji->type || !(ji = json_find(ji->data.o, CONST_STR_LEN("user"), JSON_OBJECT)))
+        return NULL;
+    return json_find(ji->data.o, CONST_STR_LEN("id"), JSON_ANY);
+}
+
+void test_json11 () {
+    strbuf_t buf;
+    json_path_t *path = json_path_compile(CONST_STR_LEN("/params/0/user/id")),
+                *path_esc = json_path_compile(CONST_STR_LEN("/params/1/a~1b~0c")),
+                *path_obj = json_path_compile(CONST_STR_LEN("/params/0/user")),
+                *path_none = json_path_compile(CONST_STR_LEN("/params/2"));
+    json_item_t item, *ji;
+    json_t *json;
+    struct timespec ts;
+    int count = 200000;
+    size_t found = 0;
+    strbufalloc(&buf, 4096, 4096);
+    strbufadd(&buf, CONST_STR_LEN("{\"jsonrpc\": \"2.0\", \"method\": \"update\", \"meta\": {\"trace\": ["));
+    for (int i = 0; i < 100; ++i) {
+        char s [128];
+        strbufadd(&buf, s, snprintf(s, sizeof s, "%s{\"span\": %d, \"name\": \"step %d\", \"tags\": [1, 2, {\"x\": \"}]\"}]}", i ? ", " : "", i, i));
+    }
+    strbufadd(&buf, CONST_STR_LEN("]}, \"params\": [{\"user\": {\"name\": \"bob\", \"id\": 4217}}, {\"a/b~c\": \"escaped\"}], \"id\": 1}"));
+    json = json_parse_len(buf.ptr, buf.len);
+    ji = json_path_eval(json, path);
+    printf("eval: %ld", ji && JSON_INTEGER == ji->type ? ji->data.i : -1);
+    ji = json_path_eval(json, path_esc);
+    printf(", %.*s", ji ? (int)ji->data.s.len : 0, ji ? ji->data.s.ptr : "");
+    printf(", none %s\n", json_path_eval(json, path_none) ? "found" : ENOENT == errno ? "ENOENT" : "error");
+    printf("scan: %ld", 0 == json_path_scan(buf.ptr, buf.len, path, &item) && JSON_INTEGER == item.type ? item.data.i : -1);
+    if (0 == json_path_scan(buf.ptr, buf.len, path_esc, &item))
+        printf(", %.*s", (int)item.data.s.len, item.data.s.ptr);
+    if (0 == json_path_scan(buf.ptr, buf.len, path_obj, &item))
+        printf(", %.*s", (int)item.data.s.len, item.data.s.ptr);
+    printf(", none %s\n", 0 == json_path_scan(buf.ptr, buf.len, path_none, &item) ? "found" : ENOENT == errno ? "ENOENT" : "error");
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (int i = 0; i < count * 10; ++i)
+        if (find_user_id(json))
+            ++found;
+    printf("json_find chain: %.1f ns\n", elapsed(&ts) * 1e9 / count / 10);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (int i = 0; i < count * 10; ++i)
+        if (json_path_eval(json, path))
+            ++found;
+    printf("json_path_eval: %.1f ns\n", elapsed(&ts) * 1e9 / count / 10);
+    json_free(json);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (int i = 0; i < count; ++i)
+        if ((json = json_parse_arena_len(buf.ptr, buf.len))) {
+            if (find_user_id(json))
+                ++found;
+            json_free(json);
+        }
+    printf("parse + find: %.2f us\n", elapsed(&ts) * 1e6 / count);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (int i = 0; i < count; ++i)
+        if (0 == json_path_scan(buf.ptr, buf.len, path, &item))
+            ++found;
+    printf("json_path_scan: %.2f us, found " SIZE_FMT "/%d\n", elapsed(&ts) * 1e6 / count, found, count * 22);
+    json_path_free(path);
+    json_path_free(path_esc);
+    json_path_free(path_obj);
+    json_path_free(path_none);
+    free(buf.ptr);
+}
+
+// the writer as it was: snprintf, strlen and a strbufadd per part
+static void old_add_int (strbuf_t *buf, const char *key, size_t key_len, int64_t val, int is_end) {
+    char str [48];
+    snprintf(str, sizeof(str), LONG_FMT, val);
+    strbufadd(buf, CONST_STR_LEN("\""));
+    strbufadd(buf, key, key_len);
+    strbufadd(buf, CONST_STR_LEN("\":"));
+    strbufadd(buf, str, strlen(str));
+    if (!is_end)
+        strbufadd(buf, CONST_STR_LEN(","));
+}
+
+static void old_add_double (strbuf_t *buf, const char *key, size_t key_len, long double val, int is_end) {
+    char str [48];
+    snprintf(str, sizeof(str), "%.*Lf", JSON_DOUBLE_PRECISION, val);
+    strbufadd(buf, CONST_STR_LEN("\""));
+    strbufadd(buf, key, key_len);
+    strbufadd(buf, CONST_STR_LEN("\":"));
+    strbufadd(buf, str, strlen(str));
+    if (!is_end)
+        strbufadd(buf, CONST_STR_LEN(","));
+}
+
+static void add_sample (strbuf_t *buf, int i, int how) {
+    int64_t ts = 1700000000000LL + i * 37, count = (int64_t)i * 7919 - 5000000;
+    double load = i * 0.0137, temp = -40.0 + (i % 1000) * 0.125, ratio = 1.0 / (1 + i % 97);
+    json_begin_object(buf);
+    switch (how) {
+        case 0:
+            old_add_int(buf, CONST_STR_LEN("ts"), ts, JSON_NEXT);
+            old_add_int(buf, CONST_STR_LEN("count"), count, JSON_NEXT);
+            old_add_double(buf, CONST_STR_LEN("load"), load, JSON_NEXT);
+            old_add_double(buf, CONST_STR_LEN("temp"), temp, JSON_NEXT);
+            old_add_double(buf, CONST_STR_LEN("ratio"), ratio, JSON_END);
+            break;
+        case 1:
+            json_add_int(buf, CONST_STR_LEN("ts"), ts, JSON_NEXT);
+            json_add_int(buf, CONST_STR_LEN("count"), count, JSON_NEXT);
+            json_add_double(buf, CONST_STR_LEN("load"), load, JSON_NEXT);
+            json_add_double(buf, CONST_STR_LEN("temp"), temp, JSON_NEXT);
+            json_add_double(buf, CONST_STR_LEN("ratio"), ratio, JSON_END);
+            break;
+        default:
+            strbufreserve(buf, 256);
+            json_add_int(buf, CONST_STR_LEN("ts"), ts, JSON_NEXT);
+            json_add_int(buf, CONST_STR_LEN("count"), count, JSON_NEXT);
+            json_add_double_s(buf, CONST_STR_LEN("load"), load, JSON_NEXT);
+            json_add_double_s(buf, CONST_STR_LEN("temp"), temp, JSON_NEXT);
+            json_add_double_s(buf, CONST_STR_LEN("ratio"), ratio, JSON_END);
+            break;
+    }
+    json_close_object(buf, JSON_NEXT);
+}
+
+void test_json12 () {
+    static const char *names [] = { "snprintf", "json_add", "shortest" };
+    strbuf_t buf [3];
+    struct timespec ts;
+    int count = 1000000;
+    for (int how = 0; how < 3; ++how) {
+        strbufalloc(&buf[how], 64 * 1024 * 1024, 1024 * 1024);
+        json_begin_array(&buf[how]);
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        for (int i = 0; i < count; ++i)
+            add_sample(&buf[how], i, how);
+        buf[how].ptr[buf[how].len - 1] = ']';
+        printf("%s: %.0f objects/s, %.1f MB\n", names[how], count / elapsed(&ts), buf[how].len / 1e6);
+    }
+    printf("same output: %s\n", 0 == cmpstr(buf[0].ptr, buf[0].len, buf[1].ptr, buf[1].len) ? "yes" : "no");
+    printf("%.*s\n", (int)(strchr(buf[2].ptr, '}') - buf[2].ptr), buf[2].ptr + 1);
+    json_t *json = json_parse_len(buf[2].ptr, buf[2].len);
+    printf("parsed back: " SIZE_FMT "\n", json ? json->data.a->len : 0);
+    if (json)
+        json_free(json);
+    for (int how = 0; how < 3; ++how)
+        free(buf[how].ptr);
+}
+
+// the escape as it was: a strbufadd per byte and snprintf per code point
+static void old_escape (strbuf_t *dst, const char *src, size_t src_len) {
+    for (size_t i = 0; i < src_len && src[i]; ) {
+        char c = src[i];
+        if (!isunicode(c)) {
+            switch (c) {
+                case '\"': strbufadd(dst, CONST_STR_LEN("\\\"")); break;
+                case '\n': strbufadd(dst, CONST_STR_LEN("\\n")); break;
+                case '\t': strbufadd(dst, CONST_STR_LEN("\\t")); break;
+                default: strbufadd(dst, &c, sizeof(char)); break;
+            }
+            ++i;
+        } else {
+            char buf [8];
+            int z = (src[i] & 0x1f) << 6 | (src[i+1] & 0x3f);
+            snprintf(buf, sizeof buf, "\\u%04x", z);
+            strbufadd(dst, buf, strlen(buf));
+            i += 2;
+        }
+    }
+}
+
+static void bench_escape (const char *name, const char *line, int count) {
+    strbuf_t src, dst;
+    struct timespec ts;
+    double t_old, t_new;
+    strbufalloc(&src, 1024 * 1024, 1024 * 1024);
+    strbufalloc(&dst, 1024 * 1024, 1024 * 1024);
+    for (int i = 0; i < count; ++i)
+        strbufadd(&src, line, strlen(line));
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (int i = 0; i < 20; ++i) {
+        dst.len = 0;
+        old_escape(&dst, src.ptr, src.len);
+    }
+    t_old = elapsed(&ts);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (int i = 0; i < 20; ++i) {
+        dst.len = 0;
+        json_add_escape_str(&dst, CONST_STR_LEN("log"), src.ptr, src.len, JSON_END);
+    }
+    t_new = elapsed(&ts);
+    printf("%s: %.1f MB, per byte %.0f MB/s, json_add_escape_str %.0f MB/s\n", name, src.len / 1e6,
+        src.len * 20 / t_old / 1e6, src.len * 20 / t_new / 1e6);
+    free(src.ptr);
+    free(dst.ptr);
+}
+
+// the rules spelled out a byte at a time, what is not valid utf-8 is copied
+static void ref_escape (strbuf_t *dst, const uint8_t *s, size_t len) {
+    char u [16];
+    for (size_t i = 0; i < len && s[i]; ) {
+        uint8_t c = s[i];
+        size_t n = c >= 0xc2 && c <= 0xdf ? 2 : c >= 0xe0 && c <= 0xef ? 3 : c >= 0xf0 && c <= 0xf4 ? 4 : 1;
+        uint32_t cp = n > 1 ? c & (0x7f >> n) : c;
+        int ok = n > 1 && i + n <= len;
+        for (size_t k = 1; ok && k < n; ++k)
+            if (0x80 != (s[i + k] & 0xc0))
+                ok = 0;
+            else
+                cp = (cp << 6) | (s[i + k] & 0x3f);
+        if (ok && ((3 == n && cp < 0x800) || (4 == n && (cp < 0x10000 || cp > 0x10ffff)) || (cp >= 0xd800 && cp <= 0xdfff)))
+            ok = 0;
+        if (ok) {
+            if (cp < 0x10000)
+                strbufadd(dst, u, snprintf(u, sizeof u, "\\u%04x", cp));
+            else
+                strbufadd(dst, u, snprintf(u, sizeof u, "\\u%04x\\u%04x", 0xd800 | ((cp - 0x10000) >> 10), 0xdc00 | ((cp - 0x10000) & 0x3ff)));
+            i += n;
+            continue;
+        }
+        switch (c) {
+            case '"': strbufadd(dst, CONST_STR_LEN("\\\"")); break;
+            case '\\': strbufadd(dst, CONST_STR_LEN("\\\\")); break;
+            case '\b': strbufadd(dst, CONST_STR_LEN("\\b")); break;
+            case '\f': strbufadd(dst, CONST_STR_LEN("\\f")); break;
+            case '\n': strbufadd(dst, CONST_STR_LEN("\\n")); break;
+            case '\r': strbufadd(dst, CONST_STR_LEN("\\r")); break;
+            case '\t': strbufadd(dst, CONST_STR_LEN("\\t")); break;
+            default:
+                if (c < 0x20)
+                    strbufadd(dst, u, snprintf(u, sizeof u, "\\u%04x", c));
+                else
+                    strbufadd(dst, (char*)&c, 1);
+        }
+        ++i;
+    }
+}
+
+// random bytes biased to the edges of utf-8: overlong leads, surrogates, above U+10FFFF
+static void test_escape_random () {
+    static const uint8_t bytes [] = { 'a', '"', '\\', '\n', 0x01, 0x1f, 0x7f, 0x80, 0x8f, 0x90, 0x9f, 0xa0, 0xbf,
+                                      0xc0, 0xc1, 0xc2, 0xd0, 0xdf, 0xe0, 0xed, 0xef, 0xf0, 0xf4, 0xf5, 0xf7, 0xf8, 0xff };
+    static const char *cases [] = { "\xf5\x80\x80\x80", "\xf7\xbf\xbf\xbf", "\xed\xa0\x80", "\xed\xbf\xbf", "\xc0\xaf",
+                                    "\xc1\xbf", "\xe0\x80\xaf", "\xf0\x80\x80\xaf", "\xf4\x90\x80\x80", "\xf4\x8f\xbf\xbf" };
+    strbuf_t got, want;
+    uint8_t s [64];
+    int bad = 0;
+    strbufalloc(&got, 1024, 1024);
+    strbufalloc(&want, 1024, 1024);
+    for (int i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        got.len = want.len = 0;
+        strbuf_escape(&got, cases[i], strlen(cases[i]));
+        ref_escape(&want, (const uint8_t*)cases[i], strlen(cases[i]));
+        if (got.len != want.len || 0 != memcmp(got.ptr, want.ptr, got.len))
+            ++bad;
+    }
+    srand(1);
+    for (int i = 0; i < 200000; ++i) {
+        size_t len = 1 + rand() % sizeof s;
+        for (size_t k = 0; k < len; ++k)
+            s[k] = bytes[rand() % sizeof bytes];
+        got.len = want.len = 0;
+        strbuf_escape(&got, (const char*)s, len);
+        ref_escape(&want, s, len);
+        if (got.len != want.len || 0 != memcmp(got.ptr, want.ptr, got.len))
+            ++bad;
+    }
+    printf("escape random: %s, %d differ\n", bad ? "FAIL" : "ok", bad);
+    free(got.ptr);
+    free(want.ptr);
+}
+
+void test_json13 () {
+    strbuf_t buf;
+    strbufalloc(&buf, 64, 64);
+    json_add_escape_str(&buf, CONST_STR_LEN("s"), CONST_STR_LEN("a\"b\\c\n\x01 \xd0\x93 \xf0\x9f\x98\x80"), JSON_END);
+    printf("%.*s\n", (int)buf.len, buf.ptr);
+    free(buf.ptr);
+    test_escape_random();
+    bench_escape("ascii log", "2024-05-01 12:00:00.123 INFO  [worker-7] request handled in 12 ms, status=200 path=/api/v1/items\n", 200000);
+    bench_escape("mixed log", "2024-05-01 12:00:00.123 WARN  \"Грузите апельсины\" failed\tretry=3\n", 200000);
+}
+
+static int on_batch_sum (strbuf_t *buf, int64_t *sum) {
+    char s [DTOSTR_BUFSIZE];
+    strbufadd(buf, s, ltostr(*sum, s));
+    return 0;
+}
+
+static void rpc_sum (strbuf_t *buf, json_item_t **params, size_t params_len, intptr_t id, int id_len, void *userdata) {
+    int64_t sum = 0;
+    for (size_t i = 0; i < params_len; ++i)
+        sum += params[i]->data.i;
+    jsonrpc_response(buf, (jsonrpc_h)on_batch_sum, &sum, id, id_len);
+}
+
+static void rpc_upper (strbuf_t *buf, json_item_t **params, size_t params_len, intptr_t id, int id_len, void *userdata) {
+    char s [64];
+    size_t len = params[0]->data.s.len < sizeof s ? params[0]->data.s.len : sizeof s;
+    for (size_t i = 0; i < len; ++i)
+        s[i] = toupper(params[0]->data.s.ptr[i]);
+    jsonrpc_response_str(buf, s, len, id, id_len);
+}
+
+static int sum_types [] = { JSON_INTEGER, JSON_INTEGER, -1 };
+static int upper_types [] = { JSON_STRING, -1 };
+static int notified;
+
+static void rpc_notify (strbuf_t *buf, json_item_t **params, size_t params_len, intptr_t id, int id_len, void *userdata) {
+    __atomic_add_fetch(&notified, 1, __ATOMIC_RELAXED);
+    jsonrpc_response_ok(buf, id, id_len);
+}
+
+static void rpc_nested (strbuf_t *buf, json_item_t **params, size_t params_len, intptr_t id, int id_len, void *userdata);
+
+#define RPC_FILLER 60
+static jsonrpc_method_t rpc_methods [RPC_FILLER + 5] = {
+    [RPC_FILLER] = { .method = CONST_STR_INIT("sum"), .id = 1, .handle = rpc_sum, .param_lens = 2, .param_types = sum_types },
+    [RPC_FILLER + 1] = { .method = CONST_STR_INIT("upper"), .id = 2, .handle = rpc_upper, .param_lens = 1, .param_types = upper_types },
+    [RPC_FILLER + 2] = { .method = CONST_STR_INIT("notify"), .id = 3, .handle = rpc_notify },
+    [RPC_FILLER + 3] = { .method = CONST_STR_INIT("nested"), .id = 4, .handle = rpc_nested }
+};
+
+static int make_request (char *s, size_t size, int i) {
+    if (i % 2)
+        return snprintf(s, size, "{\"jsonrpc\":\"2.0\",\"method\":\"sum\",\"params\":[%d,%d],\"id\":%d}", i, i, i);
+    return snprintf(s, size, "{\"jsonrpc\":\"2.0\",\"method\":\"upper\",\"params\":[\"item %d\"],\"id\":\"s%d\"}", i, i);
+}
+
+static void make_batch (strbuf_t *buf, int n) {
+    char s [128];
+    buf->len = 0;
+    json_begin_array(buf);
+    for (int i = 0; i < n; ++i) {
+        strbufadd(buf, s, make_request(s, sizeof s, i));
+        if (i < n - 1)
+            strbufadd(buf, CONST_STR_LEN(","));
+    }
+    json_end_array(buf);
+}
+
+static void bench_batch (const char *name, jsonrpc_dispatch_t *dispatch, int n, int count) {
+    strbuf_t buf, req;
+    struct timespec ts;
+    strbufalloc(&buf, 4096, 4096);
+    strbufalloc(&req, 4096, 4096);
+    make_batch(&req, n);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (int i = 0; i < count; ++i) {
+        buf.len = 0;
+        strbufadd(&buf, req.ptr, req.len);
+        jsonrpc_dispatch(dispatch, &buf, 0, NULL);
+    }
+    double t = elapsed(&ts);
+    printf("  %-24s %8.0f batches/s %10.0f calls/s\n", name, count / t, count * (double)n / t);
+    free(req.ptr);
+    free(buf.ptr);
+}
+
+static void bench_single (const char *name, jsonrpc_dispatch_t *dispatch, int n, int count) {
+    strbuf_t buf;
+    struct timespec ts;
+    char reqs [n][128];
+    int lens [n];
+    strbufalloc(&buf, 256, 256);
+    for (int j = 0; j < n; ++j)
+        lens[j] = make_request(reqs[j], sizeof reqs[j], j);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (int i = 0; i < count; ++i)
+        for (int j = 0; j < n; ++j) {
+            buf.len = 0;
+            strbufadd(&buf, reqs[j], lens[j]);
+            jsonrpc_dispatch(dispatch, &buf, 0, NULL);
+        }
+    double t = elapsed(&ts);
+    printf("  %-24s %8.0f batches/s %10.0f calls/s\n", name, count / t, count * (double)n / t);
+    free(buf.ptr);
+}
+
+static void bench_slow (const char *name, jsonrpc_dispatch_t *dispatch, int n) {
+    strbuf_t buf;
+    struct timespec ts;
+    char s [128];
+    strbufalloc(&buf, 4096, 4096);
+    buf.len = 0;
+    json_begin_array(&buf);
+    for (int i = 0; i < n; ++i)
+        strbufadd(&buf, s, snprintf(s, sizeof s, "{\"jsonrpc\":\"2.0\",\"method\":\"sleep\",\"params\":[],\"id\":%d}%s", i, i < n - 1 ? "," : ""));
+    json_end_array(&buf);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    jsonrpc_dispatch(dispatch, &buf, 0, NULL);
+    printf("  %-24s %8.1f ms\n", name, elapsed(&ts) * 1e3);
+    free(buf.ptr);
+}
+
+// a batch dispatched from a worker of the pool it goes to
+static void rpc_nested (strbuf_t *buf, json_item_t **params, size_t params_len, intptr_t id, int id_len, void *userdata) {
+    strbuf_t req;
+    strbufalloc(&req, 1024, 1024);
+    make_batch(&req, 8);
+    jsonrpc_dispatch((jsonrpc_dispatch_t*)userdata, &req, 0, userdata);
+    free(req.ptr);
+    jsonrpc_response_ok(buf, id, id_len);
+}
+
+static void rpc_sleep (strbuf_t *buf, json_item_t **params, size_t params_len, intptr_t id, int id_len, void *userdata) {
+    usleep(2000);
+    jsonrpc_response_ok(buf, id, id_len);
+}
+
+// the batch messages must not come here, the pool frees what it is given
+static int freed_msgs;
+static void rpc_freemsg (void *data) {
+    if (data) {
+        ++freed_msgs;
+        free(data);
+    }
+}
+
+void test_json14 () {
+    strbuf_t buf;
+    char names [RPC_FILLER][16];
+    for (int i = 0; i < RPC_FILLER; ++i) {
+        rpc_methods[i].method.len = snprintf(names[i], sizeof names[i], "filler_%d", i);
+        rpc_methods[i].method.ptr = names[i];
+        rpc_methods[i].handle = rpc_sum;
+    }
+    jsonrpc_dispatch_t *dispatch = jsonrpc_dispatch_alloc(rpc_methods, NULL);
+    jsonrpc_dispatch_t linear = { .methods = rpc_methods };
+    pool_t *pool = pool_create();
+    pool_setopt(pool, POOL_MAXSLOTS, 4);
+    pool_setopt(pool, POOL_LIVINGTIME, 1000);
+    pool_setopt(pool, POOL_FREEMSG, (pool_destroy_h)rpc_freemsg);
+    pool_start(pool);
+    jsonrpc_dispatch_t *pooled = jsonrpc_dispatch_alloc(rpc_methods, pool);
+    strbufalloc(&buf, 4096, 4096);
+    jsonrpc_setver(JSONRPC_V20);
+    buf.len = 0;
+    strbufadd(&buf, CONST_STR_LEN("[{\"jsonrpc\":\"2.0\",\"method\":\"sum\",\"params\":[2,3],\"id\":1},"
+                                   "{\"jsonrpc\":\"2.0\",\"method\":\"upper\",\"params\":[\"abc\"],\"id\":\"x\"},"
+                                   "{\"jsonrpc\":\"2.0\",\"method\":\"nope\",\"params\":[],\"id\":3},"
+                                   "{\"jsonrpc\":\"2.0\",\"method\":\"sum\",\"params\":[\"2\",3],\"id\":4},"
+                                   "1]"));
+    jsonrpc_dispatch(dispatch, &buf, 0, NULL);
+    printf("%.*s\n", (int)buf.len, buf.ptr);
+    buf.len = 0;
+    strbufadd(&buf, CONST_STR_LEN("[]"));
+    jsonrpc_dispatch(dispatch, &buf, 0, NULL);
+    printf("%.*s\n", (int)buf.len, buf.ptr);
+    // notifications run but are not answered
+    for (int k = 0; k < 2; ++k) {
+        buf.len = 0;
+        strbufadd(&buf, CONST_STR_LEN("[{\"jsonrpc\":\"2.0\",\"method\":\"notify\",\"params\":[]},"
+                                       "{\"jsonrpc\":\"2.0\",\"method\":\"sum\",\"params\":[2,3],\"id\":1},"
+                                       "{\"jsonrpc\":\"2.0\",\"method\":\"nope\",\"params\":[]},"
+                                       "{\"jsonrpc\":\"2.0\",\"method\":\"notify\",\"params\":[]}]"));
+        jsonrpc_dispatch(k ? pooled : dispatch, &buf, 0, NULL);
+        printf("notifications%s: %.*s\n", k ? " on pool" : "", (int)buf.len, buf.ptr);
+    }
+    buf.len = 0;
+    strbufadd(&buf, CONST_STR_LEN("[{\"jsonrpc\":\"2.0\",\"method\":\"notify\",\"params\":[]},{\"jsonrpc\":\"2.0\",\"method\":\"notify\",\"params\":[]}]"));
+    jsonrpc_dispatch(pooled, &buf, 0, NULL);
+    printf("notifications only: %s, " SIZE_FMT " bytes, %d run\n", 0 == buf.len && 6 == notified ? "ok" : "FAIL", buf.len, notified);
+    buf.len = 0;
+    strbufadd(&buf, CONST_STR_LEN("{\"jsonrpc\":\"2.0\",\"method\":\"notify\",\"params\":[]}"));
+    jsonrpc_dispatch(dispatch, &buf, 0, NULL);
+    printf("single notification: %s\n", 0 == buf.len && 7 == notified ? "ok" : "FAIL");
+    // every worker of the pool dispatches a batch to the same pool
+    buf.len = 0;
+    strbufadd(&buf, CONST_STR_LEN("["));
+    for (int i = 0; i < 16; ++i) {
+        char s [128];
+        strbufadd(&buf, s, snprintf(s, sizeof s, "%s{\"jsonrpc\":\"2.0\",\"method\":\"nested\",\"params\":[],\"id\":%d}", i ? "," : "", i));
+    }
+    strbufadd(&buf, CONST_STR_LEN("]"));
+    jsonrpc_dispatch(pooled, &buf, 0, pooled);
+    json_t *nested = json_parse_len(buf.ptr, buf.len);
+    printf("nested batches on pool: %s\n", nested && JSON_ARRAY == nested->type && 16 == nested->data.a->len ? "ok" : "FAIL");
+    if (nested)
+        json_free(nested);
+    for (int k = 0; k < 2; ++k) {
+        make_batch(&buf, 100);
+        jsonrpc_dispatch(k ? pooled : dispatch, &buf, 0, NULL);
+        json_t *json = json_parse_len(buf.ptr, buf.len);
+        int ok = json && JSON_ARRAY == json->type && 100 == json->data.a->len;
+        if (ok) {
+            list_item_t *li = json->data.a->head;
+            for (int i = 0; i < 100 && ok; ++i, li = li->next) {
+                json_item_t *id = json_find(((json_item_t*)li->ptr)->data.o, CONST_STR_LEN("id"), JSON_ANY),
+                            *res = json_find(((json_item_t*)li->ptr)->data.o, CONST_STR_LEN("result"), JSON_ANY);
+                if (i % 2)
+                    ok = id && id->data.i == i && res && res->data.i == i * 2;
+                else
+                    ok = id && JSON_STRING == id->type && res && JSON_STRING == res->type;
+            }
+        }
+        printf("batch of 100%s: %s\n", k ? " on pool" : "", ok ? "ok" : "FAIL");
+        if (json)
+            json_free(json);
+    }
+    printf("pool with POOL_FREEMSG: %s\n", 0 == freed_msgs ? "ok" : "FAIL");
+    bench_single("100 single requests", dispatch, 100, 2000);
+    bench_batch("batch of 100, linear", &linear, 100, 2000);
+    bench_batch("batch of 100, indexed", dispatch, 100, 2000);
+    bench_batch("batch of 100, pool", pooled, 100, 2000);
+    rpc_methods[0].method = (strptr_t)CONST_STR_INIT("sleep");
+    rpc_methods[0].handle = rpc_sleep;
+    jsonrpc_dispatch_free(dispatch);
+    jsonrpc_dispatch_free(pooled);
+    dispatch = jsonrpc_dispatch_alloc(rpc_methods, NULL);
+    pooled = jsonrpc_dispatch_alloc(rpc_methods, pool);
+    bench_slow("8 x 2ms calls, inline", dispatch, 8);
+    bench_slow("8 x 2ms calls, pool", pooled, 8);
+    jsonrpc_dispatch_free(dispatch);
+    jsonrpc_dispatch_free(pooled);
+    pool_destroy(pool);
+    free(buf.ptr);
+}
+
+// strtod says ERANGE for subnormals, they are numbers all the same
+void test_json15 () {
+    const char *nums [] = { "2.2e-308", "5e-324", "4.9406564584124654e-324", "2.2250738585072011e-308", "-1e-310", "1e-400" };
+    int ok = 1;
+    for (int i = 0; i < sizeof(nums) / sizeof(nums[0]); ++i) {
+        char s [64];
+        json_t *json;
+        json_item_t *ji;
+        double d;
+        snprintf(s, sizeof s, "[%s]", nums[i]);
+        json = json_parse_len(s, strlen(s));
+        ji = json && JSON_ARRAY == json->type && json->data.a->len ? (json_item_t*)json->data.a->head->ptr : NULL;
+        d = ji && JSON_DOUBLE == ji->type ? (double)ji->data.d : -1;
+        if (!ji || JSON_DOUBLE != ji->type || d != strtod(nums[i], NULL)) {
+            printf("subnormal %s: %s\n", nums[i], ji ? (JSON_DOUBLE == ji->type ? "differs" : "not a number") : "no item");
+            ok = 0;
+        }
+        if (json)
+            json_free(json);
+    }
+    printf("subnormals: %s\n", ok ? "ok" : "FAIL");
+}
+
+// keys that share the low bits of their seed 0 hashes could be made offline,
+// the index hashes with a seed of its own and parses them as fast as any others
+static double parse_keys (strbuf_t *buf, char (*keys)[16], int n, int *found) {
+    struct timespec ts;
+    json_t *json;
+    double t;
+    buf->len = 0;
+    strbufadd(buf, CONST_STR_LEN("{"));
+    for (int i = 0; i < n; ++i) {
+        char s [32];
+        strbufadd(buf, s, snprintf(s, sizeof s, "%s\"%s\":%d", i ? "," : "", keys[i], i));
+    }
+    strbufadd(buf, CONST_STR_LEN("}"));
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    json = json_parse_len(buf->ptr, buf->len);
+    t = elapsed(&ts);
+    *found = 0;
+    for (int i = 0; json && JSON_OBJECT == json->type && i < n; ++i) {
+        json_item_t *ji = json_find(json->data.o, keys[i], strlen(keys[i]), JSON_INTEGER);
+        if (ji && i == ji->data.i)
+            ++*found;
+    }
+    if (json)
+        json_free(json);
+    return t;
+}
+
+#define FLOOD_KEYS 4000
+void test_json16 () {
+    char (*keys)[16] = malloc(FLOOD_KEYS * 16), (*plain)[16] = malloc(FLOOD_KEYS * 16);
+    hash_key_t mask = 1;
+    strbuf_t buf;
+    int n = 0, found_flood, found_plain;
+    double t_flood, t_plain;
+    while (mask < FLOOD_KEYS * 4) mask <<= 1;
+    --mask;
+    for (unsigned long i = 0; n < FLOOD_KEYS; ++i) {
+        char s [16];
+        size_t len = snprintf(s, sizeof s, "k%lx", i);
+        if (0 == (hash_nstr(s, len) & mask))
+            memcpy(keys[n++], s, len + 1);
+    }
+    for (int i = 0; i < FLOOD_KEYS; ++i)
+        snprintf(plain[i], 16, "k%x", i);
+    strbufalloc(&buf, FLOOD_KEYS * 32, 1024);
+    t_flood = parse_keys(&buf, keys, FLOOD_KEYS, &found_flood);
+    t_plain = parse_keys(&buf, plain, FLOOD_KEYS, &found_plain);
+    printf("%d keys colliding under seed 0: %s, %.2f ms, ordinary keys %.2f ms\n", FLOOD_KEYS,
+           FLOOD_KEYS == found_flood && FLOOD_KEYS == found_plain ? "ok" : "FAIL", t_flood * 1e3, t_plain * 1e3);
+    free(buf.ptr);
+    free(keys);
+    free(plain);
+}
+
 int main (int argc, const char *argv[]) {
 //    test_json1();
 //    test_json2();
 //    test_json3();
 //    test_json4();
     test_json5();
+    test_json6();
+    test_json7();
+    test_json8();
+    test_json9();
+    test_json10();
+    test_json11();
+    test_json12();
+    test_json13();
+    test_json14();
+    test_json15();
+    test_json16();
     return 0;
 }
@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
 #include "../include/libex/str.h"
 #include "../include/libex/list.h"
 
@@ -69,8 +70,49 @@ void test_url (const char *url) {
     lst_free(ret);
 }
 
+static double elapsed (struct timespec *start) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec - start->tv_sec) + (ts.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void bench_list (list_t *lst, const char *name) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (int n = 0; n < 100; ++n) {
+        for (intptr_t i = 0; i < 100000; ++i)
+            lst_adde(lst, (void*)i);
+        while (lst->head)
+            lst_del(lst->head);
+    }
+    printf("%s: %f sec\n", name, elapsed(&ts));
+}
+
+void test_slab () {
+    slab_t *slab = slab_alloc(sizeof(list_item_t));
+    list_t *l1 = lst_alloc_slab(fn_free, slab),
+           *l2 = lst_alloc_slab(NULL, slab);
+    for (char **p = sa; *p; ++p)
+        lst_adde(l1, strdup(*p));
+    lst_move(l1->head, l2);
+    printf("slab items: " SIZE_FMT ", l1: " SIZE_FMT ", l2: " SIZE_FMT "\n", slab->len, l1->len, l2->len);
+    printf("moved: %s\n", (char*)l2->head->ptr);
+    free(l2->head->ptr);
+    lst_free(l2);
+    lst_free(l1);
+    printf("slab items: " SIZE_FMT "\n", slab->len);
+    slab_free(slab);
+    list_t *lst = lst_alloc(NULL);
+    bench_list(lst, "malloc");
+    lst_free(lst);
+    lst = lst_alloc_slab(NULL, NULL);
+    bench_list(lst, "slab");
+    lst_free(lst);
+}
+
 int main (int argc, const char *argv[]) {
     test();
+    test_slab();
     if (argc > 1)
         test(argv[1]);
     return 0;
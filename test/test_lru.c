@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include "../include/libex/str.h"
+#include "../include/libex/lru.h"
+
+static hash_key_t str_calc (void *key, size_t key_len) {
+    return hash_nstr((const char*)key, key_len);
+}
+
+static int str_compare (void *x, void *y) {
+    return strcmp((const char*)x, (const char*)y);
+}
+
+static void *str_copy (void *key) {
+    return strdup((const char*)key);
+}
+
+static void str_free (void *key, void *value) {
+    free(key);
+    free(value);
+}
+
+static void on_evict (lru_item_t *item, void *userdata) {
+    printf("evict %s\n", (char*)item->key);
+}
+
+static void put (lru_t *lru, const char *key, const char *value) {
+    lru_put(lru, (void*)key, strlen(key), strdup(value), strlen(value));
+}
+
+static void test_lru_1 () {
+    lru_t *lru = lru_alloc(3, LRU_UNLIMITED, str_calc, str_compare, str_copy, str_free);
+    lru_set_evict(lru, on_evict, NULL);
+    put(lru, "a", "1");
+    put(lru, "b", "2");
+    put(lru, "c", "3");
+    lru_get(lru, "a", 1);
+    put(lru, "d", "4");
+    printf("b: %s\n", lru_get(lru, "b", 1) ? "found" : "not found");
+    printf("a: %s\n", lru_get(lru, "a", 1) ? "found" : "not found");
+    // the same value again stays
+    lru_item_t *item = lru_get(lru, "a", 1);
+    lru_put(lru, "a", 1, item->value, item->size);
+    printf("a again: %s\n", (char*)lru_get(lru, "a", 1)->value);
+    LRU_FOREACH(item, lru)
+        printf("- %s: %s\n", (char*)item->key, (char*)item->value);
+    LRU_END(lru)
+    printf("len " SIZE_FMT ", hits %lu, misses %lu, evictions %lu\n", lru->len, lru->hits, lru->misses, lru->evictions);
+    lru_free(lru);
+}
+
+static void test_lru_2 () {
+    lru_t *lru = lru_alloc(LRU_UNLIMITED, 16, str_calc, str_compare, str_copy, str_free);
+    lru_set_evict(lru, on_evict, NULL);
+    put(lru, "x", "12345");
+    put(lru, "y", "12345");
+    put(lru, "z", "12345");
+    put(lru, "x", "1");
+    put(lru, "w", "1234567890");
+    printf("len " SIZE_FMT ", bytes " SIZE_FMT ", evictions %lu\n", lru->len, lru->bytes, lru->evictions);
+    lru_free(lru);
+}
+
+int main () {
+    test_lru_1();
+    test_lru_2();
+    return 0;
+}
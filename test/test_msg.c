@@ -1,4 +1,10 @@
+#include <time.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <poll.h>
 #include "msg.h"
+#include "unet.h"
 
 void test_mpz (char *s) {
 #ifdef __GMP__
@@ -29,8 +35,433 @@ void test_mpz (char *s) {
 #endif
 }
 
+#define BLOB_SIZE (8 * 1024 * 1024)
+#define BLOB_COUNT 64
+
+typedef struct {
+    int fd;
+    int is_ref;
+    char *blob;
+} writer_t;
+
+static void *writer (writer_t *w) {
+    for (int i = 0; i < BLOB_COUNT; ++i) {
+        msgbuf_t msg = MSG_INIT;
+        msg_create_request(&msg, 1, CONST_STR_LEN("blob"), 64, 64);
+        msg_seti32(&msg, i);
+        if (w->is_ref) {
+            msg_setref(&msg, w->blob, BLOB_SIZE, 0);
+            msg_setref(&msg, CONST_STR_LEN("small tail"), 0);
+            unet_writemsg(w->fd, &msg);
+        } else {
+            msg_setstr(&msg, w->blob, BLOB_SIZE);
+            msg_setstr(&msg, CONST_STR_LEN("small tail"));
+            unet_write(w->fd, msg.ptr, msg.len);
+        }
+        msg_clear(&msg);
+    }
+    return NULL;
+}
+
+static void test_ref (int is_ref) {
+    int fds [2], ok = 1;
+    pthread_t th;
+    struct timespec ts, te;
+    writer_t w = { .is_ref = is_ref, .blob = malloc(BLOB_SIZE) };
+    for (int i = 0; i < BLOB_SIZE; ++i)
+        w.blob[i] = i * 31;
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    w.fd = fds[0];
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    pthread_create(&th, NULL, (void*(*)(void*))writer, &w);
+    for (int i = 0; i < BLOB_COUNT; ++i) {
+        msgbuf_t msg = MSG_INIT;
+        int32_t n;
+        strptr_t blob, tail;
+        if (MSG_OK != unet_read_request(fds[1], &msg) ||
+            MSG_OK != msg_geti32(&msg, &n) || n != i ||
+            MSG_OK != msg_getstr(&msg, &blob) || blob.len != BLOB_SIZE || 0 != memcmp(blob.ptr, w.blob, BLOB_SIZE) ||
+            MSG_OK != msg_getstr(&msg, &tail) || 0 != cmpstr(tail.ptr, tail.len, CONST_STR_LEN("small tail")))
+            ok = 0;
+        msg_clear(&msg);
+    }
+    pthread_join(th, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &te);
+    double t = (te.tv_sec - ts.tv_sec) + (te.tv_nsec - ts.tv_nsec) / 1e9;
+    printf("%s: %s, %.0f MB/s\n", is_ref ? "msg_setref + unet_writemsg" : "msg_setstr + unet_write", ok ? "ok" : "FAIL",
+        (double)BLOB_SIZE * BLOB_COUNT / t / 1048576);
+    close(fds[0]);
+    close(fds[1]);
+    free(w.blob);
+}
+
+static void *resume_reader (writer_t *w) {
+    msgbuf_t msg = MSG_INIT;
+    int32_t n;
+    strptr_t blob, tail;
+    w->is_ref = MSG_OK == unet_read_request(w->fd, &msg) &&
+        MSG_OK == msg_geti32(&msg, &n) && 7 == n &&
+        MSG_OK == msg_getstr(&msg, &blob) && blob.len == BLOB_SIZE && 0 == memcmp(blob.ptr, w->blob, BLOB_SIZE) &&
+        MSG_OK == msg_getstr(&msg, &tail) && 0 == cmpstr(tail.ptr, tail.len, CONST_STR_LEN("small tail"));
+    msg_clear(&msg);
+    return NULL;
+}
+
+// a nonblocking socket takes the message in parts, every call goes on where the last stopped
+static void test_resume () {
+    int fds [2], calls = 0, sndbuf = 4096;
+    pthread_t th;
+    msgbuf_t msg = MSG_INIT;
+    writer_t r = { .blob = malloc(BLOB_SIZE) };
+    size_t off = 0;
+    for (int i = 0; i < BLOB_SIZE; ++i)
+        r.blob[i] = i * 17;
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof sndbuf);
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    r.fd = fds[1];
+    pthread_create(&th, NULL, (void*(*)(void*))resume_reader, &r);
+    msg_create_request(&msg, 1, CONST_STR_LEN("blob"), 64, 64);
+    msg_seti32(&msg, 7);
+    msg_setref(&msg, r.blob, BLOB_SIZE, 0);
+    msg_setref(&msg, CONST_STR_LEN("small tail"), 0);
+    while (off < msg_size(&msg)) {
+        struct pollfd pfd = { .fd = fds[0], .events = POLLOUT };
+        ssize_t sent = unet_writemsg_off(fds[0], &msg, off);
+        if (-1 == sent)
+            break;
+        off += sent;
+        ++calls;
+        poll(&pfd, 1, 1000);
+    }
+    pthread_join(th, NULL);
+    printf("unet_writemsg_off: %s, %d calls\n", off == msg_size(&msg) && r.is_ref ? "ok" : "FAIL", calls);
+    msg_clear(&msg);
+    close(fds[0]);
+    close(fds[1]);
+    free(r.blob);
+}
+
+#define NSEQ 20000
+#define NPIPE 200000
+#define NWAITERS 4
+
+typedef struct {
+    int fd;
+    netout_t out;
+    strbuf_t later;
+    size_t nreqs;
+    size_t nreads;
+    char held [64];
+    size_t held_len;
+} pipe_server_t;
+
+// odd ones go out after the rest of the batch, the client matches them by id
+static int on_pipe_request (msgbuf_t *req, pipe_server_t *srv) {
+    msgbuf_t resp = MSG_INIT;
+    int32_t n;
+    if (MSG_OK != msg_geti32(req, &n) || MSG_OK != msg_create_response(&resp, MSG_OK, 8, 64))
+        return -1;
+    msg_set_id(&resp, req->id);
+    msg_seti32(&resp, n * 2);
+    // a negative one waits for 16 others
+    if (n < 0) {
+        memcpy(srv->held, resp.ptr, srv->held_len = resp.len);
+        srv->nreqs = 0;
+    } else
+    if ((req->id & 1))
+        strbufadd(&srv->later, resp.ptr, resp.len);
+    else
+        netout_add(&srv->out, resp.ptr, resp.len);
+    msg_clear(&resp);
+    if (++srv->nreqs > 16 && srv->held_len) {
+        netout_add(&srv->out, srv->held, srv->held_len);
+        srv->held_len = 0;
+    }
+    return 0;
+}
+
+// one read and one write for all the requests that are there
+static void *pipe_server (pipe_server_t *srv) {
+    netbuf_t nbuf;
+    netbuf_alloc(&nbuf, 65536, 65536);
+    strbufalloc(&srv->later, 65536, 65536);
+    netout_init(&srv->out, 0, 0, NULL, NULL);
+    while (net_recv(srv->fd, &nbuf.buf) > 0) {
+        ++srv->nreads;
+        if (-1 == unet_process(&nbuf, msg_load_request, (unet_msg_h)on_pipe_request, srv))
+            break;
+        netout_add(&srv->out, srv->later.ptr, srv->later.len);
+        srv->later.len = 0;
+        if (NET_ERROR == netout_flush(&srv->out, srv->fd, NULL))
+            break;
+    }
+    netout_free(&srv->out);
+    strbuf_release(&srv->later);
+    netbuf_free(&nbuf);
+    return NULL;
+}
+
+static int pipe_done, pipe_bad;
+
+static void on_pipe_resp (msgbuf_t *resp, int err, void *userdata) {
+    int32_t n;
+    if (err || MSG_OK != msg_geti32(resp, &n) || n != 2 * (int32_t)(intptr_t)userdata)
+        __atomic_add_fetch(&pipe_bad, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&pipe_done, 1, __ATOMIC_RELEASE);
+}
+
+static int pipe_call (unet_client_t *cln, int32_t n) {
+    msgbuf_t req = MSG_INIT, resp = MSG_INIT;
+    int32_t m = 0;
+    msg_create_request(&req, 1, CONST_STR_LEN("pipe"), 64, 64);
+    msg_seti32(&req, n);
+    if (0 != unet_call(cln, &req, &resp) || MSG_OK != msg_geti32(&resp, &m))
+        m = -1;
+    msg_clear(&req);
+    msg_clear(&resp);
+    return m == n * 2;
+}
+
+static void *pipe_waiter (unet_client_t *cln) {
+    for (int i = 0; i < NSEQ / NWAITERS; ++i)
+        if (!pipe_call(cln, i))
+            __atomic_add_fetch(&pipe_bad, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+static double since (struct timespec *ts) {
+    struct timespec te;
+    clock_gettime(CLOCK_MONOTONIC, &te);
+    return (te.tv_sec - ts->tv_sec) + (te.tv_nsec - ts->tv_nsec) / 1e9;
+}
+
+// one request a round trip against all of them on the way
+static void test_pipeline () {
+    int fds [2], ok = 1;
+    pthread_t th, waiters [NWAITERS];
+    pipe_server_t srv;
+    unet_client_t *cln;
+    struct timespec ts;
+    double t;
+    memset(&srv, 0, sizeof srv);
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    srv.fd = fds[1];
+    pthread_create(&th, NULL, (void*(*)(void*))pipe_server, &srv);
+    cln = unet_client_alloc(fds[0], 0);
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (int i = 0; i < NSEQ && ok; ++i)
+        ok = pipe_call(cln, i);
+    t = since(&ts);
+    printf("one by one: %s, %d calls in %.0f ms, %.1f us a call\n", ok ? "ok" : "FAIL", NSEQ, t * 1e3, t * 1e6 / NSEQ);
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (int i = 0; i < NWAITERS; ++i)
+        pthread_create(&waiters[i], NULL, (void*(*)(void*))pipe_waiter, cln);
+    for (int i = 0; i < NWAITERS; ++i)
+        pthread_join(waiters[i], NULL);
+    t = since(&ts);
+    printf("%d waiters: %s, %d calls in %.0f ms, %.1f us a call\n", NWAITERS, pipe_bad ? "FAIL" : "ok", NSEQ, t * 1e3, t * 1e6 / NSEQ);
+
+    pipe_bad = 0;
+    srv.nreqs = srv.nreads = 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (int i = 0; i < NPIPE; ++i) {
+        msgbuf_t req = MSG_INIT;
+        msg_create_request(&req, 1, CONST_STR_LEN("pipe"), 64, 64);
+        msg_seti32(&req, i);
+        if (-1 == unet_call_async(cln, &req, on_pipe_resp, (void*)(intptr_t)i))
+            ++pipe_bad;
+        msg_clear(&req);
+    }
+    while (__atomic_load_n(&pipe_done, __ATOMIC_ACQUIRE) + pipe_bad < NPIPE)
+        usleep(1000);
+    t = since(&ts);
+    printf("pipelined: %s, %d calls in %.0f ms, %.2f us a call, %.1f requests a server read\n", pipe_bad ? "FAIL" : "ok",
+        NPIPE, t * 1e3, t * 1e6 / NPIPE, (double)srv.nreqs / srv.nreads);
+
+    unet_client_free(cln);
+    pthread_join(th, NULL);
+    close(fds[1]);
+}
+
+// a response that stays out holds its slot, the calls after it take the others,
+// over the wrap of the ids too
+static void test_slots () {
+    int fds [2], ok = 1;
+    pthread_t th;
+    pipe_server_t srv;
+    unet_client_t *cln;
+    msgbuf_t req = MSG_INIT;
+    memset(&srv, 0, sizeof srv);
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    srv.fd = fds[1];
+    pthread_create(&th, NULL, (void*(*)(void*))pipe_server, &srv);
+    cln = unet_client_alloc(fds[0], 4);
+    cln->next_id = UINT32_MAX - 1;
+    pipe_done = pipe_bad = 0;
+    msg_create_request(&req, 1, CONST_STR_LEN("pipe"), 64, 64);
+    msg_seti32(&req, -1);
+    if (-1 == unet_call_async(cln, &req, on_pipe_resp, (void*)(intptr_t)-1))
+        ok = 0;
+    msg_clear(&req);
+    for (int i = 0; i < 32 && ok; ++i)
+        ok = pipe_call(cln, i);
+    while (ok && 0 == __atomic_load_n(&pipe_done, __ATOMIC_ACQUIRE))
+        usleep(1000);
+    printf("busy slots: %s\n", ok && !pipe_bad ? "ok" : "FAIL");
+    unet_client_free(cln);
+    pthread_join(th, NULL);
+    close(fds[1]);
+}
+
+// the peer is a process of its own, it answers every blob with whether it came whole
+static void shm_server (int fd, char *blob, size_t min) {
+    unet_shm_t shm;
+    int in_ring = 0;
+    if (-1 == unet_shm_init(&shm, fd, 0))
+        _exit(1);
+    shm.min = min;
+    for (int i = 0; i < BLOB_COUNT; ++i) {
+        msgbuf_t req, resp = MSG_INIT;
+        int32_t n;
+        strptr_t str, tail;
+        int ok = MSG_OK == unet_shm_read_request(&shm, &req) &&
+            MSG_OK == msg_geti32(&req, &n) && n == i &&
+            MSG_OK == msg_getstr(&req, &str) && str.len == BLOB_SIZE && 0 == memcmp(str.ptr, blob, BLOB_SIZE) &&
+            MSG_OK == msg_getstr(&req, &tail) && 0 == cmpstr(tail.ptr, tail.len, CONST_STR_LEN("small tail"));
+        if (req.ptr >= shm.in && req.ptr < shm.in + shm.in_size + UNET_SHM_HDR)
+            ++in_ring;
+        msg_create_response(&resp, MSG_OK, 64, 64);
+        msg_seti32(&resp, ok);
+        msg_seti32(&resp, in_ring);
+        unet_shm_writemsg(&shm, &resp);
+        msg_clear(&resp);
+    }
+    unet_shm_free(&shm);
+    _exit(0);
+}
+
+// all the blobs go before the answers are read, the ring fills and the rest goes inline
+static void test_shm (size_t min) {
+    int fds [2], ok = 1, status;
+    int32_t n, in_ring = 0;
+    unet_shm_t shm;
+    pid_t pid;
+    struct timespec ts;
+    double t;
+    char *blob = malloc(BLOB_SIZE);
+    for (int i = 0; i < BLOB_SIZE; ++i)
+        blob[i] = i * 31;
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    if (0 == (pid = fork())) {
+        close(fds[0]);
+        shm_server(fds[1], blob, min);
+    }
+    close(fds[1]);
+    if (-1 == unet_shm_init(&shm, fds[0], 0)) {
+        printf("unet_shm_init: FAIL, %s\n", strerror(errno));
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        close(fds[0]);
+        free(blob);
+        return;
+    }
+    shm.min = min;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (int i = 0; i < BLOB_COUNT && ok; ++i) {
+        msgbuf_t req = MSG_INIT;
+        msg_create_request(&req, 1, CONST_STR_LEN("blob"), 64, 64);
+        msg_seti32(&req, i);
+        msg_setref(&req, blob, BLOB_SIZE, 0);
+        msg_setref(&req, CONST_STR_LEN("small tail"), 0);
+        ok = msg_size(&req) == unet_shm_writemsg(&shm, &req);
+        msg_clear(&req);
+    }
+    for (int i = 0; i < BLOB_COUNT && ok; ++i) {
+        msgbuf_t resp;
+        ok = MSG_OK == unet_shm_read_response(&shm, &resp) &&
+            MSG_OK == msg_geti32(&resp, &n) && n &&
+            MSG_OK == msg_geti32(&resp, &in_ring);
+    }
+    t = since(&ts);
+    unet_shm_free(&shm);
+    close(fds[0]);
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || 0 != WEXITSTATUS(status))
+        ok = 0;
+    printf("%s: %s, %.0f MB/s, %d of %d in the ring\n", SIZE_MAX == min ? "unet_shm inline" : "unet_shm ring", ok ? "ok" : "FAIL",
+        (double)BLOB_SIZE * BLOB_COUNT / t / 1048576, in_ring, BLOB_COUNT);
+    free(blob);
+}
+
+// no id, no flag and the layout of the peers that know nothing of ids; the id of one
+// with a reference goes in before the reference
+static void test_id () {
+    msgbuf_t msg = MSG_INIT, in = MSG_INIT;
+    strptr_t tail;
+    char *blob = malloc(MSG_REF_MIN);
+    int32_t n = 0;
+    int fds[2], ok;
+    memset(blob, 'x', MSG_REF_MIN);
+    msg_create_request(&msg, 7, CONST_STR_LEN("id"), 64, 64);
+    msg_seti32(&msg, 42);
+    msg_set_id(&msg, 0);
+    ok = *(uint32_t*)msg.ptr == msg.len && ((uint32_t*)msg.ptr)[1] == 7;
+    msg_setref(&msg, blob, MSG_REF_MIN, MSG_REF_OWN);
+    msg_setstr(&msg, CONST_STR_LEN("tail"));
+    ok = ok && MSG_OK == msg_set_id(&msg, 5) && MSG_OK == msg_set_id(&msg, 6);
+    ok = ok && *(uint32_t*)msg.ptr == (msg_size(&msg) | MSG_ID_FLAG) && ((uint32_t*)msg.ptr)[1] == 6;
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    ok = ok && unet_writemsg(fds[0], &msg) == msg_size(&msg) && MSG_OK == unet_read_request(fds[1], &in);
+    ok = ok && in.id == 6 && in.method == 7 && 0 == cmpstr(in.cookie.ptr, in.cookie.len, CONST_STR_LEN("id")) &&
+         MSG_OK == msg_geti32(&in, &n) && 42 == n && MSG_OK == msg_getstr(&in, &tail) && MSG_REF_MIN == tail.len && 'x' == tail.ptr[MSG_REF_MIN - 1] &&
+         MSG_OK == msg_getstr(&in, &tail) && 0 == cmpstr(tail.ptr, tail.len, CONST_STR_LEN("tail"));
+    printf("msg_set_id: %s\n", ok ? "ok" : "FAIL");
+    close(fds[0]);
+    close(fds[1]);
+    msg_clear(&msg);
+    msg_clear(&in);
+}
+
+// the other end sends a memfd without seals, its size could change under the mapping
+static void test_shm_unsealed () {
+    int fds [2], memfd, rc, err;
+    uint64_t size = 1024 * 1024;
+    char ctl [CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { .iov_base = &size, .iov_len = sizeof size };
+    struct msghdr mh = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = ctl, .msg_controllen = sizeof ctl };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+    unet_shm_t shm;
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    memfd = memfd_create("unsealed", MFD_CLOEXEC);
+    ftruncate(memfd, size);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+    sendmsg(fds[1], &mh, 0);
+    rc = unet_shm_init(&shm, fds[0], UNET_SHM_MIN);
+    err = errno;
+    printf("unet_shm unsealed: %s\n", -1 == rc && EPROTO == err ? "ok" : "FAIL");
+    if (0 == rc)
+        unet_shm_free(&shm);
+    close(memfd);
+    close(fds[0]);
+    close(fds[1]);
+}
 
 int main () {
     test_mpz("12345678987654321");
+    test_ref(0);
+    test_ref(1);
+    test_resume();
+    test_id();
+    test_pipeline();
+    test_slots();
+    test_shm(SIZE_MAX);
+    test_shm(UNET_SHM_MIN);
+    test_shm_unsealed();
     return 0;
 }
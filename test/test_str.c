@@ -4,6 +4,8 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <time.h>
+#include <pthread.h>
 #include "../include/libex/str.h"
 #include "../include/libex/file.h"
 #include "../include/libex/msg.h"
@@ -462,6 +464,158 @@ void test_sha () {
     printf("%s\n", sec_key);
 }
 
+#define GROW_TOTAL (100 * 1024 * 1024)
+#define GROW_PIECE 16
+
+static double elapsed (struct timespec *start) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec - start->tv_sec) + (ts.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void bench_strbuf_grow (const char *name, int growth, int is_reserve) {
+    const char piece [GROW_PIECE] = "0123456789abcdef";
+    struct timespec ts;
+    strbuf_t buf;
+    size_t resizes = 0, bufsize;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    strbufalloc(&buf, 256, 256);
+    buf.growth = growth;
+    if (is_reserve)
+        strbufreserve(&buf, GROW_TOTAL);
+    bufsize = buf.bufsize;
+    for (size_t i = 0; i < GROW_TOTAL / GROW_PIECE; ++i) {
+        strbufadd(&buf, piece, GROW_PIECE);
+        if (bufsize != buf.bufsize) {
+            bufsize = buf.bufsize;
+            ++resizes;
+        }
+    }
+    printf("  strbuf_t %-16s %8.1f ms %8zu resizes %6zu MB\n", name, elapsed(&ts) * 1e3, resizes, buf.bufsize >> 20);
+    free(buf.ptr);
+}
+
+static void bench_str_grow (const char *name, int growth) {
+    const char piece [GROW_PIECE] = "0123456789abcdef";
+    struct timespec ts;
+    str_t *str;
+    size_t resizes = 0, bufsize;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    str = stralloc(256, 256);
+    str->growth = growth;
+    bufsize = str->bufsize;
+    for (size_t i = 0; i < GROW_TOTAL / GROW_PIECE; ++i) {
+        strnadd(&str, piece, GROW_PIECE);
+        if (bufsize != str->bufsize) {
+            bufsize = str->bufsize;
+            ++resizes;
+        }
+    }
+    printf("  str_t    %-16s %8.1f ms %8zu resizes %6zu MB\n", name, elapsed(&ts) * 1e3, resizes, str->bufsize >> 20);
+    free(str);
+}
+
+static void bench_msg_grow (const char *name, int growth) {
+    const char piece [GROW_PIECE] = "0123456789abcdef";
+    struct timespec ts;
+    msgbuf_t msg = MSG_INIT;
+    size_t resizes = 0, bufsize;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    msg.growth = growth;
+    msg_create_response(&msg, 0, 256, 256);
+    bufsize = msg.bufsize;
+    for (size_t i = 0; i < GROW_TOTAL / GROW_PIECE; ++i) {
+        msg_setbuf(&msg, (void*)piece, GROW_PIECE);
+        if (bufsize != msg.bufsize) {
+            bufsize = msg.bufsize;
+            ++resizes;
+        }
+    }
+    printf("  msgbuf_t %-16s %8.1f ms %8zu resizes %6u MB\n", name, elapsed(&ts) * 1e3, resizes, msg.bufsize >> 20);
+    msg_clear(&msg);
+}
+
+void test_grow () {
+    printf("100 MB in 16 byte pieces, chunk 256\n");
+    bench_strbuf_grow("fixed", STR_GROW_FIXED, 0);
+    bench_strbuf_grow("double", STR_GROW_DOUBLE, 0);
+    bench_strbuf_grow("half", STR_GROW_HALF, 0);
+    bench_strbuf_grow("reserve", STR_GROW_FIXED, 1);
+    bench_str_grow("fixed", STR_GROW_FIXED);
+    bench_str_grow("double", STR_GROW_DOUBLE);
+    bench_str_grow("half", STR_GROW_HALF);
+    bench_msg_grow("fixed", STR_GROW_FIXED);
+    bench_msg_grow("double", STR_GROW_DOUBLE);
+    bench_msg_grow("half", STR_GROW_HALF);
+}
+
+#define CONN_COUNT 1000000
+
+// a short connection: a request buffer and a tail buffer, a few reads, gone
+static void *on_connections (strbuf_pool_stat_t *stat) {
+    for (int i = 0; i < CONN_COUNT; ++i) {
+        strbuf_t buf, tail;
+        strbufalloc(&buf, 512, 512);
+        strbufalloc(&tail, 512, 512);
+        strbufadd(&buf, CONST_STR_LEN("GET / HTTP/1.1\r\nHost: localhost\r\n\r\n"));
+        if (0 == i % 16)
+            strbufsize(&buf, 3000, 0);
+        strbuf_release(&buf);
+        strbuf_release(&tail);
+    }
+    strbuf_pool_stat(stat);
+    return NULL;
+}
+
+static void bench_pool (const char *name, size_t max_bytes, int nthreads) {
+    pthread_t th [nthreads];
+    strbuf_pool_stat_t stats [nthreads];
+    struct timespec ts;
+    strbuf_pool_setmax(max_bytes);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (int i = 0; i < nthreads; ++i)
+        pthread_create(&th[i], NULL, (void*(*)(void*))on_connections, &stats[i]);
+    for (int i = 0; i < nthreads; ++i)
+        pthread_join(th[i], NULL);
+    double t = elapsed(&ts);
+    printf("  %-12s %d threads %10.0f connections/s, thread 0: %zu hits %zu misses %zu releases %zu bytes retained\n",
+        name, nthreads, CONN_COUNT * nthreads / t, stats[0].hits, stats[0].misses, stats[0].releases, stats[0].retained);
+}
+
+static pthread_key_t late_key;
+static int late_ok;
+
+// a destructor that runs after the one of the pool still gets buffers
+static void on_late_exit (void *dummy) {
+    strbuf_t buf;
+    late_ok = 0 == strbufalloc(&buf, 100, 100);
+    strbufadd(&buf, CONST_STR_LEN("late"));
+    strbuf_release(&buf);
+}
+
+static void *on_late_thread (void *dummy) {
+    strbuf_t buf;
+    strbufalloc(&buf, 100, 100);
+    strbuf_release(&buf);
+    pthread_setspecific(late_key, (void*)1);
+    return NULL;
+}
+
+void test_strbuf_pool () {
+    pthread_t th;
+    printf("alloc/release of two buffers per connection\n");
+    bench_pool("malloc", 0, 1);
+    bench_pool("pool", 1024 * 1024, 1);
+    bench_pool("malloc", 0, 4);
+    bench_pool("pool", 1024 * 1024, 4);
+    // the key of the pool is older, its destructor goes first
+    pthread_key_create(&late_key, on_late_exit);
+    pthread_create(&th, NULL, on_late_thread, NULL);
+    pthread_join(th, NULL);
+    printf("strbuf in a later destructor: %s\n", late_ok ? "ok" : "FAIL");
+    strbuf_pool_setmax(0);
+}
+
 int main () {
 /*    test_strntok();
     test_strepl();
@@ -487,5 +641,7 @@ int main () {
     test_concat();
     test_msg();*/
     test_sha();
+    test_grow();
+    test_strbuf_pool();
     return 0;
 }
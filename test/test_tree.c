@@ -44,6 +44,17 @@ static void test_tree1 () {
     rbtree_free(t1);
 }
 
+static void test_tree2 () {
+    rbtree_t *t1 = rbtree_alloc_slab(cmp_int, copy_int, free_int, RBT_UNIQUE, NULL);
+    for (intptr_t i = 0; i < 1000; ++i)
+        rbtree_add(t1, (void*)i)->value = strdup("value");
+    for (intptr_t i = 0; i < 1000; i += 2)
+        rbtree_del_key(t1, (void*)i);
+    printf("len: " SIZE_FMT ", slab items: " SIZE_FMT "\n", t1->len, t1->slab->len);
+    rbtree_free(t1);
+}
+
 int main () {
     test_tree1();
+    test_tree2();
 }